@@ -4,6 +4,7 @@
 # define WIN32_LEAN_AND_MEAN
 # include <windows.h>
 #else
+# include <stddef.h>
 # include <sys/time.h>
 #endif
 
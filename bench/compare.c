@@ -0,0 +1,443 @@
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * nanoev_bench_compare: diff two nanoev_bench summaries written with --json
+ * or --csv and fail when throughput or p99 latency regressed beyond the noise
+ * thresholds. A CSV file may hold several runs; each numeric column is then
+ * reduced to its median.
+ */
+
+#define COMPARE_FIELDS_MAX 64
+#define COMPARE_NAME_SIZE  32
+#define COMPARE_LINE_SIZE  4096
+
+typedef struct compare_run {
+    char names[COMPARE_FIELDS_MAX][COMPARE_NAME_SIZE];
+    char texts[COMPARE_FIELDS_MAX][COMPARE_NAME_SIZE];
+    double values[COMPARE_FIELDS_MAX];
+    unsigned int count;
+    unsigned int runs;
+} compare_run;
+
+typedef struct compare_options {
+    double throughput_threshold;     /* percent drop allowed in requests_per_sec */
+    double latency_threshold;        /* percent rise allowed in latency_p99_us */
+    double latency_floor;            /* microseconds; smaller p99 rises are noise */
+} compare_options;
+
+static void usage(const char *program)
+{
+    printf("Usage:\n");
+    printf("  %s [options] BASELINE CANDIDATE\n", program);
+    printf("\nBASELINE and CANDIDATE are nanoev_bench --json or --csv files. CSV rows\n");
+    printf("are reduced to their per-column median.\n");
+    printf("\nOptions:\n");
+    printf("  --throughput-threshold PCT  Allowed requests/s drop. Default: 5.\n");
+    printf("  --latency-threshold PCT     Allowed p99 latency rise. Default: 10.\n");
+    printf("  --latency-floor USEC        Ignore p99 rises below USEC. Default: 5.\n");
+    printf("\nExit status: 0 no regression, 1 regression, 2 invalid input.\n");
+}
+
+static int parse_double(const char *value, double *out)
+{
+    char *end;
+
+    if (!value || !*value)
+        return -1;
+    *out = strtod(value, &end);
+    if (*end != '\0' || *out < 0.0)
+        return -1;
+    return 0;
+}
+
+static int run_find(const compare_run *run, const char *name)
+{
+    unsigned int i;
+
+    for (i = 0; i < run->count; i++) {
+        if (strcmp(run->names[i], name) == 0)
+            return (int)i;
+    }
+    return -1;
+}
+
+static int run_add(compare_run *run, const char *name, size_t name_len, const char *text, size_t text_len,
+    double value)
+{
+    unsigned int index = run->count;
+
+    if (index >= COMPARE_FIELDS_MAX || name_len >= COMPARE_NAME_SIZE)
+        return -1;
+    if (text_len >= COMPARE_NAME_SIZE)
+        text_len = COMPARE_NAME_SIZE - 1;
+    memcpy(run->names[index], name, name_len);
+    run->names[index][name_len] = '\0';
+    memcpy(run->texts[index], text, text_len);
+    run->texts[index][text_len] = '\0';
+    run->values[index] = value;
+    run->count++;
+    return 0;
+}
+
+static char *read_file(const char *path)
+{
+    FILE *file = fopen(path, "rb");
+    char *data = NULL;
+    size_t size = 0;
+    size_t capacity = 0;
+    size_t got;
+
+    if (!file)
+        return NULL;
+    for (;;) {
+        if (capacity - size < 4096) {
+            char *grown = (char*)realloc(data, capacity + 65536);
+            if (!grown) {
+                free(data);
+                fclose(file);
+                return NULL;
+            }
+            data = grown;
+            capacity += 65536;
+        }
+        got = fread(data + size, 1, capacity - size - 1, file);
+        size += got;
+        if (got == 0)
+            break;
+    }
+    fclose(file);
+    data[size] = '\0';
+    return data;
+}
+
+/* The flat object --json writes: string and number members only. */
+static int parse_json(const char *data, compare_run *run)
+{
+    const char *p = strchr(data, '{');
+
+    if (!p)
+        return -1;
+    p++;
+    for (;;) {
+        const char *name;
+        size_t name_len;
+
+        while (isspace((unsigned char)*p) || *p == ',')
+            p++;
+        if (*p == '}')
+            break;
+        if (*p != '"')
+            return -1;
+        name = ++p;
+        while (*p && *p != '"')
+            p++;
+        if (!*p)
+            return -1;
+        name_len = (size_t)(p - name);
+        p++;
+        while (isspace((unsigned char)*p))
+            p++;
+        if (*p++ != ':')
+            return -1;
+        while (isspace((unsigned char)*p))
+            p++;
+        if (*p == '"') {
+            const char *text = ++p;
+
+            while (*p && *p != '"')
+                p++;
+            if (!*p || run_add(run, name, name_len, text, (size_t)(p - text), 0.0) != 0)
+                return -1;
+            p++;
+        } else {
+            char *end;
+            double value = strtod(p, &end);
+
+            if (end == p || run_add(run, name, name_len, "", 0, value) != 0)
+                return -1;
+            p = end;
+        }
+    }
+    run->runs = 1;
+    return 0;
+}
+
+static int compare_doubles(const void *a, const void *b)
+{
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+
+    return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+/* Header row, then one row per run; text columns keep the first row's value. */
+static int parse_csv(char *data, compare_run *run)
+{
+    char *line;
+    char *next;
+    double *rows = NULL;
+    double *column = NULL;
+    unsigned int row_count = 0;
+    unsigned int i;
+    int ret = -1;
+
+    line = data;
+    next = strchr(line, '\n');
+    if (!next)
+        return -1;
+    *next++ = '\0';
+    for (;;) {
+        char *comma = strchr(line, ',');
+        size_t len = comma ? (size_t)(comma - line) : strlen(line);
+
+        if (len && line[len - 1] == '\r')
+            len--;
+        if (run_add(run, line, len, "", 0, 0.0) != 0)
+            return -1;
+        if (!comma)
+            break;
+        line = comma + 1;
+    }
+
+    while (*next) {
+        double *grown;
+
+        line = next;
+        next = strchr(line, '\n');
+        if (next)
+            *next++ = '\0';
+        else
+            next = line + strlen(line);
+        if (!*line || *line == '\r')
+            continue;
+
+        grown = (double*)realloc(rows, sizeof(double) * run->count * (row_count + 1));
+        if (!grown)
+            goto done;
+        rows = grown;
+        for (i = 0; i < run->count; i++) {
+            char *comma = strchr(line, ',');
+            size_t len = comma ? (size_t)(comma - line) : strlen(line);
+
+            if (!comma && i + 1 < run->count)
+                goto done;
+            if (len && line[len - 1] == '\r')
+                len--;
+            if (!row_count && (isalpha((unsigned char)*line) || *line == '"')) {
+                if (len >= COMPARE_NAME_SIZE)
+                    len = COMPARE_NAME_SIZE - 1;
+                memcpy(run->texts[i], line, len);
+                run->texts[i][len] = '\0';
+            }
+            rows[row_count * run->count + i] = strtod(line, NULL);
+            if (comma)
+                line = comma + 1;
+        }
+        row_count++;
+    }
+    if (!row_count)
+        goto done;
+
+    column = (double*)malloc(sizeof(double) * row_count);
+    if (!column)
+        goto done;
+    for (i = 0; i < run->count; i++) {
+        unsigned int r;
+
+        for (r = 0; r < row_count; r++)
+            column[r] = rows[r * run->count + i];
+        qsort(column, row_count, sizeof(double), compare_doubles);
+        run->values[i] = row_count % 2 ? column[row_count / 2]
+            : (column[row_count / 2 - 1] + column[row_count / 2]) / 2.0;
+    }
+    run->runs = row_count;
+    ret = 0;
+
+done:
+    free(column);
+    free(rows);
+    return ret;
+}
+
+static int load_run(const char *path, compare_run *run)
+{
+    char *data = read_file(path);
+    const char *p;
+    int ret;
+
+    memset(run, 0, sizeof(*run));
+    if (!data) {
+        fprintf(stderr, "unable to read %s\n", path);
+        return -1;
+    }
+    for (p = data; isspace((unsigned char)*p); p++)
+        ;
+    ret = *p == '{' ? parse_json(data, run) : parse_csv(data, run);
+    free(data);
+    if (ret != 0 || run_find(run, "requests_per_sec") < 0 || run_find(run, "latency_p99_us") < 0) {
+        fprintf(stderr, "%s is not a nanoev_bench --json or --csv summary\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+static const char *run_text(const compare_run *run, const char *name)
+{
+    int index = run_find(run, name);
+
+    return index < 0 ? "?" : run->texts[index];
+}
+
+/* --churn and --idle runs also get their own rows. */
+static int run_flag(const compare_run *run, const char *name)
+{
+    int index = run_find(run, name);
+
+    return index >= 0 && run->values[index] != 0.0;
+}
+
+static void print_run(const char *label, const char *path, const compare_run *run)
+{
+    printf("%-10s: %s %s %s, %u run%s%s (%s)\n", label,
+        run_text(run, "library"), run_text(run, "protocol"), run_text(run, "role"),
+        run->runs, run->runs == 1 ? "" : "s", run->runs > 1 ? ", median" : "", path);
+}
+
+static void warn_config(const compare_run *baseline, const compare_run *candidate)
+{
+    static const char *const fields[] = {
+        "protocol", "role", "threads", "connections", "message_size", "pipeline", "rate", "churn", "idle"
+    };
+    unsigned int i;
+
+    for (i = 0; i < sizeof(fields) / sizeof(fields[0]); i++) {
+        int a = run_find(baseline, fields[i]);
+        int b = run_find(candidate, fields[i]);
+
+        if (a < 0 || b < 0)
+            continue;
+        if (strcmp(baseline->texts[a], candidate->texts[b]) != 0 || baseline->values[a] != candidate->values[b])
+            fprintf(stderr, "warning: %s differs between the runs\n", fields[i]);
+    }
+}
+
+static double change_percent(double baseline, double candidate)
+{
+    return baseline > 0.0 ? (candidate - baseline) * 100.0 / baseline : 0.0;
+}
+
+/* Prints one metric row; returns 1 if a gated metric regressed. */
+static int compare_metric(const compare_run *baseline, const compare_run *candidate, const char *name,
+    const compare_options *options)
+{
+    int a = run_find(baseline, name);
+    int b = run_find(candidate, name);
+    double before;
+    double after;
+    double change;
+    int regressed = 0;
+    char verdict[64];
+
+    if (a < 0 || b < 0)
+        return 0;
+    before = baseline->values[a];
+    after = candidate->values[b];
+    change = change_percent(before, after);
+
+    if (strcmp(name, "requests_per_sec") == 0) {
+        regressed = change < -options->throughput_threshold;
+        snprintf(verdict, sizeof(verdict), "%s (limit -%.2f%%)", regressed ? "REGRESSION" : "ok",
+            options->throughput_threshold);
+    } else if (strcmp(name, "latency_p99_us") == 0) {
+        regressed = change > options->latency_threshold && after - before >= options->latency_floor;
+        snprintf(verdict, sizeof(verdict), "%s (limit +%.2f%%, %.0fus)", regressed ? "REGRESSION" : "ok",
+            options->latency_threshold, options->latency_floor);
+    } else {
+        snprintf(verdict, sizeof(verdict), "info");
+    }
+
+    printf("  %-22s %14.3f %14.3f %+9.2f%%  %s\n", name, before, after, change, verdict);
+    return regressed;
+}
+
+int main(int argc, char **argv)
+{
+    static const char *const metrics[] = {
+        "requests_per_sec", "latency_p99_us", "latency_p50_us", "latency_p999_us", "latency_max_us",
+        "cpu_us_per_request", "errors"
+    };
+    static const char *const churn_metrics[] = {
+        "connections_per_sec", "connect_p99_us", "cpu_us_per_connection"
+    };
+    static const char *const idle_metrics[] = {
+        "rss_per_connection", "kernel_per_connection", "idle_us_per_iteration"
+    };
+    compare_options options;
+    compare_run baseline;
+    compare_run candidate;
+    const char *paths[2] = { NULL, NULL };
+    unsigned int path_count = 0;
+    unsigned int i;
+    int regressions = 0;
+
+    options.throughput_threshold = 5.0;
+    options.latency_threshold = 10.0;
+    options.latency_floor = 5.0;
+
+    for (i = 1; i < (unsigned int)argc; i++) {
+        if (strcmp(argv[i], "--help") == 0 || strcmp(argv[i], "-h") == 0) {
+            usage(argv[0]);
+            return 0;
+        } else if (strcmp(argv[i], "--throughput-threshold") == 0) {
+            if (++i >= (unsigned int)argc || parse_double(argv[i], &options.throughput_threshold))
+                goto invalid_arg;
+        } else if (strcmp(argv[i], "--latency-threshold") == 0) {
+            if (++i >= (unsigned int)argc || parse_double(argv[i], &options.latency_threshold))
+                goto invalid_arg;
+        } else if (strcmp(argv[i], "--latency-floor") == 0) {
+            if (++i >= (unsigned int)argc || parse_double(argv[i], &options.latency_floor))
+                goto invalid_arg;
+        } else if (argv[i][0] == '-' || path_count == 2) {
+            goto invalid_arg;
+        } else {
+            paths[path_count++] = argv[i];
+        }
+    }
+    if (path_count != 2) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    if (load_run(paths[0], &baseline) != 0 || load_run(paths[1], &candidate) != 0)
+        return 2;
+    print_run("baseline", paths[0], &baseline);
+    print_run("candidate", paths[1], &candidate);
+    warn_config(&baseline, &candidate);
+
+    printf("\n  %-22s %14s %14s %10s  %s\n", "metric", "baseline", "candidate", "change", "verdict");
+    for (i = 0; i < sizeof(metrics) / sizeof(metrics[0]); i++)
+        regressions += compare_metric(&baseline, &candidate, metrics[i], &options);
+    if (run_flag(&baseline, "churn") && run_flag(&candidate, "churn")) {
+        for (i = 0; i < sizeof(churn_metrics) / sizeof(churn_metrics[0]); i++)
+            regressions += compare_metric(&baseline, &candidate, churn_metrics[i], &options);
+    }
+    if (run_flag(&baseline, "idle") && run_flag(&candidate, "idle")) {
+        for (i = 0; i < sizeof(idle_metrics) / sizeof(idle_metrics[0]); i++)
+            regressions += compare_metric(&baseline, &candidate, idle_metrics[i], &options);
+    }
+
+    if (regressions) {
+        printf("\n%d regression%s\n", regressions, regressions == 1 ? "" : "s");
+        return 1;
+    }
+    printf("\nno regression\n");
+    return 0;
+
+invalid_arg:
+    fprintf(stderr, "invalid argument near '%s'\n", i < (unsigned int)argc ? argv[i] : argv[argc - 1]);
+    usage(argv[0]);
+    return 2;
+}
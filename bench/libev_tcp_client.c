@@ -0,0 +1,474 @@
+#include "tcp.h"
+#include "clock.h"
+#include "net.h"
+#include "protocol.h"
+#include "report.h"
+#include "stats.h"
+
+#include <ev.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+typedef struct lev_client lev_client;
+typedef struct lev_conn lev_conn;
+
+struct lev_client {
+    const bench_config *config;
+    struct ev_loop *loop;
+    bench_sockaddr addr;
+    ev_timer report_timer;
+    ev_timer stop_timer;
+    ev_signal signal_watcher;
+    lev_conn *connections;
+    unsigned int active_connections;
+    int stopping;
+    bench_stats stats;
+    bench_stats previous;
+    uint64_t previous_us;
+    uint64_t deadline_us;
+};
+
+struct lev_conn {
+    ev_io read_watcher;
+    ev_io write_watcher;             /* waits for connect, then for room for out */
+    lev_client *client;
+    int fd;
+    int connecting;
+    unsigned char *in;               /* bytes read, replies are parsed in place */
+    unsigned int in_capacity;
+    unsigned int in_len;
+    unsigned char *frame;            /* requests are built here, pipeline frames at most */
+    unsigned int frame_size;
+    unsigned char *out;              /* requests the socket did not take yet */
+    unsigned int out_capacity;
+    unsigned int out_len;
+    uint32_t send_sequence;          /* next request to send */
+    uint32_t sequence;               /* next reply expected */
+    uint64_t *request_start_us;      /* send times, indexed by sequence % pipeline */
+    uint64_t connect_start_us;
+    int closed;
+};
+
+static void client_signal(struct ev_loop *loop, ev_signal *watcher, int revents);
+static void client_report(struct ev_loop *loop, ev_timer *watcher, int revents);
+static void client_stop(struct ev_loop *loop, ev_timer *watcher, int revents);
+static int client_connect(lev_conn *conn);
+static int client_send(lev_conn *conn, unsigned int count);
+static int client_connected(lev_conn *conn);
+static void client_read(struct ev_loop *loop, ev_io *watcher, int revents);
+static void client_writable(struct ev_loop *loop, ev_io *watcher, int revents);
+static void client_socket_close(lev_conn *conn);
+static void client_conn_close(lev_conn *conn);
+static void client_conn_free(lev_conn *conn);
+
+int bench_libev_tcp_client_run(const bench_config *config)
+{
+    lev_client client;
+    unsigned int i;
+    int ret = 1;
+
+    memset(&client, 0, sizeof(client));
+    client.config = config;
+    bench_stats_init(&client.stats);
+    bench_stats_init(&client.previous);
+    if (bench_stats_enable_latency(&client.stats, config->latency_digits) != 0) {
+        fprintf(stderr, "libev client setup failed: unable to allocate latency histogram\n");
+        return 1;
+    }
+    if (config->churn && bench_stats_enable_connect_latency(&client.stats, config->latency_digits) != 0) {
+        fprintf(stderr, "libev client setup failed: unable to allocate connect histogram\n");
+        goto done;
+    }
+
+    if (bench_resolve_addr(config, &client.addr) != 0) {
+        fprintf(stderr, "libev client setup failed: invalid address %s:%u\n",
+            config->host, (unsigned int)config->port);
+        goto done;
+    }
+    client.loop = ev_default_loop(0);
+    if (!client.loop) {
+        fprintf(stderr, "libev client setup failed: unable to create loop\n");
+        goto done;
+    }
+    if (config->busy_poll)
+        fprintf(stderr, "client warning: --busy-poll is not supported by the libev client\n");
+    if (config->threads > 1)
+        fprintf(stderr, "client warning: --threads is not supported by the libev client, using one thread\n");
+    if (config->source_ips)
+        fprintf(stderr, "client warning: --source-ips is not supported by the libev client\n");
+    if (config->rate) {
+        fprintf(stderr, "libev client setup failed: --rate is not supported by the libev client\n");
+        goto done;
+    }
+    if (config->idle) {
+        fprintf(stderr, "libev client setup failed: --idle is not supported by the libev client\n");
+        goto done;
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    client.connections = (lev_conn*)calloc(config->connections, sizeof(*client.connections));
+    if (!client.connections) {
+        fprintf(stderr, "libev client setup failed: unable to allocate %u connections\n",
+            config->connections);
+        goto done;
+    }
+
+    for (i = 0; i < config->connections; i++) {
+        lev_conn *conn = &client.connections[i];
+
+        conn->client = &client;
+        conn->fd = -1;
+        conn->frame_size = BENCH_FRAME_HEADER_SIZE + config->message_size;
+        /* at most pipeline replies are outstanding */
+        conn->in_capacity = conn->frame_size * config->pipeline;
+        if (conn->in_capacity < BENCH_READ_BUFFER_SIZE)
+            conn->in_capacity = BENCH_READ_BUFFER_SIZE;
+        conn->in = (unsigned char*)malloc(conn->in_capacity);
+        conn->frame = (unsigned char*)malloc((size_t)conn->frame_size * config->pipeline);
+        conn->request_start_us = (uint64_t*)malloc(sizeof(uint64_t) * config->pipeline);
+        client.active_connections++;
+        if (!conn->in || !conn->frame || !conn->request_start_us) {
+            fprintf(stderr, "libev client setup failed: unable to allocate connection %u buffers\n", i);
+            goto done;
+        }
+        if (client_connect(conn) != 0) {
+            fprintf(stderr, "libev client setup failed: connect start failed for connection %u errno=%d\n",
+                i, errno);
+            goto done;
+        }
+    }
+
+    ev_timer_init(&client.report_timer, client_report, (ev_tstamp)config->report_interval,
+        (ev_tstamp)config->report_interval);
+    client.report_timer.data = &client;
+    ev_timer_start(client.loop, &client.report_timer);
+    ev_timer_init(&client.stop_timer, client_stop, (ev_tstamp)config->duration + 1.0, 0.0);
+    client.stop_timer.data = &client;
+    ev_timer_start(client.loop, &client.stop_timer);
+    ev_signal_init(&client.signal_watcher, client_signal, SIGINT);
+    client.signal_watcher.data = &client;
+    ev_signal_start(client.loop, &client.signal_watcher);
+
+    client.previous_us = bench_time_us();
+    client.deadline_us = client.previous_us + ((uint64_t)config->duration * 1000000ULL);
+    printf("libev tcp client connecting to %s:%u connections=%u duration=%us message_size=%u pipeline=%u%s\n",
+        config->host, (unsigned int)config->port, config->connections, config->duration, config->message_size,
+        config->pipeline, config->churn ? " churn" : "");
+    bench_stats_print_delta_header("client", 0);
+
+    ev_run(client.loop, 0);
+    bench_stats_print_total("client", &client.stats, (uint64_t)config->duration * 1000ULL, 0);
+    if (config->churn)
+        bench_stats_print_connections(&client.stats, "connect", (uint64_t)config->duration * 1000ULL);
+    ret = bench_report_write(config, "client", &client.stats, NULL, (uint64_t)config->duration * 1000ULL) ? 1 : 0;
+
+done:
+    if (client.connections) {
+        for (i = 0; i < config->connections; i++) {
+            client_conn_close(&client.connections[i]);
+            client_conn_free(&client.connections[i]);
+        }
+    }
+    if (client.loop) {
+        ev_signal_stop(client.loop, &client.signal_watcher);
+        ev_timer_stop(client.loop, &client.stop_timer);
+        ev_timer_stop(client.loop, &client.report_timer);
+        ev_loop_destroy(client.loop);
+    }
+    free(client.connections);
+    bench_stats_free(&client.stats);
+    return ret;
+}
+
+static void client_signal(struct ev_loop *loop, ev_signal *watcher, int revents)
+{
+    lev_client *client = (lev_client*)watcher->data;
+    (void)revents;
+
+    client_stop(loop, &client->stop_timer, 0);
+}
+
+static void client_report(struct ev_loop *loop, ev_timer *watcher, int revents)
+{
+    lev_client *client = (lev_client*)watcher->data;
+    uint64_t now = bench_time_us();
+    uint64_t elapsed_ms = (now - client->previous_us) / 1000ULL;
+    (void)loop;
+    (void)revents;
+
+    bench_stats_print_delta("client", &client->stats, &client->previous, elapsed_ms, 0);
+    bench_stats_snapshot(&client->previous, &client->stats);
+    client->previous_us = now;
+}
+
+static void client_stop(struct ev_loop *loop, ev_timer *watcher, int revents)
+{
+    lev_client *client = (lev_client*)watcher->data;
+    unsigned int i;
+    (void)loop;
+    (void)revents;
+
+    client->stopping = 1;
+    for (i = 0; i < client->config->connections; i++)
+        client_conn_close(&client->connections[i]);
+}
+
+/* Start a nonblocking connect; the write watcher reports its outcome. */
+static int client_connect(lev_conn *conn)
+{
+    lev_client *client = conn->client;
+    int flags;
+
+    conn->fd = socket(client->addr.storage.ss_family, SOCK_STREAM, 0);
+    if (conn->fd < 0)
+        return -1;
+    flags = fcntl(conn->fd, F_GETFL, 0);
+    if (flags < 0 || fcntl(conn->fd, F_SETFL, flags | O_NONBLOCK) != 0) {
+        client_socket_close(conn);
+        return -1;
+    }
+
+    conn->connect_start_us = bench_time_us();
+    if (connect(conn->fd, (const struct sockaddr*)&client->addr.storage, (socklen_t)client->addr.len) != 0
+        && errno != EINPROGRESS) {
+        client_socket_close(conn);
+        return -1;
+    }
+    conn->connecting = 1;
+    ev_io_init(&conn->read_watcher, client_read, conn->fd, EV_READ);
+    conn->read_watcher.data = conn;
+    ev_io_init(&conn->write_watcher, client_writable, conn->fd, EV_WRITE);
+    conn->write_watcher.data = conn;
+    ev_io_start(client->loop, &conn->write_watcher);
+    return 0;
+}
+
+/*
+ * Build count requests and send them together. What the socket does not take
+ * right away is appended to out, behind anything already waiting there, so
+ * requests stay in order.
+ */
+static int client_send(lev_conn *conn, unsigned int count)
+{
+    lev_client *client = conn->client;
+    unsigned int len = conn->frame_size * count;
+    unsigned int i, j;
+    ssize_t sent = 0;
+
+    for (i = 0; i < count; i++) {
+        unsigned char *frame = conn->frame + (size_t)conn->frame_size * i;
+        uint32_t sequence = conn->send_sequence++;
+
+        bench_frame_write_header(frame, client->config->message_size, sequence);
+        for (j = BENCH_FRAME_HEADER_SIZE; j < conn->frame_size; j++)
+            frame[j] = (unsigned char)(sequence + j);
+        if (client->config->churn)
+            bench_frame_write_stamp(frame, conn->connect_start_us);
+        conn->request_start_us[sequence % client->config->pipeline] = bench_time_us();
+    }
+
+    if (!conn->out_len) {
+        sent = send(conn->fd, conn->frame, len, 0);
+        if (sent < 0 && !bench_socket_would_block(errno))
+            return -1;
+        if (sent < 0)
+            sent = 0;
+        if ((unsigned int)sent == len)
+            return 0;
+    }
+
+    len -= (unsigned int)sent;
+    if (len > conn->out_capacity - conn->out_len) {
+        unsigned int capacity = conn->out_capacity ? conn->out_capacity * 2 : conn->in_capacity;
+        unsigned char *out;
+
+        while (capacity - conn->out_len < len)
+            capacity *= 2;
+        out = (unsigned char*)realloc(conn->out, capacity);
+        if (!out)
+            return -1;
+        conn->out = out;
+        conn->out_capacity = capacity;
+    }
+    memcpy(conn->out + conn->out_len, conn->frame + sent, len);
+    conn->out_len += len;
+    ev_io_start(client->loop, &conn->write_watcher);
+    return 0;
+}
+
+static int client_connected(lev_conn *conn)
+{
+    lev_client *client = conn->client;
+    int error = 0;
+    socklen_t len = sizeof(error);
+
+    conn->connecting = 0;
+    ev_io_stop(client->loop, &conn->write_watcher);
+    if (getsockopt(conn->fd, SOL_SOCKET, SO_ERROR, &error, &len) != 0 || error != 0)
+        return -1;
+    if (client->config->churn)
+        bench_stats_record_connect_latency(&client->stats, bench_time_us() - conn->connect_start_us);
+
+    /* fill the pipeline; each reply then sends one more request */
+    ev_io_start(client->loop, &conn->read_watcher);
+    return client_send(conn, client->config->pipeline);
+}
+
+static void client_read(struct ev_loop *loop, ev_io *watcher, int revents)
+{
+    lev_conn *conn = (lev_conn*)watcher->data;
+    lev_client *client = conn->client;
+    unsigned int offset = 0;
+    ssize_t nread;
+    (void)loop;
+    (void)revents;
+
+    nread = recv(conn->fd, conn->in + conn->in_len, conn->in_capacity - conn->in_len, 0);
+    if (nread < 0 && bench_socket_would_block(errno))
+        return;
+    if (nread <= 0) {
+        if (!client->stopping)
+            bench_stats_record_error(&client->stats);
+        client_conn_close(conn);
+        return;
+    }
+    conn->in_len += (unsigned int)nread;
+
+    while (conn->in_len - offset >= BENCH_FRAME_HEADER_SIZE) {
+        const unsigned char *data = conn->in + offset;
+        unsigned int payload_size = bench_frame_payload_size(data);
+        unsigned int frame_size;
+        uint32_t sequence;
+        uint64_t now;
+
+        if (payload_size != client->config->message_size) {
+            bench_stats_record_error(&client->stats);
+            client_conn_close(conn);
+            return;
+        }
+        frame_size = BENCH_FRAME_HEADER_SIZE + payload_size;
+        if (conn->in_len - offset < frame_size)
+            break;
+        sequence = bench_frame_sequence(data);
+        if (sequence != conn->sequence) {
+            bench_stats_record_error(&client->stats);
+            client_conn_close(conn);
+            return;
+        }
+        offset += frame_size;
+
+        now = bench_time_us();
+        bench_stats_record_request(&client->stats, frame_size);
+        if (client->config->churn) {
+            bench_stats_record_latency(&client->stats, now - conn->connect_start_us);
+            bench_stats_record_connection(&client->stats);
+        } else {
+            bench_stats_record_latency(&client->stats,
+                now - conn->request_start_us[sequence % client->config->pipeline]);
+        }
+        conn->sequence++;
+
+        if (client->stopping || now >= client->deadline_us) {
+            client->stopping = 1;
+            client_conn_close(conn);
+            return;
+        }
+        if (client->config->churn) {
+            /* --churn: the slot lives on with a new connection */
+            client_socket_close(conn);
+            conn->in_len = 0;
+            conn->out_len = 0;
+            conn->send_sequence = 0;
+            conn->sequence = 0;
+            if (client_connect(conn) != 0) {
+                bench_stats_record_error(&client->stats);
+                client_conn_close(conn);
+            }
+            return;
+        }
+        if (client_send(conn, 1) != 0) {
+            bench_stats_record_error(&client->stats);
+            client_conn_close(conn);
+            return;
+        }
+    }
+
+    memmove(conn->in, conn->in + offset, conn->in_len - offset);
+    conn->in_len -= offset;
+}
+
+static void client_writable(struct ev_loop *loop, ev_io *watcher, int revents)
+{
+    lev_conn *conn = (lev_conn*)watcher->data;
+    lev_client *client = conn->client;
+    ssize_t sent;
+    (void)revents;
+
+    if (conn->connecting) {
+        if (client_connected(conn) != 0) {
+            if (!client->stopping)
+                bench_stats_record_error(&client->stats);
+            client_conn_close(conn);
+        }
+        return;
+    }
+
+    sent = send(conn->fd, conn->out, conn->out_len, 0);
+    if (sent < 0) {
+        if (bench_socket_would_block(errno))
+            return;
+        if (!client->stopping)
+            bench_stats_record_error(&client->stats);
+        client_conn_close(conn);
+        return;
+    }
+    memmove(conn->out, conn->out + sent, conn->out_len - (unsigned int)sent);
+    conn->out_len -= (unsigned int)sent;
+    if (!conn->out_len)
+        ev_io_stop(loop, &conn->write_watcher);
+}
+
+static void client_socket_close(lev_conn *conn)
+{
+    if (conn->fd < 0)
+        return;
+    ev_io_stop(conn->client->loop, &conn->read_watcher);
+    ev_io_stop(conn->client->loop, &conn->write_watcher);
+    close(conn->fd);
+    conn->fd = -1;
+    conn->connecting = 0;
+}
+
+/* Retire the slot; the buffers stay until client_conn_free(). */
+static void client_conn_close(lev_conn *conn)
+{
+    lev_client *client = conn->client;
+
+    if (conn->closed || !client)
+        return;
+    conn->closed = 1;
+    client_socket_close(conn);
+    if (client->active_connections > 0) {
+        client->active_connections--;
+        if (!client->active_connections)
+            ev_break(client->loop, EVBREAK_ALL);
+    }
+}
+
+static void client_conn_free(lev_conn *conn)
+{
+    free(conn->in);
+    free(conn->frame);
+    free(conn->out);
+    free(conn->request_start_us);
+    conn->in = NULL;
+    conn->frame = NULL;
+    conn->out = NULL;
+    conn->request_start_us = NULL;
+}
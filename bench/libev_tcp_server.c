@@ -0,0 +1,387 @@
+#include "tcp.h"
+#include "clock.h"
+#include "net.h"
+#include "protocol.h"
+#include "report.h"
+#include "stats.h"
+
+#include <ev.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+typedef struct lev_server lev_server;
+typedef struct lev_conn lev_conn;
+
+struct lev_server {
+    const bench_config *config;
+    struct ev_loop *loop;
+    int listen_fd;
+    ev_io accept_watcher;
+    ev_timer report_timer;
+    ev_signal signal_watcher;
+    lev_conn *head;
+    bench_stats stats;
+    bench_stats previous;
+    bench_timeval started;
+    uint64_t previous_us;
+};
+
+struct lev_conn {
+    ev_io read_watcher;
+    ev_io write_watcher;             /* started while replies wait in out */
+    lev_server *server;
+    lev_conn *next;
+    lev_conn *prev;
+    int fd;
+    unsigned char *in;               /* bytes read, frames are parsed in place */
+    unsigned int in_capacity;
+    unsigned int in_len;
+    unsigned char *out;              /* replies the socket did not take yet */
+    unsigned int out_capacity;
+    unsigned int out_len;
+    uint64_t accepted_us;            /* --churn: accept latency is recorded from the first frame */
+    int accept_recorded;
+};
+
+static void server_signal(struct ev_loop *loop, ev_signal *watcher, int revents);
+static void server_report(struct ev_loop *loop, ev_timer *watcher, int revents);
+static void server_accept(struct ev_loop *loop, ev_io *watcher, int revents);
+static void server_read(struct ev_loop *loop, ev_io *watcher, int revents);
+static void server_writable(struct ev_loop *loop, ev_io *watcher, int revents);
+static int server_send(lev_conn *conn, const unsigned char *data, unsigned int len);
+static int server_flush(lev_conn *conn);
+static int server_listen(lev_server *server, const bench_sockaddr *addr);
+static int set_nonblocking(int fd);
+static void server_close_connections(lev_server *server);
+static void server_conn_close(lev_conn *conn);
+static void server_conn_unlink(lev_conn *conn);
+
+int bench_libev_tcp_server_run(const bench_config *config)
+{
+    lev_server server;
+    bench_sockaddr addr;
+    int ret = 1;
+
+    memset(&server, 0, sizeof(server));
+    server.config = config;
+    server.listen_fd = -1;
+    bench_stats_init(&server.stats);
+    bench_stats_init(&server.previous);
+    if (config->churn && bench_stats_enable_connect_latency(&server.stats, config->latency_digits) != 0) {
+        fprintf(stderr, "libev server setup failed: unable to allocate accept histogram\n");
+        return 1;
+    }
+
+    if (bench_resolve_addr(config, &addr) != 0) {
+        fprintf(stderr, "libev server setup failed: invalid address %s:%u\n",
+            config->host, (unsigned int)config->port);
+        goto done;
+    }
+    server.loop = ev_default_loop(0);
+    if (!server.loop) {
+        fprintf(stderr, "libev server setup failed: unable to create loop\n");
+        goto done;
+    }
+    if (server_listen(&server, &addr) != 0) {
+        fprintf(stderr, "libev server setup failed: listen failed on %s:%u errno=%d\n",
+            config->host, (unsigned int)config->port, errno);
+        goto done;
+    }
+    if (config->zerocopy)
+        fprintf(stderr, "server warning: --zerocopy is not supported by the libev server\n");
+    if (config->busy_poll)
+        fprintf(stderr, "server warning: --busy-poll is not supported by the libev server\n");
+    if (config->threads > 1)
+        fprintf(stderr, "server warning: --threads is not supported by the libev server, using one thread\n");
+    if (config->idle) {
+        fprintf(stderr, "libev server setup failed: --idle is not supported by the libev server\n");
+        goto done;
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    ev_io_init(&server.accept_watcher, server_accept, server.listen_fd, EV_READ);
+    server.accept_watcher.data = &server;
+    ev_io_start(server.loop, &server.accept_watcher);
+    ev_timer_init(&server.report_timer, server_report, (ev_tstamp)config->report_interval,
+        (ev_tstamp)config->report_interval);
+    server.report_timer.data = &server;
+    ev_timer_start(server.loop, &server.report_timer);
+    ev_signal_init(&server.signal_watcher, server_signal, SIGINT);
+    server.signal_watcher.data = &server;
+    ev_signal_start(server.loop, &server.signal_watcher);
+
+    bench_now(&server.started);
+    server.previous_us = bench_time_us();
+    printf("libev tcp server listening on %s:%u message_size=%u backlog=%u%s\n",
+        config->host, (unsigned int)config->port, config->message_size, config->backlog,
+        config->churn ? " churn" : "");
+    printf("press Ctrl+C to stop\n");
+    bench_stats_print_delta_header("server", 1);
+
+    ev_run(server.loop, 0);
+
+    {
+        bench_timeval ended;
+        uint64_t elapsed_ms;
+        bench_now(&ended);
+        elapsed_ms = bench_time_diff_ms(&server.started, &ended);
+        bench_stats_print_total("server", &server.stats, elapsed_ms, 1);
+        if (config->churn)
+            bench_stats_print_connections(&server.stats, "accept", elapsed_ms);
+        ret = bench_report_write(config, "server", &server.stats, NULL, elapsed_ms) ? 1 : 0;
+    }
+
+done:
+    if (server.loop) {
+        server_close_connections(&server);
+        ev_signal_stop(server.loop, &server.signal_watcher);
+        ev_timer_stop(server.loop, &server.report_timer);
+        ev_io_stop(server.loop, &server.accept_watcher);
+        ev_loop_destroy(server.loop);
+    }
+    if (server.listen_fd >= 0)
+        close(server.listen_fd);
+    bench_stats_free(&server.stats);
+    return ret;
+}
+
+static int server_listen(lev_server *server, const bench_sockaddr *addr)
+{
+    int on = 1;
+
+    server->listen_fd = socket(addr->storage.ss_family, SOCK_STREAM, 0);
+    if (server->listen_fd < 0)
+        return -1;
+    if (setsockopt(server->listen_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) != 0
+        || bind(server->listen_fd, (const struct sockaddr*)&addr->storage, (socklen_t)addr->len) != 0
+        || listen(server->listen_fd, (int)server->config->backlog) != 0
+        || set_nonblocking(server->listen_fd) != 0)
+        return -1;
+    return 0;
+}
+
+static int set_nonblocking(int fd)
+{
+    int flags = fcntl(fd, F_GETFL, 0);
+
+    if (flags < 0)
+        return -1;
+    return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+static void server_signal(struct ev_loop *loop, ev_signal *watcher, int revents)
+{
+    (void)watcher;
+    (void)revents;
+    ev_break(loop, EVBREAK_ALL);
+}
+
+static void server_report(struct ev_loop *loop, ev_timer *watcher, int revents)
+{
+    lev_server *server = (lev_server*)watcher->data;
+    uint64_t now = bench_time_us();
+    uint64_t elapsed_ms = (now - server->previous_us) / 1000ULL;
+    (void)loop;
+    (void)revents;
+
+    bench_stats_print_delta("server", &server->stats, &server->previous, elapsed_ms, 1);
+    bench_stats_snapshot(&server->previous, &server->stats);
+    server->previous_us = now;
+}
+
+/* Accept until the backlog is empty. */
+static void server_accept(struct ev_loop *loop, ev_io *watcher, int revents)
+{
+    lev_server *server = (lev_server*)watcher->data;
+    (void)revents;
+
+    for (;;) {
+        lev_conn *conn;
+        int fd = accept(server->listen_fd, NULL, NULL);
+
+        if (fd < 0) {
+            if (!bench_socket_would_block(errno) && errno != ECONNABORTED) {
+                bench_stats_record_accept_error(&server->stats);
+                fprintf(stderr, "libev server accept error: %d\n", errno);
+            }
+            return;
+        }
+        conn = (lev_conn*)calloc(1, sizeof(*conn));
+        if (conn) {
+            conn->in_capacity = BENCH_FRAME_HEADER_SIZE + server->config->message_size;
+            if (conn->in_capacity < BENCH_READ_BUFFER_SIZE)
+                conn->in_capacity = BENCH_READ_BUFFER_SIZE;
+            conn->in = (unsigned char*)malloc(conn->in_capacity);
+        }
+        if (!conn || !conn->in || set_nonblocking(fd) != 0) {
+            bench_stats_record_accept_error(&server->stats);
+            if (conn)
+                free(conn->in);
+            free(conn);
+            close(fd);
+            continue;
+        }
+        conn->server = server;
+        conn->fd = fd;
+        conn->accepted_us = bench_time_us();
+        conn->next = server->head;
+        if (server->head)
+            server->head->prev = conn;
+        server->head = conn;
+        bench_stats_record_connection(&server->stats);
+
+        ev_io_init(&conn->read_watcher, server_read, fd, EV_READ);
+        conn->read_watcher.data = conn;
+        ev_io_init(&conn->write_watcher, server_writable, fd, EV_WRITE);
+        conn->write_watcher.data = conn;
+        ev_io_start(loop, &conn->read_watcher);
+    }
+}
+
+static void server_read(struct ev_loop *loop, ev_io *watcher, int revents)
+{
+    lev_conn *conn = (lev_conn*)watcher->data;
+    lev_server *server = conn->server;
+    unsigned int offset = 0;
+    ssize_t nread;
+    (void)loop;
+    (void)revents;
+
+    nread = recv(conn->fd, conn->in + conn->in_len, conn->in_capacity - conn->in_len, 0);
+    if (nread < 0 && bench_socket_would_block(errno))
+        return;
+    if (nread <= 0) {
+        server_conn_close(conn);
+        return;
+    }
+    conn->in_len += (unsigned int)nread;
+
+    while (conn->in_len - offset >= BENCH_FRAME_HEADER_SIZE) {
+        const unsigned char *data = conn->in + offset;
+        unsigned int payload_size = bench_frame_payload_size(data);
+        unsigned int frame_size;
+
+        if (payload_size > server->config->message_size) {
+            bench_stats_record_io_error(&server->stats);
+            server_conn_close(conn);
+            return;
+        }
+        frame_size = BENCH_FRAME_HEADER_SIZE + payload_size;
+        if (conn->in_len - offset < frame_size)
+            break;
+        if (server->config->churn && !conn->accept_recorded
+            && frame_size >= BENCH_FRAME_HEADER_SIZE + BENCH_FRAME_STAMP_SIZE) {
+            /* same clock on both ends: the client stamped its connect start */
+            uint64_t started_us = bench_frame_stamp(data);
+
+            conn->accept_recorded = 1;
+            if (conn->accepted_us >= started_us)
+                bench_stats_record_connect_latency(&server->stats, conn->accepted_us - started_us);
+        }
+        bench_stats_record_request(&server->stats, frame_size);
+        offset += frame_size;
+    }
+
+    /* the replies are the complete frames themselves, echoed in one send */
+    if (offset && server_send(conn, conn->in, offset) != 0) {
+        bench_stats_record_io_error(&server->stats);
+        server_conn_close(conn);
+        return;
+    }
+    memmove(conn->in, conn->in + offset, conn->in_len - offset);
+    conn->in_len -= offset;
+}
+
+/* Send now what the socket takes; the rest waits in out for the write watcher. */
+static int server_send(lev_conn *conn, const unsigned char *data, unsigned int len)
+{
+    ssize_t sent = 0;
+
+    if (!conn->out_len) {
+        sent = send(conn->fd, data, len, 0);
+        if (sent < 0 && !bench_socket_would_block(errno))
+            return -1;
+        if (sent < 0)
+            sent = 0;
+        if ((unsigned int)sent == len)
+            return 0;
+    }
+
+    len -= (unsigned int)sent;
+    if (len > conn->out_capacity - conn->out_len) {
+        unsigned int capacity = conn->out_capacity ? conn->out_capacity * 2 : conn->in_capacity;
+        unsigned char *out;
+
+        while (capacity - conn->out_len < len)
+            capacity *= 2;
+        out = (unsigned char*)realloc(conn->out, capacity);
+        if (!out)
+            return -1;
+        conn->out = out;
+        conn->out_capacity = capacity;
+    }
+    memcpy(conn->out + conn->out_len, data + sent, len);
+    conn->out_len += len;
+    ev_io_start(conn->server->loop, &conn->write_watcher);
+    return 0;
+}
+
+static int server_flush(lev_conn *conn)
+{
+    ssize_t sent = send(conn->fd, conn->out, conn->out_len, 0);
+
+    if (sent < 0)
+        return bench_socket_would_block(errno) ? 0 : -1;
+    memmove(conn->out, conn->out + sent, conn->out_len - (unsigned int)sent);
+    conn->out_len -= (unsigned int)sent;
+    if (!conn->out_len)
+        ev_io_stop(conn->server->loop, &conn->write_watcher);
+    return 0;
+}
+
+static void server_writable(struct ev_loop *loop, ev_io *watcher, int revents)
+{
+    lev_conn *conn = (lev_conn*)watcher->data;
+    (void)loop;
+    (void)revents;
+
+    if (server_flush(conn) != 0)
+        server_conn_close(conn);
+}
+
+static void server_close_connections(lev_server *server)
+{
+    while (server->head)
+        server_conn_close(server->head);
+}
+
+static void server_conn_unlink(lev_conn *conn)
+{
+    lev_server *server = conn->server;
+
+    if (conn->prev)
+        conn->prev->next = conn->next;
+    else
+        server->head = conn->next;
+    if (conn->next)
+        conn->next->prev = conn->prev;
+    conn->prev = NULL;
+    conn->next = NULL;
+}
+
+static void server_conn_close(lev_conn *conn)
+{
+    server_conn_unlink(conn);
+    ev_io_stop(conn->server->loop, &conn->read_watcher);
+    ev_io_stop(conn->server->loop, &conn->write_watcher);
+    close(conn->fd);
+    free(conn->in);
+    free(conn->out);
+    free(conn);
+}
@@ -2,6 +2,7 @@
 #include "clock.h"
 #include "net.h"
 #include "protocol.h"
+#include "report.h"
 #include "stats.h"
 
 #include <event2/bufferevent.h>
@@ -20,6 +21,7 @@ typedef struct event_conn event_conn;
 struct event_client {
     const bench_config *config;
     struct event_base *base;
+    bench_sockaddr addr;
     struct event *report_event;
     struct event *stop_event;
     struct event *signal_event;
@@ -37,14 +39,17 @@ struct event_conn {
     struct bufferevent *bev;
     unsigned char *frame;
     unsigned int frame_size;
-    uint32_t sequence;
-    uint64_t request_start_us;
+    uint32_t send_sequence;          /* next request to send */
+    uint32_t sequence;               /* next reply expected */
+    uint64_t *request_start_us;      /* send times, indexed by sequence % pipeline */
+    uint64_t connect_start_us;
     int closed;
 };
 
 static void client_signal(evutil_socket_t fd, short events, void *arg);
 static void client_report(evutil_socket_t fd, short events, void *arg);
 static void client_stop(evutil_socket_t fd, short events, void *arg);
+static int client_connect(event_conn *conn);
 static int client_send(event_conn *conn);
 static void client_read(struct bufferevent *bev, void *arg);
 static void client_event(struct bufferevent *bev, short events, void *arg);
@@ -53,7 +58,6 @@ static void client_conn_close(event_conn *conn);
 int bench_libevent_tcp_client_run(const bench_config *config)
 {
     event_client client;
-    bench_sockaddr addr;
     struct timeval interval;
     struct timeval duration;
     unsigned int i;
@@ -63,8 +67,16 @@ int bench_libevent_tcp_client_run(const bench_config *config)
     client.config = config;
     bench_stats_init(&client.stats);
     bench_stats_init(&client.previous);
+    if (bench_stats_enable_latency(&client.stats, config->latency_digits) != 0) {
+        fprintf(stderr, "libevent client setup failed: unable to allocate latency histogram\n");
+        return 1;
+    }
+    if (config->churn && bench_stats_enable_connect_latency(&client.stats, config->latency_digits) != 0) {
+        fprintf(stderr, "libevent client setup failed: unable to allocate connect histogram\n");
+        goto done;
+    }
 
-    if (bench_resolve_addr(config, &addr) != 0) {
+    if (bench_resolve_addr(config, &client.addr) != 0) {
         fprintf(stderr, "libevent client setup failed: invalid address %s:%u\n",
             config->host, (unsigned int)config->port);
         goto done;
@@ -74,6 +86,20 @@ int bench_libevent_tcp_client_run(const bench_config *config)
         fprintf(stderr, "libevent client setup failed: unable to create event base\n");
         goto done;
     }
+    if (config->busy_poll)
+        fprintf(stderr, "client warning: --busy-poll is not supported by the libevent client\n");
+    if (config->threads > 1)
+        fprintf(stderr, "client warning: --threads is not supported by the libevent client, using one thread\n");
+    if (config->source_ips)
+        fprintf(stderr, "client warning: --source-ips is not supported by the libevent client\n");
+    if (config->rate) {
+        fprintf(stderr, "libevent client setup failed: --rate is not supported by the libevent client\n");
+        goto done;
+    }
+    if (config->idle) {
+        fprintf(stderr, "libevent client setup failed: --idle is not supported by the libevent client\n");
+        goto done;
+    }
 
     client.connections = (event_conn*)calloc(config->connections, sizeof(*client.connections));
     if (!client.connections) {
@@ -88,18 +114,12 @@ int bench_libevent_tcp_client_run(const bench_config *config)
         conn->client = &client;
         conn->frame_size = BENCH_FRAME_HEADER_SIZE + config->message_size;
         conn->frame = (unsigned char*)malloc(conn->frame_size);
-        if (!conn->frame) {
+        conn->request_start_us = (uint64_t*)malloc(sizeof(uint64_t) * config->pipeline);
+        if (!conn->frame || !conn->request_start_us) {
             fprintf(stderr, "libevent client setup failed: unable to allocate connection %u frame\n", i);
             goto done;
         }
-        conn->bev = bufferevent_socket_new(client.base, -1, BEV_OPT_CLOSE_ON_FREE);
-        if (!conn->bev) {
-            fprintf(stderr, "libevent client setup failed: unable to allocate bufferevent %u\n", i);
-            goto done;
-        }
-        bufferevent_setcb(conn->bev, client_read, NULL, client_event, conn);
-        bufferevent_enable(conn->bev, EV_READ | EV_WRITE);
-        if (bufferevent_socket_connect(conn->bev, (struct sockaddr*)&addr.storage, addr.len) != 0) {
+        if (client_connect(conn) != 0) {
             fprintf(stderr, "libevent client setup failed: connect start failed for connection %u errno=%d\n",
                 i, errno);
             goto done;
@@ -127,13 +147,16 @@ int bench_libevent_tcp_client_run(const bench_config *config)
 
     client.previous_us = bench_time_us();
     client.deadline_us = client.previous_us + ((uint64_t)config->duration * 1000000ULL);
-    printf("libevent tcp client connecting to %s:%u connections=%u duration=%us message_size=%u\n",
-        config->host, (unsigned int)config->port, config->connections, config->duration, config->message_size);
+    printf("libevent tcp client connecting to %s:%u connections=%u duration=%us message_size=%u pipeline=%u%s\n",
+        config->host, (unsigned int)config->port, config->connections, config->duration, config->message_size,
+        config->pipeline, config->churn ? " churn" : "");
     bench_stats_print_delta_header("client", 0);
 
     event_base_dispatch(client.base);
     bench_stats_print_total("client", &client.stats, (uint64_t)config->duration * 1000ULL, 0);
-    ret = 0;
+    if (config->churn)
+        bench_stats_print_connections(&client.stats, "connect", (uint64_t)config->duration * 1000ULL);
+    ret = bench_report_write(config, "client", &client.stats, NULL, (uint64_t)config->duration * 1000ULL) ? 1 : 0;
 
 done:
     if (client.connections) {
@@ -149,6 +172,7 @@ done:
         event_free(client.report_event);
     if (client.base)
         event_base_free(client.base);
+    bench_stats_free(&client.stats);
     return ret;
 }
 
@@ -171,7 +195,7 @@ static void client_report(evutil_socket_t fd, short events, void *arg)
     (void)events;
 
     bench_stats_print_delta("client", &client->stats, &client->previous, elapsed_ms, 0);
-    client->previous = client->stats;
+    bench_stats_snapshot(&client->previous, &client->stats);
     client->previous_us = now;
 }
 
@@ -187,14 +211,30 @@ static void client_stop(evutil_socket_t fd, short events, void *arg)
         client_conn_close(&client->connections[i]);
 }
 
+static int client_connect(event_conn *conn)
+{
+    event_client *client = conn->client;
+
+    conn->bev = bufferevent_socket_new(client->base, -1, BEV_OPT_CLOSE_ON_FREE);
+    if (!conn->bev)
+        return -1;
+    bufferevent_setcb(conn->bev, client_read, NULL, client_event, conn);
+    bufferevent_enable(conn->bev, EV_READ | EV_WRITE);
+    conn->connect_start_us = bench_time_us();
+    return bufferevent_socket_connect(conn->bev, (struct sockaddr*)&client->addr.storage, client->addr.len);
+}
+
 static int client_send(event_conn *conn)
 {
+    uint32_t sequence = conn->send_sequence++;
     unsigned int i;
 
-    bench_frame_write_header(conn->frame, conn->client->config->message_size, conn->sequence);
+    bench_frame_write_header(conn->frame, conn->client->config->message_size, sequence);
     for (i = BENCH_FRAME_HEADER_SIZE; i < conn->frame_size; i++)
-        conn->frame[i] = (unsigned char)(conn->sequence + i);
-    conn->request_start_us = bench_time_us();
+        conn->frame[i] = (unsigned char)(sequence + i);
+    if (conn->client->config->churn)
+        bench_frame_write_stamp(conn->frame, conn->connect_start_us);
+    conn->request_start_us[sequence % conn->client->config->pipeline] = bench_time_us();
     return bufferevent_write(conn->bev, conn->frame, conn->frame_size);
 }
 
@@ -235,7 +275,13 @@ static void client_read(struct bufferevent *bev, void *arg)
         evbuffer_drain(input, frame_size);
         now = bench_time_us();
         bench_stats_record_request(&client->stats, frame_size);
-        bench_stats_record_latency(&client->stats, now - conn->request_start_us);
+        if (client->config->churn) {
+            bench_stats_record_latency(&client->stats, now - conn->connect_start_us);
+            bench_stats_record_connection(&client->stats);
+        } else {
+            bench_stats_record_latency(&client->stats,
+                now - conn->request_start_us[sequence % client->config->pipeline]);
+        }
         conn->sequence++;
 
         if (client->stopping || now >= client->deadline_us) {
@@ -243,6 +289,17 @@ static void client_read(struct bufferevent *bev, void *arg)
             client_conn_close(conn);
             return;
         }
+        if (client->config->churn) {
+            /* close and dial the next connection in this slot */
+            bufferevent_free(conn->bev);
+            conn->send_sequence = 0;
+            conn->sequence = 0;
+            if (client_connect(conn) != 0) {
+                bench_stats_record_error(&client->stats);
+                client_conn_close(conn);
+            }
+            return;
+        }
         if (client_send(conn) != 0) {
             bench_stats_record_error(&client->stats);
             client_conn_close(conn);
@@ -257,9 +314,18 @@ static void client_event(struct bufferevent *bev, short events, void *arg)
     (void)bev;
 
     if (events & BEV_EVENT_CONNECTED) {
-        if (client_send(conn) != 0) {
-            bench_stats_record_error(&conn->client->stats);
-            client_conn_close(conn);
+        unsigned int i;
+
+        if (conn->client->config->churn)
+            bench_stats_record_connect_latency(&conn->client->stats, bench_time_us() - conn->connect_start_us);
+
+        /* fill the pipeline; each reply then sends one more request */
+        for (i = 0; i < conn->client->config->pipeline; i++) {
+            if (client_send(conn) != 0) {
+                bench_stats_record_error(&conn->client->stats);
+                client_conn_close(conn);
+                return;
+            }
         }
         return;
     }
@@ -280,6 +346,8 @@ static void client_conn_close(event_conn *conn)
     conn->bev = NULL;
     free(conn->frame);
     conn->frame = NULL;
+    free(conn->request_start_us);
+    conn->request_start_us = NULL;
     if (conn->client && conn->client->active_connections > 0) {
         conn->client->active_connections--;
         if (!conn->client->active_connections)
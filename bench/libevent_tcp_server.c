@@ -2,6 +2,7 @@
 #include "clock.h"
 #include "net.h"
 #include "protocol.h"
+#include "report.h"
 #include "stats.h"
 
 #include <event2/bufferevent.h>
@@ -36,6 +37,8 @@ struct event_conn {
     event_conn *next;
     event_conn *prev;
     struct bufferevent *bev;
+    uint64_t accepted_us;            /* --churn: accept latency is recorded from the first frame */
+    int accept_recorded;
 };
 
 static void server_signal(evutil_socket_t fd, short events, void *arg);
@@ -60,6 +63,10 @@ int bench_libevent_tcp_server_run(const bench_config *config)
     server.config = config;
     bench_stats_init(&server.stats);
     bench_stats_init(&server.previous);
+    if (config->churn && bench_stats_enable_connect_latency(&server.stats, config->latency_digits) != 0) {
+        fprintf(stderr, "libevent server setup failed: unable to allocate accept histogram\n");
+        return 1;
+    }
 
     if (bench_resolve_addr(config, &addr) != 0) {
         fprintf(stderr, "libevent server setup failed: invalid address %s:%u\n",
@@ -87,6 +94,17 @@ int bench_libevent_tcp_server_run(const bench_config *config)
         fprintf(stderr, "libevent server setup failed: unable to create control events\n");
         goto done;
     }
+    if (config->zerocopy)
+        fprintf(stderr, "server warning: --zerocopy is not supported by the libevent server\n");
+    if (config->busy_poll)
+        fprintf(stderr, "server warning: --busy-poll is not supported by the libevent server\n");
+    if (config->threads > 1)
+        fprintf(stderr, "server warning: --threads is not supported by the libevent server, using one thread\n");
+    if (config->idle) {
+        fprintf(stderr, "libevent server setup failed: --idle is not supported by the libevent server\n");
+        goto done;
+    }
+
     interval.tv_sec = config->report_interval;
     interval.tv_usec = 0;
     if (event_add(server.report_event, &interval) != 0 || event_add(server.signal_event, NULL) != 0) {
@@ -96,8 +114,9 @@ int bench_libevent_tcp_server_run(const bench_config *config)
 
     bench_now(&server.started);
     server.previous_us = bench_time_us();
-    printf("libevent tcp server listening on %s:%u message_size=%u backlog=%u\n",
-        config->host, (unsigned int)config->port, config->message_size, config->backlog);
+    printf("libevent tcp server listening on %s:%u message_size=%u backlog=%u%s\n",
+        config->host, (unsigned int)config->port, config->message_size, config->backlog,
+        config->churn ? " churn" : "");
     printf("press Ctrl+C to stop\n");
     bench_stats_print_delta_header("server", 1);
 
@@ -106,10 +125,14 @@ int bench_libevent_tcp_server_run(const bench_config *config)
 
     {
         bench_timeval ended;
+        uint64_t elapsed_ms;
         bench_now(&ended);
-        bench_stats_print_total("server", &server.stats, bench_time_diff_ms(&server.started, &ended), 1);
+        elapsed_ms = bench_time_diff_ms(&server.started, &ended);
+        bench_stats_print_total("server", &server.stats, elapsed_ms, 1);
+        if (config->churn)
+            bench_stats_print_connections(&server.stats, "accept", elapsed_ms);
+        ret = bench_report_write(config, "server", &server.stats, NULL, elapsed_ms) ? 1 : 0;
     }
-    ret = 0;
 
 done:
     server_close_connections(&server);
@@ -121,6 +144,7 @@ done:
         evconnlistener_free(server.listener);
     if (server.base)
         event_base_free(server.base);
+    bench_stats_free(&server.stats);
     return ret;
 }
 
@@ -141,7 +165,7 @@ static void server_report(evutil_socket_t fd, short events, void *arg)
     (void)events;
 
     bench_stats_print_delta("server", &server->stats, &server->previous, elapsed_ms, 1);
-    server->previous = server->stats;
+    bench_stats_snapshot(&server->previous, &server->stats);
     server->previous_us = now;
 }
 
@@ -161,6 +185,7 @@ static void server_accept(struct evconnlistener *listener, evutil_socket_t fd,
         return;
     }
     conn->server = server;
+    conn->accepted_us = bench_time_us();
     conn->bev = bufferevent_socket_new(server->base, fd, BEV_OPT_CLOSE_ON_FREE);
     if (!conn->bev) {
         bench_stats_record_accept_error(&server->stats);
@@ -172,6 +197,7 @@ static void server_accept(struct evconnlistener *listener, evutil_socket_t fd,
     if (server->head)
         server->head->prev = conn;
     server->head = conn;
+    bench_stats_record_connection(&server->stats);
 
     bufferevent_setcb(conn->bev, server_read, NULL, server_event, conn);
     bufferevent_enable(conn->bev, EV_READ | EV_WRITE);
@@ -210,6 +236,15 @@ static void server_read(struct bufferevent *bev, void *arg)
         data = evbuffer_pullup(input, frame_size);
         if (!data)
             return;
+        if (conn->server->config->churn && !conn->accept_recorded
+            && frame_size >= BENCH_FRAME_HEADER_SIZE + BENCH_FRAME_STAMP_SIZE) {
+            /* same clock on both ends: the client stamped its connect start */
+            uint64_t started_us = bench_frame_stamp(data);
+
+            conn->accept_recorded = 1;
+            if (conn->accepted_us >= started_us)
+                bench_stats_record_connect_latency(&conn->server->stats, conn->accepted_us - started_us);
+        }
         if (bufferevent_write(bev, data, frame_size) != 0) {
             bench_stats_record_io_error(&conn->server->stats);
             server_conn_close(conn);
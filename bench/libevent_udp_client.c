@@ -0,0 +1,339 @@
+#include "udp.h"
+#include "clock.h"
+#include "net.h"
+#include "protocol.h"
+#include "report.h"
+#include "stats.h"
+
+#include <event2/event.h>
+#include <event2/util.h>
+
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define UDP_CLIENT_EXPIRE_MS 50
+
+typedef struct event_udp_client event_udp_client;
+typedef struct event_udp_sock event_udp_sock;
+
+struct event_udp_client {
+    const bench_config *config;
+    struct event_base *base;
+    struct event *report_event;
+    struct event *stop_event;
+    struct event *expire_event;
+    struct event *signal_event;
+    event_udp_sock *sockets;
+    unsigned int active_sockets;
+    unsigned int frame_size;
+    int stopping;
+    bench_stats stats;
+    bench_stats previous;
+    uint64_t previous_us;
+    uint64_t deadline_us;
+};
+
+struct event_udp_sock {
+    event_udp_client *client;
+    evutil_socket_t fd;
+    struct event *read_event;
+    unsigned char *frame;
+    unsigned char *in;
+    unsigned int in_size;
+    bench_udp_window window;
+    unsigned int to_send;            /* datagrams not sent yet */
+    int closed;
+};
+
+static void client_signal(evutil_socket_t fd, short events, void *arg);
+static void client_report(evutil_socket_t fd, short events, void *arg);
+static void client_stop(evutil_socket_t fd, short events, void *arg);
+static void client_expire(evutil_socket_t fd, short events, void *arg);
+static void client_read(evutil_socket_t fd, short events, void *arg);
+static int client_send(event_udp_sock *sock);
+static void client_sock_close(event_udp_sock *sock);
+
+int bench_libevent_udp_client_run(const bench_config *config)
+{
+    event_udp_client client;
+    bench_sockaddr addr;
+    struct timeval interval;
+    struct timeval duration;
+    struct timeval expire;
+    unsigned int i;
+    int ret = 1;
+
+    memset(&client, 0, sizeof(client));
+    client.config = config;
+    client.frame_size = BENCH_FRAME_HEADER_SIZE + config->message_size;
+    bench_stats_init(&client.stats);
+    bench_stats_init(&client.previous);
+    if (bench_stats_enable_latency(&client.stats, config->latency_digits) != 0) {
+        fprintf(stderr, "libevent client setup failed: unable to allocate latency histogram\n");
+        return 1;
+    }
+
+    if (bench_resolve_addr(config, &addr) != 0) {
+        fprintf(stderr, "libevent client setup failed: invalid address %s:%u\n",
+            config->host, (unsigned int)config->port);
+        goto done;
+    }
+    client.base = event_base_new();
+    if (!client.base) {
+        fprintf(stderr, "libevent client setup failed: unable to create event base\n");
+        goto done;
+    }
+    if (config->busy_poll)
+        fprintf(stderr, "client warning: --busy-poll is not supported by the libevent client\n");
+
+    client.sockets = (event_udp_sock*)calloc(config->connections, sizeof(*client.sockets));
+    if (!client.sockets) {
+        fprintf(stderr, "libevent client setup failed: unable to allocate %u sockets\n",
+            config->connections);
+        goto done;
+    }
+    for (i = 0; i < config->connections; i++)
+        client.sockets[i].fd = -1;
+
+    for (i = 0; i < config->connections; i++) {
+        event_udp_sock *sock = &client.sockets[i];
+
+        sock->client = &client;
+        sock->in_size = client.frame_size + 1;
+        sock->frame = (unsigned char*)malloc(client.frame_size);
+        sock->in = (unsigned char*)malloc(sock->in_size);
+        if (!sock->frame || !sock->in || bench_udp_window_init(&sock->window, config->pipeline) != 0) {
+            fprintf(stderr, "libevent client setup failed: unable to allocate socket %u buffers\n", i);
+            goto done;
+        }
+        sock->fd = socket(addr.storage.ss_family, SOCK_DGRAM, 0);
+        if (sock->fd < 0
+            || evutil_make_socket_nonblocking(sock->fd) != 0
+            || connect(sock->fd, (struct sockaddr*)&addr.storage, addr.len) != 0) {
+            fprintf(stderr, "libevent client setup failed: socket %u setup failed errno=%d\n", i, errno);
+            goto done;
+        }
+        sock->read_event = event_new(client.base, sock->fd, EV_READ | EV_PERSIST, client_read, sock);
+        if (!sock->read_event || event_add(sock->read_event, NULL) != 0) {
+            fprintf(stderr, "libevent client setup failed: unable to start socket %u\n", i);
+            goto done;
+        }
+        client.active_sockets++;
+    }
+
+    client.report_event = event_new(client.base, -1, EV_PERSIST, client_report, &client);
+    client.stop_event = event_new(client.base, -1, 0, client_stop, &client);
+    client.expire_event = event_new(client.base, -1, EV_PERSIST, client_expire, &client);
+    client.signal_event = evsignal_new(client.base, SIGINT, client_signal, &client);
+    if (!client.report_event || !client.stop_event || !client.expire_event || !client.signal_event) {
+        fprintf(stderr, "libevent client setup failed: unable to create control events\n");
+        goto done;
+    }
+    interval.tv_sec = config->report_interval;
+    interval.tv_usec = 0;
+    duration.tv_sec = config->duration + 1;
+    duration.tv_usec = 0;
+    expire.tv_sec = 0;
+    expire.tv_usec = UDP_CLIENT_EXPIRE_MS * 1000;
+    if (event_add(client.report_event, &interval) != 0
+        || event_add(client.stop_event, &duration) != 0
+        || event_add(client.expire_event, &expire) != 0
+        || event_add(client.signal_event, NULL) != 0) {
+        fprintf(stderr, "libevent client setup failed: unable to start control events\n");
+        goto done;
+    }
+
+    client.previous_us = bench_time_us();
+    client.deadline_us = client.previous_us + ((uint64_t)config->duration * 1000000ULL);
+    printf("libevent udp client sending to %s:%u sockets=%u duration=%us message_size=%u pipeline=%u\n",
+        config->host, (unsigned int)config->port, config->connections, config->duration, config->message_size,
+        config->pipeline);
+    bench_stats_print_delta_header("client", 0);
+
+    /* fill every window; each reply then sends one more datagram */
+    for (i = 0; i < config->connections; i++) {
+        client.sockets[i].to_send = config->pipeline;
+        if (client_send(&client.sockets[i]) != 0) {
+            bench_stats_record_error(&client.stats);
+            client_sock_close(&client.sockets[i]);
+        }
+    }
+
+    event_base_dispatch(client.base);
+    bench_stats_print_total("client", &client.stats, (uint64_t)config->duration * 1000ULL, 0);
+    bench_stats_print_datagrams(&client.stats);
+    ret = bench_report_write(config, "client", &client.stats, NULL, (uint64_t)config->duration * 1000ULL) ? 1 : 0;
+
+done:
+    if (client.sockets) {
+        for (i = 0; i < config->connections; i++)
+            client_sock_close(&client.sockets[i]);
+        free(client.sockets);
+    }
+    if (client.signal_event)
+        event_free(client.signal_event);
+    if (client.expire_event)
+        event_free(client.expire_event);
+    if (client.stop_event)
+        event_free(client.stop_event);
+    if (client.report_event)
+        event_free(client.report_event);
+    if (client.base)
+        event_base_free(client.base);
+    bench_stats_free(&client.stats);
+    return ret;
+}
+
+static void client_signal(evutil_socket_t fd, short events, void *arg)
+{
+    event_udp_client *client = (event_udp_client*)arg;
+    (void)fd;
+    (void)events;
+
+    client->stopping = 1;
+    client_stop(-1, 0, client);
+}
+
+static void client_report(evutil_socket_t fd, short events, void *arg)
+{
+    event_udp_client *client = (event_udp_client*)arg;
+    uint64_t now = bench_time_us();
+    uint64_t elapsed_ms = (now - client->previous_us) / 1000ULL;
+    (void)fd;
+    (void)events;
+
+    bench_stats_print_delta("client", &client->stats, &client->previous, elapsed_ms, 0);
+    bench_stats_snapshot(&client->previous, &client->stats);
+    client->previous_us = now;
+}
+
+static void client_stop(evutil_socket_t fd, short events, void *arg)
+{
+    event_udp_client *client = (event_udp_client*)arg;
+    unsigned int i;
+    (void)fd;
+    (void)events;
+
+    client->stopping = 1;
+    for (i = 0; i < client->config->connections; i++)
+        client_sock_close(&client->sockets[i]);
+}
+
+static void client_expire(evutil_socket_t fd, short events, void *arg)
+{
+    event_udp_client *client = (event_udp_client*)arg;
+    uint64_t now = bench_time_us();
+    unsigned int i, lost;
+    (void)fd;
+    (void)events;
+
+    /* give up on datagrams that went unanswered and refill their windows */
+    for (i = 0; i < client->config->connections; i++) {
+        event_udp_sock *sock = &client->sockets[i];
+
+        if (sock->closed)
+            continue;
+        lost = sock->window.inflight;
+        bench_udp_window_expire(&sock->window, &client->stats, now);
+        sock->to_send += lost - sock->window.inflight;
+        if (sock->to_send && client_send(sock) != 0) {
+            bench_stats_record_error(&client->stats);
+            client_sock_close(sock);
+        }
+    }
+}
+
+/* Send every waiting datagram the socket buffer takes. */
+static int client_send(event_udp_sock *sock)
+{
+    event_udp_client *client = sock->client;
+    uint32_t sequence;
+    unsigned int i, inflight;
+
+    while (sock->to_send) {
+        inflight = sock->window.inflight;
+        sequence = bench_udp_window_send(&sock->window, &client->stats, bench_time_us());
+        if (sock->window.inflight == inflight) {
+            /* this one took the slot of a datagram now counted lost; replace that too */
+            sock->to_send++;
+        }
+        bench_frame_write_header(sock->frame, client->config->message_size, sequence);
+        for (i = BENCH_FRAME_HEADER_SIZE; i < client->frame_size; i++)
+            sock->frame[i] = (unsigned char)(sequence + i);
+        sock->to_send--;
+        if (send(sock->fd, (const char*)sock->frame, client->frame_size, 0) != (int)client->frame_size) {
+            /* a full socket buffer drops the datagram, as the network would */
+            if (!bench_socket_would_block(EVUTIL_SOCKET_ERROR()))
+                return -1;
+        }
+    }
+    return 0;
+}
+
+static void client_read(evutil_socket_t fd, short events, void *arg)
+{
+    event_udp_sock *sock = (event_udp_sock*)arg;
+    event_udp_client *client = sock->client;
+    uint64_t now;
+    (void)events;
+
+    for (;;) {
+        int bytes = (int)recv(fd, (char*)sock->in, sock->in_size, 0);
+
+        if (bytes < 0) {
+            int error = EVUTIL_SOCKET_ERROR();
+            if (bench_socket_would_block(error))
+                break;
+            /* ICMP port unreachable shows up here as ECONNREFUSED */
+            if (!client->stopping)
+                bench_stats_record_error(&client->stats);
+            client_sock_close(sock);
+            return;
+        }
+        if ((unsigned int)bytes != client->frame_size
+            || bench_frame_payload_size(sock->in) != client->config->message_size) {
+            bench_stats_record_error(&client->stats);
+            continue;
+        }
+        now = bench_time_us();
+        if (bench_udp_window_receive(&sock->window, &client->stats, bench_frame_sequence(sock->in),
+            (unsigned int)bytes, now))
+            sock->to_send++;
+        if (client->stopping || now >= client->deadline_us) {
+            client->stopping = 1;
+            client_sock_close(sock);
+            return;
+        }
+    }
+
+    if (client_send(sock) != 0) {
+        bench_stats_record_error(&client->stats);
+        client_sock_close(sock);
+    }
+}
+
+static void client_sock_close(event_udp_sock *sock)
+{
+    if (sock->closed)
+        return;
+    sock->closed = 1;
+    if (sock->read_event)
+        event_free(sock->read_event);
+    sock->read_event = NULL;
+    if (sock->fd >= 0)
+        evutil_closesocket(sock->fd);
+    sock->fd = -1;
+    free(sock->frame);
+    free(sock->in);
+    sock->frame = NULL;
+    sock->in = NULL;
+    bench_udp_window_free(&sock->window);
+    if (sock->client && sock->client->active_sockets > 0) {
+        sock->client->active_sockets--;
+        if (!sock->client->active_sockets)
+            event_base_loopbreak(sock->client->base);
+    }
+}
@@ -0,0 +1,180 @@
+#include "udp.h"
+#include "clock.h"
+#include "net.h"
+#include "protocol.h"
+#include "report.h"
+#include "stats.h"
+
+#include <event2/event.h>
+#include <event2/util.h>
+
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* datagrams handled per readiness callback before yielding to the loop */
+#define UDP_SERVER_BATCH 64
+
+typedef struct event_udp_server {
+    const bench_config *config;
+    struct event_base *base;
+    evutil_socket_t fd;
+    struct event *read_event;
+    struct event *report_event;
+    struct event *signal_event;
+    unsigned char *buf;
+    unsigned int buf_size;
+    bench_stats stats;
+    bench_stats previous;
+    bench_timeval started;
+    uint64_t previous_us;
+} event_udp_server;
+
+static void server_signal(evutil_socket_t fd, short events, void *arg);
+static void server_report(evutil_socket_t fd, short events, void *arg);
+static void server_read(evutil_socket_t fd, short events, void *arg);
+
+int bench_libevent_udp_server_run(const bench_config *config)
+{
+    event_udp_server server;
+    bench_sockaddr addr;
+    struct timeval interval;
+    int ret = 1;
+
+    memset(&server, 0, sizeof(server));
+    server.config = config;
+    server.fd = -1;
+    bench_stats_init(&server.stats);
+    bench_stats_init(&server.previous);
+
+    if (bench_resolve_addr(config, &addr) != 0) {
+        fprintf(stderr, "libevent server setup failed: invalid address %s:%u\n",
+            config->host, (unsigned int)config->port);
+        goto done;
+    }
+    server.base = event_base_new();
+    if (!server.base) {
+        fprintf(stderr, "libevent server setup failed: unable to create event base\n");
+        goto done;
+    }
+
+    server.buf_size = BENCH_FRAME_HEADER_SIZE + config->message_size + 1;
+    server.buf = (unsigned char*)malloc(server.buf_size);
+    if (!server.buf) {
+        fprintf(stderr, "libevent server setup failed: unable to allocate buffer\n");
+        goto done;
+    }
+    server.fd = socket(addr.storage.ss_family, SOCK_DGRAM, 0);
+    if (server.fd < 0
+        || evutil_make_socket_nonblocking(server.fd) != 0
+        || evutil_make_listen_socket_reuseable(server.fd) != 0
+        || bind(server.fd, (struct sockaddr*)&addr.storage, addr.len) != 0) {
+        fprintf(stderr, "libevent server setup failed: bind failed on %s:%u errno=%d\n",
+            config->host, (unsigned int)config->port, errno);
+        goto done;
+    }
+
+    server.read_event = event_new(server.base, server.fd, EV_READ | EV_PERSIST, server_read, &server);
+    server.report_event = event_new(server.base, -1, EV_PERSIST, server_report, &server);
+    server.signal_event = evsignal_new(server.base, SIGINT, server_signal, &server);
+    if (!server.read_event || !server.report_event || !server.signal_event) {
+        fprintf(stderr, "libevent server setup failed: unable to create control events\n");
+        goto done;
+    }
+    if (config->busy_poll)
+        fprintf(stderr, "server warning: --busy-poll is not supported by the libevent server\n");
+
+    interval.tv_sec = config->report_interval;
+    interval.tv_usec = 0;
+    if (event_add(server.read_event, NULL) != 0
+        || event_add(server.report_event, &interval) != 0
+        || event_add(server.signal_event, NULL) != 0) {
+        fprintf(stderr, "libevent server setup failed: unable to start control events\n");
+        goto done;
+    }
+
+    bench_now(&server.started);
+    server.previous_us = bench_time_us();
+    printf("libevent udp server listening on %s:%u message_size=%u\n",
+        config->host, (unsigned int)config->port, config->message_size);
+    printf("press Ctrl+C to stop\n");
+    bench_stats_print_delta_header("server", 1);
+
+    if (event_base_dispatch(server.base) != 0)
+        fprintf(stderr, "libevent server failed: event loop returned failure\n");
+    {
+        bench_timeval ended;
+        uint64_t elapsed_ms;
+        bench_now(&ended);
+        elapsed_ms = bench_time_diff_ms(&server.started, &ended);
+        bench_stats_print_total("server", &server.stats, elapsed_ms, 1);
+        ret = bench_report_write(config, "server", &server.stats, NULL, elapsed_ms) ? 1 : 0;
+    }
+
+done:
+    if (server.signal_event)
+        event_free(server.signal_event);
+    if (server.report_event)
+        event_free(server.report_event);
+    if (server.read_event)
+        event_free(server.read_event);
+    if (server.fd >= 0)
+        evutil_closesocket(server.fd);
+    if (server.base)
+        event_base_free(server.base);
+    free(server.buf);
+    return ret;
+}
+
+static void server_signal(evutil_socket_t fd, short events, void *arg)
+{
+    event_udp_server *server = (event_udp_server*)arg;
+    (void)fd;
+    (void)events;
+
+    event_base_loopbreak(server->base);
+}
+
+static void server_report(evutil_socket_t fd, short events, void *arg)
+{
+    event_udp_server *server = (event_udp_server*)arg;
+    uint64_t now = bench_time_us();
+    uint64_t elapsed_ms = (now - server->previous_us) / 1000ULL;
+    (void)fd;
+    (void)events;
+
+    bench_stats_print_delta("server", &server->stats, &server->previous, elapsed_ms, 1);
+    bench_stats_snapshot(&server->previous, &server->stats);
+    server->previous_us = now;
+}
+
+static void server_read(evutil_socket_t fd, short events, void *arg)
+{
+    event_udp_server *server = (event_udp_server*)arg;
+    struct sockaddr_storage peer;
+    unsigned int i;
+    (void)events;
+
+    for (i = 0; i < UDP_SERVER_BATCH; i++) {
+        ev_socklen_t peer_len = sizeof(peer);
+        int bytes = (int)recvfrom(fd, (char*)server->buf, server->buf_size, 0, (struct sockaddr*)&peer, &peer_len);
+
+        if (bytes < 0) {
+            int error = EVUTIL_SOCKET_ERROR();
+            if (!bench_socket_would_block(error))
+                bench_stats_record_io_error(&server->stats);
+            return;
+        }
+        if (bytes < BENCH_FRAME_HEADER_SIZE
+            || bench_frame_payload_size(server->buf) != (unsigned int)bytes - BENCH_FRAME_HEADER_SIZE
+            || (unsigned int)bytes - BENCH_FRAME_HEADER_SIZE > server->config->message_size) {
+            bench_stats_record_io_error(&server->stats);
+            continue;
+        }
+        bench_stats_record_request(&server->stats, (uint64_t)bytes);
+        if (sendto(fd, (const char*)server->buf, bytes, 0, (struct sockaddr*)&peer, peer_len) != bytes)
+            bench_stats_record_io_error(&server->stats);
+    }
+}
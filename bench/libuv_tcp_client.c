@@ -0,0 +1,466 @@
+#include "tcp.h"
+#include "clock.h"
+#include "net.h"
+#include "protocol.h"
+#include "report.h"
+#include "stats.h"
+
+#include <uv.h>
+
+#include <signal.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct luv_client luv_client;
+typedef struct luv_conn luv_conn;
+
+typedef enum luv_handle_state {
+    luv_handle_none = 0,
+    luv_handle_open,
+    luv_handle_closing
+} luv_handle_state;
+
+struct luv_client {
+    const bench_config *config;
+    uv_loop_t loop;
+    int loop_ready;
+    bench_sockaddr addr;
+    uv_timer_t report_timer;
+    uv_timer_t stop_timer;
+    uv_signal_t signal;
+    luv_conn *connections;
+    unsigned int active_connections;
+    int stopping;
+    bench_stats stats;
+    bench_stats previous;
+    uint64_t previous_us;
+    uint64_t deadline_us;
+};
+
+struct luv_conn {
+    uv_tcp_t tcp;                    /* tcp.data points back here */
+    uv_connect_t connect_req;
+    luv_client *client;
+    luv_handle_state state;
+    unsigned char *in;               /* bytes read, replies are parsed in place */
+    unsigned int in_capacity;
+    unsigned int in_len;
+    unsigned char *frame;            /* requests are built here, pipeline frames at most */
+    unsigned int frame_size;
+    uint32_t send_sequence;          /* next request to send */
+    uint32_t sequence;               /* next reply expected */
+    uint64_t *request_start_us;      /* send times, indexed by sequence % pipeline */
+    uint64_t connect_start_us;
+    int closed;
+};
+
+/* Requests uv_try_write() could not send right away, copied for uv_write(). */
+typedef struct luv_write {
+    uv_write_t req;
+    unsigned char data[1];
+} luv_write;
+
+static void client_signal(uv_signal_t *handle, int signum);
+static void client_report(uv_timer_t *timer);
+static void client_stop(uv_timer_t *timer);
+static int client_connect(luv_conn *conn);
+static int client_send(luv_conn *conn, unsigned int count);
+static void client_connected(uv_connect_t *req, int status);
+static void client_alloc(uv_handle_t *handle, size_t suggested_size, uv_buf_t *buf);
+static void client_read(uv_stream_t *stream, ssize_t nread, const uv_buf_t *buf);
+static void client_write(uv_write_t *req, int status);
+static void client_close_handle(uv_handle_t *handle);
+static void client_conn_close(luv_conn *conn);
+static void client_conn_closed(uv_handle_t *handle);
+static void client_conn_free(luv_conn *conn);
+
+int bench_libuv_tcp_client_run(const bench_config *config)
+{
+    luv_client client;
+    uint64_t interval_ms;
+    unsigned int i;
+    int ret = 1;
+
+    memset(&client, 0, sizeof(client));
+    client.config = config;
+    bench_stats_init(&client.stats);
+    bench_stats_init(&client.previous);
+    if (bench_stats_enable_latency(&client.stats, config->latency_digits) != 0) {
+        fprintf(stderr, "libuv client setup failed: unable to allocate latency histogram\n");
+        return 1;
+    }
+    if (config->churn && bench_stats_enable_connect_latency(&client.stats, config->latency_digits) != 0) {
+        fprintf(stderr, "libuv client setup failed: unable to allocate connect histogram\n");
+        goto done;
+    }
+
+    if (bench_resolve_addr(config, &client.addr) != 0) {
+        fprintf(stderr, "libuv client setup failed: invalid address %s:%u\n",
+            config->host, (unsigned int)config->port);
+        goto done;
+    }
+    if (uv_loop_init(&client.loop) != 0) {
+        fprintf(stderr, "libuv client setup failed: unable to create loop\n");
+        goto done;
+    }
+    client.loop_ready = 1;
+    if (uv_timer_init(&client.loop, &client.report_timer) != 0
+        || uv_timer_init(&client.loop, &client.stop_timer) != 0
+        || uv_signal_init(&client.loop, &client.signal) != 0) {
+        fprintf(stderr, "libuv client setup failed: unable to create control handles\n");
+        goto done;
+    }
+    client.report_timer.data = &client;
+    client.stop_timer.data = &client;
+    client.signal.data = &client;
+    if (config->busy_poll)
+        fprintf(stderr, "client warning: --busy-poll is not supported by the libuv client\n");
+    if (config->threads > 1)
+        fprintf(stderr, "client warning: --threads is not supported by the libuv client, using one thread\n");
+    if (config->source_ips)
+        fprintf(stderr, "client warning: --source-ips is not supported by the libuv client\n");
+    if (config->rate) {
+        fprintf(stderr, "libuv client setup failed: --rate is not supported by the libuv client\n");
+        goto done;
+    }
+    if (config->idle) {
+        fprintf(stderr, "libuv client setup failed: --idle is not supported by the libuv client\n");
+        goto done;
+    }
+#ifndef _WIN32
+    signal(SIGPIPE, SIG_IGN);
+#endif
+
+    client.connections = (luv_conn*)calloc(config->connections, sizeof(*client.connections));
+    if (!client.connections) {
+        fprintf(stderr, "libuv client setup failed: unable to allocate %u connections\n",
+            config->connections);
+        goto done;
+    }
+
+    for (i = 0; i < config->connections; i++) {
+        luv_conn *conn = &client.connections[i];
+
+        conn->client = &client;
+        conn->frame_size = BENCH_FRAME_HEADER_SIZE + config->message_size;
+        /* at most pipeline replies are outstanding */
+        conn->in_capacity = conn->frame_size * config->pipeline;
+        if (conn->in_capacity < BENCH_READ_BUFFER_SIZE)
+            conn->in_capacity = BENCH_READ_BUFFER_SIZE;
+        conn->in = (unsigned char*)malloc(conn->in_capacity);
+        conn->frame = (unsigned char*)malloc((size_t)conn->frame_size * config->pipeline);
+        conn->request_start_us = (uint64_t*)malloc(sizeof(uint64_t) * config->pipeline);
+        client.active_connections++;
+        if (!conn->in || !conn->frame || !conn->request_start_us) {
+            fprintf(stderr, "libuv client setup failed: unable to allocate connection %u buffers\n", i);
+            goto done;
+        }
+        if (client_connect(conn) != 0) {
+            fprintf(stderr, "libuv client setup failed: connect start failed for connection %u\n", i);
+            goto done;
+        }
+    }
+
+    interval_ms = (uint64_t)config->report_interval * 1000ULL;
+    if (uv_timer_start(&client.report_timer, client_report, interval_ms, interval_ms) != 0
+        || uv_timer_start(&client.stop_timer, client_stop, ((uint64_t)config->duration + 1) * 1000ULL, 0) != 0
+        || uv_signal_start(&client.signal, client_signal, SIGINT) != 0) {
+        fprintf(stderr, "libuv client setup failed: unable to start control handles\n");
+        goto done;
+    }
+
+    client.previous_us = bench_time_us();
+    client.deadline_us = client.previous_us + ((uint64_t)config->duration * 1000000ULL);
+    printf("libuv tcp client connecting to %s:%u connections=%u duration=%us message_size=%u pipeline=%u%s\n",
+        config->host, (unsigned int)config->port, config->connections, config->duration, config->message_size,
+        config->pipeline, config->churn ? " churn" : "");
+    bench_stats_print_delta_header("client", 0);
+
+    uv_run(&client.loop, UV_RUN_DEFAULT);
+    bench_stats_print_total("client", &client.stats, (uint64_t)config->duration * 1000ULL, 0);
+    if (config->churn)
+        bench_stats_print_connections(&client.stats, "connect", (uint64_t)config->duration * 1000ULL);
+    ret = bench_report_write(config, "client", &client.stats, NULL, (uint64_t)config->duration * 1000ULL) ? 1 : 0;
+
+done:
+    if (client.connections) {
+        for (i = 0; i < config->connections; i++)
+            client_conn_close(&client.connections[i]);
+    }
+    if (client.loop_ready) {
+        client_close_handle((uv_handle_t*)&client.signal);
+        client_close_handle((uv_handle_t*)&client.stop_timer);
+        client_close_handle((uv_handle_t*)&client.report_timer);
+        /* let the close callbacks run, they free the connection buffers */
+        uv_run(&client.loop, UV_RUN_DEFAULT);
+        uv_loop_close(&client.loop);
+    }
+    free(client.connections);
+    bench_stats_free(&client.stats);
+    return ret;
+}
+
+static void client_signal(uv_signal_t *handle, int signum)
+{
+    luv_client *client = (luv_client*)handle->data;
+    (void)signum;
+
+    client->stopping = 1;
+    client_stop(&client->stop_timer);
+}
+
+static void client_report(uv_timer_t *timer)
+{
+    luv_client *client = (luv_client*)timer->data;
+    uint64_t now = bench_time_us();
+    uint64_t elapsed_ms = (now - client->previous_us) / 1000ULL;
+
+    bench_stats_print_delta("client", &client->stats, &client->previous, elapsed_ms, 0);
+    bench_stats_snapshot(&client->previous, &client->stats);
+    client->previous_us = now;
+}
+
+static void client_stop(uv_timer_t *timer)
+{
+    luv_client *client = (luv_client*)timer->data;
+    unsigned int i;
+
+    client->stopping = 1;
+    for (i = 0; i < client->config->connections; i++)
+        client_conn_close(&client->connections[i]);
+}
+
+static int client_connect(luv_conn *conn)
+{
+    luv_client *client = conn->client;
+
+    if (uv_tcp_init(&client->loop, &conn->tcp) != 0)
+        return -1;
+    conn->tcp.data = conn;
+    conn->state = luv_handle_open;
+    conn->connect_start_us = bench_time_us();
+    return uv_tcp_connect(&conn->connect_req, &conn->tcp, (const struct sockaddr*)&client->addr.storage,
+        client_connected) == 0 ? 0 : -1;
+}
+
+/*
+ * Build count requests and send them together. What the socket does not take
+ * right away is copied for uv_write(); uv_try_write() fails with UV_EAGAIN
+ * while writes are queued, so requests stay in order.
+ */
+static int client_send(luv_conn *conn, unsigned int count)
+{
+    luv_client *client = conn->client;
+    unsigned int len = conn->frame_size * count;
+    unsigned int i, j;
+    uv_buf_t buf;
+    luv_write *write;
+    int sent;
+
+    for (i = 0; i < count; i++) {
+        unsigned char *frame = conn->frame + (size_t)conn->frame_size * i;
+        uint32_t sequence = conn->send_sequence++;
+
+        bench_frame_write_header(frame, client->config->message_size, sequence);
+        for (j = BENCH_FRAME_HEADER_SIZE; j < conn->frame_size; j++)
+            frame[j] = (unsigned char)(sequence + j);
+        if (client->config->churn)
+            bench_frame_write_stamp(frame, conn->connect_start_us);
+        conn->request_start_us[sequence % client->config->pipeline] = bench_time_us();
+    }
+
+    buf = uv_buf_init((char*)conn->frame, len);
+    sent = uv_try_write((uv_stream_t*)&conn->tcp, &buf, 1);
+    if (sent < 0 && sent != UV_EAGAIN)
+        return -1;
+    if (sent < 0)
+        sent = 0;
+    if ((unsigned int)sent == len)
+        return 0;
+
+    write = (luv_write*)malloc(offsetof(luv_write, data) + (len - (unsigned int)sent));
+    if (!write)
+        return -1;
+    memcpy(write->data, conn->frame + sent, len - (unsigned int)sent);
+    buf = uv_buf_init((char*)write->data, len - (unsigned int)sent);
+    if (uv_write(&write->req, (uv_stream_t*)&conn->tcp, &buf, 1, client_write) != 0) {
+        free(write);
+        return -1;
+    }
+    return 0;
+}
+
+static void client_connected(uv_connect_t *req, int status)
+{
+    luv_conn *conn = (luv_conn*)req->handle->data;
+    luv_client *client = conn->client;
+
+    if (status == UV_ECANCELED)
+        return;
+    if (status < 0) {
+        if (!client->stopping)
+            bench_stats_record_error(&client->stats);
+        client_conn_close(conn);
+        return;
+    }
+    if (client->config->churn)
+        bench_stats_record_connect_latency(&client->stats, bench_time_us() - conn->connect_start_us);
+
+    /* fill the pipeline; each reply then sends one more request */
+    if (uv_read_start((uv_stream_t*)&conn->tcp, client_alloc, client_read) != 0
+        || client_send(conn, client->config->pipeline) != 0) {
+        bench_stats_record_error(&client->stats);
+        client_conn_close(conn);
+    }
+}
+
+/* Reads append to the connection's buffer, behind any partial reply. */
+static void client_alloc(uv_handle_t *handle, size_t suggested_size, uv_buf_t *buf)
+{
+    luv_conn *conn = (luv_conn*)handle->data;
+    (void)suggested_size;
+
+    *buf = uv_buf_init((char*)conn->in + conn->in_len, conn->in_capacity - conn->in_len);
+}
+
+static void client_read(uv_stream_t *stream, ssize_t nread, const uv_buf_t *buf)
+{
+    luv_conn *conn = (luv_conn*)stream->data;
+    luv_client *client = conn->client;
+    unsigned int offset = 0;
+    (void)buf;
+
+    if (nread < 0) {
+        if (!client->stopping)
+            bench_stats_record_error(&client->stats);
+        client_conn_close(conn);
+        return;
+    }
+    conn->in_len += (unsigned int)nread;
+
+    while (conn->in_len - offset >= BENCH_FRAME_HEADER_SIZE) {
+        const unsigned char *data = conn->in + offset;
+        unsigned int payload_size = bench_frame_payload_size(data);
+        unsigned int frame_size;
+        uint32_t sequence;
+        uint64_t now;
+
+        if (payload_size != client->config->message_size) {
+            bench_stats_record_error(&client->stats);
+            client_conn_close(conn);
+            return;
+        }
+        frame_size = BENCH_FRAME_HEADER_SIZE + payload_size;
+        if (conn->in_len - offset < frame_size)
+            break;
+        sequence = bench_frame_sequence(data);
+        if (sequence != conn->sequence) {
+            bench_stats_record_error(&client->stats);
+            client_conn_close(conn);
+            return;
+        }
+        offset += frame_size;
+
+        now = bench_time_us();
+        bench_stats_record_request(&client->stats, frame_size);
+        if (client->config->churn) {
+            bench_stats_record_latency(&client->stats, now - conn->connect_start_us);
+            bench_stats_record_connection(&client->stats);
+        } else {
+            bench_stats_record_latency(&client->stats,
+                now - conn->request_start_us[sequence % client->config->pipeline]);
+        }
+        conn->sequence++;
+
+        if (client->stopping || now >= client->deadline_us) {
+            client->stopping = 1;
+            client_conn_close(conn);
+            return;
+        }
+        if (client->config->churn) {
+            /* close, and dial the next connection in this slot once the close completes */
+            conn->state = luv_handle_closing;
+            uv_close((uv_handle_t*)&conn->tcp, client_conn_closed);
+            return;
+        }
+        if (client_send(conn, 1) != 0) {
+            bench_stats_record_error(&client->stats);
+            client_conn_close(conn);
+            return;
+        }
+    }
+
+    memmove(conn->in, conn->in + offset, conn->in_len - offset);
+    conn->in_len -= offset;
+}
+
+static void client_write(uv_write_t *req, int status)
+{
+    luv_conn *conn = (luv_conn*)req->handle->data;
+
+    free(req);
+    /* cancelled writes complete before the close callback, so conn is still here */
+    if (status < 0 && status != UV_ECANCELED) {
+        if (!conn->client->stopping)
+            bench_stats_record_error(&conn->client->stats);
+        client_conn_close(conn);
+    }
+}
+
+static void client_close_handle(uv_handle_t *handle)
+{
+    if (handle->type != UV_UNKNOWN_HANDLE && !uv_is_closing(handle))
+        uv_close(handle, NULL);
+}
+
+/* Retire the slot; its buffers go once the handle, if any, has closed. */
+static void client_conn_close(luv_conn *conn)
+{
+    if (conn->closed)
+        return;
+    conn->closed = 1;
+    if (conn->state == luv_handle_open) {
+        conn->state = luv_handle_closing;
+        uv_close((uv_handle_t*)&conn->tcp, client_conn_closed);
+    } else if (conn->state == luv_handle_none) {
+        client_conn_free(conn);
+    }
+    if (conn->client && conn->client->active_connections > 0) {
+        conn->client->active_connections--;
+        if (!conn->client->active_connections)
+            uv_stop(&conn->client->loop);
+    }
+}
+
+static void client_conn_closed(uv_handle_t *handle)
+{
+    luv_conn *conn = (luv_conn*)handle->data;
+    luv_client *client = conn->client;
+
+    conn->state = luv_handle_none;
+    if (conn->closed) {
+        client_conn_free(conn);
+        return;
+    }
+
+    /* --churn: the slot lives on with a new connection */
+    conn->in_len = 0;
+    conn->send_sequence = 0;
+    conn->sequence = 0;
+    if (client_connect(conn) != 0) {
+        bench_stats_record_error(&client->stats);
+        client_conn_close(conn);
+    }
+}
+
+static void client_conn_free(luv_conn *conn)
+{
+    free(conn->in);
+    free(conn->frame);
+    free(conn->request_start_us);
+    conn->in = NULL;
+    conn->frame = NULL;
+    conn->request_start_us = NULL;
+}
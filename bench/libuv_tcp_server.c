@@ -0,0 +1,368 @@
+#include "tcp.h"
+#include "clock.h"
+#include "net.h"
+#include "protocol.h"
+#include "report.h"
+#include "stats.h"
+
+#include <uv.h>
+
+#include <signal.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct luv_server luv_server;
+typedef struct luv_conn luv_conn;
+
+struct luv_server {
+    const bench_config *config;
+    uv_loop_t loop;
+    int loop_ready;
+    uv_tcp_t listener;
+    uv_timer_t report_timer;
+    uv_signal_t signal;
+    luv_conn *head;
+    bench_stats stats;
+    bench_stats previous;
+    bench_timeval started;
+    uint64_t previous_us;
+};
+
+struct luv_conn {
+    uv_tcp_t tcp;                    /* tcp.data points back here */
+    luv_server *server;
+    luv_conn *next;
+    luv_conn *prev;
+    unsigned char *in;               /* bytes read, frames are parsed in place */
+    unsigned int in_capacity;
+    unsigned int in_len;
+    int closing;
+    uint64_t accepted_us;            /* --churn: accept latency is recorded from the first frame */
+    int accept_recorded;
+};
+
+/* Replies uv_try_write() could not send right away, copied for uv_write(). */
+typedef struct luv_write {
+    uv_write_t req;
+    unsigned char data[1];
+} luv_write;
+
+static void server_signal(uv_signal_t *handle, int signum);
+static void server_report(uv_timer_t *timer);
+static void server_accept(uv_stream_t *listener, int status);
+static void server_alloc(uv_handle_t *handle, size_t suggested_size, uv_buf_t *buf);
+static void server_read(uv_stream_t *stream, ssize_t nread, const uv_buf_t *buf);
+static void server_write(uv_write_t *req, int status);
+static int server_send(luv_conn *conn, const unsigned char *data, unsigned int len);
+static void server_close_connections(luv_server *server);
+static void server_close_handle(uv_handle_t *handle);
+static void server_conn_close(luv_conn *conn);
+static void server_conn_closed(uv_handle_t *handle);
+static void server_conn_unlink(luv_conn *conn);
+
+int bench_libuv_tcp_server_run(const bench_config *config)
+{
+    luv_server server;
+    bench_sockaddr addr;
+    uint64_t interval_ms;
+    int ret = 1;
+    int error;
+
+    memset(&server, 0, sizeof(server));
+    server.config = config;
+    bench_stats_init(&server.stats);
+    bench_stats_init(&server.previous);
+    if (config->churn && bench_stats_enable_connect_latency(&server.stats, config->latency_digits) != 0) {
+        fprintf(stderr, "libuv server setup failed: unable to allocate accept histogram\n");
+        return 1;
+    }
+
+    if (bench_resolve_addr(config, &addr) != 0) {
+        fprintf(stderr, "libuv server setup failed: invalid address %s:%u\n",
+            config->host, (unsigned int)config->port);
+        goto done;
+    }
+    if (uv_loop_init(&server.loop) != 0) {
+        fprintf(stderr, "libuv server setup failed: unable to create loop\n");
+        goto done;
+    }
+    server.loop_ready = 1;
+    if (uv_tcp_init(&server.loop, &server.listener) != 0
+        || uv_timer_init(&server.loop, &server.report_timer) != 0
+        || uv_signal_init(&server.loop, &server.signal) != 0) {
+        fprintf(stderr, "libuv server setup failed: unable to create handles\n");
+        goto done;
+    }
+    server.listener.data = &server;
+    server.report_timer.data = &server;
+    server.signal.data = &server;
+
+    error = uv_tcp_bind(&server.listener, (const struct sockaddr*)&addr.storage, 0);
+    if (!error)
+        error = uv_listen((uv_stream_t*)&server.listener, (int)config->backlog, server_accept);
+    if (error) {
+        fprintf(stderr, "libuv server setup failed: listen failed on %s:%u: %s\n",
+            config->host, (unsigned int)config->port, uv_strerror(error));
+        goto done;
+    }
+    if (config->zerocopy)
+        fprintf(stderr, "server warning: --zerocopy is not supported by the libuv server\n");
+    if (config->busy_poll)
+        fprintf(stderr, "server warning: --busy-poll is not supported by the libuv server\n");
+    if (config->threads > 1)
+        fprintf(stderr, "server warning: --threads is not supported by the libuv server, using one thread\n");
+    if (config->idle) {
+        fprintf(stderr, "libuv server setup failed: --idle is not supported by the libuv server\n");
+        goto done;
+    }
+
+    interval_ms = (uint64_t)config->report_interval * 1000ULL;
+    if (uv_timer_start(&server.report_timer, server_report, interval_ms, interval_ms) != 0
+        || uv_signal_start(&server.signal, server_signal, SIGINT) != 0) {
+        fprintf(stderr, "libuv server setup failed: unable to start control handles\n");
+        goto done;
+    }
+#ifndef _WIN32
+    signal(SIGPIPE, SIG_IGN);
+#endif
+
+    bench_now(&server.started);
+    server.previous_us = bench_time_us();
+    printf("libuv tcp server listening on %s:%u message_size=%u backlog=%u%s\n",
+        config->host, (unsigned int)config->port, config->message_size, config->backlog,
+        config->churn ? " churn" : "");
+    printf("press Ctrl+C to stop\n");
+    bench_stats_print_delta_header("server", 1);
+
+    uv_run(&server.loop, UV_RUN_DEFAULT);
+
+    {
+        bench_timeval ended;
+        uint64_t elapsed_ms;
+        bench_now(&ended);
+        elapsed_ms = bench_time_diff_ms(&server.started, &ended);
+        bench_stats_print_total("server", &server.stats, elapsed_ms, 1);
+        if (config->churn)
+            bench_stats_print_connections(&server.stats, "accept", elapsed_ms);
+        ret = bench_report_write(config, "server", &server.stats, NULL, elapsed_ms) ? 1 : 0;
+    }
+
+done:
+    if (server.loop_ready) {
+        server_close_connections(&server);
+        server_close_handle((uv_handle_t*)&server.signal);
+        server_close_handle((uv_handle_t*)&server.report_timer);
+        server_close_handle((uv_handle_t*)&server.listener);
+        /* let the close callbacks run before the loop goes away */
+        uv_run(&server.loop, UV_RUN_DEFAULT);
+        uv_loop_close(&server.loop);
+    }
+    bench_stats_free(&server.stats);
+    return ret;
+}
+
+static void server_signal(uv_signal_t *handle, int signum)
+{
+    luv_server *server = (luv_server*)handle->data;
+    (void)signum;
+    uv_stop(&server->loop);
+}
+
+static void server_report(uv_timer_t *timer)
+{
+    luv_server *server = (luv_server*)timer->data;
+    uint64_t now = bench_time_us();
+    uint64_t elapsed_ms = (now - server->previous_us) / 1000ULL;
+
+    bench_stats_print_delta("server", &server->stats, &server->previous, elapsed_ms, 1);
+    bench_stats_snapshot(&server->previous, &server->stats);
+    server->previous_us = now;
+}
+
+static void server_accept(uv_stream_t *listener, int status)
+{
+    luv_server *server = (luv_server*)listener->data;
+    luv_conn *conn;
+
+    if (status < 0) {
+        bench_stats_record_accept_error(&server->stats);
+        fprintf(stderr, "libuv server accept error: %s\n", uv_strerror(status));
+        return;
+    }
+
+    conn = (luv_conn*)calloc(1, sizeof(*conn));
+    if (conn) {
+        conn->in_capacity = BENCH_FRAME_HEADER_SIZE + server->config->message_size;
+        if (conn->in_capacity < BENCH_READ_BUFFER_SIZE)
+            conn->in_capacity = BENCH_READ_BUFFER_SIZE;
+        conn->in = (unsigned char*)malloc(conn->in_capacity);
+    }
+    if (!conn || !conn->in || uv_tcp_init(&server->loop, &conn->tcp) != 0) {
+        bench_stats_record_accept_error(&server->stats);
+        if (conn)
+            free(conn->in);
+        free(conn);
+        return;
+    }
+    conn->tcp.data = conn;
+    conn->server = server;
+    conn->accepted_us = bench_time_us();
+    conn->next = server->head;
+    if (server->head)
+        server->head->prev = conn;
+    server->head = conn;
+
+    if (uv_accept(listener, (uv_stream_t*)&conn->tcp) != 0) {
+        bench_stats_record_accept_error(&server->stats);
+        server_conn_close(conn);
+        return;
+    }
+    bench_stats_record_connection(&server->stats);
+    if (uv_read_start((uv_stream_t*)&conn->tcp, server_alloc, server_read) != 0) {
+        bench_stats_record_io_error(&server->stats);
+        server_conn_close(conn);
+    }
+}
+
+/* Reads append to the connection's buffer, behind any partial frame. */
+static void server_alloc(uv_handle_t *handle, size_t suggested_size, uv_buf_t *buf)
+{
+    luv_conn *conn = (luv_conn*)handle->data;
+    (void)suggested_size;
+
+    *buf = uv_buf_init((char*)conn->in + conn->in_len, conn->in_capacity - conn->in_len);
+}
+
+static void server_read(uv_stream_t *stream, ssize_t nread, const uv_buf_t *buf)
+{
+    luv_conn *conn = (luv_conn*)stream->data;
+    luv_server *server = conn->server;
+    unsigned int offset = 0;
+    (void)buf;
+
+    if (nread < 0) {
+        server_conn_close(conn);
+        return;
+    }
+    conn->in_len += (unsigned int)nread;
+
+    while (conn->in_len - offset >= BENCH_FRAME_HEADER_SIZE) {
+        const unsigned char *data = conn->in + offset;
+        unsigned int payload_size = bench_frame_payload_size(data);
+        unsigned int frame_size;
+
+        if (payload_size > server->config->message_size) {
+            bench_stats_record_io_error(&server->stats);
+            server_conn_close(conn);
+            return;
+        }
+        frame_size = BENCH_FRAME_HEADER_SIZE + payload_size;
+        if (conn->in_len - offset < frame_size)
+            break;
+        if (server->config->churn && !conn->accept_recorded
+            && frame_size >= BENCH_FRAME_HEADER_SIZE + BENCH_FRAME_STAMP_SIZE) {
+            /* same clock on both ends: the client stamped its connect start */
+            uint64_t started_us = bench_frame_stamp(data);
+
+            conn->accept_recorded = 1;
+            if (conn->accepted_us >= started_us)
+                bench_stats_record_connect_latency(&server->stats, conn->accepted_us - started_us);
+        }
+        bench_stats_record_request(&server->stats, frame_size);
+        offset += frame_size;
+    }
+
+    /* the replies are the complete frames themselves, echoed in one send */
+    if (offset && server_send(conn, conn->in, offset) != 0) {
+        bench_stats_record_io_error(&server->stats);
+        server_conn_close(conn);
+        return;
+    }
+    memmove(conn->in, conn->in + offset, conn->in_len - offset);
+    conn->in_len -= offset;
+}
+
+/*
+ * Send what the socket takes now and queue a copy of the rest. uv_try_write()
+ * fails with UV_EAGAIN while writes are queued, so replies stay in order.
+ */
+static int server_send(luv_conn *conn, const unsigned char *data, unsigned int len)
+{
+    uv_buf_t buf = uv_buf_init((char*)data, len);
+    luv_write *write;
+    int sent;
+
+    sent = uv_try_write((uv_stream_t*)&conn->tcp, &buf, 1);
+    if (sent < 0 && sent != UV_EAGAIN)
+        return -1;
+    if (sent < 0)
+        sent = 0;
+    if ((unsigned int)sent == len)
+        return 0;
+
+    write = (luv_write*)malloc(offsetof(luv_write, data) + (len - (unsigned int)sent));
+    if (!write)
+        return -1;
+    memcpy(write->data, data + sent, len - (unsigned int)sent);
+    buf = uv_buf_init((char*)write->data, len - (unsigned int)sent);
+    if (uv_write(&write->req, (uv_stream_t*)&conn->tcp, &buf, 1, server_write) != 0) {
+        free(write);
+        return -1;
+    }
+    return 0;
+}
+
+static void server_write(uv_write_t *req, int status)
+{
+    luv_conn *conn = (luv_conn*)req->handle->data;
+
+    free(req);
+    /* cancelled writes complete before the close callback, so conn is still here */
+    if (status < 0)
+        server_conn_close(conn);
+}
+
+static void server_close_connections(luv_server *server)
+{
+    while (server->head)
+        server_conn_close(server->head);
+}
+
+static void server_close_handle(uv_handle_t *handle)
+{
+    if (handle->type != UV_UNKNOWN_HANDLE && !uv_is_closing(handle))
+        uv_close(handle, NULL);
+}
+
+static void server_conn_unlink(luv_conn *conn)
+{
+    luv_server *server = conn->server;
+
+    if (conn->prev)
+        conn->prev->next = conn->next;
+    else
+        server->head = conn->next;
+    if (conn->next)
+        conn->next->prev = conn->prev;
+    conn->prev = NULL;
+    conn->next = NULL;
+}
+
+static void server_conn_close(luv_conn *conn)
+{
+    if (conn->closing)
+        return;
+    conn->closing = 1;
+    server_conn_unlink(conn);
+    uv_close((uv_handle_t*)&conn->tcp, server_conn_closed);
+}
+
+static void server_conn_closed(uv_handle_t *handle)
+{
+    luv_conn *conn = (luv_conn*)handle->data;
+
+    free(conn->in);
+    free(conn);
+}
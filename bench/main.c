@@ -1,8 +1,15 @@
+#include "protocol.h"
+#include "stats.h"
 #include "tcp.h"
+#include "udp.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#ifndef BENCH_LIBRARY
+# define BENCH_LIBRARY "nanoev"
+#endif
+
 #ifndef BENCH_TCP_SERVER_RUN
 # define BENCH_TCP_SERVER_RUN bench_nanoev_tcp_server_run
 #endif
@@ -11,23 +18,42 @@
 # define BENCH_TCP_CLIENT_RUN bench_nanoev_tcp_client_run
 #endif
 
+#ifndef BENCH_UDP_SERVER_RUN
+# define BENCH_UDP_SERVER_RUN bench_nanoev_udp_server_run
+#endif
+
+#ifndef BENCH_UDP_CLIENT_RUN
+# define BENCH_UDP_CLIENT_RUN bench_nanoev_udp_client_run
+#endif
+
 static void usage(const char *program)
 {
     printf("Usage:\n");
-    printf("  %s --protocol tcp --role server [options]\n", program);
-    printf("  %s --protocol tcp --role client [options]\n", program);
+    printf("  %s --protocol tcp|udp --role server [options]\n", program);
+    printf("  %s --protocol tcp|udp --role client [options]\n", program);
     printf("\nOptions:\n");
-    printf("  --protocol tcp          Benchmark protocol. UDP is reserved for later.\n");
+    printf("  --protocol tcp|udp      Benchmark protocol. Default: tcp.\n");
     printf("  --role server|client    Benchmark role.\n");
     printf("  --host HOST             Bind or connect host. Default: 127.0.0.1.\n");
     printf("  --port PORT             Bind or connect port. Default: 4000.\n");
     printf("  --ipv6                  Use ::1 and IPv6 address family.\n");
     printf("  --duration SECONDS      Client run duration. Default: 10.\n");
-    printf("  --connections COUNT     Client connection count. Default: 1.\n");
+    printf("  --connections COUNT     Client connection (UDP: socket) count. Default: 1.\n");
     printf("  --message-size BYTES    Frame payload bytes. Default: 64.\n");
-    printf("  --pipeline DEPTH        Parsed for future use. Currently must be 1.\n");
+    printf("  --pipeline DEPTH        Client requests in flight per connection or socket. Default: 1.\n");
     printf("  --backlog COUNT         Server listen backlog. Default: 1024.\n");
     printf("  --report-interval SEC   Periodic report interval. Default: 1.\n");
+    printf("  --zerocopy BYTES        Server replies of at least BYTES use MSG_ZEROCOPY.\n");
+    printf("  --busy-poll USEC        Spin up to USEC microseconds before blocking.\n");
+    printf("  --threads COUNT         TCP loops, one per thread. Default: 1.\n");
+    printf("  --rate REQUESTS         Open-loop TCP client: send REQUESTS per second in total.\n");
+    printf("  --churn                 TCP, both roles: one request per connection, then reconnect.\n");
+    printf("  --idle                  nanoev TCP, both roles: hold idle connections and report their memory.\n");
+    printf("  --source-ips COUNT      TCP client: bind connections to 127.0.0.1 through 127.0.0.COUNT.\n");
+    printf("  --latency-digits N      Latency histogram precision, 1-%u digits. Default: %u.\n",
+        BENCH_LATENCY_DIGITS_MAX, BENCH_LATENCY_DIGITS_DEFAULT);
+    printf("  --json PATH             Also write the summary to PATH as JSON.\n");
+    printf("  --csv PATH              Also append the summary to PATH as a CSV row.\n");
 }
 
 static int parse_uint(const char *value, unsigned int *out)
@@ -58,6 +84,7 @@ int main(int argc, char **argv)
     bench_config config;
     const char *protocol = "tcp";
     int role_set = 0;
+    int udp;
     int i;
     int ret;
 
@@ -71,6 +98,15 @@ int main(int argc, char **argv)
     config.pipeline = 1;
     config.backlog = 1024;
     config.report_interval = 1;
+    config.zerocopy = 0;
+    config.busy_poll = 0;
+    config.threads = 1;
+    config.rate = 0;
+    config.churn = 0;
+    config.idle = 0;
+    config.source_ips = 0;
+    config.latency_digits = BENCH_LATENCY_DIGITS_DEFAULT;
+    config.library = BENCH_LIBRARY;
 
     for (i = 1; i < argc; i++) {
         const char *value;
@@ -122,6 +158,37 @@ int main(int argc, char **argv)
         } else if (strcmp(argv[i], "--report-interval") == 0) {
             if (next_arg(argc, argv, &i, &value) || parse_uint(value, &config.report_interval))
                 goto invalid_arg;
+        } else if (strcmp(argv[i], "--zerocopy") == 0) {
+            if (next_arg(argc, argv, &i, &value) || parse_uint(value, &config.zerocopy))
+                goto invalid_arg;
+        } else if (strcmp(argv[i], "--busy-poll") == 0) {
+            if (next_arg(argc, argv, &i, &value) || parse_uint(value, &config.busy_poll)
+                || config.busy_poll >= 1000000)
+                goto invalid_arg;
+        } else if (strcmp(argv[i], "--threads") == 0) {
+            if (next_arg(argc, argv, &i, &value) || parse_uint(value, &config.threads))
+                goto invalid_arg;
+        } else if (strcmp(argv[i], "--rate") == 0) {
+            if (next_arg(argc, argv, &i, &value) || parse_uint(value, &config.rate) || !config.rate)
+                goto invalid_arg;
+        } else if (strcmp(argv[i], "--churn") == 0) {
+            config.churn = 1;
+        } else if (strcmp(argv[i], "--idle") == 0) {
+            config.idle = 1;
+        } else if (strcmp(argv[i], "--source-ips") == 0) {
+            if (next_arg(argc, argv, &i, &value) || parse_uint(value, &config.source_ips)
+                || !config.source_ips || config.source_ips > BENCH_SOURCE_IPS_MAX)
+                goto invalid_arg;
+        } else if (strcmp(argv[i], "--latency-digits") == 0) {
+            if (next_arg(argc, argv, &i, &value) || parse_uint(value, &config.latency_digits)
+                || !config.latency_digits || config.latency_digits > BENCH_LATENCY_DIGITS_MAX)
+                goto invalid_arg;
+        } else if (strcmp(argv[i], "--json") == 0) {
+            if (next_arg(argc, argv, &i, &config.json_path))
+                goto invalid_arg;
+        } else if (strcmp(argv[i], "--csv") == 0) {
+            if (next_arg(argc, argv, &i, &config.csv_path))
+                goto invalid_arg;
         } else {
             goto invalid_arg;
         }
@@ -132,19 +199,68 @@ int main(int argc, char **argv)
         usage(argv[0]);
         return 2;
     }
-    if (strcmp(protocol, "tcp") != 0) {
-        fprintf(stderr, "UDP benchmark is not implemented yet\n");
+    if (strcmp(protocol, "tcp") == 0) {
+        udp = 0;
+    } else if (strcmp(protocol, "udp") == 0) {
+#ifdef BENCH_TCP_ONLY
+        fprintf(stderr, "--protocol udp is not supported by the %s bench\n", BENCH_LIBRARY);
+        return 2;
+#else
+        udp = 1;
+#endif
+    } else {
+        fprintf(stderr, "unknown protocol '%s'\n", protocol);
+        return 2;
+    }
+    config.protocol = protocol;
+    if (!config.duration || !config.connections || !config.message_size || !config.report_interval
+        || !config.pipeline || !config.threads) {
+        fprintf(stderr, "duration, connections, message-size, pipeline, report-interval, and threads must be non-zero\n");
+        return 2;
+    }
+    if (udp && config.threads > 1) {
+        fprintf(stderr, "--threads is supported for TCP only\n");
+        return 2;
+    }
+    if (config.role == bench_role_client && config.connections < config.threads) {
+        fprintf(stderr, "connections must be at least threads\n");
+        return 2;
+    }
+    if (udp && config.rate) {
+        fprintf(stderr, "--rate is supported for TCP only\n");
+        return 2;
+    }
+    if (config.rate && config.rate < config.threads) {
+        fprintf(stderr, "rate must be at least threads\n");
         return 2;
     }
-    if (config.pipeline != 1) {
-        fprintf(stderr, "--pipeline currently must be 1\n");
+    if (config.churn && (udp || config.rate || config.pipeline > 1)) {
+        fprintf(stderr, "--churn is supported for TCP only, without --rate or --pipeline\n");
         return 2;
     }
-    if (!config.duration || !config.connections || !config.message_size || !config.report_interval) {
-        fprintf(stderr, "duration, connections, message-size, and report-interval must be non-zero\n");
+    if (config.churn && config.message_size < BENCH_FRAME_STAMP_SIZE) {
+        fprintf(stderr, "message-size must be at least %u with --churn\n", (unsigned int)BENCH_FRAME_STAMP_SIZE);
+        return 2;
+    }
+    if (config.idle && (udp || config.rate || config.churn || config.pipeline > 1)) {
+        fprintf(stderr, "--idle is supported for TCP only, without --rate, --churn or --pipeline\n");
+        return 2;
+    }
+    if (config.source_ips && (udp || config.family != bench_family_ipv4)) {
+        fprintf(stderr, "--source-ips is supported for IPv4 TCP only\n");
+        return 2;
+    }
+    if (udp && config.message_size > BENCH_UDP_MAX_DATAGRAM - BENCH_FRAME_HEADER_SIZE) {
+        fprintf(stderr, "message-size must be at most %u for UDP\n",
+            (unsigned int)(BENCH_UDP_MAX_DATAGRAM - BENCH_FRAME_HEADER_SIZE));
         return 2;
     }
 
+#ifndef BENCH_TCP_ONLY
+    if (udp)
+        ret = config.role == bench_role_server ? BENCH_UDP_SERVER_RUN(&config) : BENCH_UDP_CLIENT_RUN(&config);
+    else
+#endif
     if (config.role == bench_role_server)
         ret = BENCH_TCP_SERVER_RUN(&config);
     else
@@ -0,0 +1,743 @@
+#include "nanoev.h"
+#include "../source/nanoev_internal.h"
+#ifndef _WIN32
+# include "../source/nanoev_poller.h"
+# include <time.h>
+# include <unistd.h>
+#endif
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * nanoev_microbench: focused measurements of loop internals that the TCP echo
+ * benchmark only sees end to end. Each case runs --repeat times and the
+ * fastest run is reported, which filters out scheduler noise.
+ */
+
+#define MICROBENCH_RESULT_EXTRA 64
+#define PING_PONG_SAMPLES_MAX   1000000
+
+typedef struct microbench_options {
+    const char *filter;
+    unsigned int time_ms;            /* length of the time-bound cases */
+    unsigned int repeat;
+    unsigned int max_timers;
+} microbench_options;
+
+typedef struct microbench_result {
+    uint64_t ops;
+    uint64_t elapsed_ns;
+    char extra[MICROBENCH_RESULT_EXTRA];
+} microbench_result;
+
+typedef int (*microbench_fn)(const microbench_options *options, unsigned int arg, microbench_result *result);
+
+static int failures;
+
+static uint64_t now_ns(void)
+{
+#ifdef _WIN32
+    static LARGE_INTEGER frequency;
+    LARGE_INTEGER counter;
+
+    if (!frequency.QuadPart)
+        QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+    return (uint64_t)(counter.QuadPart / frequency.QuadPart) * 1000000000ULL
+        + (uint64_t)(counter.QuadPart % frequency.QuadPart) * 1000000000ULL / (uint64_t)frequency.QuadPart;
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+/* Deterministic spread of timer deadlines so heap keys are distinct. */
+static uint32_t next_random(uint32_t *state)
+{
+    *state = *state * 1664525u + 1013904223u;
+    return *state >> 8;
+}
+
+static void run_case(const microbench_options *options, const char *name, microbench_fn fn, unsigned int arg)
+{
+    microbench_result best;
+    microbench_result result;
+    unsigned int i;
+
+    if (options->filter && !strstr(name, options->filter))
+        return;
+
+    memset(&best, 0, sizeof(best));
+    for (i = 0; i < options->repeat; i++) {
+        memset(&result, 0, sizeof(result));
+        if (fn(options, arg, &result) != 0 || !result.ops) {
+            printf("%-28s failed\n", name);
+            failures++;
+            return;
+        }
+        if (!best.ops || result.elapsed_ns * best.ops < best.elapsed_ns * result.ops)
+            best = result;
+    }
+    printf("%-28s %12llu %12.1f %12.3f  %s\n", name, (unsigned long long)best.ops,
+        (double)best.elapsed_ns / (double)best.ops,
+        best.elapsed_ns ? (double)best.ops * 1000.0 / (double)best.elapsed_ns : 0.0,
+        best.extra);
+    fflush(stdout);
+}
+
+/*----------------------------------------------------------------------------*/
+
+typedef struct iteration_state {
+    uint64_t deadline_ns;
+    unsigned int ticks;
+} iteration_state;
+
+static void on_iteration_tick(nanoev_event *timer)
+{
+    iteration_state *state = (iteration_state*)nanoev_event_userdata(timer);
+
+    if ((++state->ticks & 1023) == 0 && now_ns() >= state->deadline_ns)
+        nanoev_loop_break(timer->loop);
+}
+
+/* An idle loop kept awake by a 1us repeating timer: one zero time-out poll per pass. */
+static int bench_loop_iteration(const microbench_options *options, unsigned int arg, microbench_result *result)
+{
+    nanoev_loop *loop = nanoev_loop_new(NULL);
+    nanoev_event *timer = NULL;
+    nanoev_loop_stats before, after;
+    nanoev_timeval tick = { 0, 1 };
+    iteration_state state;
+    uint64_t start;
+    int ret = -1;
+    (void)arg;
+
+    if (!loop)
+        return -1;
+    memset(&state, 0, sizeof(state));
+    timer = nanoev_event_new(nanoev_event_timer, loop, &state);
+    if (!timer || nanoev_timer_add(timer, tick, 1, on_iteration_tick) != NANOEV_SUCCESS)
+        goto done;
+
+    nanoev_loop_get_stats(loop, &before);
+    start = now_ns();
+    state.deadline_ns = start + (uint64_t)options->time_ms * 1000000ULL;
+    if (nanoev_loop_run(loop) != NANOEV_SUCCESS)
+        goto done;
+    result->elapsed_ns = now_ns() - start;
+    nanoev_loop_get_stats(loop, &after);
+    result->ops = after.iterations - before.iterations;
+    snprintf(result->extra, sizeof(result->extra), "timer fired on %.0f%% of passes",
+        result->ops ? (double)state.ticks * 100.0 / (double)result->ops : 0.0);
+    ret = 0;
+
+done:
+    if (timer)
+        nanoev_event_free(timer);
+    nanoev_loop_free(loop);
+    return ret;
+}
+
+/*----------------------------------------------------------------------------*/
+
+enum { timer_measure_add = 0, timer_measure_del, timer_measure_fire };
+
+typedef struct timer_state {
+    nanoev_event **timers;
+    unsigned int count;
+    unsigned int fired;
+    int measure;
+    uint64_t start_ns;
+    uint64_t end_ns;
+    int failed;
+} timer_state;
+
+static void on_timer_fire(nanoev_event *timer)
+{
+    timer_state *state = (timer_state*)nanoev_event_userdata(timer);
+
+    if (++state->fired == state->count) {
+        state->end_ns = now_ns();
+        nanoev_loop_break(timer->loop);
+    }
+}
+
+static int timers_add_all(timer_state *state, uint32_t max_delay_usec)
+{
+    uint32_t seed = 12345;
+    nanoev_timeval after;
+    unsigned int i;
+    uint32_t delay;
+
+    for (i = 0; i < state->count; i++) {
+        delay = next_random(&seed) % max_delay_usec;
+        after.tv_sec = (long)(delay / 1000000);
+        after.tv_usec = (long)(delay % 1000000);
+        if (nanoev_timer_add(state->timers[i], after, 0, on_timer_fire) != NANOEV_SUCCESS)
+            return -1;
+    }
+    return 0;
+}
+
+static int timers_del_all(timer_state *state)
+{
+    unsigned int i;
+
+    for (i = 0; i < state->count; i++) {
+        if (nanoev_timer_del(state->timers[i]) != NANOEV_SUCCESS)
+            return -1;
+    }
+    return 0;
+}
+
+/* Runs inside the loop, so nanoev_timer_add() uses the cached loop time. */
+static void on_timer_driver(nanoev_event *driver)
+{
+    timer_state *state = (timer_state*)nanoev_event_userdata(driver);
+    uint64_t wait_until;
+
+    switch (state->measure) {
+    case timer_measure_add:
+        /* deadlines 1s to 1000s out, so nothing fires */
+        state->start_ns = now_ns();
+        state->failed = timers_add_all(state, 1000000000u) != 0;
+        state->end_ns = now_ns();
+        state->failed |= timers_del_all(state) != 0;
+        nanoev_loop_break(driver->loop);
+        break;
+
+    case timer_measure_del:
+        state->failed = timers_add_all(state, 1000000000u) != 0;
+        state->start_ns = now_ns();
+        state->failed |= timers_del_all(state) != 0;
+        state->end_ns = now_ns();
+        nanoev_loop_break(driver->loop);
+        break;
+
+    case timer_measure_fire:
+        /* deadlines within the next 1ms; wait them out so the next pass fires all of them */
+        if (timers_add_all(state, 1000u) != 0) {
+            state->failed = 1;
+            nanoev_loop_break(driver->loop);
+            break;
+        }
+        wait_until = now_ns() + 1100000ULL;
+        while (now_ns() < wait_until)
+            ;
+        state->start_ns = now_ns();
+        break;
+    }
+}
+
+static int bench_timer(const microbench_options *options, unsigned int count, int measure,
+    microbench_result *result)
+{
+    nanoev_loop *loop = nanoev_loop_new(NULL);
+    nanoev_event *driver = NULL;
+    nanoev_timeval now_after = { 0, 0 };
+    timer_state state;
+    unsigned int i;
+    int ret = -1;
+    (void)options;
+
+    if (!loop)
+        return -1;
+    memset(&state, 0, sizeof(state));
+    state.count = count;
+    state.measure = measure;
+    state.timers = (nanoev_event**)calloc(count, sizeof(*state.timers));
+    if (!state.timers)
+        goto done;
+    for (i = 0; i < count; i++) {
+        state.timers[i] = nanoev_event_new(nanoev_event_timer, loop, &state);
+        if (!state.timers[i])
+            goto done;
+    }
+    driver = nanoev_event_new(nanoev_event_timer, loop, &state);
+    if (!driver || nanoev_timer_add(driver, now_after, 0, on_timer_driver) != NANOEV_SUCCESS)
+        goto done;
+    if (nanoev_loop_run(loop) != NANOEV_SUCCESS || state.failed)
+        goto done;
+
+    result->ops = count;
+    result->elapsed_ns = state.end_ns - state.start_ns;
+    ret = 0;
+
+done:
+    if (state.timers) {
+        for (i = 0; i < count && state.timers[i]; i++)
+            nanoev_event_free(state.timers[i]);
+        free(state.timers);
+    }
+    if (driver)
+        nanoev_event_free(driver);
+    nanoev_loop_free(loop);
+    return ret;
+}
+
+static int bench_timer_add(const microbench_options *options, unsigned int count, microbench_result *result)
+{
+    return bench_timer(options, count, timer_measure_add, result);
+}
+
+static int bench_timer_del(const microbench_options *options, unsigned int count, microbench_result *result)
+{
+    return bench_timer(options, count, timer_measure_del, result);
+}
+
+static int bench_timer_fire(const microbench_options *options, unsigned int count, microbench_result *result)
+{
+    return bench_timer(options, count, timer_measure_fire, result);
+}
+
+/*----------------------------------------------------------------------------*/
+
+typedef struct async_state {
+    nanoev_event *async;
+    volatile long done;
+    uint64_t deadline_ns;
+    uint64_t sends;
+    uint64_t elapsed_ns;
+    uint64_t callbacks;
+    int failed;
+} async_state;
+
+static void async_producer(void *arg)
+{
+    async_state *state = (async_state*)arg;
+    uint64_t start = now_ns();
+    uint64_t now = start;
+
+    while (now < state->deadline_ns) {
+        if (nanoev_async_send(state->async) != NANOEV_SUCCESS) {
+            state->failed = 1;
+            break;
+        }
+        if ((++state->sends & 255) == 0)
+            now = now_ns();
+    }
+    state->elapsed_ns = now_ns() - start;
+    atomic_add(&state->done, 1);
+    nanoev_async_send(state->async);
+}
+
+static void on_async_consume(nanoev_event *async)
+{
+    async_state *state = (async_state*)nanoev_event_userdata(async);
+
+    state->callbacks++;
+    if (atomic_add(&state->done, 0))
+        nanoev_loop_break(async->loop);
+}
+
+/* Another thread sends as fast as it can; sends that land before the loop wakes coalesce. */
+static int bench_async_send(const microbench_options *options, unsigned int arg, microbench_result *result)
+{
+    nanoev_loop *loop = nanoev_loop_new(NULL);
+    async_state state;
+    thread_handle producer;
+    int ret = -1;
+    (void)arg;
+
+    if (!loop)
+        return -1;
+    memset(&state, 0, sizeof(state));
+    state.async = nanoev_event_new(nanoev_event_async, loop, &state);
+    if (!state.async || nanoev_async_start(state.async, on_async_consume) != NANOEV_SUCCESS)
+        goto done;
+    state.deadline_ns = now_ns() + (uint64_t)options->time_ms * 1000000ULL;
+    if (thread_create(&producer, async_producer, &state) != NANOEV_SUCCESS)
+        goto done;
+    ret = nanoev_loop_run(loop) == NANOEV_SUCCESS ? 0 : -1;
+    thread_join(producer);
+    if (state.failed)
+        ret = -1;
+
+    result->ops = state.sends;
+    result->elapsed_ns = state.elapsed_ns;
+    snprintf(result->extra, sizeof(result->extra), "%llu callbacks, %.1f sends each",
+        (unsigned long long)state.callbacks,
+        state.callbacks ? (double)state.sends / (double)state.callbacks : 0.0);
+
+done:
+    if (state.async)
+        nanoev_event_free(state.async);
+    nanoev_loop_free(loop);
+    return ret;
+}
+
+typedef struct ping_pong_state {
+    nanoev_loop *loop_a;
+    nanoev_loop *loop_b;
+    nanoev_event *async_a;           /* runs on the main thread */
+    nanoev_event *async_b;           /* runs on the helper thread */
+    volatile long done;
+    uint64_t deadline_ns;
+    uint64_t sent_ns;
+    uint64_t *samples;
+    unsigned int sample_count;
+    int failed;
+} ping_pong_state;
+
+static void ping_pong_thread(void *arg)
+{
+    ping_pong_state *state = (ping_pong_state*)arg;
+
+    if (nanoev_loop_run(state->loop_b) != NANOEV_SUCCESS)
+        state->failed = 1;
+}
+
+static void on_pong(nanoev_event *async)
+{
+    ping_pong_state *state = (ping_pong_state*)nanoev_event_userdata(async);
+
+    if (atomic_add(&state->done, 0)) {
+        nanoev_loop_break(async->loop);
+        return;
+    }
+    nanoev_async_send(state->async_a);
+}
+
+static void on_ping(nanoev_event *async)
+{
+    ping_pong_state *state = (ping_pong_state*)nanoev_event_userdata(async);
+    uint64_t now = now_ns();
+
+    if (state->sent_ns)
+        state->samples[state->sample_count++] = now - state->sent_ns;
+    if (state->sample_count == PING_PONG_SAMPLES_MAX || now >= state->deadline_ns) {
+        atomic_add(&state->done, 1);
+        nanoev_async_send(state->async_b);
+        nanoev_loop_break(async->loop);
+        return;
+    }
+    state->sent_ns = now_ns();
+    if (nanoev_async_send(state->async_b) != NANOEV_SUCCESS) {
+        state->failed = 1;
+        atomic_add(&state->done, 1);
+        nanoev_loop_break(async->loop);
+    }
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t*)a;
+    uint64_t y = *(const uint64_t*)b;
+
+    return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+/* Round trips between two loops on two threads; each leg is one nanoev_async_send() wakeup. */
+static int bench_async_ping_pong(const microbench_options *options, unsigned int arg, microbench_result *result)
+{
+    ping_pong_state state;
+    thread_handle helper;
+    int helper_started = 0;
+    uint64_t total = 0;
+    unsigned int i;
+    int ret = -1;
+    (void)arg;
+
+    memset(&state, 0, sizeof(state));
+    state.samples = (uint64_t*)malloc(sizeof(uint64_t) * PING_PONG_SAMPLES_MAX);
+    state.loop_a = nanoev_loop_new(NULL);
+    state.loop_b = nanoev_loop_new(NULL);
+    if (!state.samples || !state.loop_a || !state.loop_b)
+        goto done;
+    state.async_a = nanoev_event_new(nanoev_event_async, state.loop_a, &state);
+    state.async_b = nanoev_event_new(nanoev_event_async, state.loop_b, &state);
+    if (!state.async_a || !state.async_b
+        || nanoev_async_start(state.async_a, on_ping) != NANOEV_SUCCESS
+        || nanoev_async_start(state.async_b, on_pong) != NANOEV_SUCCESS)
+        goto done;
+    if (thread_create(&helper, ping_pong_thread, &state) != NANOEV_SUCCESS)
+        goto done;
+    helper_started = 1;
+
+    state.deadline_ns = now_ns() + (uint64_t)options->time_ms * 1000000ULL;
+    nanoev_async_send(state.async_a);
+    if (nanoev_loop_run(state.loop_a) != NANOEV_SUCCESS)
+        state.failed = 1;
+    thread_join(helper);
+    helper_started = 0;
+    if (state.failed || !state.sample_count)
+        goto done;
+
+    for (i = 0; i < state.sample_count; i++)
+        total += state.samples[i];
+    qsort(state.samples, state.sample_count, sizeof(uint64_t), compare_u64);
+    result->ops = state.sample_count;
+    result->elapsed_ns = total;
+    snprintf(result->extra, sizeof(result->extra), "round trip p50=%lluns p99=%lluns",
+        (unsigned long long)state.samples[state.sample_count / 2],
+        (unsigned long long)state.samples[(uint64_t)state.sample_count * 99 / 100]);
+    ret = 0;
+
+done:
+    if (helper_started) {
+        atomic_add(&state.done, 1);
+        nanoev_async_send(state.async_b);
+        nanoev_loop_break(state.loop_b);
+        thread_join(helper);
+    }
+    if (state.async_a)
+        nanoev_event_free(state.async_a);
+    if (state.async_b)
+        nanoev_event_free(state.async_b);
+    if (state.loop_a)
+        nanoev_loop_free(state.loop_a);
+    if (state.loop_b)
+        nanoev_loop_free(state.loop_b);
+    free(state.samples);
+    return ret;
+}
+
+/*----------------------------------------------------------------------------*/
+
+#ifndef _WIN32
+
+typedef struct fake_io_state {
+    nanoev_proactor proactor;
+    io_context *contexts;
+    uint64_t deadline_ns;
+    uint64_t completions;
+    unsigned int in_flight;
+    int stopping;
+    int failed;
+} fake_io_state;
+
+static void on_fake_io(nanoev_proactor *proactor, io_context *ctx)
+{
+    fake_io_state *state = (fake_io_state*)proactor;
+
+    state->in_flight--;
+    if ((++state->completions & 4095) == 0 && now_ns() >= state->deadline_ns)
+        state->stopping = 1;
+    if (!state->stopping) {
+        if (submit_fake_io(proactor->loop, proactor, ctx) == 0) {
+            state->in_flight++;
+            return;
+        }
+        state->failed = 1;
+        state->stopping = 1;
+    }
+    if (!state->in_flight)
+        nanoev_loop_break(proactor->loop);
+}
+
+/* depth completions kept queued, each resubmitted from its callback; no syscalls involved. */
+static int bench_fake_io(const microbench_options *options, unsigned int depth, microbench_result *result)
+{
+    nanoev_loop *loop = nanoev_loop_new(NULL);
+    fake_io_state state;
+    uint64_t start;
+    unsigned int i;
+    int ret = -1;
+
+    if (!loop)
+        return -1;
+    memset(&state, 0, sizeof(state));
+    state.proactor.type = nanoev_event_async;
+    state.proactor.loop = loop;
+    state.proactor.cb = on_fake_io;
+    state.contexts = (io_context*)calloc(depth, sizeof(*state.contexts));
+    if (!state.contexts)
+        goto done;
+    for (i = 0; i < depth; i++) {
+        if (submit_fake_io(loop, &state.proactor, &state.contexts[i]) != 0)
+            goto done;
+        state.in_flight++;
+    }
+
+    start = now_ns();
+    state.deadline_ns = start + (uint64_t)options->time_ms * 1000000ULL;
+    if (nanoev_loop_run(loop) != NANOEV_SUCCESS || state.failed)
+        goto done;
+    result->elapsed_ns = now_ns() - start;
+    result->ops = state.completions;
+    ret = 0;
+
+done:
+    free(state.contexts);
+    nanoev_loop_free(loop);
+    return ret;
+}
+
+static int bench_poller_modify(const microbench_options *options, unsigned int arg, microbench_result *result)
+{
+    static const int cycle[] = { _EV_READ, _EV_READ | _EV_WRITE, _EV_WRITE, 0 };
+    poller_impl *impl = get_poller_impl();
+    nanoev_proactor proactor;
+    poller p;
+    SOCKET sock;
+    uint64_t start;
+    uint64_t deadline;
+    uint64_t ops = 0;
+    unsigned int i;
+    int ret = -1;
+    (void)arg;
+
+    p = impl->poller_create();
+    if (!p)
+        return -1;
+    sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sock == INVALID_SOCKET) {
+        impl->poller_destroy(p);
+        return -1;
+    }
+    memset(&proactor, 0, sizeof(proactor));
+
+    start = now_ns();
+    deadline = start + (uint64_t)options->time_ms * 1000000ULL;
+    do {
+        for (i = 0; i < 256; i++) {
+            if (impl->poller_modify(p, sock, &proactor, cycle[i % 4]) != 0)
+                goto done;
+        }
+        ops += 256;
+    } while (now_ns() < deadline);
+    result->elapsed_ns = now_ns() - start;
+    result->ops = ops;
+    snprintf(result->extra, sizeof(result->extra), "add, modify, modify, delete");
+    ret = 0;
+
+done:
+    close(sock);
+    impl->poller_destroy(p);
+    return ret;
+}
+
+#endif
+
+/*----------------------------------------------------------------------------*/
+
+static int bench_event_new_free(const microbench_options *options, unsigned int type, microbench_result *result)
+{
+    nanoev_loop *loop = nanoev_loop_new(NULL);
+    nanoev_event *events[256];
+    uint64_t start;
+    uint64_t deadline;
+    uint64_t ops = 0;
+    unsigned int i;
+    int ret = -1;
+
+    if (!loop)
+        return -1;
+    start = now_ns();
+    deadline = start + (uint64_t)options->time_ms * 1000000ULL;
+    do {
+        for (i = 0; i < 256; i++) {
+            events[i] = nanoev_event_new((nanoev_event_type)type, loop, NULL);
+            if (!events[i])
+                goto done;
+        }
+        for (i = 0; i < 256; i++)
+            nanoev_event_free(events[i]);
+        ops += 256;
+    } while (now_ns() < deadline);
+    result->elapsed_ns = now_ns() - start;
+    result->ops = ops;
+    ret = 0;
+
+done:
+    nanoev_loop_free(loop);
+    return ret;
+}
+
+/*----------------------------------------------------------------------------*/
+
+static void usage(const char *program)
+{
+    printf("Usage:\n");
+    printf("  %s [options]\n", program);
+    printf("\nOptions:\n");
+    printf("  --filter TEXT      Run only cases whose name contains TEXT.\n");
+    printf("  --time MS          Length of each time-bound run. Default: 500.\n");
+    printf("  --repeat COUNT     Runs per case; the fastest is reported. Default: 3.\n");
+    printf("  --max-timers COUNT Largest timer heap to measure. Default: 1000000.\n");
+}
+
+static int parse_uint(const char *value, unsigned int *out)
+{
+    char *end;
+    unsigned long parsed;
+
+    if (!value || !*value)
+        return -1;
+    parsed = strtoul(value, &end, 10);
+    if (*end != '\0' || !parsed || parsed > 0xffffffffUL)
+        return -1;
+    *out = (unsigned int)parsed;
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    static const unsigned int timer_counts[] = { 1000, 100000, 1000000 };
+    microbench_options options;
+    char name[64];
+    unsigned int i;
+    int ret;
+
+    options.filter = NULL;
+    options.time_ms = 500;
+    options.repeat = 3;
+    options.max_timers = 1000000;
+
+    for (i = 1; i < (unsigned int)argc; i++) {
+        const char *value = i + 1 < (unsigned int)argc ? argv[i + 1] : NULL;
+
+        if (strcmp(argv[i], "--help") == 0 || strcmp(argv[i], "-h") == 0) {
+            usage(argv[0]);
+            return 0;
+        } else if (strcmp(argv[i], "--filter") == 0 && value) {
+            options.filter = value;
+        } else if (strcmp(argv[i], "--time") == 0 && !parse_uint(value, &options.time_ms)) {
+        } else if (strcmp(argv[i], "--repeat") == 0 && !parse_uint(value, &options.repeat)) {
+        } else if (strcmp(argv[i], "--max-timers") == 0 && !parse_uint(value, &options.max_timers)) {
+        } else {
+            fprintf(stderr, "invalid argument near '%s'\n", argv[i]);
+            usage(argv[0]);
+            return 2;
+        }
+        i++;
+    }
+
+    ret = nanoev_init();
+    if (ret != NANOEV_SUCCESS) {
+        fprintf(stderr, "nanoev_init returned %d\n", ret);
+        return 1;
+    }
+
+    printf("%-28s %12s %12s %12s  %s\n", "case", "ops", "ns/op", "Mops/s", "notes");
+    run_case(&options, "loop_iteration", bench_loop_iteration, 0);
+    for (i = 0; i < sizeof(timer_counts) / sizeof(timer_counts[0]); i++) {
+        if (timer_counts[i] > options.max_timers)
+            break;
+        snprintf(name, sizeof(name), "timer_add/%u", timer_counts[i]);
+        run_case(&options, name, bench_timer_add, timer_counts[i]);
+        snprintf(name, sizeof(name), "timer_del/%u", timer_counts[i]);
+        run_case(&options, name, bench_timer_del, timer_counts[i]);
+        snprintf(name, sizeof(name), "timer_fire/%u", timer_counts[i]);
+        run_case(&options, name, bench_timer_fire, timer_counts[i]);
+    }
+    run_case(&options, "async_send", bench_async_send, 0);
+    run_case(&options, "async_ping_pong", bench_async_ping_pong, 0);
+#ifndef _WIN32
+    run_case(&options, "fake_io/depth1", bench_fake_io, 1);
+    run_case(&options, "fake_io/depth256", bench_fake_io, 256);
+#endif
+    run_case(&options, "event_new_free/timer", bench_event_new_free, nanoev_event_timer);
+    run_case(&options, "event_new_free/async", bench_event_new_free, nanoev_event_async);
+    run_case(&options, "event_new_free/tcp", bench_event_new_free, nanoev_event_tcp);
+#ifndef _WIN32
+    run_case(&options, "poller_modify", bench_poller_modify, 0);
+#endif
+
+    nanoev_term();
+    return failures ? 1 : 0;
+}
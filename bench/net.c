@@ -4,6 +4,7 @@
 #include <string.h>
 
 #ifndef _WIN32
+# include <errno.h>
 # include <netdb.h>
 #endif
 
@@ -33,3 +34,12 @@ int bench_resolve_addr(const bench_config *config, bench_sockaddr *addr)
     freeaddrinfo(result);
     return 0;
 }
+
+int bench_socket_would_block(int error)
+{
+#ifdef _WIN32
+    return error == WSAEWOULDBLOCK;
+#else
+    return error == EAGAIN || error == EWOULDBLOCK || error == EINTR;
+#endif
+}
@@ -17,5 +17,7 @@ typedef struct bench_sockaddr {
 } bench_sockaddr;
 
 int bench_resolve_addr(const bench_config *config, bench_sockaddr *addr);
+/* Nonzero when a nonblocking socket call failed only because it would block. */
+int bench_socket_would_block(int error);
 
 #endif
@@ -5,7 +5,7 @@
 
 #define BENCH_FRAME_HEADER_SIZE 8
 
-static void bench_write_u32(unsigned char *buf, uint32_t value)
+static inline void bench_write_u32(unsigned char *buf, uint32_t value)
 {
     buf[0] = (unsigned char)((value >> 24) & 0xff);
     buf[1] = (unsigned char)((value >> 16) & 0xff);
@@ -13,7 +13,7 @@ static void bench_write_u32(unsigned char *buf, uint32_t value)
     buf[3] = (unsigned char)(value & 0xff);
 }
 
-static uint32_t bench_read_u32(const unsigned char *buf)
+static inline uint32_t bench_read_u32(const unsigned char *buf)
 {
     return ((uint32_t)buf[0] << 24)
         | ((uint32_t)buf[1] << 16)
@@ -21,20 +21,38 @@ static uint32_t bench_read_u32(const unsigned char *buf)
         | (uint32_t)buf[3];
 }
 
-static void bench_frame_write_header(unsigned char *buf, uint32_t payload_size, uint32_t sequence)
+static inline void bench_frame_write_header(unsigned char *buf, uint32_t payload_size, uint32_t sequence)
 {
     bench_write_u32(buf, payload_size);
     bench_write_u32(buf + 4, sequence);
 }
 
-static uint32_t bench_frame_payload_size(const unsigned char *buf)
+static inline uint32_t bench_frame_payload_size(const unsigned char *buf)
 {
     return bench_read_u32(buf);
 }
 
-static uint32_t bench_frame_sequence(const unsigned char *buf)
+static inline uint32_t bench_frame_sequence(const unsigned char *buf)
 {
     return bench_read_u32(buf + 4);
 }
 
+/* Read buffer per connection in the libuv and libev variants, nanoev's frame reader default. */
+#define BENCH_READ_BUFFER_SIZE  (64 * 1024)
+
+/* --churn: the payload starts with the client's connect start time from bench_time_us(). */
+#define BENCH_FRAME_STAMP_SIZE 8
+
+static inline void bench_frame_write_stamp(unsigned char *buf, uint64_t us)
+{
+    bench_write_u32(buf + BENCH_FRAME_HEADER_SIZE, (uint32_t)(us >> 32));
+    bench_write_u32(buf + BENCH_FRAME_HEADER_SIZE + 4, (uint32_t)us);
+}
+
+static inline uint64_t bench_frame_stamp(const unsigned char *buf)
+{
+    return ((uint64_t)bench_read_u32(buf + BENCH_FRAME_HEADER_SIZE) << 32)
+        | bench_read_u32(buf + BENCH_FRAME_HEADER_SIZE + 4);
+}
+
 #endif
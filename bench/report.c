@@ -0,0 +1,293 @@
+#include "report.h"
+#include <stdio.h>
+#include <string.h>
+
+#ifdef _WIN32
+# define WIN32_LEAN_AND_MEAN
+# include <windows.h>
+#else
+# include <sys/resource.h>
+# include <unistd.h>
+#endif
+
+#define REPORT_FIELDS_MAX 64
+
+typedef enum report_field_type {
+    report_text = 0,
+    report_uint,
+    report_real
+} report_field_type;
+
+typedef struct report_field {
+    const char *name;
+    report_field_type type;
+    const char *text;
+    uint64_t uint;
+    double real;
+} report_field;
+
+typedef struct report {
+    report_field fields[REPORT_FIELDS_MAX];
+    unsigned int count;
+} report;
+
+static report_field *report_add(report *r, const char *name, report_field_type type)
+{
+    report_field *field = &r->fields[r->count++];
+
+    memset(field, 0, sizeof(*field));
+    field->name = name;
+    field->type = type;
+    return field;
+}
+
+static void report_text_field(report *r, const char *name, const char *value)
+{
+    report_add(r, name, report_text)->text = value;
+}
+
+static void report_uint_field(report *r, const char *name, uint64_t value)
+{
+    report_add(r, name, report_uint)->uint = value;
+}
+
+static void report_real_field(report *r, const char *name, double value)
+{
+    report_add(r, name, report_real)->real = value;
+}
+
+static void report_print_value(FILE *file, const report_field *field, int quote_text)
+{
+    switch (field->type) {
+    case report_text:
+        fprintf(file, quote_text ? "\"%s\"" : "%s", field->text);
+        break;
+    case report_uint:
+        fprintf(file, "%llu", (unsigned long long)field->uint);
+        break;
+    case report_real:
+        fprintf(file, "%.3f", field->real);
+        break;
+    }
+}
+
+static int report_write_json(const report *r, const char *path)
+{
+    FILE *file = fopen(path, "w");
+    unsigned int i;
+
+    if (!file)
+        return -1;
+    fprintf(file, "{\n");
+    for (i = 0; i < r->count; i++) {
+        fprintf(file, "  \"%s\": ", r->fields[i].name);
+        report_print_value(file, &r->fields[i], 1);
+        fprintf(file, i + 1 < r->count ? ",\n" : "\n");
+    }
+    fprintf(file, "}\n");
+    return fclose(file) == 0 ? 0 : -1;
+}
+
+/* One row per run; the header goes in only when the file is new or empty. */
+static int report_write_csv(const report *r, const char *path)
+{
+    FILE *file = fopen(path, "a");
+    unsigned int i;
+
+    if (!file)
+        return -1;
+    if (fseek(file, 0, SEEK_END) == 0 && ftell(file) == 0) {
+        for (i = 0; i < r->count; i++)
+            fprintf(file, i + 1 < r->count ? "%s," : "%s\n", r->fields[i].name);
+    }
+    for (i = 0; i < r->count; i++) {
+        report_print_value(file, &r->fields[i], 0);
+        fputc(i + 1 < r->count ? ',' : '\n', file);
+    }
+    return fclose(file) == 0 ? 0 : -1;
+}
+
+void bench_usage_get(bench_usage *usage)
+{
+#ifdef _WIN32
+    FILETIME creation, exit, kernel, user;
+    ULARGE_INTEGER value;
+
+    memset(usage, 0, sizeof(*usage));
+    if (!GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user))
+        return;
+    value.LowPart = user.dwLowDateTime;
+    value.HighPart = user.dwHighDateTime;
+    usage->user_sec = (double)value.QuadPart / 10000000.0;
+    value.LowPart = kernel.dwLowDateTime;
+    value.HighPart = kernel.dwHighDateTime;
+    usage->system_sec = (double)value.QuadPart / 10000000.0;
+#else
+    struct rusage ru;
+
+    memset(usage, 0, sizeof(*usage));
+    if (getrusage(RUSAGE_SELF, &ru) != 0)
+        return;
+    usage->user_sec = (double)ru.ru_utime.tv_sec + (double)ru.ru_utime.tv_usec / 1000000.0;
+    usage->system_sec = (double)ru.ru_stime.tv_sec + (double)ru.ru_stime.tv_usec / 1000000.0;
+    usage->voluntary_switches = (uint64_t)ru.ru_nvcsw;
+    usage->involuntary_switches = (uint64_t)ru.ru_nivcsw;
+#endif
+}
+
+#ifdef __linux__
+/* The first number after key on a line starting with prefix, or 0. */
+static uint64_t read_proc_value(const char *path, const char *prefix, const char *key)
+{
+    FILE *file = fopen(path, "r");
+    char line[512];
+    unsigned long long value = 0;
+
+    if (!file)
+        return 0;
+    while (fgets(line, sizeof(line), file)) {
+        const char *found;
+
+        if (strncmp(line, prefix, strlen(prefix)) != 0)
+            continue;
+        found = strstr(line + strlen(prefix), key);
+        if (found)
+            sscanf(found + strlen(key), "%llu", &value);
+        break;
+    }
+    fclose(file);
+    return (uint64_t)value;
+}
+#endif
+
+void bench_memory_get(bench_memory *memory)
+{
+    memset(memory, 0, sizeof(*memory));
+#if defined(__linux__)
+    {
+        FILE *file = fopen("/proc/self/statm", "r");
+        unsigned long long size, resident;
+        uint64_t page_size = (uint64_t)sysconf(_SC_PAGESIZE);
+
+        if (file) {
+            if (fscanf(file, "%llu %llu", &size, &resident) == 2)
+                memory->rss_bytes = (uint64_t)resident * page_size;
+            fclose(file);
+        }
+        memory->slab_bytes = read_proc_value("/proc/meminfo", "Slab:", " ") * 1024;
+        memory->tcp_sockets = read_proc_value("/proc/net/sockstat", "TCP:", "inuse ")
+            + read_proc_value("/proc/net/sockstat6", "TCP6:", "inuse ");
+        memory->tcp_buffer_bytes = read_proc_value("/proc/net/sockstat", "TCP:", "mem ") * page_size;
+    }
+#elif !defined(_WIN32)
+    {
+        struct rusage ru;
+
+        if (getrusage(RUSAGE_SELF, &ru) == 0)
+# ifdef __APPLE__
+            memory->rss_bytes = (uint64_t)ru.ru_maxrss;
+# else
+            memory->rss_bytes = (uint64_t)ru.ru_maxrss * 1024;
+# endif
+    }
+#endif
+}
+
+int bench_report_write(const bench_config *config, const char *role, const bench_stats *stats,
+    const bench_idle *idle, uint64_t elapsed_ms)
+{
+    double seconds = elapsed_ms ? (double)elapsed_ms / 1000.0 : 1.0;
+    const bench_histogram *latency = &stats->latency;
+    const bench_histogram *service = &stats->service_latency;
+    const bench_histogram *connect = &stats->connect_latency;
+    bench_usage usage;
+    double cpu_us_per_request;
+    double cpu_us_per_connection;
+    report r;
+    int ret = 0;
+
+    bench_usage_get(&usage);
+    cpu_us_per_request = stats->requests
+        ? (usage.user_sec + usage.system_sec) * 1000000.0 / (double)stats->requests : 0.0;
+    cpu_us_per_connection = stats->connections
+        ? (usage.user_sec + usage.system_sec) * 1000000.0 / (double)stats->connections : 0.0;
+    printf("  cpu      : user=%.2fs system=%.2fs (%.2fus/request", usage.user_sec, usage.system_sec,
+        cpu_us_per_request);
+    if (config->churn)
+        printf(", %.2fus/connection", cpu_us_per_connection);
+    printf(") switches=%llu voluntary, %llu involuntary\n",
+        (unsigned long long)usage.voluntary_switches, (unsigned long long)usage.involuntary_switches);
+
+    if (!config->json_path && !config->csv_path)
+        return 0;
+
+    r.count = 0;
+    report_text_field(&r, "library", config->library);
+    report_text_field(&r, "protocol", config->protocol);
+    report_text_field(&r, "role", role);
+    report_uint_field(&r, "threads", config->threads);
+    report_uint_field(&r, "connections", config->connections);
+    report_uint_field(&r, "message_size", config->message_size);
+    report_uint_field(&r, "pipeline", config->pipeline);
+    report_uint_field(&r, "rate", config->rate);
+    report_uint_field(&r, "churn", (uint64_t)config->churn);
+    report_uint_field(&r, "idle", (uint64_t)config->idle);
+    report_uint_field(&r, "elapsed_ms", elapsed_ms);
+    report_uint_field(&r, "requests", stats->requests);
+    report_real_field(&r, "requests_per_sec", (double)stats->requests / seconds);
+    report_uint_field(&r, "bytes", stats->bytes);
+    report_real_field(&r, "mib_per_sec", (double)stats->bytes / (1024.0 * 1024.0) / seconds);
+    report_uint_field(&r, "errors", stats->errors);
+    report_uint_field(&r, "accept_errors", stats->accept_errors);
+    report_uint_field(&r, "io_errors", stats->io_errors);
+    report_uint_field(&r, "latency_min_us", latency->count ? latency->min : 0);
+    report_uint_field(&r, "latency_avg_us", latency->count ? latency->sum / latency->count : 0);
+    report_uint_field(&r, "latency_p50_us", bench_histogram_value_at(latency, 50.0));
+    report_uint_field(&r, "latency_p90_us", bench_histogram_value_at(latency, 90.0));
+    report_uint_field(&r, "latency_p99_us", bench_histogram_value_at(latency, 99.0));
+    report_uint_field(&r, "latency_p999_us", bench_histogram_value_at(latency, 99.9));
+    report_uint_field(&r, "latency_p9999_us", bench_histogram_value_at(latency, 99.99));
+    report_uint_field(&r, "latency_max_us", latency->max);
+    report_uint_field(&r, "service_p50_us", bench_histogram_value_at(service, 50.0));
+    report_uint_field(&r, "service_p99_us", bench_histogram_value_at(service, 99.0));
+    report_uint_field(&r, "service_p999_us", bench_histogram_value_at(service, 99.9));
+    report_uint_field(&r, "requests_scheduled", stats->requests_scheduled);
+    report_uint_field(&r, "connections_completed", stats->connections);
+    report_real_field(&r, "connections_per_sec", (double)stats->connections / seconds);
+    report_uint_field(&r, "connect_p50_us", bench_histogram_value_at(connect, 50.0));
+    report_uint_field(&r, "connect_p99_us", bench_histogram_value_at(connect, 99.0));
+    report_uint_field(&r, "connect_p999_us", bench_histogram_value_at(connect, 99.9));
+    report_uint_field(&r, "datagrams_sent", stats->datagrams_sent);
+    report_uint_field(&r, "datagrams_lost", stats->datagrams_lost);
+    report_uint_field(&r, "datagrams_reordered", stats->datagrams_reordered);
+    report_uint_field(&r, "datagrams_late", stats->datagrams_late);
+    report_uint_field(&r, "idle_connections", idle ? idle->connections : 0);
+    report_uint_field(&r, "idle_timers", idle ? idle->timers : 0);
+    report_uint_field(&r, "rss_bytes", idle ? idle->rss_bytes : 0);
+    report_real_field(&r, "rss_per_connection", idle && idle->connections
+        ? ((double)idle->rss_bytes - (double)idle->rss_baseline_bytes) / (double)idle->connections : 0.0);
+    report_real_field(&r, "kernel_per_connection", idle && idle->connections
+        ? (double)idle->slab_delta_bytes / (double)idle->connections : 0.0);
+    report_uint_field(&r, "tcp_sockets", idle ? idle->tcp_sockets : 0);
+    report_uint_field(&r, "tcp_buffer_bytes", idle ? idle->tcp_buffer_bytes : 0);
+    report_real_field(&r, "idle_iterations_per_sec", idle && idle->seconds > 0.0
+        ? (double)idle->iterations / idle->seconds : 0.0);
+    report_real_field(&r, "idle_us_per_iteration", idle && idle->iterations
+        ? (double)idle->callback_usec / (double)idle->iterations : 0.0);
+    report_real_field(&r, "cpu_user_sec", usage.user_sec);
+    report_real_field(&r, "cpu_system_sec", usage.system_sec);
+    report_real_field(&r, "cpu_us_per_request", cpu_us_per_request);
+    report_real_field(&r, "cpu_us_per_connection", cpu_us_per_connection);
+    report_uint_field(&r, "voluntary_switches", usage.voluntary_switches);
+    report_uint_field(&r, "involuntary_switches", usage.involuntary_switches);
+
+    if (config->json_path && report_write_json(&r, config->json_path) != 0) {
+        fprintf(stderr, "%s failed: unable to write %s\n", role, config->json_path);
+        ret = -1;
+    }
+    if (config->csv_path && report_write_csv(&r, config->csv_path) != 0) {
+        fprintf(stderr, "%s failed: unable to write %s\n", role, config->csv_path);
+        ret = -1;
+    }
+    return ret;
+}
@@ -0,0 +1,41 @@
+#ifndef NANOEV_BENCH_REPORT_H
+#define NANOEV_BENCH_REPORT_H
+
+#include "tcp.h"
+#include "stats.h"
+#include <stdint.h>
+
+/* Process-wide CPU time and context switches so far. */
+typedef struct bench_usage {
+    double user_sec;
+    double system_sec;
+    uint64_t voluntary_switches;     /* 0 where the platform does not count them */
+    uint64_t involuntary_switches;
+} bench_usage;
+
+void bench_usage_get(bench_usage *usage);
+
+/*
+ * Process and kernel memory now. Linux reports every field; elsewhere only
+ * rss_bytes is filled in, with the peak rather than the current size on
+ * macOS, and Windows reports nothing.
+ */
+typedef struct bench_memory {
+    uint64_t rss_bytes;
+    uint64_t slab_bytes;             /* kernel slab, system wide */
+    uint64_t tcp_sockets;            /* TCP and TCP6 sockets in use, system wide */
+    uint64_t tcp_buffer_bytes;       /* TCP buffer memory, system wide */
+} bench_memory;
+
+void bench_memory_get(bench_memory *memory);
+
+/*
+ * Finish a run's summary: print the cpu line under bench_stats_print_total()
+ * and, when --json or --csv was given, write the same summary there with the
+ * run's configuration. idle carries the --idle figures and may be NULL.
+ * Returns nonzero if an output file could not be written.
+ */
+int bench_report_write(const bench_config *config, const char *role, const bench_stats *stats,
+    const bench_idle *idle, uint64_t elapsed_ms);
+
+#endif
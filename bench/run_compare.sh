@@ -11,20 +11,54 @@ RUNS=${RUNS:-3}
 SLEEP_AFTER_RUN=${SLEEP_AFTER_RUN:-5}
 REPORT_INTERVAL=${REPORT_INTERVAL:-$DURATION}
 SCENARIOS=${SCENARIOS:-"10:64 100:64 500:64 100:1024"}
+PIPELINE=${PIPELINE:-1}
+CHURN=${CHURN:-0}
 
 NANOEV_BIN=$BUILD_DIR/nanoev_bench
 LIBEVENT_BIN=$BUILD_DIR/libevent_bench
+LIBUV_BIN=$BUILD_DIR/libuv_bench
+LIBEV_BIN=$BUILD_DIR/libev_bench
 
-if [ ! -x "$NANOEV_BIN" ]; then
-    echo "missing executable: $NANOEV_BIN" >&2
-    echo "build with: cmake -S . -B build-release -DCMAKE_BUILD_TYPE=Release -DNANOEV_BUILD_BENCHMARKS=ON && cmake --build build-release" >&2
-    exit 1
+# libuv_bench and libev_bench join the default run when they were built.
+if [ -z "${BACKENDS:-}" ]; then
+    BACKENDS="nanoev libevent"
+    [ -x "$LIBUV_BIN" ] && BACKENDS="$BACKENDS libuv"
+    [ -x "$LIBEV_BIN" ] && BACKENDS="$BACKENDS libev"
 fi
 
-if [ ! -x "$LIBEVENT_BIN" ]; then
-    echo "missing executable: $LIBEVENT_BIN" >&2
-    echo "libevent_bench is built only when libevent is found during CMake configure" >&2
-    exit 1
+backend_bin() {
+    case $1 in
+        nanoev) echo "$NANOEV_BIN" ;;
+        libevent) echo "$LIBEVENT_BIN" ;;
+        libuv) echo "$LIBUV_BIN" ;;
+        libev) echo "$LIBEV_BIN" ;;
+        *) return 1 ;;
+    esac
+}
+
+for backend in $BACKENDS; do
+    if ! bin=$(backend_bin "$backend"); then
+        echo "unknown backend: $backend" >&2
+        exit 1
+    fi
+    if [ ! -x "$bin" ]; then
+        echo "missing executable: $bin" >&2
+        if [ "$backend" = nanoev ]; then
+            echo "build with: cmake -S . -B build-release -DCMAKE_BUILD_TYPE=Release -DNANOEV_BUILD_BENCHMARKS=ON && cmake --build build-release" >&2
+        else
+            echo "${backend}_bench is built only when $backend is found during CMake configure" >&2
+        fi
+        exit 1
+    fi
+done
+
+CHURN_ARG=
+if [ "$CHURN" = 1 ]; then
+    if [ "$PIPELINE" != 1 ]; then
+        echo "CHURN=1 needs PIPELINE=1" >&2
+        exit 1
+    fi
+    CHURN_ARG=--churn
 fi
 
 mkdir -p "$RESULT_DIR"
@@ -52,7 +86,7 @@ run_one() {
 
     {
         echo
-        echo "=== backend=$backend connections=$connections message_size=$message_size run=$run port=$port ==="
+        echo "=== backend=$backend connections=$connections message_size=$message_size pipeline=$PIPELINE churn=$CHURN run=$run port=$port ==="
         date "+started_at=%Y-%m-%d %H:%M:%S"
     } >> "$LOG_FILE"
 
@@ -60,7 +94,7 @@ run_one() {
         --host "$HOST" \
         --port "$port" \
         --message-size "$message_size" \
-        --report-interval "$REPORT_INTERVAL" >> "$LOG_FILE" 2>&1 &
+        --report-interval "$REPORT_INTERVAL" $CHURN_ARG >> "$LOG_FILE" 2>&1 &
     cleanup_pid=$!
 
     sleep 2
@@ -70,8 +104,10 @@ run_one() {
         --port "$port" \
         --connections "$connections" \
         --message-size "$message_size" \
+        --pipeline "$PIPELINE" \
         --duration "$DURATION" \
-        --report-interval "$REPORT_INTERVAL" >> "$LOG_FILE" 2>&1
+        --report-interval "$REPORT_INTERVAL" $CHURN_ARG \
+        --csv "$RESULT_DIR/compare-$STAMP-$backend-${connections}x$message_size.csv" >> "$LOG_FILE" 2>&1
 
     kill -INT "$cleanup_pid" 2>/dev/null || true
     wait "$cleanup_pid" 2>/dev/null || true
@@ -95,15 +131,14 @@ port=$BASE_PORT
     echo "runs=$RUNS"
     echo "sleep_after_run=$SLEEP_AFTER_RUN"
     echo "scenarios=$SCENARIOS"
+    echo "pipeline=$PIPELINE"
+    echo "churn=$CHURN"
+    echo "backends=$BACKENDS"
     echo
 } | tee "$LOG_FILE"
 
-for backend in nanoev libevent; do
-    if [ "$backend" = nanoev ]; then
-        bin=$NANOEV_BIN
-    else
-        bin=$LIBEVENT_BIN
-    fi
+for backend in $BACKENDS; do
+    bin=$(backend_bin "$backend")
 
     for scenario in $SCENARIOS; do
         connections=${scenario%:*}
@@ -120,7 +155,7 @@ done
 
 awk '
 BEGIN {
-    print "backend\tconnections\tmessage_size\trun\trequests\treq_per_sec\tmib_per_sec\tclient_errors\tavg_us\tp50_us\tp95_us\tp99_us\tserver_errors\taccept_errors\tio_errors"
+    print "backend\tconnections\tmessage_size\trun\trequests\treq_per_sec\tmib_per_sec\tclient_errors\tavg_us\tp50_us\tp90_us\tp99_us\tp999_us\tp9999_us\tserver_errors\taccept_errors\tio_errors"
 }
 /^=== backend=/ {
     backend = connections = message_size = run = ""
@@ -149,12 +184,14 @@ in_client && /errors   :/ {
     gsub(",", "", client_errors)
 }
 in_client && /latency  :/ {
-    avg_us = p50_us = p95_us = p99_us = ""
+    avg_us = p50_us = p90_us = p99_us = p999_us = p9999_us = ""
     for (i = 1; i <= NF; i++) {
         if ($i ~ /^avg=/) { avg_us = $i; sub("avg=", "", avg_us); sub("us", "", avg_us) }
         if ($i ~ /^p50=/) { p50_us = $i; sub("p50=", "", p50_us); sub("us", "", p50_us) }
-        if ($i ~ /^p95=/) { p95_us = $i; sub("p95=", "", p95_us); sub("us", "", p95_us) }
+        if ($i ~ /^p90=/) { p90_us = $i; sub("p90=", "", p90_us); sub("us", "", p90_us) }
         if ($i ~ /^p99=/) { p99_us = $i; sub("p99=", "", p99_us); sub("us", "", p99_us) }
+        if ($i ~ /^p99\.9=/) { p999_us = $i; sub("p99\\.9=", "", p999_us); sub("us", "", p999_us) }
+        if ($i ~ /^p99\.99=/) { p9999_us = $i; sub("p99\\.99=", "", p9999_us); sub("us", "", p9999_us) }
     }
 }
 in_server && /errors   :/ {
@@ -166,7 +203,7 @@ in_server && /errors   :/ {
     gsub(",", "", accept_errors)
     gsub("io=", "", io_errors)
     gsub("[)]", "", io_errors)
-    print backend "\t" connections "\t" message_size "\t" run "\t" requests "\t" req_per_sec "\t" mib_per_sec "\t" client_errors "\t" avg_us "\t" p50_us "\t" p95_us "\t" p99_us "\t" server_errors "\t" accept_errors "\t" io_errors
+    print backend "\t" connections "\t" message_size "\t" run "\t" requests "\t" req_per_sec "\t" mib_per_sec "\t" client_errors "\t" avg_us "\t" p50_us "\t" p90_us "\t" p99_us "\t" p999_us "\t" p9999_us "\t" server_errors "\t" accept_errors "\t" io_errors
     in_server = 0
 }
 ' "$LOG_FILE" > "$SUMMARY_FILE"
@@ -193,7 +230,7 @@ function rate_to_num(rate, value, suffix) {
 BEGIN {
     FS = "\t"
     OFS = "\t"
-    print "backend", "connections", "message_size", "source_run", "req_per_sec", "mib_per_sec", "client_errors", "avg_us", "p50_us", "p95_us", "p99_us", "server_errors", "accept_errors", "io_errors"
+    print "backend", "connections", "message_size", "source_run", "req_per_sec", "mib_per_sec", "client_errors", "avg_us", "p50_us", "p90_us", "p99_us", "p999_us", "p9999_us", "server_errors", "accept_errors", "io_errors"
 }
 NR == 1 { next }
 {
@@ -219,7 +256,7 @@ END {
         }
         median = order[int((c + 1) / 2)]
         split(line[key, median], fields, "\t")
-        print fields[1], fields[2], fields[3], fields[4], fields[6], fields[7], fields[8], fields[9], fields[10], fields[11], fields[12], fields[13], fields[14], fields[15]
+        print fields[1], fields[2], fields[3], fields[4], fields[6], fields[7], fields[8], fields[9], fields[10], fields[11], fields[12], fields[13], fields[14], fields[15], fields[16], fields[17]
     }
 }
 ' "$SUMMARY_FILE" > "$MEDIAN_FILE"
@@ -229,3 +266,4 @@ echo "done"
 echo "raw log: $LOG_FILE"
 echo "summary: $SUMMARY_FILE"
 echo "median: $MEDIAN_FILE"
+echo "client csv: $RESULT_DIR/compare-$STAMP-<backend>-<connections>x<message_size>.csv"
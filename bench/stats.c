@@ -1,45 +1,54 @@
 #include "stats.h"
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <time.h>
 
 #define FORMAT_BUFFER_SIZE 32
 
-static unsigned int latency_bucket(uint64_t latency_us)
+/* Number of bits needed to hold value; 0 for 0. */
+static unsigned int bit_length(uint64_t value)
 {
-    unsigned int bucket = 0;
-    uint64_t upper = 1;
+#if defined(__GNUC__) || defined(__clang__)
+    return value ? 64u - (unsigned int)__builtin_clzll(value) : 0;
+#else
+    unsigned int bits = 0;
 
-    while (bucket + 1 < BENCH_LATENCY_BUCKETS && latency_us > upper) {
-        upper <<= 1;
-        bucket++;
+    while (value) {
+        bits++;
+        value >>= 1;
     }
-    return bucket;
+    return bits;
+#endif
 }
 
-static uint64_t percentile_us(const bench_stats *stats, unsigned int percentile)
+/*
+ * Bucket 0 holds values below 2 * sub_bucket_half_count one by one; every
+ * following bucket covers twice the range with half the sub-buckets, each
+ * twice as wide as the ones before it.
+ */
+static unsigned int histogram_index(const bench_histogram *histogram, uint64_t value)
 {
-    uint64_t target;
-    uint64_t seen = 0;
-    unsigned int i;
+    unsigned int bucket = bit_length(value | histogram->sub_bucket_mask)
+        - (histogram->sub_bucket_half_count_magnitude + 1);
+    unsigned int sub_bucket = (unsigned int)(value >> bucket);
 
-    if (!stats->latency_count)
-        return 0;
+    return ((bucket + 1) << histogram->sub_bucket_half_count_magnitude)
+        + sub_bucket - histogram->sub_bucket_half_count;
+}
 
-    target = (stats->latency_count * percentile + 99) / 100;
-    if (!target)
-        target = 1;
+/* Highest value that lands in counts[index]. */
+static uint64_t histogram_value(const bench_histogram *histogram, unsigned int index)
+{
+    int bucket = (int)(index >> histogram->sub_bucket_half_count_magnitude) - 1;
+    unsigned int sub_bucket = (index & (histogram->sub_bucket_half_count - 1))
+        + histogram->sub_bucket_half_count;
 
-    for (i = 0; i < BENCH_LATENCY_BUCKETS; i++) {
-        seen += stats->latency_buckets[i];
-        if (seen >= target) {
-            if (!i)
-                return 1;
-            return (uint64_t)1 << i;
-        }
+    if (bucket < 0) {
+        sub_bucket -= histogram->sub_bucket_half_count;
+        bucket = 0;
     }
-
-    return stats->latency_max_us;
+    return ((uint64_t)sub_bucket << bucket) + ((uint64_t)1 << bucket) - 1;
 }
 
 static void format_count(uint64_t value, char *buf, size_t size)
@@ -96,10 +105,181 @@ static void format_clock_time(char *buf, size_t size)
     snprintf(buf, size, "%02d:%02d:%02d", tm_now.tm_hour, tm_now.tm_min, tm_now.tm_sec);
 }
 
+int bench_histogram_init(bench_histogram *histogram, unsigned int significant_digits)
+{
+    uint64_t largest_single_unit = 2;
+    uint64_t smallest_untrackable;
+    unsigned int magnitude;
+    unsigned int bucket_count = 1;
+    unsigned int i;
+
+    memset(histogram, 0, sizeof(*histogram));
+    histogram->min = UINT64_MAX;
+    if (significant_digits < 1 || significant_digits > BENCH_LATENCY_DIGITS_MAX)
+        return -1;
+
+    /* a sub-bucket per unit up to 2 * 10^digits keeps that many digits exact */
+    for (i = 0; i < significant_digits; i++)
+        largest_single_unit *= 10;
+    magnitude = bit_length(largest_single_unit - 1);
+    histogram->sub_bucket_half_count_magnitude = magnitude - 1;
+    histogram->sub_bucket_half_count = 1u << (magnitude - 1);
+    histogram->sub_bucket_mask = ((uint64_t)1 << magnitude) - 1;
+
+    smallest_untrackable = (uint64_t)1 << magnitude;
+    while (smallest_untrackable <= BENCH_LATENCY_MAX_US) {
+        smallest_untrackable <<= 1;
+        bucket_count++;
+    }
+    histogram->counts_len = (bucket_count + 1) * histogram->sub_bucket_half_count;
+    histogram->counts = (uint64_t*)calloc(histogram->counts_len, sizeof(*histogram->counts));
+    if (!histogram->counts)
+        return -1;
+    histogram->significant_digits = significant_digits;
+    return 0;
+}
+
+void bench_histogram_free(bench_histogram *histogram)
+{
+    free(histogram->counts);
+    histogram->counts = NULL;
+}
+
+void bench_histogram_record(bench_histogram *histogram, uint64_t value)
+{
+    histogram->count++;
+    histogram->sum += value;
+    if (value < histogram->min)
+        histogram->min = value;
+    if (value > histogram->max)
+        histogram->max = value;
+    if (histogram->counts)
+        histogram->counts[histogram_index(histogram,
+            value < BENCH_LATENCY_MAX_US ? value : BENCH_LATENCY_MAX_US)]++;
+}
+
+int bench_histogram_merge(bench_histogram *dst, const bench_histogram *src)
+{
+    unsigned int i;
+
+    if (src->counts) {
+        if (!dst->counts) {
+            bench_histogram totals = *dst;
+
+            if (bench_histogram_init(dst, src->significant_digits) != 0) {
+                *dst = totals;
+                return -1;
+            }
+            dst->count = totals.count;
+            dst->sum = totals.sum;
+            dst->min = totals.min;
+            dst->max = totals.max;
+        } else if (dst->significant_digits != src->significant_digits) {
+            return -1;
+        }
+        for (i = 0; i < src->counts_len; i++)
+            dst->counts[i] += src->counts[i];
+    }
+    dst->count += src->count;
+    dst->sum += src->sum;
+    if (src->min < dst->min)
+        dst->min = src->min;
+    if (src->max > dst->max)
+        dst->max = src->max;
+    return 0;
+}
+
+uint64_t bench_histogram_value_at(const bench_histogram *histogram, double percentile)
+{
+    uint64_t target;
+    uint64_t seen = 0;
+    uint64_t value;
+    unsigned int i;
+
+    if (!histogram->count)
+        return 0;
+    if (!histogram->counts)
+        return histogram->max;
+
+    target = (uint64_t)(percentile / 100.0 * (double)histogram->count + 0.5);
+    if (!target)
+        target = 1;
+
+    for (i = 0; i < histogram->counts_len; i++) {
+        seen += histogram->counts[i];
+        if (seen >= target) {
+            value = histogram_value(histogram, i);
+            return value < histogram->max ? value : histogram->max;
+        }
+    }
+    return histogram->max;
+}
+
 void bench_stats_init(bench_stats *stats)
 {
     memset(stats, 0, sizeof(*stats));
-    stats->latency_min_us = UINT64_MAX;
+    stats->latency.min = UINT64_MAX;
+    stats->service_latency.min = UINT64_MAX;
+    stats->connect_latency.min = UINT64_MAX;
+}
+
+int bench_stats_enable_latency(bench_stats *stats, unsigned int significant_digits)
+{
+    return bench_histogram_init(&stats->latency, significant_digits);
+}
+
+int bench_stats_enable_service_latency(bench_stats *stats, unsigned int significant_digits)
+{
+    return bench_histogram_init(&stats->service_latency, significant_digits);
+}
+
+int bench_stats_enable_connect_latency(bench_stats *stats, unsigned int significant_digits)
+{
+    return bench_histogram_init(&stats->connect_latency, significant_digits);
+}
+
+void bench_stats_free(bench_stats *stats)
+{
+    bench_histogram_free(&stats->latency);
+    bench_histogram_free(&stats->service_latency);
+    bench_histogram_free(&stats->connect_latency);
+}
+
+int bench_stats_merge(bench_stats *dst, const bench_stats *src)
+{
+    dst->requests += src->requests;
+    dst->bytes += src->bytes;
+    dst->errors += src->errors;
+    dst->accept_errors += src->accept_errors;
+    dst->io_errors += src->io_errors;
+    dst->connections += src->connections;
+    dst->requests_scheduled += src->requests_scheduled;
+    dst->datagrams_sent += src->datagrams_sent;
+    dst->datagrams_lost += src->datagrams_lost;
+    dst->datagrams_reordered += src->datagrams_reordered;
+    dst->datagrams_late += src->datagrams_late;
+    dst->connections_open += src->connections_open;
+    dst->loop_iterations += src->loop_iterations;
+    dst->loop_poll_usec += src->loop_poll_usec;
+    dst->loop_callback_usec += src->loop_callback_usec;
+    dst->loop_timers += src->loop_timers;
+    if (bench_histogram_merge(&dst->service_latency, &src->service_latency) != 0
+        || bench_histogram_merge(&dst->connect_latency, &src->connect_latency) != 0)
+        return -1;
+    return bench_histogram_merge(&dst->latency, &src->latency);
+}
+
+/* Copy the counters for interval reports; dst keeps its own histograms. */
+void bench_stats_snapshot(bench_stats *dst, const bench_stats *src)
+{
+    bench_histogram latency = dst->latency;
+    bench_histogram service_latency = dst->service_latency;
+    bench_histogram connect_latency = dst->connect_latency;
+
+    *dst = *src;
+    dst->latency = latency;
+    dst->service_latency = service_latency;
+    dst->connect_latency = connect_latency;
 }
 
 void bench_stats_record_request(bench_stats *stats, uint64_t bytes)
@@ -127,15 +307,33 @@ void bench_stats_record_io_error(bench_stats *stats)
 
 void bench_stats_record_latency(bench_stats *stats, uint64_t latency_us)
 {
-    unsigned int bucket = latency_bucket(latency_us);
+    bench_histogram_record(&stats->latency, latency_us);
+}
 
-    stats->latency_count++;
-    stats->latency_sum_us += latency_us;
-    if (latency_us < stats->latency_min_us)
-        stats->latency_min_us = latency_us;
-    if (latency_us > stats->latency_max_us)
-        stats->latency_max_us = latency_us;
-    stats->latency_buckets[bucket]++;
+void bench_stats_record_service_latency(bench_stats *stats, uint64_t latency_us)
+{
+    bench_histogram_record(&stats->service_latency, latency_us);
+}
+
+void bench_stats_record_connection(bench_stats *stats)
+{
+    stats->connections++;
+}
+
+void bench_stats_record_connect_latency(bench_stats *stats, uint64_t latency_us)
+{
+    bench_histogram_record(&stats->connect_latency, latency_us);
+}
+
+void bench_stats_record_open(bench_stats *stats)
+{
+    stats->connections_open++;
+}
+
+void bench_stats_record_close(bench_stats *stats)
+{
+    if (stats->connections_open)
+        stats->connections_open--;
 }
 
 void bench_stats_print_delta_header(const char *prefix, int show_error_breakdown)
@@ -174,12 +372,37 @@ void bench_stats_print_delta(const char *prefix, const bench_stats *stats, const
         time_buf, rate_buf, mib_buf, requests_buf, total_buf, errors_buf);
 }
 
+static void print_latency(const char *label, const bench_histogram *latency)
+{
+    uint64_t avg = latency->count ? latency->sum / latency->count : 0;
+    uint64_t min = latency->min == UINT64_MAX ? 0 : latency->min;
+
+    if (latency->count && latency->counts) {
+        printf("  %-8s : min=%lluus avg=%lluus p50=%lluus p90=%lluus p99=%lluus p99.9=%lluus"
+            " p99.99=%lluus max=%lluus\n",
+            label,
+            (unsigned long long)min,
+            (unsigned long long)avg,
+            (unsigned long long)bench_histogram_value_at(latency, 50.0),
+            (unsigned long long)bench_histogram_value_at(latency, 90.0),
+            (unsigned long long)bench_histogram_value_at(latency, 99.0),
+            (unsigned long long)bench_histogram_value_at(latency, 99.9),
+            (unsigned long long)bench_histogram_value_at(latency, 99.99),
+            (unsigned long long)latency->max);
+    } else if (latency->count) {
+        printf("  %-8s : min=%lluus avg=%lluus max=%lluus\n",
+            label,
+            (unsigned long long)min,
+            (unsigned long long)avg,
+            (unsigned long long)latency->max);
+    }
+}
+
 void bench_stats_print_total(const char *prefix, const bench_stats *stats, uint64_t elapsed_ms,
     int show_error_breakdown)
 {
     double seconds = elapsed_ms ? (double)elapsed_ms / 1000.0 : 1.0;
-    uint64_t avg = stats->latency_count ? stats->latency_sum_us / stats->latency_count : 0;
-    uint64_t min = stats->latency_min_us == UINT64_MAX ? 0 : stats->latency_min_us;
+    const bench_histogram *latency = &stats->latency;
     char duration_buf[FORMAT_BUFFER_SIZE];
     char requests_buf[FORMAT_BUFFER_SIZE];
     char errors_buf[FORMAT_BUFFER_SIZE];
@@ -212,13 +435,91 @@ void bench_stats_print_total(const char *prefix, const bench_stats *stats, uint6
         printf("  errors   : %s\n", errors_buf);
     }
 
-    if (stats->latency_count) {
-        printf("  latency  : min=%lluus avg=%lluus p50=%lluus p95=%lluus p99=%lluus max=%lluus\n",
-            (unsigned long long)min,
-            (unsigned long long)avg,
-            (unsigned long long)percentile_us(stats, 50),
-            (unsigned long long)percentile_us(stats, 95),
-            (unsigned long long)percentile_us(stats, 99),
-            (unsigned long long)stats->latency_max_us);
+    print_latency("latency", latency);
+}
+
+void bench_stats_print_datagrams(const bench_stats *stats)
+{
+    char sent_buf[FORMAT_BUFFER_SIZE];
+    char lost_buf[FORMAT_BUFFER_SIZE];
+    char reordered_buf[FORMAT_BUFFER_SIZE];
+    char late_buf[FORMAT_BUFFER_SIZE];
+    double loss = stats->datagrams_sent
+        ? (double)stats->datagrams_lost * 100.0 / (double)stats->datagrams_sent : 0.0;
+
+    format_count(stats->datagrams_sent, sent_buf, sizeof(sent_buf));
+    format_count(stats->datagrams_lost, lost_buf, sizeof(lost_buf));
+    format_count(stats->datagrams_reordered, reordered_buf, sizeof(reordered_buf));
+    format_count(stats->datagrams_late, late_buf, sizeof(late_buf));
+
+    printf("  packets  : sent=%s lost=%s (%.3f%%) reordered=%s late=%s\n",
+        sent_buf, lost_buf, loss, reordered_buf, late_buf);
+}
+
+/*
+ * Open-loop summary: the latency line above is measured from each request's
+ * intended send time; service is measured from when it actually left, which
+ * is what a closed-loop client would have reported.
+ */
+void bench_stats_print_rate(const bench_stats *stats, unsigned int target_rate, uint64_t elapsed_ms)
+{
+    double seconds = elapsed_ms ? (double)elapsed_ms / 1000.0 : 1.0;
+    char target_buf[FORMAT_BUFFER_SIZE];
+    char achieved_buf[FORMAT_BUFFER_SIZE];
+    char scheduled_buf[FORMAT_BUFFER_SIZE];
+    double completed = stats->requests_scheduled
+        ? (double)stats->requests * 100.0 / (double)stats->requests_scheduled : 0.0;
+
+    format_rate((double)target_rate, target_buf, sizeof(target_buf));
+    format_rate((double)stats->requests / seconds, achieved_buf, sizeof(achieved_buf));
+    format_count(stats->requests_scheduled, scheduled_buf, sizeof(scheduled_buf));
+
+    printf("  rate     : target=%s achieved=%s scheduled=%s completed=%.2f%%\n",
+        target_buf, achieved_buf, scheduled_buf, completed);
+    print_latency("service", &stats->service_latency);
+}
+
+/* --churn summary: connections per second, then the connect or accept latency line. */
+void bench_stats_print_connections(const bench_stats *stats, const char *label, uint64_t elapsed_ms)
+{
+    double seconds = elapsed_ms ? (double)elapsed_ms / 1000.0 : 1.0;
+    char connections_buf[FORMAT_BUFFER_SIZE];
+    char rate_buf[FORMAT_BUFFER_SIZE];
+
+    format_count(stats->connections, connections_buf, sizeof(connections_buf));
+    format_rate((double)stats->connections / seconds, rate_buf, sizeof(rate_buf));
+
+    printf("  conns    : %s (%s)\n", connections_buf, rate_buf);
+    print_latency(label, &stats->connect_latency);
+}
+
+/* --idle summary: what the open connections cost at rest. */
+void bench_stats_print_idle(const bench_idle *idle)
+{
+    char connections_buf[FORMAT_BUFFER_SIZE];
+    char timers_buf[FORMAT_BUFFER_SIZE];
+    char sockets_buf[FORMAT_BUFFER_SIZE];
+    double connections = idle->connections ? (double)idle->connections : 1.0;
+    double mib = 1024.0 * 1024.0;
+
+    format_count(idle->connections, connections_buf, sizeof(connections_buf));
+    format_count(idle->timers, timers_buf, sizeof(timers_buf));
+    format_count(idle->tcp_sockets, sockets_buf, sizeof(sockets_buf));
+
+    printf("  idle     : %s connections, %s timers, sampled over %.2fs\n",
+        connections_buf, timers_buf, idle->seconds);
+    if (idle->rss_bytes) {
+        double growth = (double)idle->rss_bytes - (double)idle->rss_baseline_bytes;
+
+        printf("  memory   : rss=%.2f MiB (%+.2f MiB, %.0f bytes/connection)\n",
+            (double)idle->rss_bytes / mib, growth / mib, growth / connections);
+    }
+    if (idle->tcp_sockets) {
+        printf("  kernel   : sockets=%s buffers=%.2f MiB slab=%+.2f MiB (%.0f bytes/connection), system wide\n",
+            sockets_buf, (double)idle->tcp_buffer_bytes / mib, (double)idle->slab_delta_bytes / mib,
+            (double)idle->slab_delta_bytes / connections);
     }
+    printf("  loop     : %.2f iterations/s, %.2fus/iteration outside the poller\n",
+        idle->seconds > 0.0 ? (double)idle->iterations / idle->seconds : 0.0,
+        idle->iterations ? (double)idle->callback_usec / (double)idle->iterations : 0.0);
 }
@@ -3,7 +3,28 @@
 
 #include <stdint.h>
 
-#define BENCH_LATENCY_BUCKETS 32
+#define BENCH_LATENCY_DIGITS_DEFAULT 3
+#define BENCH_LATENCY_DIGITS_MAX     5
+#define BENCH_LATENCY_MAX_US         3600000000ULL
+
+/*
+ * Log-linear latency histogram in the style of HdrHistogram: every value up
+ * to BENCH_LATENCY_MAX_US is kept with significant_digits decimal digits of
+ * precision. Count, sum, min and max are kept even without counts, which are
+ * only allocated by bench_histogram_init().
+ */
+typedef struct bench_histogram {
+    unsigned int significant_digits;
+    unsigned int sub_bucket_half_count_magnitude;
+    unsigned int sub_bucket_half_count;
+    uint64_t sub_bucket_mask;
+    unsigned int counts_len;
+    uint64_t *counts;
+    uint64_t count;
+    uint64_t sum;
+    uint64_t min;
+    uint64_t max;
+} bench_histogram;
 
 typedef struct bench_stats {
     uint64_t requests;
@@ -11,22 +32,71 @@ typedef struct bench_stats {
     uint64_t errors;
     uint64_t accept_errors;
     uint64_t io_errors;
-    uint64_t latency_count;
-    uint64_t latency_sum_us;
-    uint64_t latency_min_us;
-    uint64_t latency_max_us;
-    uint64_t latency_buckets[BENCH_LATENCY_BUCKETS];
+    uint64_t connections;               /* server: accepted; --churn client: completed exchanges */
+    uint64_t connections_open;          /* established and not closed yet */
+    bench_histogram latency;
+    bench_histogram service_latency;    /* --rate: from the actual send, not the intended one */
+    uint64_t requests_scheduled;        /* --rate: requests whose intended send time has passed */
+    bench_histogram connect_latency;    /* --churn: client connect to connected, or to server accept */
+    uint64_t datagrams_sent;
+    uint64_t datagrams_lost;
+    uint64_t datagrams_reordered;
+    uint64_t datagrams_late;
+    uint64_t loop_iterations;           /* nanoev_loop_get_stats() as of the last snapshot */
+    uint64_t loop_poll_usec;
+    uint64_t loop_callback_usec;
+    uint64_t loop_timers;
 } bench_stats;
 
+/*
+ * --idle: figures sampled at interval reports while every connection was
+ * open and idle, from the first report after the ramp to the last one before
+ * the stop. Memory fields are 0 where the platform does not report them.
+ */
+typedef struct bench_idle {
+    uint64_t connections;
+    uint64_t timers;                    /* armed, over all loops */
+    uint64_t rss_bytes;
+    uint64_t rss_baseline_bytes;        /* before the first connection */
+    int64_t slab_delta_bytes;           /* kernel slab growth since the baseline, system wide */
+    uint64_t tcp_sockets;               /* TCP sockets in use, system wide */
+    uint64_t tcp_buffer_bytes;          /* TCP buffer memory, system wide */
+    double seconds;                     /* between the two samples */
+    uint64_t iterations;                /* poller waits over all loops */
+    uint64_t poll_usec;
+    uint64_t callback_usec;
+} bench_idle;
+
+int bench_histogram_init(bench_histogram *histogram, unsigned int significant_digits);
+void bench_histogram_free(bench_histogram *histogram);
+void bench_histogram_record(bench_histogram *histogram, uint64_t value);
+int bench_histogram_merge(bench_histogram *dst, const bench_histogram *src);
+uint64_t bench_histogram_value_at(const bench_histogram *histogram, double percentile);
+
 void bench_stats_init(bench_stats *stats);
+int bench_stats_enable_latency(bench_stats *stats, unsigned int significant_digits);
+int bench_stats_enable_service_latency(bench_stats *stats, unsigned int significant_digits);
+int bench_stats_enable_connect_latency(bench_stats *stats, unsigned int significant_digits);
+void bench_stats_free(bench_stats *stats);
+int bench_stats_merge(bench_stats *dst, const bench_stats *src);
+void bench_stats_snapshot(bench_stats *dst, const bench_stats *src);
 void bench_stats_record_request(bench_stats *stats, uint64_t bytes);
 void bench_stats_record_error(bench_stats *stats);
 void bench_stats_record_accept_error(bench_stats *stats);
 void bench_stats_record_io_error(bench_stats *stats);
 void bench_stats_record_latency(bench_stats *stats, uint64_t latency_us);
+void bench_stats_record_service_latency(bench_stats *stats, uint64_t latency_us);
+void bench_stats_record_connection(bench_stats *stats);
+void bench_stats_record_connect_latency(bench_stats *stats, uint64_t latency_us);
+void bench_stats_record_open(bench_stats *stats);
+void bench_stats_record_close(bench_stats *stats);
 void bench_stats_print_delta_header(const char *prefix, int show_error_breakdown);
 void bench_stats_print_delta(const char *prefix, const bench_stats *stats, const bench_stats *previous,
     uint64_t elapsed_ms, int show_error_breakdown);
 void bench_stats_print_total(const char *prefix, const bench_stats *stats, uint64_t elapsed_ms,
     int show_error_breakdown);
+void bench_stats_print_datagrams(const bench_stats *stats);
+void bench_stats_print_rate(const bench_stats *stats, unsigned int target_rate, uint64_t elapsed_ms);
+void bench_stats_print_connections(const bench_stats *stats, const char *label, uint64_t elapsed_ms);
+void bench_stats_print_idle(const bench_idle *idle);
 #endif
@@ -11,7 +11,17 @@ typedef enum bench_family {
     bench_family_ipv6
 } bench_family;
 
+/* --idle: connects in flight per client thread while ramping up */
+#define BENCH_IDLE_CONNECT_WINDOW  256
+/* --idle: timeout on the reads idle connections wait in, like a gateway's idle timeout */
+#define BENCH_IDLE_TIMEOUT_SEC     3600
+
+/* --source-ips: client connections bind to 127.0.0.1 through 127.0.0.COUNT */
+#define BENCH_SOURCE_IPS_MAX       254
+
 typedef struct bench_config {
+    const char *library;
+    const char *protocol;
     bench_role role;
     const char *host;
     unsigned short port;
@@ -22,11 +32,25 @@ typedef struct bench_config {
     unsigned int pipeline;
     unsigned int backlog;
     unsigned int report_interval;
+    unsigned int zerocopy;
+    unsigned int busy_poll;
+    unsigned int threads;
+    unsigned int rate;
+    int churn;
+    int idle;
+    unsigned int source_ips;
+    unsigned int latency_digits;
+    const char *json_path;
+    const char *csv_path;
 } bench_config;
 
 int bench_nanoev_tcp_server_run(const bench_config *config);
 int bench_nanoev_tcp_client_run(const bench_config *config);
 int bench_libevent_tcp_server_run(const bench_config *config);
 int bench_libevent_tcp_client_run(const bench_config *config);
+int bench_libuv_tcp_server_run(const bench_config *config);
+int bench_libuv_tcp_client_run(const bench_config *config);
+int bench_libev_tcp_server_run(const bench_config *config);
+int bench_libev_tcp_client_run(const bench_config *config);
 
 #endif
@@ -1,7 +1,9 @@
 #include "tcp.h"
 #include "clock.h"
 #include "protocol.h"
+#include "report.h"
 #include "stats.h"
+#include "worker.h"
 #include "nanoev.h"
 #include <assert.h>
 #include <stdio.h>
@@ -10,227 +12,319 @@
 
 #define ASSERT assert
 
-#ifdef _WIN32
-# define WIN32_LEAN_AND_MEAN
-# include <windows.h>
-#else
-# include <signal.h>
-#endif
-
-typedef enum tcp_phase {
-    tcp_phase_read_header = 0,
-    tcp_phase_read_payload,
-    tcp_phase_write
-} tcp_phase;
-
 typedef struct tcp_client tcp_client;
 typedef struct tcp_client_conn tcp_client_conn;
 
 struct tcp_client_conn {
     tcp_client *client;
+    unsigned int index;
     nanoev_event *tcp;
-    tcp_phase phase;
-    unsigned char *buf;
     unsigned int frame_size;
-    unsigned int progress;
-    uint32_t sequence;
-    uint64_t request_start_us;
+    unsigned char *out;              /* requests being written */
+    unsigned int out_len;
+    unsigned int out_sent;
+    unsigned char *queue;            /* requests built since */
+    unsigned int queue_len;
+    int writing;
+    uint32_t send_sequence;          /* next request to build */
+    uint32_t recv_sequence;          /* next reply expected */
+    uint32_t due_sequence;           /* --rate: requests whose send time has come */
+    uint64_t *request_start_us;      /* send times, indexed by sequence % pipeline */
+    uint64_t connect_start_us;
+    int connected;
     int closed;
 };
 
 struct tcp_client {
     const bench_config *config;
     nanoev_loop *loop;
-    nanoev_event *async;
+    struct nanoev_addr addr;
     nanoev_event *stop_timer;
-    nanoev_event *report_timer;
+    nanoev_event *pace_timer;        /* --rate only */
     tcp_client_conn *connections;
+    unsigned int connection_count;
     unsigned int active_connections;
+    unsigned int connecting;
     int stopping;
-    bench_stats stats;
-    bench_stats previous;
-    bench_timeval started;
-    uint64_t previous_us;
+    bench_stats *stats;
     uint64_t deadline_us;
+    unsigned int rate;               /* this worker's share of --rate */
+    uint64_t pace_start_us;
+    uint64_t pace_index;             /* next request on the schedule */
+    struct nanoev_addr *sources;     /* --source-ips */
+    unsigned int next_connect;       /* --idle: first connection not dialed yet */
+    int holding;                     /* --idle: every connection has dialed once */
+    int connect_warned;
 };
 
-static nanoev_event *signal_async;
-
-static void on_signal_async(nanoev_event *async);
-static int install_signal_handler(nanoev_event *async);
+static int client_start(bench_worker *worker);
+static void client_stop(bench_worker *worker);
+static void client_finish(bench_worker *worker);
+static int client_ramp(tcp_client *client);
+static int conn_connect(tcp_client_conn *conn);
+static int conn_reconnect(tcp_client_conn *conn);
 static void conn_close(tcp_client_conn *conn);
-static int conn_send(tcp_client_conn *conn);
-static int conn_read_header(tcp_client_conn *conn);
-static int conn_read_payload(tcp_client_conn *conn);
+static void conn_queue_request(tcp_client_conn *conn);
+static int conn_flush(tcp_client_conn *conn);
+static int conn_read_frames(tcp_client_conn *conn);
+static int conn_send_due(tcp_client_conn *conn);
+static uint64_t pace_time(const tcp_client *client, uint64_t index);
 static void on_connect(nanoev_event *tcp, int status);
 static void on_write(nanoev_event *tcp, int status, void *buf, unsigned int bytes);
-static void on_read(nanoev_event *tcp, int status, void *buf, unsigned int bytes);
+static void on_frame(nanoev_event *tcp, int status, void *frame, unsigned int len);
+static void on_idle_reply(nanoev_event *tcp, int status, void *buf, unsigned int bytes);
+static void on_idle_read(nanoev_event *tcp, int status, void *buf, unsigned int bytes);
+static void on_pace(nanoev_event *timer);
 static void on_stop(nanoev_event *timer);
-static void on_report(nanoev_event *timer);
 
-#ifdef _WIN32
-static BOOL WINAPI ctrl_handler(DWORD type)
-{
-    (void)type;
-    if (signal_async)
-        nanoev_async_send(signal_async);
-    return TRUE;
-}
-#else
-static void sigint_handler(int sig)
-{
-    (void)sig;
-    if (signal_async)
-        nanoev_async_send(signal_async);
-}
-#endif
+static const bench_worker_ops client_ops = { client_start, client_stop, client_finish };
 
 int bench_nanoev_tcp_client_run(const bench_config *config)
 {
-    tcp_client client;
-    struct nanoev_addr addr;
-    nanoev_timeval interval;
-    nanoev_timeval duration;
+    bench_workers workers;
+    tcp_client *clients;
+    bench_idle idle;
+    const bench_idle *idle_figures = NULL;
     unsigned int i;
-    int ret;
-
-    memset(&client, 0, sizeof(client));
-    client.config = config;
-    bench_stats_init(&client.stats);
-    bench_stats_init(&client.previous);
+    int ret = 1;
 
-    ret = nanoev_init();
-    if (ret != NANOEV_SUCCESS) {
-        fprintf(stderr, "client setup failed: nanoev_init returned %d\n", ret);
-        return 1;
+    clients = (tcp_client*)calloc(config->threads, sizeof(*clients));
+    if (bench_workers_init(&workers, config, &client_ops, "client", 0) != 0 || !clients) {
+        fprintf(stderr, "client setup failed: unable to allocate %u workers\n", config->threads);
+        goto done;
     }
-
-    client.loop = nanoev_loop_new(NULL);
-    if (!client.loop) {
-        fprintf(stderr, "client setup failed: unable to create loop\n");
-        goto fail;
+    for (i = 0; i < config->threads; i++) {
+        clients[i].config = config;
+        workers.workers[i].role = &clients[i];
     }
 
-    client.async = nanoev_event_new(nanoev_event_async, client.loop, NULL);
-    client.stop_timer = nanoev_event_new(nanoev_event_timer, client.loop, &client);
-    client.report_timer = nanoev_event_new(nanoev_event_timer, client.loop, &client);
-    if (!client.async || !client.stop_timer || !client.report_timer) {
-        fprintf(stderr, "client setup failed: unable to create control events\n");
-        goto fail;
+    printf("tcp client connecting to %s:%u threads=%u connections=%u duration=%us message_size=%u pipeline=%u",
+        config->host, (unsigned int)config->port, config->threads, config->connections, config->duration,
+        config->message_size, config->pipeline);
+    if (config->rate)
+        printf(" rate=%u/s", config->rate);
+    if (config->churn)
+        printf(" churn");
+    if (config->idle)
+        printf(" idle");
+    if (config->source_ips)
+        printf(" source_ips=%u", config->source_ips);
+    printf("\n");
+    bench_stats_print_delta_header("client", 0);
+
+    if (bench_workers_run(&workers) != 0) {
+        fprintf(stderr, "client failed: a worker thread failed\n");
+        goto done;
+    }
+    bench_stats_print_total("client", &workers.total, (uint64_t)config->duration * 1000ULL, 0);
+    if (config->rate)
+        bench_stats_print_rate(&workers.total, config->rate, (uint64_t)config->duration * 1000ULL);
+    if (config->churn)
+        bench_stats_print_connections(&workers.total, "connect", (uint64_t)config->duration * 1000ULL);
+    if (config->idle && bench_workers_idle(&workers, &idle) == 0) {
+        bench_stats_print_idle(&idle);
+        idle_figures = &idle;
+    } else if (config->idle) {
+        fprintf(stderr, "client warning: no idle figures, the connections never held steady for a report interval\n");
     }
-    if (nanoev_async_start(client.async, on_signal_async) != NANOEV_SUCCESS) {
-        fprintf(stderr, "client setup failed: unable to start signal async\n");
-        goto fail;
+    ret = bench_report_write(config, "client", &workers.total, idle_figures,
+        (uint64_t)config->duration * 1000ULL) ? 1 : 0;
+
+done:
+    bench_workers_free(&workers);
+    free(clients);
+    return ret;
+}
+
+/* Runs on the worker thread: open this worker's share of the connections. */
+static int client_start(bench_worker *worker)
+{
+    tcp_client *client = (tcp_client*)worker->role;
+    const bench_config *config = client->config;
+    nanoev_timeval duration;
+    unsigned int i;
+
+    client->loop = worker->loop;
+    client->stats = &worker->stats;
+    client->connection_count = bench_worker_share(worker, config->connections);
+    client->rate = bench_worker_share(worker, config->rate);
+    client->stop_timer = nanoev_event_new(nanoev_event_timer, client->loop, client);
+    if (!client->stop_timer) {
+        fprintf(stderr, "client setup failed: unable to create stop timer\n");
+        return -1;
     }
-    if (install_signal_handler(client.async)) {
-        fprintf(stderr, "client setup failed: unable to install signal handler\n");
-        goto fail;
+    if (client->rate) {
+        client->pace_timer = nanoev_event_new(nanoev_event_timer, client->loop, client);
+        if (!client->pace_timer) {
+            fprintf(stderr, "client setup failed: unable to create pacing timer\n");
+            return -1;
+        }
     }
 
-    client.connections = (tcp_client_conn*)calloc(config->connections, sizeof(*client.connections));
-    if (!client.connections) {
-        fprintf(stderr, "client setup failed: unable to allocate %u connections\n", config->connections);
-        goto fail;
+    client->connections = (tcp_client_conn*)calloc(client->connection_count, sizeof(*client->connections));
+    if (!client->connections) {
+        fprintf(stderr, "client setup failed: unable to allocate %u connections\n", client->connection_count);
+        return -1;
     }
-    if (nanoev_addr_init(&addr, config->family == bench_family_ipv6 ? NANOEV_AF_INET6 : NANOEV_AF_INET,
+    if (nanoev_addr_init(&client->addr, config->family == bench_family_ipv6 ? NANOEV_AF_INET6 : NANOEV_AF_INET,
         config->host, config->port) != NANOEV_SUCCESS) {
         fprintf(stderr, "client setup failed: invalid address %s:%u\n",
             config->host, (unsigned int)config->port);
-        goto fail;
+        return -1;
+    }
+    if (config->source_ips) {
+        char ip[32];
+
+        client->sources = (struct nanoev_addr*)calloc(config->source_ips, sizeof(*client->sources));
+        if (!client->sources) {
+            fprintf(stderr, "client setup failed: unable to allocate source addresses\n");
+            return -1;
+        }
+        for (i = 0; i < config->source_ips; i++) {
+            snprintf(ip, sizeof(ip), "127.0.0.%u", i + 1);
+            nanoev_addr_init(&client->sources[i], NANOEV_AF_INET, ip, 0);
+        }
     }
 
-    for (i = 0; i < config->connections; i++) {
-        tcp_client_conn *conn = &client.connections[i];
+    for (i = 0; i < client->connection_count; i++) {
+        tcp_client_conn *conn = &client->connections[i];
 
-        conn->client = &client;
+        conn->client = client;
+        conn->index = i;
         conn->frame_size = BENCH_FRAME_HEADER_SIZE + config->message_size;
-        conn->buf = (unsigned char*)malloc(conn->frame_size);
-        if (!conn->buf) {
-            fprintf(stderr, "client setup failed: unable to allocate connection %u buffer\n", i);
-            goto fail;
+        /* at most pipeline requests are outstanding, so neither buffer grows */
+        conn->out = (unsigned char*)malloc((size_t)conn->frame_size * config->pipeline);
+        conn->queue = (unsigned char*)malloc((size_t)conn->frame_size * config->pipeline);
+        conn->request_start_us = (uint64_t*)malloc(sizeof(uint64_t) * config->pipeline);
+        if (!conn->out || !conn->queue || !conn->request_start_us) {
+            fprintf(stderr, "client setup failed: unable to allocate connection %u buffers\n", i);
+            return -1;
         }
-        conn->tcp = nanoev_event_new(nanoev_event_tcp, client.loop, conn);
-        if (!conn->tcp) {
-            fprintf(stderr, "client setup failed: unable to allocate TCP event for connection %u\n", i);
-            goto fail;
-        }
-        if (nanoev_tcp_connect(conn->tcp, &addr, NULL, on_connect) != NANOEV_SUCCESS) {
+        if (config->idle)
+            continue;
+        if (conn_connect(conn) != 0) {
             fprintf(stderr, "client setup failed: connect start failed for connection %u, socket_error=%d\n",
-                i, nanoev_tcp_error(conn->tcp));
-            goto fail;
+                i, conn->tcp ? nanoev_tcp_error(conn->tcp) : 0);
+            return -1;
         }
-        client.active_connections++;
+        client->active_connections++;
+        client->connecting++;
+    }
+    if (config->idle) {
+        /* the hold starts once the ramp is over, see client_ramp() */
+        client->active_connections = client->connection_count;
+        return client_ramp(client);
     }
 
-    interval.tv_sec = config->report_interval;
-    interval.tv_usec = 0;
     duration.tv_sec = config->duration + 1;
     duration.tv_usec = 0;
-    if (nanoev_timer_add(client.report_timer, interval, 1, on_report) != NANOEV_SUCCESS) {
-        fprintf(stderr, "client setup failed: unable to start report timer\n");
-        goto fail;
-    }
-    if (nanoev_timer_add(client.stop_timer, duration, 0, on_stop) != NANOEV_SUCCESS) {
+    if (nanoev_timer_add(client->stop_timer, duration, 0, on_stop) != NANOEV_SUCCESS) {
         fprintf(stderr, "client setup failed: unable to start stop timer\n");
-        goto fail;
+        return -1;
     }
+    client->deadline_us = bench_time_us() + ((uint64_t)config->duration * 1000000ULL);
+    return 0;
+}
 
-    bench_now(&client.started);
-    client.previous_us = bench_time_us();
-    client.deadline_us = client.previous_us + ((uint64_t)config->duration * 1000000ULL);
-    printf("tcp client connecting to %s:%u connections=%u duration=%us message_size=%u\n",
-        config->host, (unsigned int)config->port, config->connections, config->duration, config->message_size);
-    bench_stats_print_delta_header("client", 0);
+static void client_stop(bench_worker *worker)
+{
+    tcp_client *client = (tcp_client*)worker->role;
 
-    ret = nanoev_loop_run(client.loop);
-    if (ret != NANOEV_SUCCESS)
-        goto fail;
+    on_stop(client->stop_timer);
+}
 
-    bench_stats_print_total("client", &client.stats, (uint64_t)config->duration * 1000ULL, 0);
+static void client_finish(bench_worker *worker)
+{
+    tcp_client *client = (tcp_client*)worker->role;
+    unsigned int i;
 
-    for (i = 0; i < config->connections; i++)
-        conn_close(&client.connections[i]);
-    free(client.connections);
-    nanoev_event_free(client.report_timer);
-    nanoev_event_free(client.stop_timer);
-    nanoev_event_free(client.async);
-    nanoev_loop_free(client.loop);
-    nanoev_term();
-    return 0;
+    if (client->connections) {
+        for (i = 0; i < client->connection_count; i++)
+            conn_close(&client->connections[i]);
+        free(client->connections);
+    }
+    client->connections = NULL;
+    if (client->pace_timer)
+        nanoev_event_free(client->pace_timer);
+    client->pace_timer = NULL;
+    if (client->stop_timer)
+        nanoev_event_free(client->stop_timer);
+    client->stop_timer = NULL;
+    free(client->sources);
+    client->sources = NULL;
+}
+
+/*
+ * --idle: dial the connections a window at a time, so the server's listen
+ * backlog does not overflow, and hold them for --duration once every one has
+ * been dialed. A connection that fails is counted as an error and stays
+ * closed.
+ */
+static int client_ramp(tcp_client *client)
+{
+    nanoev_timeval duration;
 
-fail:
-    if (client.connections) {
-        for (i = 0; i < config->connections; i++)
-            conn_close(&client.connections[i]);
-        free(client.connections);
-    }
-    if (client.report_timer)
-        nanoev_event_free(client.report_timer);
-    if (client.stop_timer)
-        nanoev_event_free(client.stop_timer);
-    if (client.async)
-        nanoev_event_free(client.async);
-    if (client.loop)
-        nanoev_loop_free(client.loop);
-    nanoev_term();
-    return 1;
+    while (!client->stopping && client->connecting < BENCH_IDLE_CONNECT_WINDOW
+        && client->next_connect < client->connection_count) {
+        tcp_client_conn *conn = &client->connections[client->next_connect++];
+
+        if (conn_connect(conn) != 0) {
+            if (!client->connect_warned) {
+                client->connect_warned = 1;
+                fprintf(stderr, "client warning: connect start failed for connection %u, socket_error=%d\n",
+                    conn->index, conn->tcp ? nanoev_tcp_error(conn->tcp) : 0);
+            }
+            bench_stats_record_error(client->stats);
+            conn_close(conn);
+            continue;
+        }
+        client->connecting++;
+    }
+    if (client->holding || client->connecting || client->next_connect < client->connection_count)
+        return 0;
+
+    client->holding = 1;
+    duration.tv_sec = client->config->duration;
+    duration.tv_usec = 0;
+    if (nanoev_timer_add(client->stop_timer, duration, 0, on_stop) != NANOEV_SUCCESS) {
+        fprintf(stderr, "client failed: unable to start stop timer\n");
+        return -1;
+    }
+    return 0;
 }
 
-static void on_signal_async(nanoev_event *async)
+static int conn_connect(tcp_client_conn *conn)
 {
-    nanoev_loop_break(nanoev_event_loop(async));
+    tcp_client *client = conn->client;
+
+    conn->tcp = nanoev_event_new(nanoev_event_tcp, client->loop, conn);
+    if (!conn->tcp)
+        return -1;
+    if (client->sources && nanoev_tcp_bind(conn->tcp,
+        &client->sources[conn->index % client->config->source_ips]) != NANOEV_SUCCESS)
+        return -1;
+    conn->connect_start_us = bench_time_us();
+    return nanoev_tcp_connect(conn->tcp, &client->addr, NULL, on_connect) == NANOEV_SUCCESS ? 0 : -1;
 }
 
-static int install_signal_handler(nanoev_event *async)
+/* --churn: the exchange is done, so close this connection and dial the next one in its slot. */
+static int conn_reconnect(tcp_client_conn *conn)
 {
-    signal_async = async;
-#ifdef _WIN32
-    return SetConsoleCtrlHandler(ctrl_handler, TRUE) ? 0 : -1;
-#else
-    signal(SIGPIPE, SIG_IGN);
-    signal(SIGINT, sigint_handler);
+    bench_stats_record_close(conn->client->stats);
+    nanoev_event_free(conn->tcp);
+    conn->tcp = NULL;
+    conn->connected = 0;
+    conn->writing = 0;
+    conn->out_len = 0;
+    conn->out_sent = 0;
+    conn->queue_len = 0;
+    conn->send_sequence = 0;
+    conn->recv_sequence = 0;
+    if (conn_connect(conn) != 0)
+        return -1;
+    /* on_connect() counts it down like an initial dial */
+    conn->client->connecting++;
     return 0;
-#endif
 }
 
 static void conn_close(tcp_client_conn *conn)
@@ -238,11 +332,17 @@ static void conn_close(tcp_client_conn *conn)
     if (conn->closed)
         return;
     conn->closed = 1;
+    if (conn->connected)
+        bench_stats_record_close(conn->client->stats);
     if (conn->tcp)
         nanoev_event_free(conn->tcp);
     conn->tcp = NULL;
-    free(conn->buf);
-    conn->buf = NULL;
+    free(conn->out);
+    free(conn->queue);
+    free(conn->request_start_us);
+    conn->out = NULL;
+    conn->queue = NULL;
+    conn->request_start_us = NULL;
     if (conn->client && conn->client->active_connections > 0) {
         conn->client->active_connections--;
         if (!conn->client->active_connections)
@@ -250,55 +350,118 @@ static void conn_close(tcp_client_conn *conn)
     }
 }
 
-static int conn_send(tcp_client_conn *conn)
+static void conn_queue_request(tcp_client_conn *conn)
 {
+    unsigned char *frame = conn->queue + conn->queue_len;
+    uint32_t sequence = conn->send_sequence++;
     unsigned int i;
 
-    bench_frame_write_header(conn->buf, conn->client->config->message_size, conn->sequence);
+    bench_frame_write_header(frame, conn->client->config->message_size, sequence);
     for (i = BENCH_FRAME_HEADER_SIZE; i < conn->frame_size; i++)
-        conn->buf[i] = (unsigned char)(conn->sequence + i);
+        frame[i] = (unsigned char)(sequence + i);
+    if (conn->client->config->churn)
+        bench_frame_write_stamp(frame, conn->connect_start_us);
+    conn->queue_len += conn->frame_size;
+    conn->request_start_us[sequence % conn->client->config->pipeline] = bench_time_us();
+}
 
-    conn->phase = tcp_phase_write;
-    conn->progress = 0;
-    conn->request_start_us = bench_time_us();
-    return nanoev_tcp_write(conn->tcp, conn->buf, conn->frame_size, NULL, on_write) == NANOEV_SUCCESS ? 0 : -1;
+/* Swap the queue in as the next write; requests queue up while it is pending. */
+static int conn_flush(tcp_client_conn *conn)
+{
+    unsigned char *buf = conn->out;
+
+    conn->out = conn->queue;
+    conn->out_len = conn->queue_len;
+    conn->out_sent = 0;
+    conn->queue = buf;
+    conn->queue_len = 0;
+    conn->writing = 1;
+    return nanoev_tcp_write(conn->tcp, conn->out, conn->out_len, NULL, on_write) == NANOEV_SUCCESS ? 0 : -1;
 }
 
-static int conn_read_header(tcp_client_conn *conn)
+static int conn_read_frames(tcp_client_conn *conn)
 {
-    conn->phase = tcp_phase_read_header;
-    conn->progress = 0;
-    return nanoev_tcp_read(conn->tcp, conn->buf, BENCH_FRAME_HEADER_SIZE, NULL, on_read) == NANOEV_SUCCESS ? 0 : -1;
+    nanoev_tcp_framing framing;
+
+    memset(&framing, 0, sizeof(framing));
+    framing.prefix_size = 4;
+    framing.header_size = BENCH_FRAME_HEADER_SIZE;
+    framing.max_payload = conn->client->config->message_size;
+    return nanoev_tcp_read_frames(conn->tcp, &framing, on_frame) == NANOEV_SUCCESS ? 0 : -1;
 }
 
-static int conn_read_payload(tcp_client_conn *conn)
+/*
+ * Open loop: send every request whose intended time has come, up to pipeline
+ * in flight. Requests held back by a full pipeline wait here, and the wait
+ * counts towards their latency.
+ */
+static int conn_send_due(tcp_client_conn *conn)
 {
-    unsigned int payload_size = bench_frame_payload_size(conn->buf);
+    unsigned int pipeline = conn->client->config->pipeline;
 
-    if (payload_size != conn->client->config->message_size)
-        return -1;
-    conn->phase = tcp_phase_read_payload;
-    conn->progress = BENCH_FRAME_HEADER_SIZE;
-    if (!payload_size)
+    if (conn->closed || !conn->connected)
         return 0;
-    return nanoev_tcp_read(conn->tcp, conn->buf + conn->progress, payload_size, NULL, on_read) == NANOEV_SUCCESS ? 0 : -1;
+    while (conn->send_sequence != conn->due_sequence && conn->send_sequence - conn->recv_sequence < pipeline)
+        conn_queue_request(conn);
+    if (conn->queue_len && !conn->writing)
+        return conn_flush(conn);
+    return 0;
+}
+
+/* Intended send time of the index-th request; request k goes to connection k % connection_count. */
+static uint64_t pace_time(const tcp_client *client, uint64_t index)
+{
+    return client->pace_start_us + index * 1000000ULL / client->rate;
 }
 
 static void on_connect(nanoev_event *tcp, int status)
 {
     tcp_client_conn *conn = (tcp_client_conn*)nanoev_event_userdata(tcp);
+    tcp_client *client = conn->client;
+    unsigned int i;
 
+    client->connecting--;
+    if (!status && client->config->churn)
+        bench_stats_record_connect_latency(client->stats, bench_time_us() - conn->connect_start_us);
+    if (!status)
+        bench_stats_record_open(client->stats);
     if (status) {
-        if (!conn->client->stopping)
-            bench_stats_record_error(&conn->client->stats);
+        if (!client->stopping)
+            bench_stats_record_error(client->stats);
         conn_close(conn);
-        return;
+    } else if (client->config->idle) {
+        /* one exchange to prove the connection works, then it falls silent */
+        conn->connected = 1;
+        conn_queue_request(conn);
+        if (conn_flush(conn) != 0
+            || nanoev_tcp_read_exact(tcp, conn->queue, conn->frame_size, NULL, on_idle_reply) != NANOEV_SUCCESS) {
+            bench_stats_record_error(client->stats);
+            conn_close(conn);
+        }
+    } else if (client->rate) {
+        conn->connected = 1;
+        if (conn_read_frames(conn) != 0) {
+            bench_stats_record_error(client->stats);
+            conn_close(conn);
+        }
+    } else {
+        /* fill the pipeline; each reply then sends one more request */
+        conn->connected = 1;
+        for (i = 0; i < client->config->pipeline; i++)
+            conn_queue_request(conn);
+        if (conn_read_frames(conn) != 0 || conn_flush(conn) != 0) {
+            bench_stats_record_error(client->stats);
+            conn_close(conn);
+        }
     }
 
-    if (conn_send(conn) != 0) {
-        bench_stats_record_error(&conn->client->stats);
-        conn_close(conn);
+    /* the schedule starts once every connection is up, so connect time is not latency */
+    if (client->rate && !client->connecting && !client->stopping) {
+        client->pace_start_us = bench_time_us();
+        on_pace(client->pace_timer);
     }
+    if (client->config->idle && client_ramp(client) != 0)
+        on_stop(client->stop_timer);
 }
 
 static void on_write(nanoev_event *tcp, int status, void *buf, unsigned int bytes)
@@ -309,94 +472,197 @@ static void on_write(nanoev_event *tcp, int status, void *buf, unsigned int byte
 
     if (status) {
         if (!conn->client->stopping)
-            bench_stats_record_error(&conn->client->stats);
+            bench_stats_record_error(conn->client->stats);
         conn_close(conn);
         return;
     }
 
-    conn->progress += bytes;
-    if (conn->progress < conn->frame_size) {
-        ret = nanoev_tcp_write(tcp, conn->buf + conn->progress, conn->frame_size - conn->progress, NULL, on_write);
+    conn->out_sent += bytes;
+    if (conn->out_sent < conn->out_len) {
+        ret = nanoev_tcp_write(tcp, conn->out + conn->out_sent, conn->out_len - conn->out_sent, NULL, on_write);
         if (ret != NANOEV_SUCCESS) {
-            bench_stats_record_error(&conn->client->stats);
+            bench_stats_record_error(conn->client->stats);
             conn_close(conn);
         }
         return;
     }
 
-    if (conn_read_header(conn) != 0) {
-        bench_stats_record_error(&conn->client->stats);
+    conn->writing = 0;
+    if (conn->queue_len && conn_flush(conn) != 0) {
+        bench_stats_record_error(conn->client->stats);
         conn_close(conn);
     }
 }
 
-static void on_read(nanoev_event *tcp, int status, void *buf, unsigned int bytes)
+static void on_frame(nanoev_event *tcp, int status, void *frame, unsigned int len)
 {
     tcp_client_conn *conn = (tcp_client_conn*)nanoev_event_userdata(tcp);
-    int ret = 0;
-    (void)buf;
+    tcp_client *client = conn->client;
+    uint32_t sequence;
+    uint64_t now;
 
-    if (status || !bytes) {
-        if (!conn->client->stopping)
-            bench_stats_record_error(&conn->client->stats);
+    if (!frame) {
+        /* peer closed, socket error, or a reply over message_size */
+        if (!client->stopping || status == NANOEV_ERROR_FAIL)
+            bench_stats_record_error(client->stats);
         conn_close(conn);
         return;
     }
 
-    conn->progress += bytes;
-    if (conn->phase == tcp_phase_read_header) {
-        if (conn->progress < BENCH_FRAME_HEADER_SIZE) {
-            ret = nanoev_tcp_read(tcp, conn->buf + conn->progress, BENCH_FRAME_HEADER_SIZE - conn->progress, NULL, on_read);
-        } else {
-            ret = conn_read_payload(conn);
-        }
-    } else if (conn->progress < conn->frame_size) {
-        ret = nanoev_tcp_read(tcp, conn->buf + conn->progress, conn->frame_size - conn->progress, NULL, on_read);
+    sequence = bench_frame_sequence((const unsigned char*)frame);
+    if (len != conn->frame_size || sequence != conn->recv_sequence) {
+        bench_stats_record_error(client->stats);
+        conn_close(conn);
+        return;
+    }
+
+    now = bench_time_us();
+    bench_stats_record_request(client->stats, len);
+    if (client->rate) {
+        bench_stats_record_latency(client->stats,
+            now - pace_time(client, (uint64_t)sequence * client->connection_count + conn->index));
+        bench_stats_record_service_latency(client->stats,
+            now - conn->request_start_us[sequence % client->config->pipeline]);
+    } else if (client->config->churn) {
+        /* the whole exchange: handshake, accept, request and reply */
+        bench_stats_record_latency(client->stats, now - conn->connect_start_us);
+        bench_stats_record_connection(client->stats);
     } else {
-        uint32_t sequence = bench_frame_sequence(conn->buf);
+        bench_stats_record_latency(client->stats,
+            now - conn->request_start_us[sequence % client->config->pipeline]);
+    }
+    conn->recv_sequence++;
 
-        if (sequence != conn->sequence) {
-            bench_stats_record_error(&conn->client->stats);
+    if (client->stopping || now >= client->deadline_us) {
+        client->stopping = 1;
+        conn_close(conn);
+        return;
+    }
+
+    if (client->config->churn) {
+        if (conn_reconnect(conn) != 0) {
+            bench_stats_record_error(client->stats);
             conn_close(conn);
-            return;
         }
-
-        bench_stats_record_request(&conn->client->stats, conn->frame_size);
-        uint64_t now = bench_time_us();
-
-        bench_stats_record_latency(&conn->client->stats, now - conn->request_start_us);
-        conn->sequence++;
-        if (conn->client->stopping || now >= conn->client->deadline_us) {
-            conn->client->stopping = 1;
+        return;
+    }
+    if (client->rate) {
+        if (conn_send_due(conn) != 0) {
+            bench_stats_record_error(client->stats);
             conn_close(conn);
-            return;
         }
-        ret = conn_send(conn);
+        return;
     }
+    conn_queue_request(conn);
+    if (!conn->writing && conn_flush(conn) != 0) {
+        bench_stats_record_error(client->stats);
+        conn_close(conn);
+    }
+}
+
+/* --idle: the reply to the one request; the flush left conn->queue free to read it into. */
+static void on_idle_reply(nanoev_event *tcp, int status, void *buf, unsigned int bytes)
+{
+    tcp_client_conn *conn = (tcp_client_conn*)nanoev_event_userdata(tcp);
+    tcp_client *client = conn->client;
+    nanoev_timeval timeout;
 
-    if (ret != 0) {
-        bench_stats_record_error(&conn->client->stats);
+    if (status || bytes != conn->frame_size || bench_frame_sequence((const unsigned char*)buf) != 0) {
+        if (!client->stopping)
+            bench_stats_record_error(client->stats);
+        conn_close(conn);
+        return;
+    }
+    bench_stats_record_request(client->stats, bytes);
+    bench_stats_record_latency(client->stats, bench_time_us() - conn->request_start_us[0]);
+    conn->recv_sequence++;
+
+    timeout.tv_sec = BENCH_IDLE_TIMEOUT_SEC;
+    timeout.tv_usec = 0;
+    if (nanoev_tcp_read(tcp, conn->queue, conn->frame_size, &timeout, on_idle_read) != NANOEV_SUCCESS) {
+        bench_stats_record_error(client->stats);
         conn_close(conn);
     }
 }
 
-static void on_stop(nanoev_event *timer)
+/* --idle: nothing should arrive, so any completion ends the connection. */
+static void on_idle_read(nanoev_event *tcp, int status, void *buf, unsigned int bytes)
+{
+    tcp_client_conn *conn = (tcp_client_conn*)nanoev_event_userdata(tcp);
+    (void)status;
+    (void)buf;
+    (void)bytes;
+
+    if (!conn->client->stopping)
+        bench_stats_record_error(conn->client->stats);
+    conn_close(conn);
+}
+
+/*
+ * Walk the schedule up to now, then sleep until the next request is due. The
+ * epoll and IOCP pollers wait in whole milliseconds and round a partial one
+ * up, so unless the loop is busy polling the delay is rounded up here as well
+ * to keep the schedule and the wakeups in step: requests then leave in
+ * batches up to 1ms late, and that lateness is part of the latency measured
+ * from their slots.
+ */
+static void on_pace(nanoev_event *timer)
 {
     tcp_client *client = (tcp_client*)nanoev_event_userdata(timer);
+    uint64_t now = bench_time_us();
+    uint64_t next;
+    uint64_t delay;
+    nanoev_timeval after;
     unsigned int i;
 
-    client->stopping = 1;
-    for (i = 0; i < client->config->connections; i++)
-        conn_close(&client->connections[i]);
+    while (!client->stopping) {
+        tcp_client_conn *conn;
+
+        next = pace_time(client, client->pace_index);
+        if (next > now || next >= client->deadline_us)
+            break;
+        conn = &client->connections[client->pace_index % client->connection_count];
+        client->pace_index++;
+        client->stats->requests_scheduled++;
+        if (conn->closed)
+            continue;
+        conn->due_sequence++;
+        if (conn_send_due(conn) != 0) {
+            bench_stats_record_error(client->stats);
+            conn_close(conn);
+        }
+    }
+
+    if (client->stopping || now >= client->deadline_us) {
+        /* nothing more is scheduled; connections still waiting on a reply close on it */
+        for (i = 0; i < client->connection_count; i++) {
+            tcp_client_conn *conn = &client->connections[i];
+
+            if (!conn->closed && conn->send_sequence == conn->recv_sequence)
+                conn_close(conn);
+        }
+        return;
+    }
+
+    if (next > client->deadline_us)
+        next = client->deadline_us;
+    delay = next - now;
+    if (!client->config->busy_poll)
+        delay = (delay + 999) / 1000 * 1000;
+    after.tv_sec = (long)(delay / 1000000);
+    after.tv_usec = (long)(delay % 1000000);
+    if (nanoev_timer_add(timer, after, 0, on_pace) != NANOEV_SUCCESS) {
+        bench_stats_record_error(client->stats);
+        on_stop(timer);
+    }
 }
 
-static void on_report(nanoev_event *timer)
+static void on_stop(nanoev_event *timer)
 {
     tcp_client *client = (tcp_client*)nanoev_event_userdata(timer);
-    uint64_t now = bench_time_us();
-    uint64_t elapsed_ms = (now - client->previous_us) / 1000ULL;
+    unsigned int i;
 
-    bench_stats_print_delta("client", &client->stats, &client->previous, elapsed_ms, 0);
-    client->previous = client->stats;
-    client->previous_us = now;
+    client->stopping = 1;
+    for (i = 0; i < client->connection_count; i++)
+        conn_close(&client->connections[i]);
 }
@@ -1,7 +1,9 @@
 #include "tcp.h"
 #include "clock.h"
 #include "protocol.h"
+#include "report.h"
 #include "stats.h"
+#include "worker.h"
 #include "nanoev.h"
 #include <assert.h>
 #include <stdio.h>
@@ -10,19 +12,6 @@
 
 #define ASSERT assert
 
-#ifdef _WIN32
-# define WIN32_LEAN_AND_MEAN
-# include <windows.h>
-#else
-# include <signal.h>
-#endif
-
-typedef enum tcp_phase {
-    tcp_phase_read_header = 0,
-    tcp_phase_read_payload,
-    tcp_phase_write
-} tcp_phase;
-
 typedef struct tcp_server tcp_server;
 typedef struct tcp_server_conn tcp_server_conn;
 
@@ -31,168 +20,164 @@ struct tcp_server_conn {
     tcp_server_conn *next;
     tcp_server_conn *prev;
     nanoev_event *tcp;
-    tcp_phase phase;
-    unsigned char *buf;
-    unsigned int capacity;
-    unsigned int frame_size;
-    unsigned int progress;
+    unsigned char *out;              /* replies being written */
+    unsigned int out_capacity;
+    unsigned int out_len;
+    unsigned int out_sent;
+    unsigned char *queue;            /* replies to frames parsed since */
+    unsigned int queue_capacity;
+    unsigned int queue_len;
+    int writing;
+    uint64_t accepted_us;            /* --churn: accept latency is recorded from the first frame */
+    int accept_recorded;
+    int parking;                     /* --idle: wait in an idle read once the reply is written */
 };
 
 struct tcp_server {
     const bench_config *config;
     nanoev_loop *loop;
     nanoev_event *listener;
-    nanoev_event *async;
-    nanoev_event *report_timer;
     tcp_server_conn *head;
-    bench_stats stats;
-    bench_stats previous;
-    bench_timeval started;
-    uint64_t previous_us;
+    bench_stats *stats;
+    uint64_t zerocopy_completions;
+    uint64_t zerocopy_copied;
+    int zerocopy_warned;
 };
 
-static nanoev_event *signal_async;
-
-static void on_signal_async(nanoev_event *async);
-static int install_signal_handler(nanoev_event *async);
+static int server_start(bench_worker *worker);
+static void server_stop(bench_worker *worker);
+static void server_finish(bench_worker *worker);
 static void on_accept(nanoev_event *tcp, int status, nanoev_event *tcp_new);
 static int server_accept_next(tcp_server *server, nanoev_event *tcp);
 static void server_close_connections(tcp_server *server);
 static void* alloc_userdata(void *context, void *userdata);
+static void conn_record_accept(tcp_server_conn *conn, const unsigned char *frame);
 static void conn_close(tcp_server_conn *conn);
 static void conn_unlink(tcp_server_conn *conn);
-static int conn_read_header(tcp_server_conn *conn);
-static int conn_read_payload(tcp_server_conn *conn);
-static int conn_write(tcp_server_conn *conn);
-static void on_read(nanoev_event *tcp, int status, void *buf, unsigned int bytes);
+static int conn_read_frames(tcp_server_conn *conn);
+static int conn_queue_reply(tcp_server_conn *conn, const void *frame, unsigned int len);
+static int conn_flush(tcp_server_conn *conn);
+static void on_frame(nanoev_event *tcp, int status, void *frame, unsigned int len);
 static void on_write(nanoev_event *tcp, int status, void *buf, unsigned int bytes);
-static void on_report(nanoev_event *timer);
+static int conn_park(tcp_server_conn *conn);
+static void on_idle_read(nanoev_event *tcp, int status, void *buf, unsigned int bytes);
 
-#ifdef _WIN32
-static BOOL WINAPI ctrl_handler(DWORD type)
-{
-    (void)type;
-    if (signal_async)
-        nanoev_async_send(signal_async);
-    return TRUE;
-}
-#else
-static void sigint_handler(int sig)
-{
-    (void)sig;
-    if (signal_async)
-        nanoev_async_send(signal_async);
-}
-#endif
+static const bench_worker_ops server_ops = { server_start, server_stop, server_finish };
 
 int bench_nanoev_tcp_server_run(const bench_config *config)
 {
-    tcp_server server;
-    struct nanoev_addr addr;
-    nanoev_timeval interval;
-    int ret;
+    bench_workers workers;
+    tcp_server *servers;
+    bench_timeval started;
+    bench_timeval ended;
+    bench_idle idle;
+    const bench_idle *idle_figures = NULL;
+    uint64_t elapsed_ms;
+    uint64_t zerocopy_completions = 0;
+    uint64_t zerocopy_copied = 0;
+    unsigned int i;
+    int ret = 1;
+
+    servers = (tcp_server*)calloc(config->threads, sizeof(*servers));
+    if (bench_workers_init(&workers, config, &server_ops, "server", 1) != 0 || !servers) {
+        fprintf(stderr, "server setup failed: unable to allocate %u workers\n", config->threads);
+        goto done;
+    }
+    for (i = 0; i < config->threads; i++) {
+        servers[i].config = config;
+        workers.workers[i].role = &servers[i];
+    }
 
-    memset(&server, 0, sizeof(server));
-    server.config = config;
-    bench_stats_init(&server.stats);
-    bench_stats_init(&server.previous);
+    bench_now(&started);
+    printf("tcp server listening on %s:%u threads=%u message_size=%u backlog=%u zerocopy=%u%s\n",
+        config->host, (unsigned int)config->port, config->threads, config->message_size, config->backlog,
+        config->zerocopy, config->churn ? " churn" : config->idle ? " idle" : "");
+    printf("press Ctrl+C to stop\n");
+    bench_stats_print_delta_header("server", 1);
 
-    ret = nanoev_init();
-    if (ret != NANOEV_SUCCESS) {
-        fprintf(stderr, "server setup failed: nanoev_init returned %d\n", ret);
-        return 1;
+    if (bench_workers_run(&workers) != 0) {
+        fprintf(stderr, "server failed: a worker thread failed\n");
+        goto done;
     }
-
-    server.loop = nanoev_loop_new(NULL);
-    if (!server.loop) {
-        fprintf(stderr, "server setup failed: unable to create loop\n");
-        goto fail;
+    bench_now(&ended);
+    elapsed_ms = bench_time_diff_ms(&started, &ended);
+    bench_stats_print_total("server", &workers.total, elapsed_ms, 1);
+    if (config->churn)
+        bench_stats_print_connections(&workers.total, "accept", elapsed_ms);
+    if (config->zerocopy) {
+        for (i = 0; i < config->threads; i++) {
+            zerocopy_completions += servers[i].zerocopy_completions;
+            zerocopy_copied += servers[i].zerocopy_copied;
+        }
+        printf("  zerocopy : %llu completions, %llu copied, %llu zerocopy\n",
+            (unsigned long long)zerocopy_completions,
+            (unsigned long long)zerocopy_copied,
+            (unsigned long long)(zerocopy_completions - zerocopy_copied));
     }
+    if (config->idle && bench_workers_idle(&workers, &idle) == 0) {
+        bench_stats_print_idle(&idle);
+        idle_figures = &idle;
+    } else if (config->idle) {
+        fprintf(stderr, "server warning: no idle figures, the connections never held steady for a report interval\n");
+    }
+    ret = bench_report_write(config, "server", &workers.total, idle_figures, elapsed_ms) ? 1 : 0;
 
-    server.listener = nanoev_event_new(nanoev_event_tcp, server.loop, &server);
-    server.async = nanoev_event_new(nanoev_event_async, server.loop, NULL);
-    server.report_timer = nanoev_event_new(nanoev_event_timer, server.loop, &server);
-    if (!server.listener || !server.async || !server.report_timer) {
-        fprintf(stderr, "server setup failed: unable to create control events\n");
-        goto fail;
+done:
+    bench_workers_free(&workers);
+    free(servers);
+    return ret;
+}
+
+/* Runs on the worker thread: listen, sharing the port when there are several workers. */
+static int server_start(bench_worker *worker)
+{
+    tcp_server *server = (tcp_server*)worker->role;
+    const bench_config *config = server->config;
+    unsigned int flags = worker->group->count > 1 ? NANOEV_TCP_LISTEN_REUSEPORT : 0;
+    struct nanoev_addr addr;
+
+    server->loop = worker->loop;
+    server->stats = &worker->stats;
+    server->listener = nanoev_event_new(nanoev_event_tcp, server->loop, server);
+    if (!server->listener) {
+        fprintf(stderr, "server setup failed: unable to create listener\n");
+        return -1;
     }
 
     if (nanoev_addr_init(&addr, config->family == bench_family_ipv6 ? NANOEV_AF_INET6 : NANOEV_AF_INET,
         config->host, config->port) != NANOEV_SUCCESS) {
         fprintf(stderr, "server setup failed: invalid address %s:%u\n",
             config->host, (unsigned int)config->port);
-        goto fail;
+        return -1;
     }
-    if (nanoev_tcp_listen(server.listener, &addr, (int)config->backlog) != NANOEV_SUCCESS) {
+    if (nanoev_tcp_listen_ex(server->listener, &addr, (int)config->backlog, flags) != NANOEV_SUCCESS) {
         fprintf(stderr, "server setup failed: listen failed on %s:%u, socket_error=%d\n",
-            config->host, (unsigned int)config->port, nanoev_tcp_error(server.listener));
-        goto fail;
+            config->host, (unsigned int)config->port, nanoev_tcp_error(server->listener));
+        return -1;
     }
-    if (nanoev_tcp_accept(server.listener, NULL, on_accept, alloc_userdata) != NANOEV_SUCCESS) {
+    if (nanoev_tcp_accept(server->listener, NULL, on_accept, alloc_userdata) != NANOEV_SUCCESS) {
         fprintf(stderr, "server setup failed: accept start failed, socket_error=%d\n",
-            nanoev_tcp_error(server.listener));
-        goto fail;
-    }
-    if (nanoev_async_start(server.async, on_signal_async) != NANOEV_SUCCESS) {
-        fprintf(stderr, "server setup failed: unable to start signal async\n");
-        goto fail;
-    }
-    if (install_signal_handler(server.async)) {
-        fprintf(stderr, "server setup failed: unable to install signal handler\n");
-        goto fail;
-    }
-
-    interval.tv_sec = config->report_interval;
-    interval.tv_usec = 0;
-    if (nanoev_timer_add(server.report_timer, interval, 1, on_report) != NANOEV_SUCCESS) {
-        fprintf(stderr, "server setup failed: unable to start report timer\n");
-        goto fail;
-    }
-
-    bench_now(&server.started);
-    server.previous_us = bench_time_us();
-    printf("tcp server listening on %s:%u message_size=%u backlog=%u\n",
-        config->host, (unsigned int)config->port, config->message_size, config->backlog);
-    printf("press Ctrl+C to stop\n");
-    bench_stats_print_delta_header("server", 1);
-
-    ret = nanoev_loop_run(server.loop);
-    if (ret != NANOEV_SUCCESS) {
-        fprintf(stderr, "server failed: loop returned %d\n", ret);
-        goto fail;
-    }
-
-    {
-        bench_timeval ended;
-        bench_now(&ended);
-        bench_stats_print_total("server", &server.stats, bench_time_diff_ms(&server.started, &ended), 1);
+            nanoev_tcp_error(server->listener));
+        return -1;
     }
-
-    server_close_connections(&server);
-    nanoev_event_free(server.report_timer);
-    nanoev_event_free(server.async);
-    nanoev_event_free(server.listener);
-    nanoev_loop_free(server.loop);
-    nanoev_term();
     return 0;
+}
 
-fail:
-    server_close_connections(&server);
-    if (server.report_timer)
-        nanoev_event_free(server.report_timer);
-    if (server.async)
-        nanoev_event_free(server.async);
-    if (server.listener)
-        nanoev_event_free(server.listener);
-    if (server.loop)
-        nanoev_loop_free(server.loop);
-    nanoev_term();
-    return 1;
+static void server_stop(bench_worker *worker)
+{
+    tcp_server *server = (tcp_server*)worker->role;
+
+    nanoev_loop_break(server->loop);
 }
 
-static void on_signal_async(nanoev_event *async)
+static void server_finish(bench_worker *worker)
 {
-    nanoev_loop_break(nanoev_event_loop(async));
+    tcp_server *server = (tcp_server*)worker->role;
+
+    server_close_connections(server);
+    if (server->listener)
+        nanoev_event_free(server->listener);
+    server->listener = NULL;
 }
 
 static void server_close_connections(tcp_server *server)
@@ -201,18 +186,6 @@ static void server_close_connections(tcp_server *server)
         conn_close(server->head);
 }
 
-static int install_signal_handler(nanoev_event *async)
-{
-    signal_async = async;
-#ifdef _WIN32
-    return SetConsoleCtrlHandler(ctrl_handler, TRUE) ? 0 : -1;
-#else
-    signal(SIGPIPE, SIG_IGN);
-    signal(SIGINT, sigint_handler);
-    return 0;
-#endif
-}
-
 static void* alloc_userdata(void *context, void *userdata)
 {
     tcp_server *server = (tcp_server*)context;
@@ -221,7 +194,8 @@ static void* alloc_userdata(void *context, void *userdata)
     if (userdata) {
         conn = (tcp_server_conn*)userdata;
         conn_unlink(conn);
-        free(conn->buf);
+        free(conn->out);
+        free(conn->queue);
         free(conn);
         return NULL;
     }
@@ -230,9 +204,12 @@ static void* alloc_userdata(void *context, void *userdata)
     if (!conn)
         return NULL;
     conn->server = server;
-    conn->capacity = BENCH_FRAME_HEADER_SIZE + server->config->message_size;
-    conn->buf = (unsigned char*)malloc(conn->capacity);
-    if (!conn->buf) {
+    conn->out_capacity = conn->queue_capacity = BENCH_FRAME_HEADER_SIZE + server->config->message_size;
+    conn->out = (unsigned char*)malloc(conn->out_capacity);
+    conn->queue = (unsigned char*)malloc(conn->queue_capacity);
+    if (!conn->out || !conn->queue) {
+        free(conn->out);
+        free(conn->queue);
         free(conn);
         return NULL;
     }
@@ -249,7 +226,7 @@ static void on_accept(nanoev_event *tcp, int status, nanoev_event *tcp_new)
     tcp_server_conn *conn;
 
     if (status || !tcp_new) {
-        bench_stats_record_accept_error(&server->stats);
+        bench_stats_record_accept_error(server->stats);
         if (server_accept_next(server, tcp) != 0)
             nanoev_loop_break(server->loop);
         return;
@@ -258,9 +235,20 @@ static void on_accept(nanoev_event *tcp, int status, nanoev_event *tcp_new)
     conn = (tcp_server_conn*)nanoev_event_userdata(tcp_new);
     ASSERT(conn);
     conn->tcp = tcp_new;
+    bench_stats_record_connection(server->stats);
+    bench_stats_record_open(server->stats);
+    if (server->config->churn)
+        conn->accepted_us = bench_time_us();
+
+    if (server->config->zerocopy
+        && nanoev_tcp_set_zerocopy(tcp_new, server->config->zerocopy) != NANOEV_SUCCESS
+        && !server->zerocopy_warned) {
+        server->zerocopy_warned = 1;
+        fprintf(stderr, "server warning: MSG_ZEROCOPY unavailable, replies are copied\n");
+    }
 
-    if (conn_read_header(conn) != 0) {
-        bench_stats_record_error(&server->stats);
+    if (conn_read_frames(conn) != 0) {
+        bench_stats_record_error(server->stats);
         conn_close(conn);
     }
 
@@ -272,11 +260,25 @@ static int server_accept_next(tcp_server *server, nanoev_event *tcp)
 {
     if (nanoev_tcp_accept(tcp, NULL, on_accept, alloc_userdata) == NANOEV_SUCCESS)
         return 0;
-    bench_stats_record_accept_error(&server->stats);
+    bench_stats_record_accept_error(server->stats);
     fprintf(stderr, "server accept failed: accept start failed, socket_error=%d\n", nanoev_tcp_error(tcp));
     return -1;
 }
 
+/*
+ * --churn: the client stamps its connect start into the payload, so the gap
+ * to on_accept covers the handshake, the backlog wait and the accept itself.
+ * Both ends read the same host clock, which only holds on one machine.
+ */
+static void conn_record_accept(tcp_server_conn *conn, const unsigned char *frame)
+{
+    uint64_t started_us = bench_frame_stamp(frame);
+
+    conn->accept_recorded = 1;
+    if (conn->accepted_us >= started_us)
+        bench_stats_record_connect_latency(conn->server->stats, conn->accepted_us - started_us);
+}
+
 static void conn_unlink(tcp_server_conn *conn)
 {
     tcp_server *server = conn->server;
@@ -293,72 +295,91 @@ static void conn_unlink(tcp_server_conn *conn)
 
 static void conn_close(tcp_server_conn *conn)
 {
+    unsigned int completions, copied;
+
     conn_unlink(conn);
+    if (conn->tcp)
+        bench_stats_record_close(conn->server->stats);
+    if (conn->tcp && nanoev_tcp_zerocopy_stats(conn->tcp, &completions, &copied) == NANOEV_SUCCESS) {
+        conn->server->zerocopy_completions += completions;
+        conn->server->zerocopy_copied += copied;
+    }
     if (conn->tcp)
         nanoev_event_free(conn->tcp);
     conn->tcp = NULL;
-    free(conn->buf);
-    conn->buf = NULL;
+    free(conn->out);
+    free(conn->queue);
     free(conn);
 }
 
-static int conn_read_header(tcp_server_conn *conn)
+static int conn_read_frames(tcp_server_conn *conn)
 {
-    conn->phase = tcp_phase_read_header;
-    conn->frame_size = BENCH_FRAME_HEADER_SIZE;
-    conn->progress = 0;
-    return nanoev_tcp_read(conn->tcp, conn->buf, BENCH_FRAME_HEADER_SIZE, NULL, on_read) == NANOEV_SUCCESS ? 0 : -1;
+    nanoev_tcp_framing framing;
+
+    memset(&framing, 0, sizeof(framing));
+    framing.prefix_size = 4;
+    framing.header_size = BENCH_FRAME_HEADER_SIZE;
+    framing.max_payload = conn->server->config->message_size;
+    return nanoev_tcp_read_frames(conn->tcp, &framing, on_frame) == NANOEV_SUCCESS ? 0 : -1;
 }
 
-static int conn_read_payload(tcp_server_conn *conn)
+static int conn_queue_reply(tcp_server_conn *conn, const void *frame, unsigned int len)
 {
-    unsigned int payload_size = bench_frame_payload_size(conn->buf);
+    unsigned char *queue;
+    unsigned int capacity;
 
-    if (payload_size > conn->server->config->message_size)
-        return -1;
-    conn->phase = tcp_phase_read_payload;
-    conn->frame_size = BENCH_FRAME_HEADER_SIZE + payload_size;
-    conn->progress = BENCH_FRAME_HEADER_SIZE;
-    if (!payload_size)
-        return conn_write(conn);
-    return nanoev_tcp_read(conn->tcp, conn->buf + conn->progress, payload_size, NULL, on_read) == NANOEV_SUCCESS ? 0 : -1;
+    if (len > conn->queue_capacity - conn->queue_len) {
+        capacity = conn->queue_capacity * 2;
+        while (capacity - conn->queue_len < len)
+            capacity *= 2;
+        queue = (unsigned char*)realloc(conn->queue, capacity);
+        if (!queue)
+            return -1;
+        conn->queue = queue;
+        conn->queue_capacity = capacity;
+    }
+    memcpy(conn->queue + conn->queue_len, frame, len);
+    conn->queue_len += len;
+    return 0;
 }
 
-static int conn_write(tcp_server_conn *conn)
+/* Swap the queue in as the next write; replies queue up while it is pending. */
+static int conn_flush(tcp_server_conn *conn)
 {
-    conn->phase = tcp_phase_write;
-    conn->progress = 0;
-    return nanoev_tcp_write(conn->tcp, conn->buf, conn->frame_size, NULL, on_write) == NANOEV_SUCCESS ? 0 : -1;
+    unsigned char *buf = conn->out;
+    unsigned int capacity = conn->out_capacity;
+
+    conn->out = conn->queue;
+    conn->out_capacity = conn->queue_capacity;
+    conn->out_len = conn->queue_len;
+    conn->out_sent = 0;
+    conn->queue = buf;
+    conn->queue_capacity = capacity;
+    conn->queue_len = 0;
+    conn->writing = 1;
+    return nanoev_tcp_write(conn->tcp, conn->out, conn->out_len, NULL, on_write) == NANOEV_SUCCESS ? 0 : -1;
 }
 
-static void on_read(nanoev_event *tcp, int status, void *buf, unsigned int bytes)
+static void on_frame(nanoev_event *tcp, int status, void *frame, unsigned int len)
 {
     tcp_server_conn *conn = (tcp_server_conn*)nanoev_event_userdata(tcp);
-    int ret = 0;
-    (void)buf;
 
-    if (status || !bytes) {
+    if (!frame) {
+        /* peer closed, socket error, or a frame over message_size */
+        if (status == NANOEV_ERROR_FAIL)
+            bench_stats_record_error(conn->server->stats);
         conn_close(conn);
         return;
     }
 
-    conn->progress += bytes;
-    if (conn->progress < conn->frame_size) {
-        ret = nanoev_tcp_read(tcp, conn->buf + conn->progress, conn->frame_size - conn->progress, NULL, on_read);
-        if (ret != NANOEV_SUCCESS) {
-            bench_stats_record_error(&conn->server->stats);
-            conn_close(conn);
-        }
-        return;
-    }
-
-    if (conn->phase == tcp_phase_read_header)
-        ret = conn_read_payload(conn);
-    else
-        ret = conn_write(conn);
-
-    if (ret != 0) {
-        bench_stats_record_error(&conn->server->stats);
+    bench_stats_record_request(conn->server->stats, len);
+    if (conn->server->config->churn && !conn->accept_recorded
+        && len >= BENCH_FRAME_HEADER_SIZE + BENCH_FRAME_STAMP_SIZE)
+        conn_record_accept(conn, (const unsigned char*)frame);
+    if (conn->server->config->idle && nanoev_tcp_stop_frames(tcp) == NANOEV_SUCCESS)
+        conn->parking = 1;
+    if (conn_queue_reply(conn, frame, len) != 0 || (!conn->writing && conn_flush(conn) != 0)) {
+        bench_stats_record_error(conn->server->stats);
         conn_close(conn);
     }
 }
@@ -374,30 +395,49 @@ static void on_write(nanoev_event *tcp, int status, void *buf, unsigned int byte
         return;
     }
 
-    conn->progress += bytes;
-    if (conn->progress < conn->frame_size) {
-        ret = nanoev_tcp_write(tcp, conn->buf + conn->progress, conn->frame_size - conn->progress, NULL, on_write);
+    conn->out_sent += bytes;
+    if (conn->out_sent < conn->out_len) {
+        ret = nanoev_tcp_write(tcp, conn->out + conn->out_sent, conn->out_len - conn->out_sent, NULL, on_write);
         if (ret != NANOEV_SUCCESS) {
-            bench_stats_record_error(&conn->server->stats);
+            bench_stats_record_error(conn->server->stats);
             conn_close(conn);
         }
         return;
     }
 
-    bench_stats_record_request(&conn->server->stats, conn->frame_size);
-    if (conn_read_header(conn) != 0) {
-        bench_stats_record_error(&conn->server->stats);
+    conn->writing = 0;
+    if (conn->queue_len && conn_flush(conn) != 0) {
+        bench_stats_record_error(conn->server->stats);
+        conn_close(conn);
+    } else if (!conn->queue_len && conn->parking && conn_park(conn) != 0) {
+        bench_stats_record_error(conn->server->stats);
         conn_close(conn);
     }
 }
 
-static void on_report(nanoev_event *timer)
+/*
+ * --idle: after its one reply the connection waits in a plain read with a
+ * long timeout, the way a gateway holds an idle client, so every connection
+ * keeps one timer armed. The frame reader and its buffer are gone by now.
+ */
+static int conn_park(tcp_server_conn *conn)
 {
-    tcp_server *server = (tcp_server*)nanoev_event_userdata(timer);
-    uint64_t now = bench_time_us();
-    uint64_t elapsed_ms = (now - server->previous_us) / 1000ULL;
+    nanoev_timeval timeout;
+
+    conn->parking = 0;
+    timeout.tv_sec = BENCH_IDLE_TIMEOUT_SEC;
+    timeout.tv_usec = 0;
+    return nanoev_tcp_read(conn->tcp, conn->queue, conn->queue_capacity, &timeout, on_idle_read)
+        == NANOEV_SUCCESS ? 0 : -1;
+}
+
+/* --idle: the client only ever closes, so data or a timeout is an error. */
+static void on_idle_read(nanoev_event *tcp, int status, void *buf, unsigned int bytes)
+{
+    tcp_server_conn *conn = (tcp_server_conn*)nanoev_event_userdata(tcp);
+    (void)buf;
 
-    bench_stats_print_delta("server", &server->stats, &server->previous, elapsed_ms, 1);
-    server->previous = server->stats;
-    server->previous_us = now;
+    if (status || bytes)
+        bench_stats_record_error(conn->server->stats);
+    conn_close(conn);
 }
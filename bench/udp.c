@@ -0,0 +1,82 @@
+#include "udp.h"
+
+#include <stdlib.h>
+
+int bench_udp_window_init(bench_udp_window *window, unsigned int depth)
+{
+    window->depth = depth;
+    window->size = depth * 2;
+    window->slots = (bench_udp_slot*)calloc(window->size, sizeof(*window->slots));
+    window->inflight = 0;
+    window->next_sequence = 0;
+    window->highest = 0;
+    window->answered = 0;
+    window->progress_us = 0;
+    return window->slots ? 0 : -1;
+}
+
+void bench_udp_window_free(bench_udp_window *window)
+{
+    free(window->slots);
+    window->slots = NULL;
+}
+
+uint32_t bench_udp_window_send(bench_udp_window *window, bench_stats *stats, uint64_t now_us)
+{
+    uint32_t sequence = window->next_sequence++;
+    bench_udp_slot *slot = &window->slots[sequence % window->size];
+
+    if (slot->pending) {
+        /* overtaken by size newer datagrams */
+        stats->datagrams_lost++;
+        window->inflight--;
+    }
+    if (!window->inflight)
+        window->progress_us = now_us;
+    slot->sequence = sequence;
+    slot->pending = 1;
+    slot->sent_us = now_us;
+    window->inflight++;
+    stats->datagrams_sent++;
+    return sequence;
+}
+
+int bench_udp_window_receive(bench_udp_window *window, bench_stats *stats, uint32_t sequence,
+    unsigned int bytes, uint64_t now_us)
+{
+    bench_udp_slot *slot = &window->slots[sequence % window->size];
+
+    if (!slot->pending || slot->sequence != sequence) {
+        stats->datagrams_late++;
+        return 0;
+    }
+    slot->pending = 0;
+    window->inflight--;
+    window->progress_us = now_us;
+
+    if (window->answered && sequence < window->highest)
+        stats->datagrams_reordered++;
+    if (!window->answered || sequence > window->highest)
+        window->highest = sequence;
+    window->answered = 1;
+
+    bench_stats_record_request(stats, bytes);
+    bench_stats_record_latency(stats, now_us - slot->sent_us);
+    return 1;
+}
+
+void bench_udp_window_expire(bench_udp_window *window, bench_stats *stats, uint64_t now_us)
+{
+    unsigned int i;
+
+    if (!window->inflight || now_us - window->progress_us < BENCH_UDP_LOSS_TIMEOUT_US)
+        return;
+    for (i = 0; i < window->size; i++) {
+        if (window->slots[i].pending) {
+            window->slots[i].pending = 0;
+            stats->datagrams_lost++;
+        }
+    }
+    window->inflight = 0;
+    window->progress_us = now_us;
+}
@@ -0,0 +1,45 @@
+#ifndef NANOEV_BENCH_UDP_H
+#define NANOEV_BENCH_UDP_H
+
+#include "tcp.h"
+#include "stats.h"
+#include <stdint.h>
+
+#define BENCH_UDP_MAX_DATAGRAM    65507
+#define BENCH_UDP_LOSS_TIMEOUT_US 200000ULL
+
+typedef struct bench_udp_slot {
+    uint32_t sequence;
+    int pending;
+    uint64_t sent_us;
+} bench_udp_slot;
+
+/*
+ * Datagrams in flight on one client socket. A datagram counts as lost when no
+ * reply arrives for BENCH_UDP_LOSS_TIMEOUT_US, or when its slot is needed for
+ * a newer one; a reply that shows up afterwards counts as late.
+ */
+typedef struct bench_udp_window {
+    bench_udp_slot *slots;
+    unsigned int size;
+    unsigned int depth;              /* datagrams to keep in flight */
+    unsigned int inflight;
+    uint32_t next_sequence;
+    uint32_t highest;                /* highest sequence answered so far */
+    int answered;
+    uint64_t progress_us;            /* last reply, or last expiry */
+} bench_udp_window;
+
+int bench_udp_window_init(bench_udp_window *window, unsigned int depth);
+void bench_udp_window_free(bench_udp_window *window);
+uint32_t bench_udp_window_send(bench_udp_window *window, bench_stats *stats, uint64_t now_us);
+int bench_udp_window_receive(bench_udp_window *window, bench_stats *stats, uint32_t sequence,
+    unsigned int bytes, uint64_t now_us);
+void bench_udp_window_expire(bench_udp_window *window, bench_stats *stats, uint64_t now_us);
+
+int bench_nanoev_udp_server_run(const bench_config *config);
+int bench_nanoev_udp_client_run(const bench_config *config);
+int bench_libevent_udp_server_run(const bench_config *config);
+int bench_libevent_udp_client_run(const bench_config *config);
+
+#endif
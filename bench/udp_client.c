@@ -0,0 +1,405 @@
+#include "udp.h"
+#include "clock.h"
+#include "protocol.h"
+#include "report.h"
+#include "stats.h"
+#include "nanoev.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+# define WIN32_LEAN_AND_MEAN
+# include <windows.h>
+#else
+# include <signal.h>
+#endif
+
+#define UDP_CLIENT_EXPIRE_MS 50
+
+typedef struct udp_client udp_client;
+typedef struct udp_client_sock udp_client_sock;
+
+struct udp_client_sock {
+    udp_client *client;
+    nanoev_event *udp;
+    unsigned char *out;              /* datagram being written */
+    unsigned char *in;
+    unsigned int in_size;
+    bench_udp_window window;
+    unsigned int to_send;            /* datagrams waiting for the write */
+    int writing;
+    int closed;
+};
+
+struct udp_client {
+    const bench_config *config;
+    nanoev_loop *loop;
+    nanoev_event *async;
+    nanoev_event *stop_timer;
+    nanoev_event *report_timer;
+    nanoev_event *expire_timer;
+    udp_client_sock *sockets;
+    unsigned int active_sockets;
+    unsigned int frame_size;
+    int stopping;
+    bench_stats stats;
+    bench_stats previous;
+    uint64_t previous_us;
+    uint64_t deadline_us;
+};
+
+static nanoev_event *signal_async;
+
+static void on_signal_async(nanoev_event *async);
+static int install_signal_handler(nanoev_event *async);
+static void sock_close(udp_client_sock *sock);
+static int sock_send(udp_client_sock *sock);
+static void sock_fail(udp_client_sock *sock);
+static void on_read(nanoev_event *udp, int status, void *buf, unsigned int bytes,
+    const struct nanoev_addr *from_addr);
+static void on_write(nanoev_event *udp, int status, void *buf, unsigned int bytes);
+static void on_expire(nanoev_event *timer);
+static void on_stop(nanoev_event *timer);
+static void on_report(nanoev_event *timer);
+
+#ifdef _WIN32
+static BOOL WINAPI ctrl_handler(DWORD type)
+{
+    (void)type;
+    if (signal_async)
+        nanoev_async_send(signal_async);
+    return TRUE;
+}
+#else
+static void sigint_handler(int sig)
+{
+    (void)sig;
+    if (signal_async)
+        nanoev_async_send(signal_async);
+}
+#endif
+
+int bench_nanoev_udp_client_run(const bench_config *config)
+{
+    udp_client client;
+    struct nanoev_addr addr;
+    nanoev_timeval interval;
+    nanoev_timeval duration;
+    nanoev_timeval expire;
+    unsigned int i;
+    int ret;
+
+    memset(&client, 0, sizeof(client));
+    client.config = config;
+    client.frame_size = BENCH_FRAME_HEADER_SIZE + config->message_size;
+    bench_stats_init(&client.stats);
+    bench_stats_init(&client.previous);
+    if (bench_stats_enable_latency(&client.stats, config->latency_digits) != 0) {
+        fprintf(stderr, "client setup failed: unable to allocate latency histogram\n");
+        return 1;
+    }
+
+    ret = nanoev_init();
+    if (ret != NANOEV_SUCCESS) {
+        fprintf(stderr, "client setup failed: nanoev_init returned %d\n", ret);
+        bench_stats_free(&client.stats);
+        return 1;
+    }
+
+    client.loop = nanoev_loop_new(NULL);
+    if (!client.loop) {
+        fprintf(stderr, "client setup failed: unable to create loop\n");
+        goto fail;
+    }
+    if (config->busy_poll) {
+        nanoev_timeval budget;
+        budget.tv_sec = 0;
+        budget.tv_usec = config->busy_poll;
+        if (nanoev_loop_set_busy_poll(client.loop, &budget) != NANOEV_SUCCESS) {
+            fprintf(stderr, "client setup failed: unable to enable busy polling\n");
+            goto fail;
+        }
+    }
+
+    client.async = nanoev_event_new(nanoev_event_async, client.loop, NULL);
+    client.stop_timer = nanoev_event_new(nanoev_event_timer, client.loop, &client);
+    client.report_timer = nanoev_event_new(nanoev_event_timer, client.loop, &client);
+    client.expire_timer = nanoev_event_new(nanoev_event_timer, client.loop, &client);
+    if (!client.async || !client.stop_timer || !client.report_timer || !client.expire_timer) {
+        fprintf(stderr, "client setup failed: unable to create control events\n");
+        goto fail;
+    }
+    if (nanoev_async_start(client.async, on_signal_async) != NANOEV_SUCCESS) {
+        fprintf(stderr, "client setup failed: unable to start signal async\n");
+        goto fail;
+    }
+    if (install_signal_handler(client.async)) {
+        fprintf(stderr, "client setup failed: unable to install signal handler\n");
+        goto fail;
+    }
+
+    client.sockets = (udp_client_sock*)calloc(config->connections, sizeof(*client.sockets));
+    if (!client.sockets) {
+        fprintf(stderr, "client setup failed: unable to allocate %u sockets\n", config->connections);
+        goto fail;
+    }
+    if (nanoev_addr_init(&addr, config->family == bench_family_ipv6 ? NANOEV_AF_INET6 : NANOEV_AF_INET,
+        config->host, config->port) != NANOEV_SUCCESS) {
+        fprintf(stderr, "client setup failed: invalid address %s:%u\n",
+            config->host, (unsigned int)config->port);
+        goto fail;
+    }
+
+    for (i = 0; i < config->connections; i++) {
+        udp_client_sock *sock = &client.sockets[i];
+
+        sock->client = &client;
+        /* one spare byte so an oversized reply is caught rather than truncated */
+        sock->in_size = client.frame_size + 1;
+        sock->out = (unsigned char*)malloc(client.frame_size);
+        sock->in = (unsigned char*)malloc(sock->in_size);
+        if (!sock->out || !sock->in || bench_udp_window_init(&sock->window, config->pipeline) != 0) {
+            fprintf(stderr, "client setup failed: unable to allocate socket %u buffers\n", i);
+            goto fail;
+        }
+        sock->udp = nanoev_event_new(nanoev_event_udp, client.loop, sock);
+        if (!sock->udp) {
+            fprintf(stderr, "client setup failed: unable to allocate UDP event for socket %u\n", i);
+            goto fail;
+        }
+        if (nanoev_udp_connect(sock->udp, &addr) != NANOEV_SUCCESS
+            || nanoev_udp_read(sock->udp, sock->in, sock->in_size, on_read) != NANOEV_SUCCESS) {
+            fprintf(stderr, "client setup failed: socket %u setup failed, socket_error=%d\n",
+                i, nanoev_udp_error(sock->udp));
+            goto fail;
+        }
+        client.active_sockets++;
+    }
+
+    interval.tv_sec = config->report_interval;
+    interval.tv_usec = 0;
+    duration.tv_sec = config->duration + 1;
+    duration.tv_usec = 0;
+    expire.tv_sec = 0;
+    expire.tv_usec = UDP_CLIENT_EXPIRE_MS * 1000;
+    if (nanoev_timer_add(client.report_timer, interval, 1, on_report) != NANOEV_SUCCESS
+        || nanoev_timer_add(client.expire_timer, expire, 1, on_expire) != NANOEV_SUCCESS) {
+        fprintf(stderr, "client setup failed: unable to start report timer\n");
+        goto fail;
+    }
+    if (nanoev_timer_add(client.stop_timer, duration, 0, on_stop) != NANOEV_SUCCESS) {
+        fprintf(stderr, "client setup failed: unable to start stop timer\n");
+        goto fail;
+    }
+
+    client.previous_us = bench_time_us();
+    client.deadline_us = client.previous_us + ((uint64_t)config->duration * 1000000ULL);
+    printf("udp client sending to %s:%u sockets=%u duration=%us message_size=%u pipeline=%u\n",
+        config->host, (unsigned int)config->port, config->connections, config->duration, config->message_size,
+        config->pipeline);
+    bench_stats_print_delta_header("client", 0);
+
+    /* fill every window; each reply then sends one more datagram */
+    for (i = 0; i < config->connections; i++) {
+        client.sockets[i].to_send = config->pipeline;
+        if (sock_send(&client.sockets[i]) != 0)
+            sock_fail(&client.sockets[i]);
+    }
+
+    ret = nanoev_loop_run(client.loop);
+    if (ret != NANOEV_SUCCESS)
+        goto fail;
+
+    bench_stats_print_total("client", &client.stats, (uint64_t)config->duration * 1000ULL, 0);
+    bench_stats_print_datagrams(&client.stats);
+    ret = bench_report_write(config, "client", &client.stats, NULL, (uint64_t)config->duration * 1000ULL);
+
+    for (i = 0; i < config->connections; i++)
+        sock_close(&client.sockets[i]);
+    free(client.sockets);
+    nanoev_event_free(client.expire_timer);
+    nanoev_event_free(client.report_timer);
+    nanoev_event_free(client.stop_timer);
+    nanoev_event_free(client.async);
+    nanoev_loop_free(client.loop);
+    bench_stats_free(&client.stats);
+    nanoev_term();
+    return ret ? 1 : 0;
+
+fail:
+    if (client.sockets) {
+        for (i = 0; i < config->connections; i++)
+            sock_close(&client.sockets[i]);
+        free(client.sockets);
+    }
+    if (client.expire_timer)
+        nanoev_event_free(client.expire_timer);
+    if (client.report_timer)
+        nanoev_event_free(client.report_timer);
+    if (client.stop_timer)
+        nanoev_event_free(client.stop_timer);
+    if (client.async)
+        nanoev_event_free(client.async);
+    if (client.loop)
+        nanoev_loop_free(client.loop);
+    bench_stats_free(&client.stats);
+    nanoev_term();
+    return 1;
+}
+
+static void on_signal_async(nanoev_event *async)
+{
+    nanoev_loop_break(nanoev_event_loop(async));
+}
+
+static int install_signal_handler(nanoev_event *async)
+{
+    signal_async = async;
+#ifdef _WIN32
+    return SetConsoleCtrlHandler(ctrl_handler, TRUE) ? 0 : -1;
+#else
+    signal(SIGINT, sigint_handler);
+    return 0;
+#endif
+}
+
+static void sock_close(udp_client_sock *sock)
+{
+    if (sock->closed)
+        return;
+    sock->closed = 1;
+    if (sock->udp)
+        nanoev_event_free(sock->udp);
+    sock->udp = NULL;
+    free(sock->out);
+    free(sock->in);
+    sock->out = NULL;
+    sock->in = NULL;
+    bench_udp_window_free(&sock->window);
+    if (sock->client && sock->client->active_sockets > 0) {
+        sock->client->active_sockets--;
+        if (!sock->client->active_sockets)
+            nanoev_loop_break(sock->client->loop);
+    }
+}
+
+static void sock_fail(udp_client_sock *sock)
+{
+    bench_stats_record_error(&sock->client->stats);
+    sock_close(sock);
+}
+
+/* Send the next waiting datagram unless a write is already pending. */
+static int sock_send(udp_client_sock *sock)
+{
+    udp_client *client = sock->client;
+    uint32_t sequence;
+    unsigned int i, inflight;
+
+    if (sock->writing || !sock->to_send)
+        return 0;
+
+    inflight = sock->window.inflight;
+    sequence = bench_udp_window_send(&sock->window, &client->stats, bench_time_us());
+    if (sock->window.inflight == inflight) {
+        /* this one took the slot of a datagram now counted lost; replace that too */
+        sock->to_send++;
+    }
+    bench_frame_write_header(sock->out, client->config->message_size, sequence);
+    for (i = BENCH_FRAME_HEADER_SIZE; i < client->frame_size; i++)
+        sock->out[i] = (unsigned char)(sequence + i);
+
+    sock->to_send--;
+    sock->writing = 1;
+    return nanoev_udp_write(sock->udp, sock->out, client->frame_size, NULL, on_write) == NANOEV_SUCCESS ? 0 : -1;
+}
+
+static void on_write(nanoev_event *udp, int status, void *buf, unsigned int bytes)
+{
+    udp_client_sock *sock = (udp_client_sock*)nanoev_event_userdata(udp);
+    (void)buf;
+    (void)bytes;
+
+    sock->writing = 0;
+    if (status || sock_send(sock) != 0)
+        sock_fail(sock);
+}
+
+static void on_read(nanoev_event *udp, int status, void *buf, unsigned int bytes,
+    const struct nanoev_addr *from_addr)
+{
+    udp_client_sock *sock = (udp_client_sock*)nanoev_event_userdata(udp);
+    udp_client *client = sock->client;
+    const unsigned char *frame = (const unsigned char*)buf;
+    uint64_t now;
+    (void)from_addr;
+
+    if (status) {
+        /* ICMP port unreachable shows up here as ECONNREFUSED */
+        if (!client->stopping)
+            sock_fail(sock);
+        else
+            sock_close(sock);
+        return;
+    }
+
+    if (bytes != client->frame_size || bench_frame_payload_size(frame) != client->config->message_size) {
+        bench_stats_record_error(&client->stats);
+    } else {
+        now = bench_time_us();
+        if (bench_udp_window_receive(&sock->window, &client->stats, bench_frame_sequence(frame), bytes, now))
+            sock->to_send++;
+        if (client->stopping || now >= client->deadline_us) {
+            client->stopping = 1;
+            sock_close(sock);
+            return;
+        }
+    }
+
+    if (nanoev_udp_read(udp, sock->in, sock->in_size, on_read) != NANOEV_SUCCESS || sock_send(sock) != 0)
+        sock_fail(sock);
+}
+
+static void on_expire(nanoev_event *timer)
+{
+    udp_client *client = (udp_client*)nanoev_event_userdata(timer);
+    uint64_t now = bench_time_us();
+    unsigned int i, lost;
+
+    /* give up on datagrams that went unanswered and refill their windows */
+    for (i = 0; i < client->config->connections; i++) {
+        udp_client_sock *sock = &client->sockets[i];
+
+        if (sock->closed)
+            continue;
+        lost = sock->window.inflight;
+        bench_udp_window_expire(&sock->window, &client->stats, now);
+        if (sock->window.inflight == lost)
+            continue;
+        sock->to_send += lost;
+        if (sock_send(sock) != 0)
+            sock_fail(sock);
+    }
+}
+
+static void on_stop(nanoev_event *timer)
+{
+    udp_client *client = (udp_client*)nanoev_event_userdata(timer);
+    unsigned int i;
+
+    client->stopping = 1;
+    for (i = 0; i < client->config->connections; i++)
+        sock_close(&client->sockets[i]);
+}
+
+static void on_report(nanoev_event *timer)
+{
+    udp_client *client = (udp_client*)nanoev_event_userdata(timer);
+    uint64_t now = bench_time_us();
+    uint64_t elapsed_ms = (now - client->previous_us) / 1000ULL;
+
+    bench_stats_print_delta("client", &client->stats, &client->previous, elapsed_ms, 0);
+    bench_stats_snapshot(&client->previous, &client->stats);
+    client->previous_us = now;
+}
@@ -0,0 +1,255 @@
+#include "udp.h"
+#include "clock.h"
+#include "protocol.h"
+#include "report.h"
+#include "stats.h"
+#include "nanoev.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+# define WIN32_LEAN_AND_MEAN
+# include <windows.h>
+#else
+# include <signal.h>
+#endif
+
+typedef struct udp_server {
+    const bench_config *config;
+    nanoev_loop *loop;
+    nanoev_event *udp;
+    nanoev_event *async;
+    nanoev_event *report_timer;
+    unsigned char *buf;
+    unsigned int buf_size;
+    struct nanoev_addr peer;
+    bench_stats stats;
+    bench_stats previous;
+    bench_timeval started;
+    uint64_t previous_us;
+} udp_server;
+
+static nanoev_event *signal_async;
+
+static void on_signal_async(nanoev_event *async);
+static int install_signal_handler(nanoev_event *async);
+static int server_read_next(udp_server *server);
+static void on_read(nanoev_event *udp, int status, void *buf, unsigned int bytes,
+    const struct nanoev_addr *from_addr);
+static void on_write(nanoev_event *udp, int status, void *buf, unsigned int bytes);
+static void on_report(nanoev_event *timer);
+
+#ifdef _WIN32
+static BOOL WINAPI ctrl_handler(DWORD type)
+{
+    (void)type;
+    if (signal_async)
+        nanoev_async_send(signal_async);
+    return TRUE;
+}
+#else
+static void sigint_handler(int sig)
+{
+    (void)sig;
+    if (signal_async)
+        nanoev_async_send(signal_async);
+}
+#endif
+
+int bench_nanoev_udp_server_run(const bench_config *config)
+{
+    udp_server server;
+    struct nanoev_addr addr;
+    nanoev_timeval interval;
+    int ret;
+
+    memset(&server, 0, sizeof(server));
+    server.config = config;
+    bench_stats_init(&server.stats);
+    bench_stats_init(&server.previous);
+
+    ret = nanoev_init();
+    if (ret != NANOEV_SUCCESS) {
+        fprintf(stderr, "server setup failed: nanoev_init returned %d\n", ret);
+        return 1;
+    }
+
+    server.loop = nanoev_loop_new(NULL);
+    if (!server.loop) {
+        fprintf(stderr, "server setup failed: unable to create loop\n");
+        goto fail;
+    }
+    if (config->busy_poll) {
+        nanoev_timeval budget;
+        budget.tv_sec = 0;
+        budget.tv_usec = config->busy_poll;
+        if (nanoev_loop_set_busy_poll(server.loop, &budget) != NANOEV_SUCCESS) {
+            fprintf(stderr, "server setup failed: unable to enable busy polling\n");
+            goto fail;
+        }
+    }
+
+    /* room for a datagram longer than expected, so it is caught rather than truncated */
+    server.buf_size = BENCH_FRAME_HEADER_SIZE + config->message_size + 1;
+    server.buf = (unsigned char*)malloc(server.buf_size);
+    server.udp = nanoev_event_new(nanoev_event_udp, server.loop, &server);
+    server.async = nanoev_event_new(nanoev_event_async, server.loop, NULL);
+    server.report_timer = nanoev_event_new(nanoev_event_timer, server.loop, &server);
+    if (!server.buf || !server.udp || !server.async || !server.report_timer) {
+        fprintf(stderr, "server setup failed: unable to create control events\n");
+        goto fail;
+    }
+
+    if (nanoev_addr_init(&addr, config->family == bench_family_ipv6 ? NANOEV_AF_INET6 : NANOEV_AF_INET,
+        config->host, config->port) != NANOEV_SUCCESS) {
+        fprintf(stderr, "server setup failed: invalid address %s:%u\n",
+            config->host, (unsigned int)config->port);
+        goto fail;
+    }
+    if (nanoev_udp_bind(server.udp, &addr) != NANOEV_SUCCESS) {
+        fprintf(stderr, "server setup failed: bind failed on %s:%u, socket_error=%d\n",
+            config->host, (unsigned int)config->port, nanoev_udp_error(server.udp));
+        goto fail;
+    }
+    if (server_read_next(&server) != 0) {
+        fprintf(stderr, "server setup failed: read start failed, socket_error=%d\n",
+            nanoev_udp_error(server.udp));
+        goto fail;
+    }
+    if (nanoev_async_start(server.async, on_signal_async) != NANOEV_SUCCESS) {
+        fprintf(stderr, "server setup failed: unable to start signal async\n");
+        goto fail;
+    }
+    if (install_signal_handler(server.async)) {
+        fprintf(stderr, "server setup failed: unable to install signal handler\n");
+        goto fail;
+    }
+
+    interval.tv_sec = config->report_interval;
+    interval.tv_usec = 0;
+    if (nanoev_timer_add(server.report_timer, interval, 1, on_report) != NANOEV_SUCCESS) {
+        fprintf(stderr, "server setup failed: unable to start report timer\n");
+        goto fail;
+    }
+
+    bench_now(&server.started);
+    server.previous_us = bench_time_us();
+    printf("udp server listening on %s:%u message_size=%u\n",
+        config->host, (unsigned int)config->port, config->message_size);
+    printf("press Ctrl+C to stop\n");
+    bench_stats_print_delta_header("server", 1);
+
+    ret = nanoev_loop_run(server.loop);
+    if (ret != NANOEV_SUCCESS) {
+        fprintf(stderr, "server failed: loop returned %d\n", ret);
+        goto fail;
+    }
+
+    {
+        bench_timeval ended;
+        uint64_t elapsed_ms;
+        bench_now(&ended);
+        elapsed_ms = bench_time_diff_ms(&server.started, &ended);
+        bench_stats_print_total("server", &server.stats, elapsed_ms, 1);
+        ret = bench_report_write(config, "server", &server.stats, NULL, elapsed_ms);
+    }
+
+    nanoev_event_free(server.report_timer);
+    nanoev_event_free(server.async);
+    nanoev_event_free(server.udp);
+    nanoev_loop_free(server.loop);
+    free(server.buf);
+    nanoev_term();
+    return ret ? 1 : 0;
+
+fail:
+    if (server.report_timer)
+        nanoev_event_free(server.report_timer);
+    if (server.async)
+        nanoev_event_free(server.async);
+    if (server.udp)
+        nanoev_event_free(server.udp);
+    if (server.loop)
+        nanoev_loop_free(server.loop);
+    free(server.buf);
+    nanoev_term();
+    return 1;
+}
+
+static void on_signal_async(nanoev_event *async)
+{
+    nanoev_loop_break(nanoev_event_loop(async));
+}
+
+static int install_signal_handler(nanoev_event *async)
+{
+    signal_async = async;
+#ifdef _WIN32
+    return SetConsoleCtrlHandler(ctrl_handler, TRUE) ? 0 : -1;
+#else
+    signal(SIGINT, sigint_handler);
+    return 0;
+#endif
+}
+
+static int server_read_next(udp_server *server)
+{
+    return nanoev_udp_read(server->udp, server->buf, server->buf_size, on_read) == NANOEV_SUCCESS ? 0 : -1;
+}
+
+static void on_read(nanoev_event *udp, int status, void *buf, unsigned int bytes,
+    const struct nanoev_addr *from_addr)
+{
+    udp_server *server = (udp_server*)nanoev_event_userdata(udp);
+
+    if (status) {
+        fprintf(stderr, "server failed: read error, socket_error=%d\n", status);
+        bench_stats_record_io_error(&server->stats);
+        nanoev_loop_break(server->loop);
+        return;
+    }
+
+    /* echo the datagram from the same buffer, then read the next one */
+    if (bytes < BENCH_FRAME_HEADER_SIZE
+        || bench_frame_payload_size((const unsigned char*)buf) != bytes - BENCH_FRAME_HEADER_SIZE
+        || bytes - BENCH_FRAME_HEADER_SIZE > server->config->message_size) {
+        bench_stats_record_io_error(&server->stats);
+    } else {
+        bench_stats_record_request(&server->stats, bytes);
+        server->peer = *from_addr;
+        if (nanoev_udp_write(udp, buf, bytes, &server->peer, on_write) == NANOEV_SUCCESS)
+            return;
+        bench_stats_record_io_error(&server->stats);
+    }
+
+    if (server_read_next(server) != 0) {
+        fprintf(stderr, "server failed: read start failed, socket_error=%d\n", nanoev_udp_error(udp));
+        nanoev_loop_break(server->loop);
+    }
+}
+
+static void on_write(nanoev_event *udp, int status, void *buf, unsigned int bytes)
+{
+    udp_server *server = (udp_server*)nanoev_event_userdata(udp);
+    (void)buf;
+    (void)bytes;
+
+    if (status)
+        bench_stats_record_io_error(&server->stats);
+    if (server_read_next(server) != 0) {
+        fprintf(stderr, "server failed: read start failed, socket_error=%d\n", nanoev_udp_error(udp));
+        nanoev_loop_break(server->loop);
+    }
+}
+
+static void on_report(nanoev_event *timer)
+{
+    udp_server *server = (udp_server*)nanoev_event_userdata(timer);
+    uint64_t now = bench_time_us();
+    uint64_t elapsed_ms = (now - server->previous_us) / 1000ULL;
+
+    bench_stats_print_delta("server", &server->stats, &server->previous, elapsed_ms, 1);
+    bench_stats_snapshot(&server->previous, &server->stats);
+    server->previous_us = now;
+}
@@ -0,0 +1,547 @@
+#include "worker.h"
+#include "clock.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+# include <process.h>
+#else
+# include <signal.h>
+#endif
+
+static nanoev_event *signal_async;
+
+static void mutex_init(bench_mutex *mutex);
+static void mutex_free(bench_mutex *mutex);
+static void mutex_lock(bench_mutex *mutex);
+static void mutex_unlock(bench_mutex *mutex);
+static int thread_start(bench_worker *worker);
+static void thread_join(bench_worker *worker);
+static void worker_main(bench_worker *worker);
+static void worker_publish(bench_worker *worker);
+static void on_control(nanoev_event *async);
+static void on_signal(nanoev_event *async);
+static void on_notify(nanoev_event *async);
+static void on_report(nanoev_event *timer);
+static void workers_stop(bench_workers *workers);
+static void workers_sample_idle(bench_workers *workers, const bench_stats *merged, uint64_t now);
+static int install_signal_handler(nanoev_event *async);
+
+#ifdef _WIN32
+static BOOL WINAPI ctrl_handler(DWORD type)
+{
+    (void)type;
+    if (signal_async)
+        nanoev_async_send(signal_async);
+    return TRUE;
+}
+
+static unsigned __stdcall thread_entry(void *arg)
+{
+    worker_main((bench_worker*)arg);
+    return 0;
+}
+#else
+static void sigint_handler(int sig)
+{
+    (void)sig;
+    if (signal_async)
+        nanoev_async_send(signal_async);
+}
+
+static void* thread_entry(void *arg)
+{
+    worker_main((bench_worker*)arg);
+    return NULL;
+}
+#endif
+
+int bench_workers_init(bench_workers *workers, const bench_config *config, const bench_worker_ops *ops,
+    const char *prefix, int show_error_breakdown)
+{
+    unsigned int i;
+
+    memset(workers, 0, sizeof(*workers));
+    workers->config = config;
+    workers->ops = ops;
+    workers->prefix = prefix;
+    workers->show_error_breakdown = show_error_breakdown;
+    workers->count = config->threads;
+    bench_stats_init(&workers->total);
+    bench_stats_init(&workers->previous);
+
+    workers->workers = (bench_worker*)calloc(workers->count, sizeof(*workers->workers));
+    if (!workers->workers)
+        return -1;
+    for (i = 0; i < workers->count; i++) {
+        bench_worker *worker = &workers->workers[i];
+
+        worker->group = workers;
+        worker->index = i;
+        bench_stats_init(&worker->stats);
+        bench_stats_init(&worker->published);
+        if (config->role == bench_role_client
+            && bench_stats_enable_latency(&worker->stats, config->latency_digits) != 0)
+            return -1;
+        if (config->role == bench_role_client && config->rate
+            && bench_stats_enable_service_latency(&worker->stats, config->latency_digits) != 0)
+            return -1;
+        if (config->churn && bench_stats_enable_connect_latency(&worker->stats, config->latency_digits) != 0)
+            return -1;
+    }
+    if (config->role == bench_role_client
+        && bench_stats_enable_latency(&workers->total, config->latency_digits) != 0)
+        return -1;
+    if (config->role == bench_role_client && config->rate
+        && bench_stats_enable_service_latency(&workers->total, config->latency_digits) != 0)
+        return -1;
+    if (config->churn && bench_stats_enable_connect_latency(&workers->total, config->latency_digits) != 0)
+        return -1;
+    mutex_init(&workers->lock);
+    workers->lock_ready = 1;
+    return 0;
+}
+
+void bench_workers_free(bench_workers *workers)
+{
+    unsigned int i;
+
+    if (workers->workers) {
+        for (i = 0; i < workers->count; i++)
+            bench_stats_free(&workers->workers[i].stats);
+        free(workers->workers);
+        workers->workers = NULL;
+    }
+    bench_stats_free(&workers->total);
+    if (workers->lock_ready)
+        mutex_free(&workers->lock);
+    workers->lock_ready = 0;
+}
+
+int bench_workers_run(bench_workers *workers)
+{
+    const char *prefix = workers->prefix;
+    nanoev_timeval interval;
+    unsigned int started = 0;
+    unsigned int i;
+    int ret;
+
+    ret = nanoev_init();
+    if (ret != NANOEV_SUCCESS) {
+        fprintf(stderr, "%s setup failed: nanoev_init returned %d\n", prefix, ret);
+        return -1;
+    }
+    /* cleared once the control loop is ready */
+    workers->failed = 1;
+
+    workers->loop = nanoev_loop_new(NULL);
+    if (!workers->loop) {
+        fprintf(stderr, "%s setup failed: unable to create control loop\n", prefix);
+        goto done;
+    }
+    workers->signal = nanoev_event_new(nanoev_event_async, workers->loop, workers);
+    workers->notify = nanoev_event_new(nanoev_event_async, workers->loop, workers);
+    workers->report_timer = nanoev_event_new(nanoev_event_timer, workers->loop, workers);
+    if (!workers->signal || !workers->notify || !workers->report_timer
+        || nanoev_async_start(workers->signal, on_signal) != NANOEV_SUCCESS
+        || nanoev_async_start(workers->notify, on_notify) != NANOEV_SUCCESS) {
+        fprintf(stderr, "%s setup failed: unable to create control events\n", prefix);
+        goto done;
+    }
+    if (install_signal_handler(workers->signal)) {
+        fprintf(stderr, "%s setup failed: unable to install signal handler\n", prefix);
+        goto done;
+    }
+    interval.tv_sec = workers->config->report_interval;
+    interval.tv_usec = 0;
+    if (nanoev_timer_add(workers->report_timer, interval, 1, on_report) != NANOEV_SUCCESS) {
+        fprintf(stderr, "%s setup failed: unable to start report timer\n", prefix);
+        goto done;
+    }
+
+    workers->failed = 0;
+    if (workers->config->idle)
+        bench_memory_get(&workers->idle_baseline);
+    workers->previous_us = bench_time_us();
+    for (i = 0; i < workers->count; i++) {
+        bench_worker *worker = &workers->workers[i];
+
+        if (workers->failed || thread_start(worker) != 0) {
+            if (!workers->failed)
+                fprintf(stderr, "%s setup failed: unable to start thread %u\n", prefix, i);
+            /* never ran, so there is nothing to wait for */
+            worker->finished = 1;
+            worker->failed = 1;
+            workers->failed = 1;
+            continue;
+        }
+        started++;
+    }
+    if (workers->failed)
+        workers_stop(workers);
+    /* runs until every worker has finished */
+    if (started)
+        nanoev_loop_run(workers->loop);
+
+done:
+    for (i = 0; i < workers->count; i++)
+        thread_join(&workers->workers[i]);
+    for (i = 0; i < workers->count; i++) {
+        if (workers->workers[i].failed)
+            workers->failed = 1;
+        bench_stats_merge(&workers->total, &workers->workers[i].stats);
+    }
+    install_signal_handler(NULL);
+    if (workers->report_timer)
+        nanoev_event_free(workers->report_timer);
+    if (workers->notify)
+        nanoev_event_free(workers->notify);
+    if (workers->signal)
+        nanoev_event_free(workers->signal);
+    if (workers->loop)
+        nanoev_loop_free(workers->loop);
+    workers->report_timer = workers->notify = workers->signal = NULL;
+    workers->loop = NULL;
+    nanoev_term();
+    return workers->failed ? -1 : 0;
+}
+
+int bench_workers_idle(const bench_workers *workers, bench_idle *idle)
+{
+    const bench_idle_sample *first = &workers->idle_first;
+    const bench_idle_sample *last = &workers->idle_last;
+
+    memset(idle, 0, sizeof(*idle));
+    if (!first->time_us || last->time_us <= first->time_us)
+        return -1;
+    idle->connections = last->connections_open;
+    idle->timers = last->loop_timers;
+    idle->rss_bytes = last->memory.rss_bytes;
+    idle->rss_baseline_bytes = workers->idle_baseline.rss_bytes;
+    idle->slab_delta_bytes = (int64_t)last->memory.slab_bytes - (int64_t)workers->idle_baseline.slab_bytes;
+    idle->tcp_sockets = last->memory.tcp_sockets;
+    idle->tcp_buffer_bytes = last->memory.tcp_buffer_bytes;
+    idle->seconds = (double)(last->time_us - first->time_us) / 1000000.0;
+    idle->iterations = last->loop_iterations - first->loop_iterations;
+    idle->poll_usec = last->loop_poll_usec - first->loop_poll_usec;
+    idle->callback_usec = last->loop_callback_usec - first->loop_callback_usec;
+    return 0;
+}
+
+unsigned int bench_worker_share(const bench_worker *worker, unsigned int count)
+{
+    unsigned int threads = worker->group->count;
+
+    return count / threads + (worker->index < count % threads ? 1 : 0);
+}
+
+static void worker_main(bench_worker *worker)
+{
+    bench_workers *workers = worker->group;
+    const bench_config *config = workers->config;
+    int failed = 1;
+    int pending;
+
+    worker->loop = nanoev_loop_new(worker);
+    if (!worker->loop) {
+        fprintf(stderr, "%s setup failed: unable to create loop on thread %u\n", workers->prefix, worker->index);
+        goto finish;
+    }
+    if (config->busy_poll) {
+        nanoev_timeval budget;
+        budget.tv_sec = 0;
+        budget.tv_usec = config->busy_poll;
+        if (nanoev_loop_set_busy_poll(worker->loop, &budget) != NANOEV_SUCCESS) {
+            fprintf(stderr, "%s setup failed: unable to enable busy polling\n", workers->prefix);
+            goto finish;
+        }
+    }
+    worker->control = nanoev_event_new(nanoev_event_async, worker->loop, worker);
+    if (!worker->control || nanoev_async_start(worker->control, on_control) != NANOEV_SUCCESS) {
+        fprintf(stderr, "%s setup failed: unable to create control event on thread %u\n",
+            workers->prefix, worker->index);
+        goto finish;
+    }
+    if (workers->ops->start(worker) != 0)
+        goto finish;
+
+    /* requests made before the control event existed were never sent */
+    mutex_lock(&workers->lock);
+    worker->started = 1;
+    pending = worker->snapshot_requested || worker->stop_requested;
+    mutex_unlock(&workers->lock);
+    if (pending)
+        nanoev_async_send(worker->control);
+
+    failed = nanoev_loop_run(worker->loop) != NANOEV_SUCCESS;
+
+finish:
+    workers->ops->finish(worker);
+
+    mutex_lock(&workers->lock);
+    worker_publish(worker);
+    worker->started = 0;
+    worker->finished = 1;
+    worker->failed = failed;
+    mutex_unlock(&workers->lock);
+
+    /* nothing sends to the control event once finished is set */
+    if (worker->control)
+        nanoev_event_free(worker->control);
+    worker->control = NULL;
+    if (worker->loop)
+        nanoev_loop_free(worker->loop);
+    worker->loop = NULL;
+    nanoev_async_send(workers->notify);
+}
+
+/* Called with the lock held. */
+static void worker_publish(bench_worker *worker)
+{
+    nanoev_loop_stats loop_stats;
+
+    if (worker->loop) {
+        nanoev_loop_get_stats(worker->loop, &loop_stats);
+        worker->stats.loop_iterations = loop_stats.iterations;
+        worker->stats.loop_poll_usec = loop_stats.poll_usec;
+        worker->stats.loop_callback_usec = loop_stats.callback_usec;
+        worker->stats.loop_timers = loop_stats.timer_count;
+    }
+    bench_stats_snapshot(&worker->published, &worker->stats);
+    worker->snapshot_requested = 0;
+}
+
+static void on_control(nanoev_event *async)
+{
+    bench_worker *worker = (bench_worker*)nanoev_event_userdata(async);
+    bench_workers *workers = worker->group;
+    int replied = 0;
+    int stop;
+
+    mutex_lock(&workers->lock);
+    if (worker->snapshot_requested) {
+        worker_publish(worker);
+        replied = 1;
+    }
+    stop = worker->stop_requested;
+    worker->stop_requested = 0;
+    mutex_unlock(&workers->lock);
+
+    if (replied)
+        nanoev_async_send(workers->notify);
+    if (stop)
+        workers->ops->stop(worker);
+}
+
+static void on_signal(nanoev_event *async)
+{
+    workers_stop((bench_workers*)nanoev_event_userdata(async));
+}
+
+static void on_notify(nanoev_event *async)
+{
+    bench_workers *workers = (bench_workers*)nanoev_event_userdata(async);
+    bench_stats merged;
+    unsigned int finished = 0;
+    unsigned int answered = 0;
+    int failed = 0;
+    unsigned int i;
+    uint64_t now;
+
+    bench_stats_init(&merged);
+    mutex_lock(&workers->lock);
+    for (i = 0; i < workers->count; i++) {
+        bench_worker *worker = &workers->workers[i];
+
+        if (worker->finished) {
+            finished++;
+            failed |= worker->failed;
+        }
+        if (!worker->snapshot_requested)
+            answered++;
+        bench_stats_merge(&merged, &worker->published);
+    }
+    mutex_unlock(&workers->lock);
+
+    if (workers->report_pending && answered == workers->count) {
+        now = bench_time_us();
+        bench_stats_print_delta(workers->prefix, &merged, &workers->previous,
+            (now - workers->previous_us) / 1000ULL, workers->show_error_breakdown);
+        bench_stats_snapshot(&workers->previous, &merged);
+        workers->previous_us = now;
+        workers->report_pending = 0;
+        if (workers->config->idle && !workers->stopping)
+            workers_sample_idle(workers, &merged, now);
+    }
+    if (failed && !workers->stopping) {
+        /* one worker failed to start or run; bring the others down too */
+        workers->failed = 1;
+        workers_stop(workers);
+    }
+    if (finished == workers->count)
+        nanoev_loop_break(workers->loop);
+}
+
+static void on_report(nanoev_event *timer)
+{
+    bench_workers *workers = (bench_workers*)nanoev_event_userdata(timer);
+    unsigned int i;
+
+    if (workers->report_pending)
+        return;
+    workers->report_pending = 1;
+    mutex_lock(&workers->lock);
+    for (i = 0; i < workers->count; i++) {
+        bench_worker *worker = &workers->workers[i];
+
+        if (worker->finished)
+            continue;
+        worker->snapshot_requested = 1;
+        /* sent under the lock, so the worker cannot free the event meanwhile */
+        if (worker->started)
+            nanoev_async_send(worker->control);
+    }
+    mutex_unlock(&workers->lock);
+    on_notify(workers->notify);
+}
+
+static void workers_stop(bench_workers *workers)
+{
+    unsigned int i;
+
+    workers->stopping = 1;
+    mutex_lock(&workers->lock);
+    for (i = 0; i < workers->count; i++) {
+        bench_worker *worker = &workers->workers[i];
+
+        if (worker->finished)
+            continue;
+        worker->stop_requested = 1;
+        if (worker->started)
+            nanoev_async_send(worker->control);
+    }
+    mutex_unlock(&workers->lock);
+}
+
+/*
+ * --idle: the ramp is over once the open count holds for a whole interval.
+ * From then on every report with that many connections still open is kept as
+ * the latest sample, so a stop that closes them does not spoil the figures.
+ */
+static void workers_sample_idle(bench_workers *workers, const bench_stats *merged, uint64_t now)
+{
+    bench_idle_sample sample;
+    uint64_t previous_open = workers->idle_previous_open;
+
+    workers->idle_previous_open = merged->connections_open;
+    if (!merged->connections_open)
+        return;
+    if (workers->idle_first.time_us && merged->connections_open != workers->idle_first.connections_open)
+        return;
+    if (!workers->idle_first.time_us && merged->connections_open != previous_open)
+        return;
+
+    sample.time_us = now;
+    sample.connections_open = merged->connections_open;
+    sample.loop_iterations = merged->loop_iterations;
+    sample.loop_poll_usec = merged->loop_poll_usec;
+    sample.loop_callback_usec = merged->loop_callback_usec;
+    sample.loop_timers = merged->loop_timers;
+    bench_memory_get(&sample.memory);
+    if (!workers->idle_first.time_us)
+        workers->idle_first = sample;
+    workers->idle_last = sample;
+}
+
+static int install_signal_handler(nanoev_event *async)
+{
+    signal_async = async;
+    if (!async)
+        return 0;
+#ifdef _WIN32
+    return SetConsoleCtrlHandler(ctrl_handler, TRUE) ? 0 : -1;
+#else
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGINT, sigint_handler);
+    return 0;
+#endif
+}
+
+#ifdef _WIN32
+static void mutex_init(bench_mutex *mutex)
+{
+    InitializeCriticalSection(mutex);
+}
+
+static void mutex_free(bench_mutex *mutex)
+{
+    DeleteCriticalSection(mutex);
+}
+
+static void mutex_lock(bench_mutex *mutex)
+{
+    EnterCriticalSection(mutex);
+}
+
+static void mutex_unlock(bench_mutex *mutex)
+{
+    LeaveCriticalSection(mutex);
+}
+
+static int thread_start(bench_worker *worker)
+{
+    uintptr_t handle = _beginthreadex(NULL, 0, thread_entry, worker, 0, NULL);
+
+    if (!handle)
+        return -1;
+    worker->thread = (HANDLE)handle;
+    worker->thread_started = 1;
+    return 0;
+}
+
+static void thread_join(bench_worker *worker)
+{
+    if (!worker->thread_started)
+        return;
+    WaitForSingleObject(worker->thread, INFINITE);
+    CloseHandle(worker->thread);
+    worker->thread_started = 0;
+}
+#else
+static void mutex_init(bench_mutex *mutex)
+{
+    pthread_mutex_init(mutex, NULL);
+}
+
+static void mutex_free(bench_mutex *mutex)
+{
+    pthread_mutex_destroy(mutex);
+}
+
+static void mutex_lock(bench_mutex *mutex)
+{
+    pthread_mutex_lock(mutex);
+}
+
+static void mutex_unlock(bench_mutex *mutex)
+{
+    pthread_mutex_unlock(mutex);
+}
+
+static int thread_start(bench_worker *worker)
+{
+    if (pthread_create(&worker->thread, NULL, thread_entry, worker) != 0)
+        return -1;
+    worker->thread_started = 1;
+    return 0;
+}
+
+static void thread_join(bench_worker *worker)
+{
+    if (!worker->thread_started)
+        return;
+    pthread_join(worker->thread, NULL);
+    worker->thread_started = 0;
+}
+#endif
@@ -0,0 +1,108 @@
+#ifndef NANOEV_BENCH_WORKER_H
+#define NANOEV_BENCH_WORKER_H
+
+#include "tcp.h"
+#include "report.h"
+#include "stats.h"
+#include "nanoev.h"
+
+#ifdef _WIN32
+# define WIN32_LEAN_AND_MEAN
+# include <windows.h>
+typedef HANDLE bench_thread;
+typedef CRITICAL_SECTION bench_mutex;
+#else
+# include <pthread.h>
+typedef pthread_t bench_thread;
+typedef pthread_mutex_t bench_mutex;
+#endif
+
+typedef struct bench_worker bench_worker;
+typedef struct bench_workers bench_workers;
+
+/*
+ * Role hooks, each called on the worker's own thread. start sets the role up
+ * on worker->loop and returns nonzero on failure. stop asks a running role to
+ * wind down; the role must then break the loop. finish releases what start
+ * created once the loop has returned, whether or not start succeeded.
+ */
+typedef struct bench_worker_ops {
+    int (*start)(bench_worker *worker);
+    void (*stop)(bench_worker *worker);
+    void (*finish)(bench_worker *worker);
+} bench_worker_ops;
+
+struct bench_worker {
+    bench_workers *group;
+    unsigned int index;
+    void *role;                      /* role state, set before bench_workers_run() */
+    nanoev_loop *loop;
+    nanoev_event *control;           /* async: the main thread wants a snapshot or a stop */
+    bench_stats stats;               /* written only on the worker thread */
+    bench_thread thread;
+    int thread_started;
+    /* guarded by group->lock */
+    bench_stats published;           /* counters as of the last snapshot */
+    int started;
+    int snapshot_requested;
+    int stop_requested;
+    int finished;
+    int failed;
+};
+
+/* --idle: merged worker counters and process memory at one interval report. */
+typedef struct bench_idle_sample {
+    uint64_t time_us;
+    uint64_t connections_open;
+    uint64_t loop_iterations;
+    uint64_t loop_poll_usec;
+    uint64_t loop_callback_usec;
+    uint64_t loop_timers;
+    bench_memory memory;
+} bench_idle_sample;
+
+/*
+ * One nanoev loop per worker thread. The main thread runs a control loop that
+ * handles Ctrl+C, prints interval reports from snapshots the workers publish,
+ * and merges every worker's stats into total once they have all finished.
+ */
+struct bench_workers {
+    const bench_config *config;
+    const bench_worker_ops *ops;
+    const char *prefix;
+    int show_error_breakdown;
+    bench_worker *workers;
+    unsigned int count;
+    nanoev_loop *loop;
+    nanoev_event *signal;
+    nanoev_event *notify;            /* async: a worker published a snapshot or finished */
+    nanoev_event *report_timer;
+    bench_mutex lock;
+    int lock_ready;
+    int report_pending;
+    int stopping;
+    int failed;
+    bench_stats total;
+    bench_stats previous;
+    uint64_t previous_us;
+    bench_memory idle_baseline;      /* --idle: before any worker started */
+    bench_idle_sample idle_first;    /* first report once the open count held steady */
+    bench_idle_sample idle_last;     /* latest report with that many connections open */
+    uint64_t idle_previous_open;
+};
+
+int bench_workers_init(bench_workers *workers, const bench_config *config, const bench_worker_ops *ops,
+    const char *prefix, int show_error_breakdown);
+int bench_workers_run(bench_workers *workers);
+void bench_workers_free(bench_workers *workers);
+
+/*
+ * --idle: the figures between idle_first and idle_last. Returns nonzero when
+ * the run ended before two such reports were taken.
+ */
+int bench_workers_idle(const bench_workers *workers, bench_idle *idle);
+
+/* This worker's part of count items, spread as evenly as possible. */
+unsigned int bench_worker_share(const bench_worker *worker, unsigned int count);
+
+#endif
@@ -148,6 +148,143 @@ void nanoev_loop_now(
     nanoev_timeval *now
     );
 
+/*
+ * nanoev_loop_set_busy_poll
+ *   Spin on the poller before blocking when the loop would otherwise sleep.
+ *
+ * Parameters:
+ *   loop   - Loop to configure.
+ *   budget - Maximum spin time before falling back to a blocking wait, less
+ *            than one second. NULL or zero disables busy polling.
+ *
+ * Returns:
+ *   NANOEV_SUCCESS on success, otherwise NANOEV_ERROR_INVALID_ARG.
+ *
+ * Notes:
+ *   While spinning, the loop polls with a zero time-out and keeps running
+ *   timers, so wakeups avoid a scheduler round trip at the cost of CPU. The
+ *   budget adapts: a spin that finds events doubles it up to the configured
+ *   value, a spin that finds nothing halves it, so an idle loop returns to
+ *   blocking waits. Call from the loop thread. Combine with
+ *   nanoev_tcp_set_busy_poll() or nanoev_udp_set_busy_poll() to also poll
+ *   the NIC queue on Linux.
+ */
+int nanoev_loop_set_busy_poll(
+    nanoev_loop *loop,
+    const nanoev_timeval *budget
+    );
+
+/* buckets of nanoev_loop_stats.events_per_poll */
+#define NANOEV_LOOP_STATS_BUCKETS  10
+
+typedef struct nanoev_loop_stats {
+    unsigned long long iterations;               /* poller waits */
+    unsigned long long events;                   /* completions dispatched */
+    unsigned long long events_per_poll[NANOEV_LOOP_STATS_BUCKETS];
+    unsigned long long poll_usec;                /* time inside the poller */
+    unsigned long long callback_usec;            /* time outside the poller */
+    unsigned long long timers_fired;
+    unsigned long long timer_lateness_usec;      /* sum over fired timers */
+    unsigned long long timer_lateness_max_usec;
+    unsigned int fake_io_depth;                  /* queued fake completions */
+    unsigned int timer_count;                    /* armed timers */
+    unsigned int endgame_count;                  /* freed, awaiting I/O */
+    unsigned int tcp_count;                      /* live events by type */
+    unsigned int udp_count;
+    unsigned int async_count;
+} nanoev_loop_stats;
+
+/*
+ * nanoev_loop_get_stats
+ *   Snapshot the loop's runtime statistics.
+ *
+ * Parameters:
+ *   loop  - Loop to query.
+ *   stats - Output statistics.
+ *
+ * Notes:
+ *   Counters are cumulative since nanoev_loop_new(); subtract two snapshots
+ *   to get a rate. events_per_poll[0] counts waits that returned nothing and
+ *   events_per_poll[i] counts waits returning 2^(i-1) to 2^i - 1 events, the
+ *   last bucket being open ended. A callback_usec share close to 100% means
+ *   the loop is saturated. Timer lateness is measured against the cached loop
+ *   time when timers are processed. Live counts include events created with
+ *   nanoev_event_new() and not yet freed; freed events still waiting for
+ *   outstanding I/O are reported in endgame_count. Call from the loop thread.
+ */
+void nanoev_loop_get_stats(
+    nanoev_loop *loop,
+    nanoev_loop_stats *stats
+    );
+
+typedef void (*nanoev_slow_callback)(
+    nanoev_loop *loop,
+    int type,
+    void *userdata,
+    const nanoev_timeval *elapsed
+    );
+
+/*
+ * nanoev_loop_set_slow_callback
+ *   Report event callbacks that run longer than a threshold.
+ *
+ * Parameters:
+ *   loop      - Loop to configure.
+ *   threshold - Callback duration that counts as slow. NULL disables the
+ *               detector.
+ *   callback  - Hook invoked on the loop thread after each slow callback
+ *               with the event type (a nanoev_event_type), the event's
+ *               userdata and the elapsed time. NULL disables the detector.
+ *
+ * Returns:
+ *   NANOEV_SUCCESS on success, otherwise NANOEV_ERROR_INVALID_ARG.
+ *
+ * Notes:
+ *   I/O completions and timer expirations are measured individually. The
+ *   event may already be freed when the hook runs, so only the captured type
+ *   and userdata are passed. DNS completions are reported as async events
+ *   owned by the library. When disabled the dispatch path takes no extra
+ *   clock readings. Call from the loop thread.
+ */
+int nanoev_loop_set_slow_callback(
+    nanoev_loop *loop,
+    const nanoev_timeval *threshold,
+    nanoev_slow_callback callback
+    );
+
+typedef void (*nanoev_watchdog_callback)(
+    nanoev_loop *loop,
+    const nanoev_timeval *stalled
+    );
+
+/*
+ * nanoev_loop_set_watchdog
+ *   Watch the loop from a helper thread and report stalls.
+ *
+ * Parameters:
+ *   loop     - Loop to watch.
+ *   timeout  - How long the loop may stay away from the poller before it is
+ *              reported. NULL disables the watchdog.
+ *   callback - Hook invoked on the watchdog thread with the time spent away
+ *              from the poller so far. NULL disables the watchdog.
+ *
+ * Returns:
+ *   NANOEV_SUCCESS on success, NANOEV_ERROR_INVALID_ARG for a bad timeout,
+ *   otherwise NANOEV_ERROR_OUT_OF_MEMORY or NANOEV_ERROR_FAIL.
+ *
+ * Notes:
+ *   Each stall is reported once. The hook runs concurrently with the loop,
+ *   so it may only call thread-safe functions such as nanoev_loop_break()
+ *   and nanoev_async_send(). Time blocked in the poller never counts as a
+ *   stall. Replacing or disabling the watchdog joins the helper thread,
+ *   which also happens in nanoev_loop_free(). Call from the loop thread.
+ */
+int nanoev_loop_set_watchdog(
+    nanoev_loop *loop,
+    const nanoev_timeval *timeout,
+    nanoev_watchdog_callback callback
+    );
+
 /*----------------------------------------------------------------------------*/
 
 struct nanoev_event;
@@ -322,7 +459,10 @@ typedef void (*nanoev_dns_callback)(
  * Notes:
  *   At most one resolve may be pending on an event at a time. Freeing the event
  *   while a resolve is pending cancels the callback, but the system resolver may
- *   continue blocking on a worker thread until it completes.
+ *   continue blocking on a worker thread until it completes. Concurrent
+ *   resolves of the same host and family share one system lookup. With the
+ *   native backend (see nanoev_dns_set_backend()) no thread is involved and
+ *   freeing the event cancels the query outright.
  */
 int nanoev_dns_resolve(
     nanoev_event *event,
@@ -332,6 +472,305 @@ int nanoev_dns_resolve(
     nanoev_dns_callback callback
     );
 
+/*
+ * nanoev_dns_set_cache
+ *   Configure the process-wide DNS result cache.
+ *
+ * Parameters:
+ *   max_entries  - Maximum cached names. 0 disables and empties the cache.
+ *   ttl          - Seconds a successful answer stays cached. Must be non-zero
+ *                  when the cache is enabled.
+ *   negative_ttl - Seconds a "name does not exist" answer stays cached. 0
+ *                  disables negative caching.
+ *
+ * Returns:
+ *   NANOEV_SUCCESS on success, NANOEV_ERROR_ACCESS_DENIED before nanoev_init(),
+ *   otherwise a NANOEV_ERROR_* code.
+ *
+ * Notes:
+ *   The cache is disabled by default. Entries are keyed by host name (case
+ *   insensitive) and family; the port is applied per request. A hit completes
+ *   on the next loop iteration without a worker thread, never from inside
+ *   nanoev_dns_resolve(). The system resolver does not report record TTLs, so
+ *   ttl bounds every entry; native backend answers also expire with their
+ *   records. Transient resolver failures are never cached. When full, the
+ *   least recently used entry is evicted. Reconfiguring empties the cache;
+ *   nanoev_term() disables it.
+ */
+int nanoev_dns_set_cache(
+    unsigned int max_entries,
+    unsigned int ttl,
+    unsigned int negative_ttl
+    );
+
+/*
+ * nanoev_dns_set_pool
+ *   Size the worker pool used by the system DNS backend.
+ *
+ * Parameters:
+ *   threads   - Maximum worker threads, 1 to 64. The default is 4.
+ *   max_queue - Maximum lookups waiting for a worker, or 0 for no limit (the
+ *               default).
+ *
+ * Returns:
+ *   NANOEV_SUCCESS on success, NANOEV_ERROR_ACCESS_DENIED before nanoev_init(),
+ *   otherwise a NANOEV_ERROR_* code.
+ *
+ * Notes:
+ *   Workers start on demand, one at a time, while lookups are waiting and
+ *   fewer than threads are running. Workers already started keep running
+ *   until nanoev_term(), so lowering threads only stops further growth. When
+ *   the queue is full, nanoev_dns_resolve() fails with NANOEV_ERROR_FAIL; a
+ *   resolve that joins a lookup already pending for the same name is never
+ *   refused. nanoev_term() restores the defaults.
+ */
+int nanoev_dns_set_pool(
+    unsigned int threads,
+    unsigned int max_queue
+    );
+
+#define NANOEV_DNS_BACKEND_SYSTEM  0
+#define NANOEV_DNS_BACKEND_NATIVE  1
+
+/*
+ * nanoev_dns_set_backend
+ *   Select the process-wide resolver used by nanoev_dns_resolve().
+ *
+ * Parameters:
+ *   backend      - NANOEV_DNS_BACKEND_SYSTEM or NANOEV_DNS_BACKEND_NATIVE.
+ *   servers      - Name servers for the native backend, or NULL to read them
+ *                  from /etc/resolv.conf. Ignored for the system backend.
+ *   server_count - Number of entries in servers. At most 3 are used.
+ *
+ * Returns:
+ *   NANOEV_SUCCESS on success, NANOEV_ERROR_ACCESS_DENIED before nanoev_init(),
+ *   otherwise a NANOEV_ERROR_* code.
+ *
+ * Notes:
+ *   The system backend (the default) runs getaddrinfo() on worker threads. The
+ *   native backend is a stub resolver on the calling loop: it answers numeric
+ *   addresses and hosts file names directly, otherwise sends A and/or AAAA
+ *   queries over UDP, retries across servers on timeout, and repeats a
+ *   truncated answer over TCP. IPv4 results come before IPv6 results. Search
+ *   domains are not applied, so names should be fully qualified. The resolv.conf
+ *   "timeout:" and "attempts:" options are honored. On Windows servers must be
+ *   given. Record TTLs bound the lifetime of cached answers. The hosts file and
+ *   resolv.conf are read once per call; nanoev_term() restores the system
+ *   backend.
+ */
+int nanoev_dns_set_backend(
+    int backend,
+    const struct nanoev_addr *servers,
+    unsigned int server_count
+    );
+
+/*
+ * nanoev_dns_cache_stats
+ *   Return DNS cache hit and miss counts since the cache was configured.
+ *
+ * Parameters:
+ *   hits   - Optional output hit count.
+ *   misses - Optional output miss count.
+ */
+void nanoev_dns_cache_stats(
+    unsigned int *hits,
+    unsigned int *misses
+    );
+
+/*----------------------------------------------------------------------------*/
+
+struct nanoev_buf;
+typedef struct nanoev_buf nanoev_buf;
+
+/* size of the pooled chunks nanoev_buf data lives in */
+#define NANOEV_BUF_CHUNK_SIZE  16384
+
+typedef struct nanoev_buf_seg {
+    void *data;
+    unsigned int len;
+} nanoev_buf_seg;
+
+/*
+ * nanoev_buf_new
+ *   Create an empty reference-counted buffer chain.
+ *
+ * Returns:
+ *   Buffer with one reference on success, otherwise NULL.
+ *
+ * Notes:
+ *   Data lives in pooled chunks shared between bufs by reference, so the same
+ *   bytes can be queued on many connections without copying. A buf with more
+ *   than one reference is read-only. References may be taken and dropped from
+ *   any thread. Release every buf before nanoev_term().
+ */
+nanoev_buf* nanoev_buf_new(void);
+
+/*
+ * nanoev_buf_ref
+ *   Take another reference on a buffer.
+ *
+ * Parameters:
+ *   buf - Buffer.
+ *
+ * Returns:
+ *   buf.
+ */
+nanoev_buf* nanoev_buf_ref(
+    nanoev_buf *buf
+    );
+
+/*
+ * nanoev_buf_unref
+ *   Drop a reference on a buffer, freeing it with the last one.
+ *
+ * Parameters:
+ *   buf - Buffer, or NULL.
+ */
+void nanoev_buf_unref(
+    nanoev_buf *buf
+    );
+
+/*
+ * nanoev_buf_len
+ *   Return the number of bytes in a buffer.
+ *
+ * Parameters:
+ *   buf - Buffer.
+ */
+unsigned int nanoev_buf_len(
+    const nanoev_buf *buf
+    );
+
+/*
+ * nanoev_buf_append
+ *   Copy bytes to the end of a buffer.
+ *
+ * Parameters:
+ *   buf  - Buffer with a single reference.
+ *   data - Bytes to copy.
+ *   len  - Number of bytes.
+ *
+ * Returns:
+ *   NANOEV_SUCCESS on success, otherwise a NANOEV_ERROR_* code.
+ */
+int nanoev_buf_append(
+    nanoev_buf *buf,
+    const void *data,
+    unsigned int len
+    );
+
+/*
+ * nanoev_buf_append_buf
+ *   Append a byte range of another buffer without copying it.
+ *
+ * Parameters:
+ *   buf    - Buffer with a single reference.
+ *   src    - Source buffer; may be shared.
+ *   offset - Offset of the range in src.
+ *   len    - Length of the range.
+ *
+ * Returns:
+ *   NANOEV_SUCCESS on success, otherwise a NANOEV_ERROR_* code.
+ *
+ * Notes:
+ *   buf references src's chunks, so later changes to src do not affect it.
+ */
+int nanoev_buf_append_buf(
+    nanoev_buf *buf,
+    const nanoev_buf *src,
+    unsigned int offset,
+    unsigned int len
+    );
+
+/*
+ * nanoev_buf_reserve
+ *   Return contiguous writable space at the end of a buffer.
+ *
+ * Parameters:
+ *   buf - Buffer with a single reference.
+ *   len - Bytes of space needed.
+ *
+ * Returns:
+ *   Pointer to at least len writable bytes, or NULL if buf is shared or memory
+ *   is exhausted.
+ *
+ * Notes:
+ *   The space becomes part of buf only through nanoev_buf_commit(). Requests
+ *   up to NANOEV_BUF_CHUNK_SIZE bytes are served from the chunk pool.
+ */
+void* nanoev_buf_reserve(
+    nanoev_buf *buf,
+    unsigned int len
+    );
+
+/*
+ * nanoev_buf_commit
+ *   Add bytes written to reserved space to the end of a buffer.
+ *
+ * Parameters:
+ *   buf - Buffer passed to nanoev_buf_reserve().
+ *   len - Bytes written, at most the len reserved.
+ */
+void nanoev_buf_commit(
+    nanoev_buf *buf,
+    unsigned int len
+    );
+
+/*
+ * nanoev_buf_consume
+ *   Drop bytes from the front of a buffer.
+ *
+ * Parameters:
+ *   buf - Buffer with a single reference.
+ *   len - Bytes to drop, at most nanoev_buf_len(buf).
+ */
+void nanoev_buf_consume(
+    nanoev_buf *buf,
+    unsigned int len
+    );
+
+/*
+ * nanoev_buf_segments
+ *   Describe the contiguous pieces of a buffer.
+ *
+ * Parameters:
+ *   buf  - Buffer.
+ *   segs - Output array, or NULL if max is zero.
+ *   max  - Capacity of segs.
+ *
+ * Returns:
+ *   Total number of segments, which may exceed max.
+ *
+ * Notes:
+ *   The pointers stay valid while the caller holds a reference and does not
+ *   consume the bytes they cover.
+ */
+unsigned int nanoev_buf_segments(
+    const nanoev_buf *buf,
+    nanoev_buf_seg *segs,
+    unsigned int max
+    );
+
+/*
+ * nanoev_buf_copy
+ *   Copy bytes out of a buffer.
+ *
+ * Parameters:
+ *   buf    - Buffer.
+ *   offset - Offset of the first byte to copy.
+ *   data   - Destination.
+ *   len    - Maximum number of bytes to copy.
+ *
+ * Returns:
+ *   Number of bytes copied.
+ */
+unsigned int nanoev_buf_copy(
+    const nanoev_buf *buf,
+    unsigned int offset,
+    void *data,
+    unsigned int len
+    );
+
 /*----------------------------------------------------------------------------*/
 
 /*
@@ -420,6 +859,103 @@ typedef void (*nanoev_tcp_on_read)(
     unsigned int bytes
     );
 
+/*
+ * nanoev_tcp_on_read_until
+ *   Callback invoked when a nanoev_tcp_read_until() operation completes.
+ *
+ * Parameters:
+ *   tcp    - TCP event.
+ *   status - 0 on success, otherwise a platform socket error.
+ *   buf    - Buffer passed to nanoev_tcp_read_until().
+ *   bytes  - Bytes held in buf, the filled bytes included.
+ *   found  - Length of the data up to and including the first delimiter, or
+ *            0 if buf filled up or the peer closed the connection first.
+ *
+ * Notes:
+ *   Bytes after found were received past the delimiter and belong to what
+ *   follows it.
+ */
+typedef void (*nanoev_tcp_on_read_until)(
+    nanoev_event *tcp,
+    int status,
+    void *buf,
+    unsigned int bytes,
+    unsigned int found
+    );
+
+#define NANOEV_TCP_MAX_DELIMITER 8
+
+typedef struct nanoev_iovec {
+    void *buf;
+    unsigned int len;
+} nanoev_iovec;
+
+#define NANOEV_TCP_MAX_IOV 64
+
+/*
+ * nanoev_tcp_on_write_buf
+ *   Callback invoked when a nanoev_tcp_write_buf() operation completes.
+ *
+ * Parameters:
+ *   tcp    - TCP event.
+ *   status - 0 on success, otherwise a platform socket error.
+ *   buf    - Buffer passed to nanoev_tcp_write_buf().
+ *   bytes  - Number of bytes written; all of buf unless status is nonzero.
+ */
+typedef void (*nanoev_tcp_on_write_buf)(
+    nanoev_event *tcp,
+    int status,
+    nanoev_buf *buf,
+    unsigned int bytes
+    );
+
+/*
+ * nanoev_tcp_on_read_buf
+ *   Callback invoked when a nanoev_tcp_read_buf() operation completes.
+ *
+ * Parameters:
+ *   tcp    - TCP event.
+ *   status - 0 on success, otherwise a platform socket error.
+ *   buf    - Buffer passed to nanoev_tcp_read_buf(), with the bytes read
+ *            appended.
+ *   bytes  - Number of bytes read. bytes == 0 means the peer closed the
+ *            connection.
+ */
+typedef void (*nanoev_tcp_on_read_buf)(
+    nanoev_event *tcp,
+    int status,
+    nanoev_buf *buf,
+    unsigned int bytes
+    );
+
+/*
+ * nanoev_tcp_on_frame
+ *   Callback invoked for each frame received by nanoev_tcp_read_frames().
+ *
+ * Parameters:
+ *   tcp    - TCP event.
+ *   status - 0 on success, a platform socket error, or NANOEV_ERROR_FAIL for
+ *            a frame over max_payload or a connection closed mid-frame.
+ *   frame  - Whole frame, header included. Valid until the callback returns.
+ *   len    - Frame length. len == 0 with status 0 means the peer closed the
+ *            connection between frames.
+ */
+typedef void (*nanoev_tcp_on_frame)(
+    nanoev_event *tcp,
+    int status,
+    void *frame,
+    unsigned int len
+    );
+
+typedef struct nanoev_tcp_framing {
+    unsigned int prefix_size;                    /* length prefix bytes: 1, 2 or 4 */
+    int little_endian;                           /* prefix byte order, big endian if 0 */
+    unsigned int header_size;                    /* bytes before the payload, prefix first */
+    int length_includes_header;                  /* prefix counts the header too */
+    unsigned int max_payload;                    /* larger frames fail the connection */
+    unsigned int buffer_size;                    /* initial read buffer, 0 for 64 KiB */
+} nanoev_tcp_framing;
+
 #ifdef _WIN32
 #  define NANOEV_TCP_SHUT_READ  SD_RECEIVE
 #  define NANOEV_TCP_SHUT_WRITE SD_SEND
@@ -455,6 +991,89 @@ int nanoev_tcp_connect(
     nanoev_tcp_on_connect callback
     );
 
+/*
+ * nanoev_tcp_connect_host
+ *   Resolve a host name and connect to the first address that answers.
+ *
+ * Parameters:
+ *   event    - TCP event.
+ *   host     - Host name or numeric IP address.
+ *   port     - Host-byte-order port.
+ *   timeout  - Timeout for the whole operation, or NULL for no timeout.
+ *   callback - Completion callback.
+ *
+ * Returns:
+ *   NANOEV_SUCCESS if the operation was started, otherwise a NANOEV_ERROR_* code.
+ *
+ * Notes:
+ *   The host is resolved with nanoev_dns_resolve() and the addresses are tried
+ *   as in nanoev_tcp_connect_addrs(), alternating families with IPv6 first
+ *   (RFC 8305). A failed resolve completes with WSAHOST_NOT_FOUND on Windows
+ *   and EHOSTUNREACH elsewhere. Freeing the event cancels the operation.
+ */
+int nanoev_tcp_connect_host(
+    nanoev_event *event,
+    const char *host,
+    unsigned short port,
+    const nanoev_timeval *timeout,
+    nanoev_tcp_on_connect callback
+    );
+
+/*
+ * nanoev_tcp_connect_addrs
+ *   Race connection attempts over a list of addresses.
+ *
+ * Parameters:
+ *   event      - TCP event.
+ *   addrs      - Candidate server addresses, in order of preference.
+ *   addr_count - Number of entries in addrs.
+ *   timeout    - Timeout for the whole operation, or NULL for no timeout.
+ *   callback   - Completion callback.
+ *
+ * Returns:
+ *   NANOEV_SUCCESS if the operation was started, otherwise a NANOEV_ERROR_* code.
+ *
+ * Notes:
+ *   An attempt starts every 250 ms, or as soon as the previous one fails, and
+ *   earlier attempts keep running. The first to connect wins: its socket
+ *   becomes the event's and the others are cancelled. If every attempt fails,
+ *   callback receives the last error. On Windows the attempts run one after
+ *   another on the event itself. No other operation may be started on the
+ *   event until callback runs.
+ */
+int nanoev_tcp_connect_addrs(
+    nanoev_event *event,
+    const struct nanoev_addr *addrs,
+    unsigned int addr_count,
+    const nanoev_timeval *timeout,
+    nanoev_tcp_on_connect callback
+    );
+
+/*
+ * nanoev_tcp_bind
+ *   Bind a TCP event to a local address before nanoev_tcp_connect().
+ *
+ * Parameters:
+ *   event      - TCP event.
+ *   local_addr - Local address; port 0 lets the system choose.
+ *
+ * Returns:
+ *   NANOEV_SUCCESS on success, otherwise a NANOEV_ERROR_* code.
+ *
+ * Notes:
+ *   Use it to pick the source address of an outgoing connection, for
+ *   example to spread many connections over several local IPs. With port 0,
+ *   Linux defers the port choice to connect (IP_BIND_ADDRESS_NO_PORT), so a
+ *   local port only has to be unique per destination. The next
+ *   nanoev_tcp_connect() must use the same address family;
+ *   nanoev_tcp_connect_host() and nanoev_tcp_connect_addrs() refuse a bound
+ *   event.
+ */
+int nanoev_tcp_bind(
+    nanoev_event *event,
+    const struct nanoev_addr *local_addr
+    );
+
 /*
  * nanoev_tcp_listen
  *   Bind a TCP event to a local address and start listening.
@@ -473,6 +1092,38 @@ int nanoev_tcp_listen(
     int backlog
     );
 
+#define NANOEV_TCP_LISTEN_REUSEPORT 0x0001   /* share the port with other listeners */
+
+/*
+ * nanoev_tcp_listen_ex
+ *   Like nanoev_tcp_listen(), with options applied before the socket binds.
+ *
+ * Parameters:
+ *   event      - TCP event.
+ *   local_addr - Local address.
+ *   backlog    - Listen backlog.
+ *   flags      - Zero or NANOEV_TCP_LISTEN_* flags.
+ *
+ * Returns:
+ *   NANOEV_SUCCESS on success, NANOEV_ERROR_INVALID_ARG for unknown flags,
+ *   NANOEV_ERROR_FAIL if the platform lacks a requested option, otherwise a
+ *   NANOEV_ERROR_* code.
+ *
+ * Notes:
+ *   NANOEV_TCP_LISTEN_REUSEPORT sets SO_REUSEPORT (SO_REUSEPORT_LB on
+ *   FreeBSD), so several listeners (one per loop, typically one per thread)
+ *   can bind the same address. On Linux and FreeBSD the kernel spreads
+ *   incoming connections across them; other platforms with SO_REUSEPORT,
+ *   such as macOS, only share the port. Without the option the call fails
+ *   without touching the event.
+ */
+int nanoev_tcp_listen_ex(
+    nanoev_event *event,
+    const struct nanoev_addr *local_addr,
+    int backlog,
+    unsigned int flags
+    );
+
 /*
  * nanoev_tcp_accept
  *   Start one asynchronous accept operation on a listening TCP event.
@@ -555,6 +1206,195 @@ int nanoev_tcp_read(
     nanoev_tcp_on_read callback
     );
 
+/*
+ * nanoev_tcp_read_exact
+ *   Start one asynchronous TCP read that waits for exactly len bytes.
+ *
+ * Parameters:
+ *   event    - TCP event.
+ *   buf      - Receive buffer.
+ *   len      - Number of bytes to read.
+ *   timeout  - Timeout for the whole read, or NULL for no timeout.
+ *   callback - Completion callback.
+ *
+ * Returns:
+ *   NANOEV_SUCCESS if the operation was started, otherwise a NANOEV_ERROR_* code.
+ *
+ * Notes:
+ *   Partial reads are continued internally, so callback runs once with
+ *   bytes == len, unless an error occurs or the peer closes the connection
+ *   first; bytes is then the count received so far. Counts as the event's
+ *   one pending read.
+ */
+int nanoev_tcp_read_exact(
+    nanoev_event *event,
+    void *buf,
+    unsigned int len,
+    const nanoev_timeval *timeout,
+    nanoev_tcp_on_read callback
+    );
+
+/*
+ * nanoev_tcp_read_until
+ *   Start one asynchronous TCP read that waits for a delimiter.
+ *
+ * Parameters:
+ *   event     - TCP event.
+ *   buf       - Receive buffer.
+ *   len       - Size of buf.
+ *   filled    - Bytes already at the start of buf, such as the partial line
+ *               left over from the previous read.
+ *   delim     - Delimiter, for example "\r\n".
+ *   delim_len - Delimiter length, 1 to NANOEV_TCP_MAX_DELIMITER.
+ *   timeout   - Timeout for the whole read, or NULL for no timeout.
+ *   callback  - Completion callback.
+ *
+ * Returns:
+ *   NANOEV_SUCCESS if the operation was started, otherwise a NANOEV_ERROR_* code.
+ *
+ * Notes:
+ *   Reads continue into buf after filled until the delimiter appears, buf is
+ *   full, or the peer closes the connection. Only new bytes are searched, plus
+ *   the delim_len - 1 bytes before them, so a delimiter split across reads
+ *   is found. The filled bytes must not already contain the delimiter; that
+ *   is NANOEV_ERROR_INVALID_ARG. Counts as the event's one pending read.
+ */
+int nanoev_tcp_read_until(
+    nanoev_event *event,
+    void *buf,
+    unsigned int len,
+    unsigned int filled,
+    const void *delim,
+    unsigned int delim_len,
+    const nanoev_timeval *timeout,
+    nanoev_tcp_on_read_until callback
+    );
+
+/*
+ * nanoev_tcp_readv
+ *   Start one asynchronous TCP read that scatters into several buffers.
+ *
+ * Parameters:
+ *   event    - TCP event.
+ *   bufs     - Receive buffers, filled in order.
+ *   count    - Number of buffers, 1 to NANOEV_TCP_MAX_IOV.
+ *   timeout  - Timeout duration, or NULL for no timeout.
+ *   callback - Completion callback; its buf is bufs[0].buf.
+ *
+ * Returns:
+ *   NANOEV_SUCCESS if the operation was started, otherwise a NANOEV_ERROR_* code.
+ *
+ * Notes:
+ *   One readv() (WSARecv() on Windows) fills a header and its payload, or the
+ *   tail and head of a ring buffer, without a staging copy. bytes is the total
+ *   across the buffers. The bufs array is copied and may be released once this
+ *   returns; the buffers themselves must stay valid until callback runs.
+ *   Counts as the event's one pending read.
+ */
+int nanoev_tcp_readv(
+    nanoev_event *event,
+    const nanoev_iovec *bufs,
+    unsigned int count,
+    const nanoev_timeval *timeout,
+    nanoev_tcp_on_read callback
+    );
+
+/*
+ * nanoev_tcp_write_buf
+ *   Start writing the whole of a buffer chain to a TCP event.
+ *
+ * Parameters:
+ *   event    - TCP event.
+ *   buf      - Data to write; may be shared with other writes.
+ *   timeout  - Limit on each stall of the write, or NULL for no timeout.
+ *   callback - Completion callback.
+ *
+ * Returns:
+ *   NANOEV_SUCCESS if the operation was started, otherwise a NANOEV_ERROR_* code.
+ *
+ * Notes:
+ *   The event holds a reference on buf until callback returns. Segments are
+ *   gathered into one send, and a short send is continued internally, so
+ *   callback runs once. Counts as the event's one pending write.
+ */
+int nanoev_tcp_write_buf(
+    nanoev_event *event,
+    nanoev_buf *buf,
+    const nanoev_timeval *timeout,
+    nanoev_tcp_on_write_buf callback
+    );
+
+/*
+ * nanoev_tcp_read_buf
+ *   Start one asynchronous TCP read that appends to a buffer chain.
+ *
+ * Parameters:
+ *   event    - TCP event.
+ *   buf      - Buffer with a single reference.
+ *   len      - Maximum number of bytes to read.
+ *   timeout  - Timeout duration, or NULL for no timeout.
+ *   callback - Completion callback.
+ *
+ * Returns:
+ *   NANOEV_SUCCESS if the operation was started, otherwise a NANOEV_ERROR_* code.
+ *
+ * Notes:
+ *   len bytes are reserved at the end of buf, from the chunk pool when len is
+ *   at most NANOEV_BUF_CHUNK_SIZE. buf must remain valid and unmodified until
+ *   callback runs. Counts as the event's one pending read.
+ */
+int nanoev_tcp_read_buf(
+    nanoev_event *event,
+    nanoev_buf *buf,
+    unsigned int len,
+    const nanoev_timeval *timeout,
+    nanoev_tcp_on_read_buf callback
+    );
+
+/*
+ * nanoev_tcp_read_frames
+ *   Start reading length-prefixed frames from a TCP event.
+ *
+ * Parameters:
+ *   event    - TCP event.
+ *   framing  - Frame layout.
+ *   callback - Frame callback.
+ *
+ * Returns:
+ *   NANOEV_SUCCESS if reading was started, otherwise a NANOEV_ERROR_* code.
+ *
+ * Notes:
+ *   Reads fill as much of an internal buffer as the socket has ready, and
+ *   every complete frame in it is delivered in place, so a read usually
+ *   carries many frames. The buffer grows to fit a frame up to max_payload.
+ *   Reading continues until nanoev_tcp_stop_frames(), an error, or the peer
+ *   closing the connection; the last two end with a final callback. Counts
+ *   as the event's one pending read.
+ */
+int nanoev_tcp_read_frames(
+    nanoev_event *event,
+    const nanoev_tcp_framing *framing,
+    nanoev_tcp_on_frame callback
+    );
+
+/*
+ * nanoev_tcp_stop_frames
+ *   Stop nanoev_tcp_read_frames() from inside its callback.
+ *
+ * Parameters:
+ *   event - TCP event.
+ *
+ * Returns:
+ *   NANOEV_SUCCESS on success, otherwise NANOEV_ERROR_ACCESS_DENIED.
+ *
+ * Notes:
+ *   No more frames are delivered and buffered bytes after the current frame
+ *   are discarded. Reads may be started again once the callback returns.
+ */
+int nanoev_tcp_stop_frames(
+    nanoev_event *event
+    );
+
 /*
  * nanoev_tcp_shutdown
  *   Shut down reads, writes, or both directions on a connected TCP event.
@@ -682,6 +1522,397 @@ int nanoev_tcp_set_keepalive(
     int enabled
     );
 
+/*
+ * nanoev_tcp_set_busy_poll
+ *   Set SO_BUSY_POLL (and SO_PREFER_BUSY_POLL when available) on an open TCP
+ *   socket.
+ *
+ * Parameters:
+ *   event - TCP event.
+ *   usec  - Socket busy-poll time in microseconds, or zero to disable.
+ *
+ * Returns:
+ *   NANOEV_SUCCESS on success, NANOEV_ERROR_FAIL if the platform does not
+ *   support socket busy polling or the process lacks the privilege for the
+ *   requested value, otherwise a NANOEV_ERROR_* code.
+ *
+ * Notes:
+ *   Linux only. A failed call leaves the TCP event usable.
+ */
+int nanoev_tcp_set_busy_poll(
+    nanoev_event *event,
+    unsigned int usec
+    );
+
+/*
+ * nanoev_tcp_set_zerocopy
+ *   Send large writes on a connected TCP event with MSG_ZEROCOPY.
+ *
+ * Parameters:
+ *   event     - Connected TCP event.
+ *   threshold - Writes of at least this many bytes use MSG_ZEROCOPY. Zero
+ *               disables zerocopy transmit.
+ *
+ * Returns:
+ *   NANOEV_SUCCESS on success, NANOEV_ERROR_FAIL if the platform or kernel
+ *   does not support SO_ZEROCOPY, otherwise a NANOEV_ERROR_* code.
+ *
+ * Notes:
+ *   Linux only. A zerocopy write completes only after the kernel reports on
+ *   the socket error queue that the buffer is no longer referenced, so
+ *   nanoev_tcp_on_write still marks the point where buf may be reused. The
+ *   kernel may fall back to copying (always on loopback); see
+ *   nanoev_tcp_zerocopy_stats(). Cannot be changed while a zerocopy write is
+ *   pending. A failed call leaves the connection usable with copying writes.
+ */
+int nanoev_tcp_set_zerocopy(
+    nanoev_event *event,
+    unsigned int threshold
+    );
+
+/*
+ * nanoev_tcp_zerocopy_stats
+ *   Return MSG_ZEROCOPY completion counters for a TCP event.
+ *
+ * Parameters:
+ *   event       - TCP event.
+ *   completions - Output number of zerocopy sends released by the kernel.
+ *   copied      - Output number of those sends the kernel had to copy anyway.
+ *
+ * Returns:
+ *   NANOEV_SUCCESS on success, otherwise NANOEV_ERROR_INVALID_ARG.
+ */
+int nanoev_tcp_zerocopy_stats(
+    nanoev_event *event,
+    unsigned int *completions,
+    unsigned int *copied
+    );
+
+/*----------------------------------------------------------------------------*/
+
+struct nanoev_tcp_pool;
+typedef struct nanoev_tcp_pool nanoev_tcp_pool;
+
+/*
+ * nanoev_tcp_pool_callback
+ *   Callback invoked when a nanoev_tcp_pool_acquire() request completes.
+ *
+ * Parameters:
+ *   pool     - Connection pool.
+ *   status   - 0 on success, otherwise the platform socket error, or
+ *              NANOEV_ERROR_OUT_OF_MEMORY if no connection could be created.
+ *   tcp      - Connected TCP event on success, otherwise NULL.
+ *   userdata - Value passed to nanoev_tcp_pool_acquire().
+ *
+ * Notes:
+ *   The connection belongs to the caller until it is handed back with
+ *   nanoev_tcp_pool_release(). Its userdata is NULL and may be changed freely.
+ */
+typedef void (*nanoev_tcp_pool_callback)(
+    nanoev_tcp_pool *pool,
+    int status,
+    nanoev_event *tcp,
+    void *userdata
+    );
+
+typedef struct nanoev_tcp_pool_stats {
+    unsigned long long connects;                 /* connections established */
+    unsigned long long connect_failures;
+    unsigned long long reuses;                   /* acquires served from idle */
+    unsigned long long expired;                  /* idle past idle_timeout */
+    unsigned long long unhealthy;                /* idle found closed or readable */
+    unsigned int idle;
+    unsigned int active;                         /* handed out */
+    unsigned int connecting;
+    unsigned int waiting;                        /* queued acquires */
+} nanoev_tcp_pool_stats;
+
+/*
+ * nanoev_tcp_pool_new
+ *   Create a pool of outbound TCP connections keyed by server address.
+ *
+ * Parameters:
+ *   loop                - Loop that owns the connections.
+ *   max_per_target      - Limit on connections open to one address, handed
+ *                         out plus connecting. Zero means no limit.
+ *   max_idle_per_target - Idle connections kept per address; released
+ *                         connections beyond this are closed.
+ *   idle_timeout        - How long an idle connection is kept, or NULL to keep
+ *                         it until the pool is freed.
+ *
+ * Returns:
+ *   Pool on success, otherwise NULL.
+ *
+ * Notes:
+ *   Idle connections are reused most recently released first, so the coldest
+ *   ones are left to expire. A connection is checked before it is reused and
+ *   closed if the peer has closed it, reset it, or sent unsolicited data.
+ *   Call from the loop thread.
+ */
+nanoev_tcp_pool* nanoev_tcp_pool_new(
+    nanoev_loop *loop,
+    unsigned int max_per_target,
+    unsigned int max_idle_per_target,
+    const nanoev_timeval *idle_timeout
+    );
+
+/*
+ * nanoev_tcp_pool_free
+ *   Free a connection pool.
+ *
+ * Parameters:
+ *   pool - Pool to free.
+ *
+ * Notes:
+ *   Idle and connecting connections are closed and pending acquires are
+ *   dropped without their callbacks. Connections currently handed out stay
+ *   open and become the caller's to free with nanoev_event_free(). May be
+ *   called from a pool callback.
+ */
+void nanoev_tcp_pool_free(
+    nanoev_tcp_pool *pool
+    );
+
+/*
+ * nanoev_tcp_pool_acquire
+ *   Get a connection to a server address from the pool.
+ *
+ * Parameters:
+ *   pool     - Connection pool.
+ *   addr     - Server address.
+ *   timeout  - Limit on the wait for a connection, or NULL for no limit.
+ *   callback - Completion callback.
+ *   userdata - Value passed to callback.
+ *
+ * Returns:
+ *   NANOEV_SUCCESS if the request was queued, otherwise a NANOEV_ERROR_* code.
+ *
+ * Notes:
+ *   A healthy idle connection is preferred; otherwise a new one is opened
+ *   unless max_per_target connections to addr are already open, in which case
+ *   the request waits for one to be released. Requests to one address are
+ *   served in order. callback always runs from the loop, never from inside
+ *   this call. A timed out request completes with the platform socket timeout
+ *   error, such as ETIMEDOUT or WSAETIMEDOUT; a failed connect completes the
+ *   oldest waiting request with its error.
+ */
+int nanoev_tcp_pool_acquire(
+    nanoev_tcp_pool *pool,
+    const struct nanoev_addr *addr,
+    const nanoev_timeval *timeout,
+    nanoev_tcp_pool_callback callback,
+    void *userdata
+    );
+
+/*
+ * nanoev_tcp_pool_release
+ *   Hand a connection back to the pool.
+ *
+ * Parameters:
+ *   pool     - Connection pool.
+ *   tcp      - Connection from nanoev_tcp_pool_acquire().
+ *   reusable - Nonzero to keep the connection for later acquires, zero to
+ *              close it.
+ *
+ * Returns:
+ *   NANOEV_SUCCESS on success, NANOEV_ERROR_INVALID_ARG if tcp is not handed
+ *   out by pool.
+ *
+ * Notes:
+ *   Only a connection with no read or write in progress and nothing left to
+ *   read is kept; any other is closed even if reusable is nonzero. tcp must
+ *   not be used after this call. Freeing tcp with nanoev_event_free() instead
+ *   is the same as releasing it with reusable zero.
+ */
+int nanoev_tcp_pool_release(
+    nanoev_tcp_pool *pool,
+    nanoev_event *tcp,
+    int reusable
+    );
+
+/*
+ * nanoev_tcp_pool_get_stats
+ *   Snapshot a connection pool's counters.
+ *
+ * Parameters:
+ *   pool  - Connection pool.
+ *   stats - Output statistics.
+ *
+ * Notes:
+ *   Counters are cumulative since nanoev_tcp_pool_new(); the gauges cover all
+ *   addresses.
+ */
+void nanoev_tcp_pool_get_stats(
+    nanoev_tcp_pool *pool,
+    nanoev_tcp_pool_stats *stats
+    );
+
+/*----------------------------------------------------------------------------*/
+
+struct nanoev_tcp_fanout;
+typedef struct nanoev_tcp_fanout nanoev_tcp_fanout;
+
+#define NANOEV_FANOUT_DROP_SUBSCRIBER 0      /* remove a subscriber that falls behind */
+#define NANOEV_FANOUT_DROP_MESSAGE    1      /* skip messages for it until it catches up */
+
+/*
+ * nanoev_tcp_fanout_on_drop
+ *   Callback invoked when a subscriber is removed from a fanout by the
+ *   fanout itself.
+ *
+ * Parameters:
+ *   fanout   - Fanout.
+ *   tcp      - Subscriber that was removed.
+ *   status   - 0 if it exceeded max_queued_bytes, otherwise the write error,
+ *              or a NANOEV_ERROR_* code if a write could not be started.
+ *   userdata - Value passed to nanoev_tcp_fanout_new().
+ *
+ * Notes:
+ *   The subscriber is already removed when this runs. It is usually closed
+ *   here with nanoev_event_free().
+ */
+typedef void (*nanoev_tcp_fanout_on_drop)(
+    nanoev_tcp_fanout *fanout,
+    nanoev_event *tcp,
+    int status,
+    void *userdata
+    );
+
+typedef struct nanoev_tcp_fanout_stats {
+    unsigned long long published;                /* nanoev_tcp_fanout_publish() calls */
+    unsigned long long deliveries;               /* messages queued to a subscriber */
+    unsigned long long flushes;                  /* gathered writes started */
+    unsigned long long skipped;                  /* messages not queued, DROP_MESSAGE */
+    unsigned long long dropped;                  /* subscribers removed by the fanout */
+    unsigned long long queued_bytes;             /* queued or being written */
+    unsigned int subscribers;
+    unsigned int writing;                        /* subscribers with a write pending */
+} nanoev_tcp_fanout_stats;
+
+/*
+ * nanoev_tcp_fanout_new
+ *   Create a fanout that broadcasts messages to a set of TCP connections.
+ *
+ * Parameters:
+ *   loop             - Loop that owns the subscribers.
+ *   max_queued_bytes - Limit on the bytes queued or being written to one
+ *                      subscriber. Zero means no limit.
+ *   policy           - NANOEV_FANOUT_DROP_SUBSCRIBER or
+ *                      NANOEV_FANOUT_DROP_MESSAGE, applied to a subscriber
+ *                      that would go over max_queued_bytes.
+ *   on_drop          - Callback for subscribers the fanout removes, or NULL.
+ *   userdata         - Value passed to on_drop.
+ *
+ * Returns:
+ *   Fanout on success, otherwise NULL.
+ *
+ * Notes:
+ *   A published message is shared by every subscriber queue, never copied.
+ *   Messages published during one loop iteration are written to each
+ *   subscriber with one gathered write, and messages published while a
+ *   write is pending go out together when it completes. A subscriber with
+ *   nothing queued always accepts the next message, whatever its size.
+ *   Call from the loop thread.
+ */
+nanoev_tcp_fanout* nanoev_tcp_fanout_new(
+    nanoev_loop *loop,
+    unsigned int max_queued_bytes,
+    int policy,
+    nanoev_tcp_fanout_on_drop on_drop,
+    void *userdata
+    );
+
+/*
+ * nanoev_tcp_fanout_free
+ *   Free a fanout.
+ *
+ * Parameters:
+ *   fanout - Fanout to free.
+ *
+ * Notes:
+ *   Subscribers stay open and undelivered messages are discarded; writes
+ *   already started still complete. May be called from on_drop.
+ */
+void nanoev_tcp_fanout_free(
+    nanoev_tcp_fanout *fanout
+    );
+
+/*
+ * nanoev_tcp_fanout_add
+ *   Subscribe a connection to a fanout.
+ *
+ * Parameters:
+ *   fanout - Fanout.
+ *   tcp    - Connected TCP event.
+ *
+ * Returns:
+ *   NANOEV_SUCCESS on success, NANOEV_ERROR_ACCESS_DENIED if tcp already
+ *   belongs to a fanout, otherwise a NANOEV_ERROR_* code.
+ *
+ * Notes:
+ *   The fanout becomes the only writer on tcp; reads are left to the caller.
+ *   Freeing tcp with nanoev_event_free() removes it from the fanout.
+ */
+int nanoev_tcp_fanout_add(
+    nanoev_tcp_fanout *fanout,
+    nanoev_event *tcp
+    );
+
+/*
+ * nanoev_tcp_fanout_remove
+ *   Unsubscribe a connection.
+ *
+ * Parameters:
+ *   fanout - Fanout.
+ *   tcp    - Subscriber.
+ *
+ * Returns:
+ *   NANOEV_SUCCESS on success, otherwise NANOEV_ERROR_INVALID_ARG.
+ *
+ * Notes:
+ *   Queued messages are discarded. A write already started completes in the
+ *   background, and tcp accepts other writes only after that.
+ */
+int nanoev_tcp_fanout_remove(
+    nanoev_tcp_fanout *fanout,
+    nanoev_event *tcp
+    );
+
+/*
+ * nanoev_tcp_fanout_publish
+ *   Queue a message to every subscriber.
+ *
+ * Parameters:
+ *   fanout  - Fanout.
+ *   payload - Message. Its chunks are referenced, so the caller may unref it
+ *             right away, but must not write into the referenced bytes.
+ *
+ * Returns:
+ *   NANOEV_SUCCESS on success, otherwise a NANOEV_ERROR_* code.
+ *
+ * Notes:
+ *   Nothing is written from inside this call. Subscribers over
+ *   max_queued_bytes are handled by the policy, and dropped subscribers are
+ *   reported to on_drop from the loop.
+ */
+int nanoev_tcp_fanout_publish(
+    nanoev_tcp_fanout *fanout,
+    const nanoev_buf *payload
+    );
+
+/*
+ * nanoev_tcp_fanout_get_stats
+ *   Snapshot a fanout's counters.
+ *
+ * Parameters:
+ *   fanout - Fanout.
+ *   stats  - Output counters.
+ */
+void nanoev_tcp_fanout_get_stats(
+    nanoev_tcp_fanout *fanout,
+    nanoev_tcp_fanout_stats *stats
+    );
+
 /*----------------------------------------------------------------------------*/
 
 /*
@@ -720,6 +1951,43 @@ typedef void (*nanoev_udp_on_write)(
     unsigned int bytes
     );
 
+/*
+ * nanoev_udp_on_read_buf
+ *   Callback invoked when a nanoev_udp_read_buf() operation completes.
+ *
+ * Parameters:
+ *   udp       - UDP event.
+ *   status    - 0 on success, otherwise a platform socket error.
+ *   buf       - Buffer passed to nanoev_udp_read_buf(), with the datagram
+ *               appended.
+ *   bytes     - Number of bytes read.
+ *   from_addr - Sender address for the received datagram.
+ */
+typedef void (*nanoev_udp_on_read_buf)(
+    nanoev_event *udp,
+    int status,
+    nanoev_buf *buf,
+    unsigned int bytes,
+    const struct nanoev_addr *from_addr
+    );
+
+/*
+ * nanoev_udp_on_write_buf
+ *   Callback invoked when a nanoev_udp_write_buf() operation completes.
+ *
+ * Parameters:
+ *   udp    - UDP event.
+ *   status - 0 on success, otherwise a platform socket error.
+ *   buf    - Buffer passed to nanoev_udp_write_buf().
+ *   bytes  - Number of bytes written.
+ */
+typedef void (*nanoev_udp_on_write_buf)(
+    nanoev_event *udp,
+    int status,
+    nanoev_buf *buf,
+    unsigned int bytes
+    );
+
 /*
  * nanoev_udp_read
  *   Start one asynchronous UDP read operation.
@@ -770,6 +2038,54 @@ int nanoev_udp_write(
     nanoev_udp_on_write callback
     );
 
+/*
+ * nanoev_udp_read_buf
+ *   Start one asynchronous UDP read that appends a datagram to a buffer chain.
+ *
+ * Parameters:
+ *   event    - UDP event.
+ *   buf      - Buffer with a single reference.
+ *   len      - Maximum datagram size.
+ *   callback - Completion callback.
+ *
+ * Returns:
+ *   NANOEV_SUCCESS if the operation was started, otherwise a NANOEV_ERROR_* code.
+ *
+ * Notes:
+ *   len contiguous bytes are reserved at the end of buf. buf must remain valid
+ *   and unmodified until callback runs. Counts as the event's one pending read.
+ */
+int nanoev_udp_read_buf(
+    nanoev_event *event,
+    nanoev_buf *buf,
+    unsigned int len,
+    nanoev_udp_on_read_buf callback
+    );
+
+/*
+ * nanoev_udp_write_buf
+ *   Start sending a buffer chain as one UDP datagram.
+ *
+ * Parameters:
+ *   event    - UDP event.
+ *   buf      - Datagram payload, at most 16 segments; may be shared.
+ *   to_addr  - Destination address, or NULL for a connected UDP event.
+ *   callback - Completion callback.
+ *
+ * Returns:
+ *   NANOEV_SUCCESS if the operation was started, otherwise a NANOEV_ERROR_* code.
+ *
+ * Notes:
+ *   The segments are gathered into one send. The event holds a reference on
+ *   buf until callback returns. Counts as the event's one pending write.
+ */
+int nanoev_udp_write_buf(
+    nanoev_event *event,
+    nanoev_buf *buf,
+    const struct nanoev_addr *to_addr,
+    nanoev_udp_on_write_buf callback
+    );
+
 /*
  * nanoev_udp_connect
  *   Set the default peer address for a UDP event.
@@ -895,6 +2211,28 @@ int nanoev_udp_set_broadcast(
     int enabled
     );
 
+/*
+ * nanoev_udp_set_busy_poll
+ *   Set SO_BUSY_POLL (and SO_PREFER_BUSY_POLL when available) on an open UDP
+ *   socket.
+ *
+ * Parameters:
+ *   event - UDP event.
+ *   usec  - Socket busy-poll time in microseconds, or zero to disable.
+ *
+ * Returns:
+ *   NANOEV_SUCCESS on success, NANOEV_ERROR_FAIL if the platform does not
+ *   support socket busy polling or the process lacks the privilege for the
+ *   requested value, otherwise a NANOEV_ERROR_* code.
+ *
+ * Notes:
+ *   Linux only. A failed call leaves the UDP event usable.
+ */
+int nanoev_udp_set_busy_poll(
+    nanoev_event *event,
+    unsigned int usec
+    );
+
 /*----------------------------------------------------------------------------*/
 
 /*
@@ -1009,4 +2347,47 @@ int nanoev_timer_del(
 
 /*----------------------------------------------------------------------------*/
 
+/*
+ * nanoev_trace_hooks
+ *   Optional callbacks fired at trace points on the dispatch path.
+ *
+ * Notes:
+ *   Any member may be NULL. Hooks run inline on the loop thread and must not
+ *   free the events they are given. poll_enter/poll_exit bracket each poller
+ *   wait, dispatch precedes each I/O completion callback, timer_fire precedes
+ *   each timer expiration with its lateness in microseconds, the tcp_* hooks
+ *   precede the matching user callback and lazy_delete fires when a freed
+ *   event must wait for outstanding I/O. Builds configured with
+ *   NANOEV_ENABLE_USDT also expose the same points as USDT probes of the
+ *   "nanoev" provider.
+ */
+typedef struct nanoev_trace_hooks {
+    void (*poll_enter)(nanoev_loop *loop, const nanoev_timeval *timeout);
+    void (*poll_exit)(nanoev_loop *loop, int count);
+    void (*dispatch)(nanoev_loop *loop, nanoev_event *event);
+    void (*timer_fire)(nanoev_loop *loop, nanoev_event *event, unsigned long long late_usec);
+    void (*tcp_accept)(nanoev_event *listener, int status, nanoev_event *tcp);
+    void (*tcp_connect)(nanoev_event *tcp, int status);
+    void (*tcp_read)(nanoev_event *tcp, int status, unsigned int bytes);
+    void (*tcp_write)(nanoev_event *tcp, int status, unsigned int bytes);
+    void (*lazy_delete)(nanoev_loop *loop, nanoev_event *event);
+} nanoev_trace_hooks;
+
+/*
+ * nanoev_set_trace_hooks
+ *   Install process-wide trace hooks.
+ *
+ * Parameters:
+ *   hooks - Hook table to copy, or NULL to remove all hooks.
+ *
+ * Notes:
+ *   The table is shared by all loops and is not synchronized; install it
+ *   while no loop is running.
+ */
+void nanoev_set_trace_hooks(
+    const nanoev_trace_hooks *hooks
+    );
+
+/*----------------------------------------------------------------------------*/
+
 #endif  /* __NANOEV_H__ */
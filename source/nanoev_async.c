@@ -64,8 +64,8 @@ void async_free(nanoev_event *event)
     nanoev_async *async = (nanoev_async*)event;
 
     mutex_lock(&async->lock);
-    if (async->async_sent || (async->flags & NANOEV_ASYNC_FLAG_READING)) {
-        /* lazy delete */
+    if (async->flags & NANOEV_ASYNC_FLAG_READING) {
+        /* lazy delete: a wakeup is still on its way */
         add_endgame_proactor(async->loop, (nanoev_proactor*)async);
         mutex_unlock(&async->lock);
         return;
@@ -179,6 +179,8 @@ int nanoev_async_send(nanoev_event *event)
         ret = NANOEV_ERROR_FAIL;
         goto my_exit;
     }
+    /* the byte is outstanding I/O until the reactor reads it back */
+    async->flags |= NANOEV_ASYNC_FLAG_READING;
 #endif
     async->async_sent = 1;
 
@@ -0,0 +1,472 @@
+#include "nanoev_internal.h"
+
+/*----------------------------------------------------------------------------*/
+
+/*
+ * A nanoev_buf is a list of segments, each a byte range of a reference-counted
+ * chunk. Chunks of NANOEV_BUF_CHUNK_SIZE bytes are recycled through a
+ * process-wide free list; larger reservations get a chunk of their own.
+ * Appending another buf only takes references on its chunks, so a payload can
+ * be shared by many bufs without copying. Only the segment that reserved a
+ * chunk may grow into the chunk's free space, and only while it ends at the
+ * chunk's high-water mark.
+ */
+
+#define BUF_POOL_MAX_CHUNKS  256
+#define BUF_INLINE_SEGS      4
+
+typedef struct buf_chunk {
+    volatile long refs;
+    unsigned int size;
+    unsigned int used;              /* bytes committed by the owning segment */
+    struct buf_chunk *next;         /* free list */
+} buf_chunk;
+
+#define BUF_CHUNK_DATA(chunk)  ((char*)((chunk) + 1))
+
+typedef struct buf_seg {
+    buf_chunk *chunk;
+    unsigned int offset;
+    unsigned int len;
+    int owner;                      /* may grow into the chunk's free space */
+} buf_seg;
+
+struct nanoev_buf {
+    volatile long refs;
+    unsigned int len;
+    unsigned int first;             /* first live segment */
+    unsigned int count;             /* end of the live segments */
+    unsigned int capacity;
+    buf_seg *segs;
+    buf_seg inline_segs[BUF_INLINE_SEGS];
+};
+
+static struct {
+    mutex lock;
+    buf_chunk *free;
+    unsigned int free_count;
+    int initialized;
+} buf_pool;
+
+static buf_chunk* chunk_alloc(unsigned int size);
+static void chunk_unref(buf_chunk *chunk);
+static int  buf_push_seg(nanoev_buf *buf, buf_chunk *chunk, unsigned int offset,
+    unsigned int len, int owner);
+static char* buf_tail_space(nanoev_buf *buf, unsigned int *avail);
+
+/*----------------------------------------------------------------------------*/
+
+int buf_init(void)
+{
+    memset(&buf_pool, 0, sizeof(buf_pool));
+    if (mutex_init(&buf_pool.lock))
+        return NANOEV_ERROR_FAIL;
+    buf_pool.initialized = 1;
+    return NANOEV_SUCCESS;
+}
+
+void buf_term(void)
+{
+    buf_chunk *chunk;
+
+    if (!buf_pool.initialized)
+        return;
+
+    mutex_lock(&buf_pool.lock);
+    buf_pool.initialized = 0;
+    while ((chunk = buf_pool.free) != NULL) {
+        buf_pool.free = chunk->next;
+        mem_free(chunk);
+    }
+    buf_pool.free_count = 0;
+    mutex_unlock(&buf_pool.lock);
+
+    mutex_uninit(&buf_pool.lock);
+}
+
+unsigned int buf_fill_iov(
+    const nanoev_buf *buf,
+    unsigned int offset,
+    io_buf *vec,
+    unsigned int max
+    )
+{
+    const buf_seg *seg;
+    unsigned int i, n = 0;
+
+    for (i = buf->first; i < buf->count && n < max; i++) {
+        seg = &buf->segs[i];
+        if (offset >= seg->len) {
+            offset -= seg->len;
+            continue;
+        }
+        vec[n].buf = BUF_CHUNK_DATA(seg->chunk) + seg->offset + offset;
+        vec[n].len = seg->len - offset;
+        offset = 0;
+        n++;
+    }
+    return n;
+}
+
+/*----------------------------------------------------------------------------*/
+
+nanoev_buf* nanoev_buf_new(void)
+{
+    nanoev_buf *buf;
+
+    buf = (nanoev_buf*)mem_alloc(sizeof(nanoev_buf));
+    if (!buf)
+        return NULL;
+    memset(buf, 0, sizeof(nanoev_buf));
+    buf->refs = 1;
+    buf->segs = buf->inline_segs;
+    buf->capacity = BUF_INLINE_SEGS;
+    return buf;
+}
+
+nanoev_buf* nanoev_buf_ref(
+    nanoev_buf *buf
+    )
+{
+    ASSERT(buf);
+
+    atomic_add(&buf->refs, 1);
+    return buf;
+}
+
+void nanoev_buf_unref(
+    nanoev_buf *buf
+    )
+{
+    unsigned int i;
+
+    if (!buf)
+        return;
+    if (atomic_add(&buf->refs, -1) != 0)
+        return;
+
+    for (i = buf->first; i < buf->count; i++)
+        chunk_unref(buf->segs[i].chunk);
+    if (buf->segs != buf->inline_segs)
+        mem_free(buf->segs);
+    mem_free(buf);
+}
+
+unsigned int nanoev_buf_len(
+    const nanoev_buf *buf
+    )
+{
+    ASSERT(buf);
+
+    return buf->len;
+}
+
+void* nanoev_buf_reserve(
+    nanoev_buf *buf,
+    unsigned int len
+    )
+{
+    buf_chunk *chunk;
+    unsigned int avail;
+    char *space;
+
+    ASSERT(buf);
+
+    if (!len || buf->refs != 1)
+        return NULL;
+
+    space = buf_tail_space(buf, &avail);
+    if (space && avail >= len)
+        return space;
+
+    chunk = chunk_alloc(len);
+    if (!chunk)
+        return NULL;
+    if (buf_push_seg(buf, chunk, 0, 0, 1)) {
+        chunk_unref(chunk);
+        return NULL;
+    }
+    return BUF_CHUNK_DATA(chunk);
+}
+
+void nanoev_buf_commit(
+    nanoev_buf *buf,
+    unsigned int len
+    )
+{
+    buf_seg *tail;
+
+    ASSERT(buf);
+    ASSERT(buf->refs == 1);
+
+    if (!len)
+        return;
+
+    ASSERT(buf->count > buf->first);
+    tail = &buf->segs[buf->count - 1];
+    ASSERT(tail->owner && tail->offset + tail->len == tail->chunk->used);
+    ASSERT(tail->chunk->size - tail->chunk->used >= len);
+
+    tail->len += len;
+    tail->chunk->used += len;
+    buf->len += len;
+}
+
+int nanoev_buf_append(
+    nanoev_buf *buf,
+    const void *data,
+    unsigned int len
+    )
+{
+    const char *src = (const char*)data;
+    unsigned int avail, n;
+    char *space;
+
+    ASSERT(buf);
+
+    if (!data && len)
+        return NANOEV_ERROR_INVALID_ARG;
+    if (buf->refs != 1)
+        return NANOEV_ERROR_ACCESS_DENIED;
+
+    while (len) {
+        space = buf_tail_space(buf, &avail);
+        if (!space) {
+            n = len < NANOEV_BUF_CHUNK_SIZE ? len : NANOEV_BUF_CHUNK_SIZE;
+            space = (char*)nanoev_buf_reserve(buf, n);
+            if (!space)
+                return NANOEV_ERROR_OUT_OF_MEMORY;
+            avail = n;
+        }
+        n = len < avail ? len : avail;
+        memcpy(space, src, n);
+        nanoev_buf_commit(buf, n);
+        src += n;
+        len -= n;
+    }
+    return NANOEV_SUCCESS;
+}
+
+int nanoev_buf_append_buf(
+    nanoev_buf *buf,
+    const nanoev_buf *src,
+    unsigned int offset,
+    unsigned int len
+    )
+{
+    const buf_seg *seg;
+    unsigned int i, n;
+
+    ASSERT(buf && src);
+
+    if (buf == src || offset > src->len || len > src->len - offset)
+        return NANOEV_ERROR_INVALID_ARG;
+    if (buf->refs != 1)
+        return NANOEV_ERROR_ACCESS_DENIED;
+
+    for (i = src->first; i < src->count && len; i++) {
+        seg = &src->segs[i];
+        if (offset >= seg->len) {
+            offset -= seg->len;
+            continue;
+        }
+        n = seg->len - offset;
+        if (n > len)
+            n = len;
+        if (buf_push_seg(buf, seg->chunk, seg->offset + offset, n, 0))
+            return NANOEV_ERROR_OUT_OF_MEMORY;
+        atomic_add(&seg->chunk->refs, 1);
+        buf->len += n;
+        len -= n;
+        offset = 0;
+    }
+    return NANOEV_SUCCESS;
+}
+
+void nanoev_buf_consume(
+    nanoev_buf *buf,
+    unsigned int len
+    )
+{
+    buf_seg *seg;
+
+    ASSERT(buf);
+    ASSERT(buf->refs == 1);
+    ASSERT(len <= buf->len);
+
+    buf->len -= len;
+    while (buf->first < buf->count) {
+        seg = &buf->segs[buf->first];
+        if (len < seg->len || (!len && seg->owner && buf->first + 1 == buf->count)) {
+            /* a partly consumed segment, or the empty tail kept for appends */
+            seg->offset += len;
+            seg->len -= len;
+            break;
+        }
+        len -= seg->len;
+        chunk_unref(seg->chunk);
+        buf->first++;
+    }
+    if (buf->first == buf->count)
+        buf->first = buf->count = 0;
+}
+
+unsigned int nanoev_buf_segments(
+    const nanoev_buf *buf,
+    nanoev_buf_seg *segs,
+    unsigned int max
+    )
+{
+    const buf_seg *seg;
+    unsigned int i, n = 0;
+
+    ASSERT(buf);
+
+    for (i = buf->first; i < buf->count; i++) {
+        seg = &buf->segs[i];
+        if (!seg->len)
+            continue;
+        if (n < max) {
+            segs[n].data = BUF_CHUNK_DATA(seg->chunk) + seg->offset;
+            segs[n].len = seg->len;
+        }
+        n++;
+    }
+    return n;
+}
+
+unsigned int nanoev_buf_copy(
+    const nanoev_buf *buf,
+    unsigned int offset,
+    void *data,
+    unsigned int len
+    )
+{
+    const buf_seg *seg;
+    char *dst = (char*)data;
+    unsigned int i, n, copied = 0;
+
+    ASSERT(buf);
+    ASSERT(data || !len);
+
+    for (i = buf->first; i < buf->count && copied < len; i++) {
+        seg = &buf->segs[i];
+        if (offset >= seg->len) {
+            offset -= seg->len;
+            continue;
+        }
+        n = seg->len - offset;
+        if (n > len - copied)
+            n = len - copied;
+        memcpy(dst + copied, BUF_CHUNK_DATA(seg->chunk) + seg->offset + offset, n);
+        copied += n;
+        offset = 0;
+    }
+    return copied;
+}
+
+/*----------------------------------------------------------------------------*/
+
+static buf_chunk* chunk_alloc(unsigned int size)
+{
+    buf_chunk *chunk = NULL;
+
+    if (size <= NANOEV_BUF_CHUNK_SIZE) {
+        size = NANOEV_BUF_CHUNK_SIZE;
+    }
+    if (size == NANOEV_BUF_CHUNK_SIZE && buf_pool.initialized) {
+        mutex_lock(&buf_pool.lock);
+        if (buf_pool.free) {
+            chunk = buf_pool.free;
+            buf_pool.free = chunk->next;
+            buf_pool.free_count--;
+        }
+        mutex_unlock(&buf_pool.lock);
+    }
+
+    if (!chunk) {
+        chunk = (buf_chunk*)mem_alloc(sizeof(buf_chunk) + size);
+        if (!chunk)
+            return NULL;
+    }
+    chunk->refs = 1;
+    chunk->size = size;
+    chunk->used = 0;
+    chunk->next = NULL;
+    return chunk;
+}
+
+static void chunk_unref(buf_chunk *chunk)
+{
+    if (atomic_add(&chunk->refs, -1) != 0)
+        return;
+
+    /* bufs outliving nanoev_term() are simply freed */
+    if (chunk->size == NANOEV_BUF_CHUNK_SIZE && buf_pool.initialized) {
+        mutex_lock(&buf_pool.lock);
+        if (buf_pool.initialized && buf_pool.free_count < BUF_POOL_MAX_CHUNKS) {
+            chunk->next = buf_pool.free;
+            buf_pool.free = chunk;
+            buf_pool.free_count++;
+            chunk = NULL;
+        }
+        mutex_unlock(&buf_pool.lock);
+    }
+    if (chunk)
+        mem_free(chunk);
+}
+
+static int buf_push_seg(
+    nanoev_buf *buf,
+    buf_chunk *chunk,
+    unsigned int offset,
+    unsigned int len,
+    int owner
+    )
+{
+    buf_seg *segs;
+    unsigned int live;
+
+    if (buf->count == buf->capacity) {
+        live = buf->count - buf->first;
+        if (buf->first) {
+            /* reuse the slots freed by nanoev_buf_consume() */
+            memmove(buf->segs, buf->segs + buf->first, live * sizeof(buf_seg));
+        } else {
+            segs = (buf_seg*)mem_alloc(buf->capacity * 2 * sizeof(buf_seg));
+            if (!segs)
+                return -1;
+            memcpy(segs, buf->segs, live * sizeof(buf_seg));
+            if (buf->segs != buf->inline_segs)
+                mem_free(buf->segs);
+            buf->segs = segs;
+            buf->capacity *= 2;
+        }
+        buf->first = 0;
+        buf->count = live;
+    }
+
+    buf->segs[buf->count].chunk = chunk;
+    buf->segs[buf->count].offset = offset;
+    buf->segs[buf->count].len = len;
+    buf->segs[buf->count].owner = owner;
+    buf->count++;
+    return 0;
+}
+
+/* free space the tail segment may grow into, or NULL */
+static char* buf_tail_space(nanoev_buf *buf, unsigned int *avail)
+{
+    buf_seg *tail;
+
+    if (buf->count == buf->first)
+        return NULL;
+    tail = &buf->segs[buf->count - 1];
+    if (!tail->owner
+        || tail->offset + tail->len != tail->chunk->used
+        || tail->chunk->used == tail->chunk->size)
+        return NULL;
+
+    *avail = tail->chunk->size - tail->chunk->used;
+    return BUF_CHUNK_DATA(tail->chunk) + tail->chunk->used;
+}
@@ -0,0 +1,421 @@
+#include "nanoev_internal.h"
+
+/*----------------------------------------------------------------------------*/
+
+/*
+ * Happy Eyeballs (RFC 8305) on top of nanoev_tcp_connect().
+ *
+ * Attempts start one Connection Attempt Delay apart, or as soon as the previous
+ * one fails, and keep running side by side until one of them connects. Reactor
+ * backends race helper events and move the winning socket into the caller's
+ * event. An IOCP socket cannot change its completion key, so on Windows the
+ * caller's event tries the addresses one at a time instead.
+ */
+
+#define CONNECT_ATTEMPT_DELAY_MS  250
+
+#ifdef _WIN32
+# define CONNECT_HOST_NOT_FOUND   WSAHOST_NOT_FOUND
+#else
+# define CONNECT_HOST_NOT_FOUND   EHOSTUNREACH
+#endif
+
+struct tcp_connector {
+    nanoev_loop *loop;
+    nanoev_event *tcp;                /* the caller's event */
+    nanoev_tcp_on_connect callback;
+    nanoev_event *dns;
+    nanoev_event *stagger;            /* starts the next attempt */
+    nanoev_event *deadline;           /* overall timeout, or NULL */
+    struct nanoev_addr *addrs;
+    unsigned int addr_count;
+    unsigned int next;                /* next address to try */
+    nanoev_event **attempts;          /* event per address while it is connecting */
+    unsigned int inflight;
+    int last_error;
+    int expired;
+#ifdef _WIN32
+    nanoev_timeval deadline_at;       /* bounds each attempt, which cannot be cancelled */
+#endif
+};
+
+static tcp_connector* connector_new(nanoev_event *tcp, const nanoev_timeval *timeout,
+    nanoev_tcp_on_connect callback);
+static void connector_release(tcp_connector *connector);
+static int  connector_set_addrs(tcp_connector *connector, const struct nanoev_addr *addrs,
+    unsigned int addr_count);
+static int  connector_start_next(tcp_connector *connector);
+static void connector_finish(tcp_connector *connector, int status, unsigned int winner);
+static void connector_on_resolve(nanoev_event *dns, int status, const struct nanoev_addr *addrs,
+    unsigned int addr_count);
+static void connector_on_connect(nanoev_event *tcp, int status);
+static void connector_on_stagger(nanoev_event *timer);
+static void connector_on_deadline(nanoev_event *timer);
+
+/*----------------------------------------------------------------------------*/
+
+int nanoev_tcp_connect_host(
+    nanoev_event *event,
+    const char *host,
+    unsigned short port,
+    const nanoev_timeval *timeout,
+    nanoev_tcp_on_connect callback
+    )
+{
+    tcp_connector *connector;
+    int ret;
+
+    ASSERT(event);
+    ASSERT(event->type == nanoev_event_tcp);
+    ASSERT(in_loop_thread(event->loop));
+
+    if (!host || !callback)
+        return NANOEV_ERROR_INVALID_ARG;
+    if (timeout && (timeout->tv_sec < 0 || timeout->tv_usec < 0 || timeout->tv_usec >= 1000000))
+        return NANOEV_ERROR_INVALID_ARG;
+    if (tcp_get_connector(event) || tcp_has_socket(event))
+        return NANOEV_ERROR_ACCESS_DENIED;
+
+    connector = connector_new(event, timeout, callback);
+    if (!connector)
+        return NANOEV_ERROR_OUT_OF_MEMORY;
+
+    connector->dns = nanoev_event_new(nanoev_event_dns, connector->loop, connector);
+    if (!connector->dns) {
+        connector_release(connector);
+        return NANOEV_ERROR_OUT_OF_MEMORY;
+    }
+    ret = nanoev_dns_resolve(connector->dns, host, NANOEV_AF_UNSPEC, port, connector_on_resolve);
+    if (ret != NANOEV_SUCCESS) {
+        connector_release(connector);
+        return ret;
+    }
+
+    tcp_set_connector(event, connector);
+    return NANOEV_SUCCESS;
+}
+
+int nanoev_tcp_connect_addrs(
+    nanoev_event *event,
+    const struct nanoev_addr *addrs,
+    unsigned int addr_count,
+    const nanoev_timeval *timeout,
+    nanoev_tcp_on_connect callback
+    )
+{
+    tcp_connector *connector;
+    unsigned int i;
+    int ret;
+
+    ASSERT(event);
+    ASSERT(event->type == nanoev_event_tcp);
+    ASSERT(in_loop_thread(event->loop));
+
+    if (!addrs || !addr_count || !callback)
+        return NANOEV_ERROR_INVALID_ARG;
+    for (i = 0; i < addr_count; i++) {
+        if (addrs[i].ss_family != AF_INET && addrs[i].ss_family != AF_INET6)
+            return NANOEV_ERROR_INVALID_ARG;
+    }
+    if (timeout && (timeout->tv_sec < 0 || timeout->tv_usec < 0 || timeout->tv_usec >= 1000000))
+        return NANOEV_ERROR_INVALID_ARG;
+    if (tcp_get_connector(event) || tcp_has_socket(event))
+        return NANOEV_ERROR_ACCESS_DENIED;
+
+    connector = connector_new(event, timeout, callback);
+    if (!connector)
+        return NANOEV_ERROR_OUT_OF_MEMORY;
+
+    /* the caller's order is kept as is */
+    ret = connector_set_addrs(connector, addrs, addr_count);
+    if (ret != NANOEV_SUCCESS) {
+        connector_release(connector);
+        return ret;
+    }
+
+    tcp_set_connector(event, connector);
+    if (!connector_start_next(connector)) {
+        /* every address failed right away */
+        tcp_set_connector(event, NULL);
+        connector_release(connector);
+        return NANOEV_ERROR_FAIL;
+    }
+
+    return NANOEV_SUCCESS;
+}
+
+void tcp_connector_free(tcp_connector *connector)
+{
+    connector_release(connector);
+}
+
+/*----------------------------------------------------------------------------*/
+
+static tcp_connector* connector_new(
+    nanoev_event *tcp,
+    const nanoev_timeval *timeout,
+    nanoev_tcp_on_connect callback
+    )
+{
+    tcp_connector *connector;
+
+    connector = (tcp_connector*)mem_alloc(sizeof(tcp_connector));
+    if (!connector)
+        return NULL;
+    memset(connector, 0, sizeof(tcp_connector));
+
+    connector->loop = tcp->loop;
+    connector->tcp = tcp;
+    connector->callback = callback;
+
+    connector->stagger = nanoev_event_new(nanoev_event_timer, connector->loop, connector);
+    if (!connector->stagger)
+        goto ERROR_EXIT;
+
+    if (timeout) {
+        connector->deadline = nanoev_event_new(nanoev_event_timer, connector->loop, connector);
+        if (!connector->deadline)
+            goto ERROR_EXIT;
+        if (nanoev_timer_add(connector->deadline, *timeout, 0, connector_on_deadline) != NANOEV_SUCCESS)
+            goto ERROR_EXIT;
+#ifdef _WIN32
+        nanoev_loop_now(connector->loop, &connector->deadline_at);
+        time_add(&connector->deadline_at, timeout);
+#endif
+    }
+
+    return connector;
+
+ERROR_EXIT:
+    connector_release(connector);
+    return NULL;
+}
+
+static void connector_release(tcp_connector *connector)
+{
+    unsigned int i;
+
+#ifndef _WIN32
+    for (i = 0; i < connector->addr_count; i++) {
+        if (connector->attempts[i]) {
+            nanoev_event_free(connector->attempts[i]);
+        }
+    }
+#else
+    /* the only attempt runs on the caller's event, which is not ours to free */
+    (void)i;
+#endif
+    if (connector->dns) {
+        nanoev_event_free(connector->dns);
+    }
+    if (connector->stagger) {
+        nanoev_event_free(connector->stagger);
+    }
+    if (connector->deadline) {
+        nanoev_event_free(connector->deadline);
+    }
+    mem_free(connector->attempts);
+    mem_free(connector->addrs);
+    mem_free(connector);
+}
+
+static int connector_set_addrs(
+    tcp_connector *connector,
+    const struct nanoev_addr *addrs,
+    unsigned int addr_count
+    )
+{
+    connector->addrs = (struct nanoev_addr*)mem_alloc(sizeof(struct nanoev_addr) * addr_count);
+    connector->attempts = (nanoev_event**)mem_alloc(sizeof(nanoev_event*) * addr_count);
+    if (!connector->addrs || !connector->attempts)
+        return NANOEV_ERROR_OUT_OF_MEMORY;
+
+    memcpy(connector->addrs, addrs, sizeof(struct nanoev_addr) * addr_count);
+    memset(connector->attempts, 0, sizeof(nanoev_event*) * addr_count);
+    connector->addr_count = addr_count;
+    return NANOEV_SUCCESS;
+}
+
+/*
+ * Start attempts until one is in flight, and arm the delay before the next.
+ * Returns non-zero while any attempt is in flight.
+ */
+static int connector_start_next(tcp_connector *connector)
+{
+    nanoev_event *tcp;
+    nanoev_timeval delay;
+    const nanoev_timeval *timeout = NULL;
+    unsigned int index;
+#ifdef _WIN32
+    nanoev_timeval remaining;
+#endif
+
+    while (connector->next < connector->addr_count) {
+#ifdef _WIN32
+        /* one at a time, on the caller's event */
+        if (connector->inflight)
+            break;
+        tcp = connector->tcp;
+        tcp_reset(tcp);
+        if (connector->deadline) {
+            nanoev_loop_now(connector->loop, &remaining);
+            if (time_cmp(&connector->deadline_at, &remaining) <= 0)
+                break;
+            delay = connector->deadline_at;
+            time_sub(&delay, &remaining);
+            remaining = delay;
+            timeout = &remaining;
+        }
+#else
+        tcp = nanoev_event_new(nanoev_event_tcp, connector->loop, connector);
+        if (!tcp) {
+            connector->last_error = ENOMEM;
+            connector->next++;
+            continue;
+        }
+#endif
+        index = connector->next++;
+        if (nanoev_tcp_connect(tcp, &connector->addrs[index], timeout, connector_on_connect) == NANOEV_SUCCESS) {
+            connector->attempts[index] = tcp;
+            connector->inflight++;
+            break;
+        }
+
+        connector->last_error = nanoev_tcp_error(tcp);
+#ifndef _WIN32
+        nanoev_event_free(tcp);
+#endif
+    }
+
+    nanoev_timer_del(connector->stagger);
+    if (connector->inflight && connector->next < connector->addr_count) {
+        delay.tv_sec = 0;
+        delay.tv_usec = CONNECT_ATTEMPT_DELAY_MS * 1000;
+        if (nanoev_timer_add(connector->stagger, delay, 0, connector_on_stagger) != NANOEV_SUCCESS) {
+            /* no more overlap, the next attempt waits for a failure */
+        }
+    }
+
+    return connector->inflight != 0;
+}
+
+static void connector_finish(tcp_connector *connector, int status, unsigned int winner)
+{
+    nanoev_event *tcp = connector->tcp;
+    nanoev_tcp_on_connect callback = connector->callback;
+
+#ifndef _WIN32
+    if (status == 0 && tcp_adopt(tcp, connector->attempts[winner]) != NANOEV_SUCCESS) {
+        status = socket_last_error();
+    }
+#else
+    /* the caller's event is the winner, nothing to free */
+    if (winner < connector->addr_count) {
+        connector->attempts[winner] = NULL;
+    }
+#endif
+
+    /* losers are cancelled by freeing them */
+    tcp_set_connector(tcp, NULL);
+    connector_release(connector);
+
+    callback(tcp, status);
+}
+
+static void connector_on_resolve(
+    nanoev_event *dns,
+    int status,
+    const struct nanoev_addr *addrs,
+    unsigned int addr_count
+    )
+{
+    tcp_connector *connector = (tcp_connector*)nanoev_event_userdata(dns);
+    unsigned int v4, v6, count = 0;
+
+    if (status != 0 || !addr_count) {
+        connector_finish(connector, CONNECT_HOST_NOT_FOUND, connector->addr_count);
+        return;
+    }
+    if (connector_set_addrs(connector, addrs, addr_count) != NANOEV_SUCCESS) {
+        connector_finish(connector, ENOMEM, connector->addr_count);
+        return;
+    }
+
+    /* RFC 8305 section 4: interleave the families, IPv6 first */
+    v4 = v6 = 0;
+    while (1) {
+        while (v6 < addr_count && addrs[v6].ss_family != AF_INET6)
+            v6++;
+        while (v4 < addr_count && addrs[v4].ss_family != AF_INET)
+            v4++;
+        if (v6 == addr_count && v4 == addr_count)
+            break;
+        if (v4 == addr_count || (v6 < addr_count && count % 2 == 0)) {
+            connector->addrs[count++] = addrs[v6++];
+        } else {
+            connector->addrs[count++] = addrs[v4++];
+        }
+    }
+    connector->addr_count = count;
+
+    if (!connector_start_next(connector)) {
+        connector_finish(connector, connector->last_error, connector->addr_count);
+    }
+}
+
+static void connector_on_connect(nanoev_event *tcp, int status)
+{
+    tcp_connector *connector;
+    unsigned int index;
+
+#ifdef _WIN32
+    connector = tcp_get_connector(tcp);
+#else
+    connector = (tcp_connector*)nanoev_event_userdata(tcp);
+#endif
+
+    for (index = 0; index < connector->addr_count; index++) {
+        if (connector->attempts[index] == tcp)
+            break;
+    }
+    ASSERT(index < connector->addr_count);
+
+    if (status == 0) {
+        connector_finish(connector, 0, index);
+        return;
+    }
+
+    /* a failure starts the next attempt without waiting for the delay */
+    connector->attempts[index] = NULL;
+    connector->inflight--;
+    connector->last_error = status;
+#ifndef _WIN32
+    nanoev_event_free(tcp);
+#endif
+
+    if (connector->expired || !connector_start_next(connector)) {
+        connector_finish(connector, connector->last_error, connector->addr_count);
+    }
+}
+
+static void connector_on_stagger(nanoev_event *timer)
+{
+    tcp_connector *connector = (tcp_connector*)nanoev_event_userdata(timer);
+
+    if (!connector_start_next(connector)) {
+        connector_finish(connector, connector->last_error, connector->addr_count);
+    }
+}
+
+static void connector_on_deadline(nanoev_event *timer)
+{
+    tcp_connector *connector = (tcp_connector*)nanoev_event_userdata(timer);
+
+    connector->expired = 1;
+#ifdef _WIN32
+    /* the attempt in flight times out by itself at the same moment */
+    if (connector->inflight)
+        return;
+#endif
+    connector_finish(connector, socket_timeout_error(), connector->addr_count);
+}
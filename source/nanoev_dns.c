@@ -1,5 +1,6 @@
 #include "nanoev_internal.h"
 
+#include <ctype.h>
 #include <stdio.h>
 #ifdef _WIN32
 # include <ws2tcpip.h>
@@ -11,7 +12,7 @@
 
 struct nanoev_dns {
     NANOEV_EVENT_FILEDS
-    struct nanoev_dns *queue_next;
+    struct nanoev_dns *waiter_next;   /* next event sharing the same lookup */
     nanoev_event *async;
     mutex lock;
     int pending;
@@ -23,32 +24,92 @@ struct nanoev_dns {
     struct nanoev_addr *addrs;
     unsigned int addr_count;
     nanoev_dns_callback callback;
+    nanoev_timer_node cache_node;     /* delivers a cache hit on the next loop iteration */
+    dns_native_query *native;         /* pending query of the native backend */
 };
 typedef struct nanoev_dns nanoev_dns;
 
 #define NANOEV_DNS_FLAG_DELETED  0x80000000
 #define DNS_THREAD_COUNT         4
+#define DNS_MAX_THREADS          64
+#define DNS_INFLIGHT_BUCKETS     64
+
+/* one getaddrinfo() call, shared by every event asking for the same name */
+typedef struct dns_lookup {
+    struct dns_lookup *queue_next;
+    struct dns_lookup *hash_next;
+    unsigned int hash;
+    int family;
+    nanoev_dns *waiters;
+    char *host;                       /* follows the lookup, lower-cased */
+} dns_lookup;
+
+typedef struct dns_cache_entry {
+    struct dns_cache_entry *hash_next;
+    struct dns_cache_entry *lru_prev;
+    struct dns_cache_entry *lru_next;
+    unsigned int hash;
+    int family;
+    int status;
+    nanoev_timeval expires;
+    unsigned int addr_count;
+    struct nanoev_addr *addrs;        /* follows the entry in the same block */
+    char *host;                       /* follows addrs, lower-cased */
+} dns_cache_entry;
+
+typedef struct dns_cache {
+    mutex lock;
+    dns_cache_entry **buckets;
+    unsigned int bucket_mask;
+    unsigned int count;
+    unsigned int max_entries;         /* 0 means disabled */
+    unsigned int ttl;
+    unsigned int negative_ttl;
+    dns_cache_entry lru;              /* sentinel, lru.lru_next is the most recent */
+    unsigned int hits;
+    unsigned int misses;
+} dns_cache;
 
 typedef struct dns_thread_pool {
     mutex lock;
     cond ready;
-    thread_handle threads[DNS_THREAD_COUNT];
-    nanoev_dns *head;
-    nanoev_dns *tail;
+    thread_handle threads[DNS_MAX_THREADS];
+    dns_lookup *head;
+    dns_lookup *tail;
+    dns_lookup *inflight[DNS_INFLIGHT_BUCKETS];
+    unsigned int queued;
+    unsigned int idle;
+    unsigned int max_threads;
+    unsigned int max_queue;           /* 0 means unbounded */
     int initialized;
     int started;
     int stopping;
+    int backend;                      /* NANOEV_DNS_BACKEND_* */
 } dns_thread_pool;
 
 static void dns_destroy(nanoev_dns *dns);
 static void dns_on_async(nanoev_event *async);
 static void dns_worker(void *arg);
-static int dns_start_workers_locked(void);
-static int dns_enqueue(nanoev_dns *dns);
+static int dns_enqueue(nanoev_dns *dns, const char *host, int family);
+static void dns_deliver(dns_lookup *lookup, int status, const struct nanoev_addr *addrs,
+    unsigned int addr_count);
 static char* dns_strdup(const char *str);
 static int dns_copy_results(struct addrinfo *results, struct nanoev_addr **addrs, unsigned int *addr_count);
+static void dns_complete(nanoev_dns *dns);
+static void dns_on_cache_hit(nanoev_timer_node *node);
+static void dns_on_native(void *arg, int status, struct nanoev_addr *addrs, unsigned int addr_count,
+    unsigned int ttl);
+static void dns_set_port(struct nanoev_addr *addrs, unsigned int addr_count, unsigned short port);
+static unsigned int dns_name_hash(const char *host, int family);
+static int dns_name_equal(const char *lower, const char *host);
+static void dns_cache_flush_locked(void);
+static int dns_cache_lookup(const char *host, int family, unsigned short port,
+    int *status, struct nanoev_addr **addrs, unsigned int *addr_count);
+static void dns_cache_store(const char *host, int family, int status,
+    const struct nanoev_addr *addrs, unsigned int addr_count, unsigned int record_ttl);
 
 static dns_thread_pool dns_pool;
+static dns_cache dns_cache_;
 
 /*----------------------------------------------------------------------------*/
 
@@ -56,13 +117,29 @@ int dns_init(void)
 {
     memset(&dns_pool, 0, sizeof(dns_pool));
 
+    memset(&dns_cache_, 0, sizeof(dns_cache_));
+
     if (mutex_init(&dns_pool.lock))
         return NANOEV_ERROR_FAIL;
     if (cond_init(&dns_pool.ready)) {
         mutex_uninit(&dns_pool.lock);
         return NANOEV_ERROR_FAIL;
     }
+    if (mutex_init(&dns_cache_.lock)) {
+        cond_uninit(&dns_pool.ready);
+        mutex_uninit(&dns_pool.lock);
+        return NANOEV_ERROR_FAIL;
+    }
+    dns_cache_.lru.lru_prev = &dns_cache_.lru;
+    dns_cache_.lru.lru_next = &dns_cache_.lru;
+    if (dns_native_init() != NANOEV_SUCCESS) {
+        mutex_uninit(&dns_cache_.lock);
+        cond_uninit(&dns_pool.ready);
+        mutex_uninit(&dns_pool.lock);
+        return NANOEV_ERROR_FAIL;
+    }
 
+    dns_pool.max_threads = DNS_THREAD_COUNT;
     dns_pool.initialized = 1;
     return NANOEV_SUCCESS;
 }
@@ -85,6 +162,118 @@ void dns_term(void)
     cond_uninit(&dns_pool.ready);
     mutex_uninit(&dns_pool.lock);
     memset(&dns_pool, 0, sizeof(dns_pool));
+
+    dns_cache_flush_locked();
+    mem_free(dns_cache_.buckets);
+    mutex_uninit(&dns_cache_.lock);
+    memset(&dns_cache_, 0, sizeof(dns_cache_));
+
+    dns_native_term();
+}
+
+int nanoev_dns_set_backend(
+    int backend,
+    const struct nanoev_addr *servers,
+    unsigned int server_count
+    )
+{
+    int ret;
+
+    if (!dns_pool.initialized)
+        return NANOEV_ERROR_ACCESS_DENIED;
+    if (backend != NANOEV_DNS_BACKEND_SYSTEM && backend != NANOEV_DNS_BACKEND_NATIVE)
+        return NANOEV_ERROR_INVALID_ARG;
+
+    if (backend == NANOEV_DNS_BACKEND_NATIVE) {
+        ret = dns_native_configure(servers, server_count);
+        if (ret != NANOEV_SUCCESS)
+            return ret;
+    }
+
+    mutex_lock(&dns_pool.lock);
+    dns_pool.backend = backend;
+    mutex_unlock(&dns_pool.lock);
+
+    return NANOEV_SUCCESS;
+}
+
+int nanoev_dns_set_pool(
+    unsigned int threads,
+    unsigned int max_queue
+    )
+{
+    if (!dns_pool.initialized)
+        return NANOEV_ERROR_ACCESS_DENIED;
+    if (threads == 0 || threads > DNS_MAX_THREADS)
+        return NANOEV_ERROR_INVALID_ARG;
+
+    mutex_lock(&dns_pool.lock);
+    dns_pool.max_threads = threads;
+    dns_pool.max_queue = max_queue;
+    mutex_unlock(&dns_pool.lock);
+
+    return NANOEV_SUCCESS;
+}
+
+int nanoev_dns_set_cache(
+    unsigned int max_entries,
+    unsigned int ttl,
+    unsigned int negative_ttl
+    )
+{
+    dns_cache_entry **buckets = NULL;
+    unsigned int bucket_count = 0;
+
+    if (!dns_pool.initialized)
+        return NANOEV_ERROR_ACCESS_DENIED;
+
+    if (max_entries) {
+        if (max_entries > 0x1000000 || !ttl)
+            return NANOEV_ERROR_INVALID_ARG;
+
+        /* keep chains short: at least one bucket per entry */
+        bucket_count = 16;
+        while (bucket_count < max_entries)
+            bucket_count <<= 1;
+        buckets = (dns_cache_entry**)mem_alloc(sizeof(dns_cache_entry*) * bucket_count);
+        if (!buckets)
+            return NANOEV_ERROR_OUT_OF_MEMORY;
+        memset(buckets, 0, sizeof(dns_cache_entry*) * bucket_count);
+    }
+
+    mutex_lock(&dns_cache_.lock);
+    dns_cache_flush_locked();
+    mem_free(dns_cache_.buckets);
+    dns_cache_.buckets = buckets;
+    dns_cache_.bucket_mask = bucket_count ? bucket_count - 1 : 0;
+    dns_cache_.max_entries = max_entries;
+    dns_cache_.ttl = ttl;
+    dns_cache_.negative_ttl = negative_ttl;
+    dns_cache_.hits = 0;
+    dns_cache_.misses = 0;
+    mutex_unlock(&dns_cache_.lock);
+
+    return NANOEV_SUCCESS;
+}
+
+void nanoev_dns_cache_stats(
+    unsigned int *hits,
+    unsigned int *misses
+    )
+{
+    unsigned int h = 0, m = 0;
+
+    if (dns_pool.initialized) {
+        mutex_lock(&dns_cache_.lock);
+        h = dns_cache_.hits;
+        m = dns_cache_.misses;
+        mutex_unlock(&dns_cache_.lock);
+    }
+
+    if (hits)
+        *hits = h;
+    if (misses)
+        *misses = m;
 }
 
 /*----------------------------------------------------------------------------*/
@@ -106,6 +295,7 @@ nanoev_event* dns_new(nanoev_loop *loop, void *userdata)
         mem_free(dns);
         return NULL;
     }
+    timer_node_init(&dns->cache_node, dns_on_cache_hit, dns);
 
     dns->async = async_new(loop, dns);
     if (!dns->async) {
@@ -132,6 +322,20 @@ void dns_free(nanoev_event *event)
     ASSERT(dns);
     ASSERT(dns->type == nanoev_event_dns);
 
+    if (timer_node_active(&dns->cache_node)) {
+        /* a cache hit waiting for delivery, no worker owns the event */
+        timer_node_del(get_loop_timers(dns->loop), &dns->cache_node);
+        dns_destroy(dns);
+        return;
+    }
+    if (dns->native) {
+        /* native queries run on the loop, cancel instead of waiting */
+        dns_native_cancel(dns->native);
+        dns->native = NULL;
+        dns_destroy(dns);
+        return;
+    }
+
     mutex_lock(&dns->lock);
     pending = dns->pending;
     if (pending) {
@@ -154,6 +358,12 @@ int nanoev_dns_resolve(
 {
     nanoev_dns *dns = (nanoev_dns*)event;
     char *host_copy;
+    struct nanoev_addr *addrs;
+    unsigned int addr_count;
+    nanoev_timeval now;
+    int status;
+    int backend;
+    int ret;
 
     ASSERT(dns);
     ASSERT(dns->type == nanoev_event_dns);
@@ -171,9 +381,36 @@ int nanoev_dns_resolve(
     }
     mutex_unlock(&dns->lock);
 
-    host_copy = dns_strdup(host);
-    if (!host_copy)
-        return NANOEV_ERROR_OUT_OF_MEMORY;
+    if (dns_cache_lookup(host, family, port, &status, &addrs, &addr_count)) {
+        /* deliver from the loop, never from inside this call */
+        nanoev_loop_now(dns->loop, &now);
+        if (timer_node_add(get_loop_timers(dns->loop), &dns->cache_node, &now) != NANOEV_SUCCESS) {
+            mem_free(addrs);
+            return NANOEV_ERROR_OUT_OF_MEMORY;
+        }
+        mutex_lock(&dns->lock);
+        dns->pending = 1;
+        dns->completed = 1;
+        dns->status = status;
+        dns->host = NULL;
+        dns->addrs = addrs;
+        dns->addr_count = addr_count;
+        dns->callback = callback;
+        mutex_unlock(&dns->lock);
+        return NANOEV_SUCCESS;
+    }
+
+    mutex_lock(&dns_pool.lock);
+    backend = dns_pool.backend;
+    mutex_unlock(&dns_pool.lock);
+
+    /* the native backend needs the name again for the cache */
+    host_copy = NULL;
+    if (backend == NANOEV_DNS_BACKEND_NATIVE) {
+        host_copy = dns_strdup(host);
+        if (!host_copy)
+            return NANOEV_ERROR_OUT_OF_MEMORY;
+    }
 
     mutex_lock(&dns->lock);
     dns->pending = 1;
@@ -187,14 +424,21 @@ int nanoev_dns_resolve(
     dns->callback = callback;
     mutex_unlock(&dns->lock);
 
-    if (dns_enqueue(dns) != NANOEV_SUCCESS) {
+    if (backend == NANOEV_DNS_BACKEND_NATIVE) {
+        dns->native = dns_native_start(dns->loop, host, family, port, dns_on_native, dns);
+        ret = dns->native ? NANOEV_SUCCESS : NANOEV_ERROR_FAIL;
+    } else {
+        ret = dns_enqueue(dns, host, family);
+    }
+
+    if (ret != NANOEV_SUCCESS) {
         mutex_lock(&dns->lock);
         dns->pending = 0;
         dns->host = NULL;
         dns->callback = NULL;
         mutex_unlock(&dns->lock);
         mem_free(host_copy);
-        return NANOEV_ERROR_FAIL;
+        return ret;
     }
 
     return NANOEV_SUCCESS;
@@ -222,7 +466,39 @@ static void dns_destroy(nanoev_dns *dns)
 
 static void dns_on_async(nanoev_event *async)
 {
-    nanoev_dns *dns = (nanoev_dns*)nanoev_event_userdata(async);
+    dns_complete((nanoev_dns*)nanoev_event_userdata(async));
+}
+
+static void dns_on_cache_hit(nanoev_timer_node *node)
+{
+    dns_complete((nanoev_dns*)node->userdata);
+}
+
+static void dns_on_native(
+    void *arg,
+    int status,
+    struct nanoev_addr *addrs,
+    unsigned int addr_count,
+    unsigned int ttl
+    )
+{
+    nanoev_dns *dns = (nanoev_dns*)arg;
+
+    dns->native = NULL;
+    dns_cache_store(dns->host, dns->family, status, addrs, addr_count, ttl);
+
+    mutex_lock(&dns->lock);
+    dns->status = status;
+    dns->addrs = addrs;
+    dns->addr_count = addr_count;
+    dns->completed = 1;
+    mutex_unlock(&dns->lock);
+
+    dns_complete(dns);
+}
+
+static void dns_complete(nanoev_dns *dns)
+{
     nanoev_dns_callback callback;
     struct nanoev_addr *addrs;
     unsigned int addr_count;
@@ -271,52 +547,43 @@ static void dns_on_async(nanoev_event *async)
 static void dns_worker(void *arg)
 {
     dns_thread_pool *pool = (dns_thread_pool*)arg;
-    nanoev_dns *dns;
+    dns_lookup *lookup;
     struct addrinfo hints;
     struct addrinfo *results = NULL;
     struct nanoev_addr *addrs = NULL;
     unsigned int addr_count = 0;
-    char service[6];
-    char *host;
-    int family;
-    unsigned short port;
     int status;
 
     while (1) {
         mutex_lock(&pool->lock);
+        pool->idle++;
         while (!pool->head && !pool->stopping) {
             cond_wait(&pool->ready, &pool->lock);
         }
+        pool->idle--;
         if (!pool->head && pool->stopping) {
             mutex_unlock(&pool->lock);
             return;
         }
 
-        dns = pool->head;
-        pool->head = dns->queue_next;
+        lookup = pool->head;
+        pool->head = lookup->queue_next;
         if (!pool->head) {
             pool->tail = NULL;
         }
-        dns->queue_next = NULL;
+        pool->queued--;
         mutex_unlock(&pool->lock);
 
         results = NULL;
         addrs = NULL;
         addr_count = 0;
 
-        mutex_lock(&dns->lock);
-        host = dns->host;
-        family = dns->family;
-        port = dns->port;
-        mutex_unlock(&dns->lock);
-
-        snprintf(service, sizeof(service), "%u", (unsigned int)port);
-
+        /* ports differ between waiters, they are applied on delivery */
         memset(&hints, 0, sizeof(hints));
-        hints.ai_family = family;
+        hints.ai_family = lookup->family;
         hints.ai_socktype = SOCK_STREAM;
 
-        status = getaddrinfo(host, service, &hints, &results);
+        status = getaddrinfo(lookup->host, NULL, &hints, &results);
         if (status == 0) {
             status = dns_copy_results(results, &addrs, &addr_count);
             if (status != 0) {
@@ -332,61 +599,132 @@ static void dns_worker(void *arg)
             freeaddrinfo(results);
         }
 
-        mutex_lock(&dns->lock);
-        dns->status = status;
-        dns->addrs = addrs;
-        dns->addr_count = addr_count;
-        dns->completed = 1;
-        mutex_unlock(&dns->lock);
-
-        nanoev_async_send(dns->async);
+        dns_cache_store(lookup->host, lookup->family, status, addrs, addr_count, 0);
+        dns_deliver(lookup, status, addrs, addr_count);
+        if (addrs) {
+            mem_free(addrs);
+        }
     }
 }
 
-static int dns_start_workers_locked(void)
+static void dns_deliver(
+    dns_lookup *lookup,
+    int status,
+    const struct nanoev_addr *addrs,
+    unsigned int addr_count
+    )
 {
-    int i;
+    dns_lookup **cur;
+    nanoev_dns *dns, *next;
+    struct nanoev_addr *copy;
 
-    for (i = 0; i < DNS_THREAD_COUNT; i++) {
-        if (thread_create(&dns_pool.threads[i], dns_worker, &dns_pool) != NANOEV_SUCCESS) {
-            dns_pool.stopping = 1;
-            cond_broadcast(&dns_pool.ready);
-            mutex_unlock(&dns_pool.lock);
+    /* later requests for the name start a new lookup from here on */
+    mutex_lock(&dns_pool.lock);
+    cur = &dns_pool.inflight[lookup->hash % DNS_INFLIGHT_BUCKETS];
+    while (*cur != lookup) {
+        cur = &(*cur)->hash_next;
+    }
+    *cur = lookup->hash_next;
+    mutex_unlock(&dns_pool.lock);
 
-            while (dns_pool.started > 0) {
-                dns_pool.started--;
-                thread_join(dns_pool.threads[dns_pool.started]);
+    for (dns = lookup->waiters; dns; dns = next) {
+        next = dns->waiter_next;
+        dns->waiter_next = NULL;
+
+        copy = NULL;
+        if (status == 0) {
+            copy = (struct nanoev_addr*)mem_alloc(sizeof(struct nanoev_addr) * addr_count);
+            if (copy) {
+                memcpy(copy, addrs, sizeof(struct nanoev_addr) * addr_count);
             }
+        }
 
-            mutex_lock(&dns_pool.lock);
-            dns_pool.stopping = 0;
-            return NANOEV_ERROR_FAIL;
+        mutex_lock(&dns->lock);
+        if (status == 0 && !copy) {
+            dns->status = EAI_MEMORY;
+        } else {
+            dns->status = status;
+            dns_set_port(copy, copy ? addr_count : 0, dns->port);
         }
-        dns_pool.started++;
+        dns->addrs = copy;
+        dns->addr_count = copy ? addr_count : 0;
+        dns->completed = 1;
+        mutex_unlock(&dns->lock);
+
+        /* dns may be destroyed by its loop from here on */
+        nanoev_async_send(dns->async);
     }
 
-    return NANOEV_SUCCESS;
+    mem_free(lookup);
 }
 
-static int dns_enqueue(nanoev_dns *dns)
+static int dns_enqueue(nanoev_dns *dns, const char *host, int family)
 {
+    dns_lookup *lookup;
+    unsigned int hash;
+    size_t host_len, i;
+
+    hash = dns_name_hash(host, family);
+
     mutex_lock(&dns_pool.lock);
     if (!dns_pool.initialized || dns_pool.stopping) {
         mutex_unlock(&dns_pool.lock);
         return NANOEV_ERROR_ACCESS_DENIED;
     }
-    if (!dns_pool.started && dns_start_workers_locked() != NANOEV_SUCCESS) {
+
+    /* join a lookup for the same name that has not completed yet */
+    lookup = dns_pool.inflight[hash % DNS_INFLIGHT_BUCKETS];
+    while (lookup && (lookup->hash != hash || lookup->family != family
+        || !dns_name_equal(lookup->host, host))) {
+        lookup = lookup->hash_next;
+    }
+    if (lookup) {
+        dns->waiter_next = lookup->waiters;
+        lookup->waiters = dns;
+        mutex_unlock(&dns_pool.lock);
+        return NANOEV_SUCCESS;
+    }
+
+    if (dns_pool.max_queue && dns_pool.queued >= dns_pool.max_queue) {
         mutex_unlock(&dns_pool.lock);
         return NANOEV_ERROR_FAIL;
     }
 
-    dns->queue_next = NULL;
+    /* add a worker while requests wait and the pool may grow */
+    if (dns_pool.idle <= dns_pool.queued && (unsigned int)dns_pool.started < dns_pool.max_threads) {
+        if (thread_create(&dns_pool.threads[dns_pool.started], dns_worker, &dns_pool) == NANOEV_SUCCESS) {
+            dns_pool.started++;
+        } else if (!dns_pool.started) {
+            mutex_unlock(&dns_pool.lock);
+            return NANOEV_ERROR_FAIL;
+        }
+    }
+
+    host_len = strlen(host);
+    lookup = (dns_lookup*)mem_alloc(sizeof(dns_lookup) + host_len + 1);
+    if (!lookup) {
+        mutex_unlock(&dns_pool.lock);
+        return NANOEV_ERROR_OUT_OF_MEMORY;
+    }
+    lookup->queue_next = NULL;
+    lookup->hash = hash;
+    lookup->family = family;
+    lookup->host = (char*)(lookup + 1);
+    for (i = 0; i <= host_len; i++) {
+        lookup->host[i] = (char)tolower((unsigned char)host[i]);
+    }
+    dns->waiter_next = NULL;
+    lookup->waiters = dns;
+
+    lookup->hash_next = dns_pool.inflight[hash % DNS_INFLIGHT_BUCKETS];
+    dns_pool.inflight[hash % DNS_INFLIGHT_BUCKETS] = lookup;
     if (dns_pool.tail) {
-        dns_pool.tail->queue_next = dns;
+        dns_pool.tail->queue_next = lookup;
     } else {
-        dns_pool.head = dns;
+        dns_pool.head = lookup;
     }
-    dns_pool.tail = dns;
+    dns_pool.tail = lookup;
+    dns_pool.queued++;
     cond_signal(&dns_pool.ready);
     mutex_unlock(&dns_pool.lock);
 
@@ -437,3 +775,251 @@ static int dns_copy_results(struct addrinfo *results, struct nanoev_addr **addrs
     *addr_count = count;
     return NANOEV_SUCCESS;
 }
+
+static void dns_set_port(struct nanoev_addr *addrs, unsigned int addr_count, unsigned short port)
+{
+    unsigned int i;
+
+    for (i = 0; i < addr_count; i++) {
+        if (addrs[i].ss_family == AF_INET) {
+            ((struct sockaddr_in*)&addrs[i])->sin_port = htons(port);
+        } else if (addrs[i].ss_family == AF_INET6) {
+            ((struct sockaddr_in6*)&addrs[i])->sin6_port = htons(port);
+        }
+    }
+}
+
+/*----------------------------------------------------------------------------*/
+
+static unsigned int dns_name_hash(const char *host, int family)
+{
+    /* FNV-1a over the lower-cased name */
+    unsigned int hash = 2166136261u;
+    const unsigned char *p;
+
+    for (p = (const unsigned char*)host; *p; p++) {
+        hash ^= (unsigned int)tolower(*p);
+        hash *= 16777619u;
+    }
+    hash ^= (unsigned int)family;
+    hash *= 16777619u;
+
+    return hash;
+}
+
+static int dns_name_equal(const char *lower, const char *host)
+{
+    const unsigned char *a = (const unsigned char*)lower;
+    const unsigned char *b = (const unsigned char*)host;
+
+    while (*a && *a == (unsigned char)tolower(*b)) {
+        a++;
+        b++;
+    }
+    return *a == 0 && *b == 0;
+}
+
+static int dns_cache_match(const dns_cache_entry *entry, unsigned int hash, const char *host, int family)
+{
+    if (entry->hash != hash || entry->family != family)
+        return 0;
+    return dns_name_equal(entry->host, host);
+}
+
+static void dns_cache_unlink_locked(dns_cache_entry *entry)
+{
+    dns_cache_entry **cur;
+
+    cur = &dns_cache_.buckets[entry->hash & dns_cache_.bucket_mask];
+    while (*cur != entry) {
+        cur = &(*cur)->hash_next;
+    }
+    *cur = entry->hash_next;
+
+    entry->lru_prev->lru_next = entry->lru_next;
+    entry->lru_next->lru_prev = entry->lru_prev;
+    dns_cache_.count--;
+}
+
+static void dns_cache_flush_locked(void)
+{
+    dns_cache_entry *entry, *next;
+
+    entry = dns_cache_.lru.lru_next;
+    while (entry && entry != &dns_cache_.lru) {
+        next = entry->lru_next;
+        mem_free(entry);
+        entry = next;
+    }
+
+    dns_cache_.lru.lru_prev = &dns_cache_.lru;
+    dns_cache_.lru.lru_next = &dns_cache_.lru;
+    dns_cache_.count = 0;
+    if (dns_cache_.buckets) {
+        memset(dns_cache_.buckets, 0, sizeof(dns_cache_entry*) * (dns_cache_.bucket_mask + 1));
+    }
+}
+
+static int dns_cache_lookup(
+    const char *host,
+    int family,
+    unsigned short port,
+    int *status,
+    struct nanoev_addr **addrs,
+    unsigned int *addr_count
+    )
+{
+    dns_cache_entry *entry;
+    unsigned int hash;
+    nanoev_timeval now;
+    struct nanoev_addr *copy = NULL;
+
+    hash = dns_name_hash(host, family);
+    nanoev_now(&now);
+
+    mutex_lock(&dns_cache_.lock);
+    if (!dns_cache_.max_entries) {
+        mutex_unlock(&dns_cache_.lock);
+        return 0;
+    }
+
+    entry = dns_cache_.buckets[hash & dns_cache_.bucket_mask];
+    while (entry && !dns_cache_match(entry, hash, host, family)) {
+        entry = entry->hash_next;
+    }
+
+    if (entry && time_cmp(&entry->expires, &now) <= 0) {
+        dns_cache_unlink_locked(entry);
+        mem_free(entry);
+        entry = NULL;
+    }
+
+    if (!entry) {
+        dns_cache_.misses++;
+        mutex_unlock(&dns_cache_.lock);
+        return 0;
+    }
+
+    if (entry->addr_count) {
+        copy = (struct nanoev_addr*)mem_alloc(sizeof(struct nanoev_addr) * entry->addr_count);
+        if (!copy) {
+            /* fall back to the resolver */
+            dns_cache_.misses++;
+            mutex_unlock(&dns_cache_.lock);
+            return 0;
+        }
+        memcpy(copy, entry->addrs, sizeof(struct nanoev_addr) * entry->addr_count);
+    }
+
+    /* move to the front of the LRU list */
+    entry->lru_prev->lru_next = entry->lru_next;
+    entry->lru_next->lru_prev = entry->lru_prev;
+    entry->lru_prev = &dns_cache_.lru;
+    entry->lru_next = dns_cache_.lru.lru_next;
+    dns_cache_.lru.lru_next->lru_prev = entry;
+    dns_cache_.lru.lru_next = entry;
+
+    *status = entry->status;
+    *addr_count = entry->addr_count;
+    dns_cache_.hits++;
+    mutex_unlock(&dns_cache_.lock);
+
+    dns_set_port(copy, *addr_count, port);
+    *addrs = copy;
+    return 1;
+}
+
+static void dns_cache_store(
+    const char *host,
+    int family,
+    int status,
+    const struct nanoev_addr *addrs,
+    unsigned int addr_count,
+    unsigned int record_ttl
+    )
+{
+    dns_cache_entry *entry, *old;
+    unsigned int hash, ttl;
+    size_t host_len, i;
+
+    if (status != 0) {
+        /* only remember answers that say the name does not exist */
+        if (status != EAI_NONAME
+        #if defined(EAI_NODATA) && EAI_NODATA != EAI_NONAME
+            && status != EAI_NODATA
+        #endif
+            ) {
+            return;
+        }
+        addr_count = 0;
+    }
+
+    mutex_lock(&dns_cache_.lock);
+    ttl = status == 0 ? dns_cache_.ttl : dns_cache_.negative_ttl;
+    if (!dns_cache_.max_entries) {
+        ttl = 0;
+    }
+    mutex_unlock(&dns_cache_.lock);
+    if (!ttl)
+        return;
+
+    host_len = strlen(host);
+    entry = (dns_cache_entry*)mem_alloc(
+        sizeof(dns_cache_entry) + sizeof(struct nanoev_addr) * addr_count + host_len + 1);
+    if (!entry)
+        return;
+
+    hash = dns_name_hash(host, family);
+    entry->hash = hash;
+    entry->family = family;
+    entry->status = status;
+    entry->addr_count = addr_count;
+    entry->addrs = (struct nanoev_addr*)(entry + 1);
+    entry->host = (char*)(entry->addrs + addr_count);
+    if (addr_count) {
+        memcpy(entry->addrs, addrs, sizeof(struct nanoev_addr) * addr_count);
+    }
+    for (i = 0; i <= host_len; i++) {
+        entry->host[i] = (char)tolower((unsigned char)host[i]);
+    }
+
+    mutex_lock(&dns_cache_.lock);
+    ttl = status == 0 ? dns_cache_.ttl : dns_cache_.negative_ttl;
+    if (!dns_cache_.max_entries || !ttl) {
+        mutex_unlock(&dns_cache_.lock);
+        mem_free(entry);
+        return;
+    }
+    /* record_ttl is 0 when the resolver does not report one */
+    if (record_ttl && record_ttl < ttl) {
+        ttl = record_ttl;
+    }
+    nanoev_now(&entry->expires);
+    entry->expires.tv_sec += ttl;
+
+    /* replace an existing answer for the same name */
+    old = dns_cache_.buckets[hash & dns_cache_.bucket_mask];
+    while (old && !dns_cache_match(old, hash, entry->host, family)) {
+        old = old->hash_next;
+    }
+    if (old) {
+        dns_cache_unlink_locked(old);
+        mem_free(old);
+    }
+
+    /* evict the least recently used entry */
+    if (dns_cache_.count >= dns_cache_.max_entries) {
+        old = dns_cache_.lru.lru_prev;
+        dns_cache_unlink_locked(old);
+        mem_free(old);
+    }
+
+    entry->hash_next = dns_cache_.buckets[hash & dns_cache_.bucket_mask];
+    dns_cache_.buckets[hash & dns_cache_.bucket_mask] = entry;
+    entry->lru_prev = &dns_cache_.lru;
+    entry->lru_next = dns_cache_.lru.lru_next;
+    dns_cache_.lru.lru_next->lru_prev = entry;
+    dns_cache_.lru.lru_next = entry;
+    dns_cache_.count++;
+    mutex_unlock(&dns_cache_.lock);
+}
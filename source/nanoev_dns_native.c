@@ -0,0 +1,1061 @@
+#include "nanoev_internal.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#ifdef _WIN32
+# include <ws2tcpip.h>
+#else
+# include <netdb.h>
+#endif
+
+/*----------------------------------------------------------------------------*/
+
+/*
+ * A stub resolver speaking DNS over nanoev UDP, falling back to TCP when an
+ * answer is truncated. Everything runs on the calling loop; no thread is
+ * involved. Names are looked up in the hosts file first and are otherwise
+ * sent as given, without search domains.
+ */
+
+#define DNS_NATIVE_MAX_SERVERS   3
+#define DNS_NATIVE_PORT          53
+#define DNS_NATIVE_UDP_SIZE      1232
+#define DNS_NATIVE_TCP_SIZE      (2 + 65535)
+#define DNS_NATIVE_QUERY_SIZE    (12 + 256 + 4)
+#define DNS_NATIVE_TIMEOUT_MS    5000
+#define DNS_NATIVE_ATTEMPTS      2
+
+#define DNS_TYPE_A               1
+#define DNS_TYPE_AAAA            28
+#define DNS_CLASS_IN             1
+
+#define DNS_RCODE_NOERROR        0
+#define DNS_RCODE_SERVFAIL       2
+#define DNS_RCODE_NXDOMAIN       3
+
+typedef struct dns_hosts_entry {
+    char *name;                       /* lower-cased */
+    struct nanoev_addr addr;
+} dns_hosts_entry;
+
+typedef struct dns_native_config {
+    mutex lock;
+    int initialized;
+    struct nanoev_addr servers[DNS_NATIVE_MAX_SERVERS];
+    unsigned int server_count;
+    unsigned int timeout_ms;
+    unsigned int attempts;
+    dns_hosts_entry *hosts;
+    unsigned int host_count;
+} dns_native_config;
+
+typedef struct dns_native_question {
+    unsigned short id;
+    unsigned short qtype;
+    unsigned int sent;                /* attempt + 1 of the last UDP send */
+    int done;
+    int truncated;                    /* needs the TCP fallback */
+    int status;
+    unsigned int ttl;
+    struct nanoev_addr *addrs;
+    unsigned int addr_count;
+    unsigned char packet[DNS_NATIVE_QUERY_SIZE];
+    unsigned int packet_len;
+} dns_native_question;
+
+struct dns_native_query {
+    nanoev_loop *loop;
+    dns_native_callback callback;
+    void *arg;
+    unsigned short port;
+
+    struct nanoev_addr servers[DNS_NATIVE_MAX_SERVERS];
+    unsigned int server_count;
+    unsigned int server_index;
+    unsigned int attempt;
+    unsigned int max_attempts;
+    unsigned int timeout_ms;
+
+    dns_native_question questions[2];
+    unsigned int question_count;
+
+    nanoev_event *timer;
+    nanoev_event *udp;
+    int udp_writing;
+    int udp_reading;
+    unsigned char udp_buf[DNS_NATIVE_UDP_SIZE];
+
+    nanoev_event *tcp;
+    dns_native_question *tcp_question;
+    unsigned char *tcp_buf;
+    unsigned int tcp_len;
+
+    /* answered without the network (numeric address or hosts file) */
+    int immediate;
+    int immediate_status;
+    struct nanoev_addr *immediate_addrs;
+    unsigned int immediate_count;
+};
+
+static dns_native_config dns_native;
+
+static int  dns_native_load_resolv_conf(struct nanoev_addr *servers, unsigned int *count,
+    unsigned int *timeout_ms, unsigned int *attempts);
+static int  dns_native_load_hosts(dns_hosts_entry **hosts, unsigned int *count);
+static void dns_native_free_hosts(dns_hosts_entry *hosts, unsigned int count);
+static int  dns_native_lookup_hosts(const char *host, int family,
+    struct nanoev_addr **addrs, unsigned int *addr_count);
+static int  dns_native_numeric(const char *host, int family, struct nanoev_addr **addrs, unsigned int *addr_count);
+static int  dns_native_encode(dns_native_question *question, const char *host);
+static int  dns_native_parse(const unsigned char *buf, unsigned int len, dns_native_question *question,
+    int *rcode, int *truncated);
+static void dns_native_send(dns_native_query *query);
+static void dns_native_start_tcp(dns_native_query *query);
+static void dns_native_stop_tcp(dns_native_query *query);
+static void dns_native_check_done(dns_native_query *query);
+static void dns_native_finish(dns_native_query *query);
+static void dns_native_release(dns_native_query *query);
+static int  dns_native_arm_timer(dns_native_query *query, unsigned int msec);
+static void dns_native_on_timer(nanoev_event *timer);
+static void dns_native_on_udp_write(nanoev_event *udp, int status, void *buf, unsigned int bytes);
+static void dns_native_on_udp_read(nanoev_event *udp, int status, void *buf, unsigned int bytes,
+    const struct nanoev_addr *from_addr);
+static void dns_native_on_tcp_connect(nanoev_event *tcp, int status);
+static void dns_native_on_tcp_write(nanoev_event *tcp, int status, void *buf, unsigned int bytes);
+static void dns_native_on_tcp_read(nanoev_event *tcp, int status, void *buf, unsigned int bytes);
+static int  dns_native_same_addr(const struct nanoev_addr *a, const struct nanoev_addr *b);
+
+/*----------------------------------------------------------------------------*/
+
+int dns_native_init(void)
+{
+    memset(&dns_native, 0, sizeof(dns_native));
+    if (mutex_init(&dns_native.lock))
+        return NANOEV_ERROR_FAIL;
+
+    dns_native.initialized = 1;
+    return NANOEV_SUCCESS;
+}
+
+void dns_native_term(void)
+{
+    if (!dns_native.initialized)
+        return;
+
+    dns_native_free_hosts(dns_native.hosts, dns_native.host_count);
+    mutex_uninit(&dns_native.lock);
+    memset(&dns_native, 0, sizeof(dns_native));
+}
+
+int dns_native_configure(const struct nanoev_addr *servers, unsigned int server_count)
+{
+    struct nanoev_addr list[DNS_NATIVE_MAX_SERVERS];
+    unsigned int count = 0, timeout_ms = DNS_NATIVE_TIMEOUT_MS, attempts = DNS_NATIVE_ATTEMPTS;
+    dns_hosts_entry *hosts = NULL, *old_hosts;
+    unsigned int host_count = 0, old_host_count, i;
+
+    if (!dns_native.initialized)
+        return NANOEV_ERROR_ACCESS_DENIED;
+
+    if (servers && server_count) {
+        if (server_count > DNS_NATIVE_MAX_SERVERS)
+            server_count = DNS_NATIVE_MAX_SERVERS;
+        for (i = 0; i < server_count; i++) {
+            if (servers[i].ss_family != AF_INET && servers[i].ss_family != AF_INET6)
+                return NANOEV_ERROR_INVALID_ARG;
+            list[count++] = servers[i];
+        }
+    } else if (dns_native_load_resolv_conf(list, &count, &timeout_ms, &attempts) != NANOEV_SUCCESS) {
+        return NANOEV_ERROR_FAIL;
+    }
+
+    /* a missing hosts file is not an error */
+    dns_native_load_hosts(&hosts, &host_count);
+
+    mutex_lock(&dns_native.lock);
+    memcpy(dns_native.servers, list, sizeof(list[0]) * count);
+    dns_native.server_count = count;
+    dns_native.timeout_ms = timeout_ms;
+    dns_native.attempts = attempts;
+    old_hosts = dns_native.hosts;
+    old_host_count = dns_native.host_count;
+    dns_native.hosts = hosts;
+    dns_native.host_count = host_count;
+    mutex_unlock(&dns_native.lock);
+
+    dns_native_free_hosts(old_hosts, old_host_count);
+    return NANOEV_SUCCESS;
+}
+
+dns_native_query* dns_native_start(
+    nanoev_loop *loop,
+    const char *host,
+    int family,
+    unsigned short port,
+    dns_native_callback callback,
+    void *arg
+    )
+{
+    dns_native_query *query;
+    unsigned int i;
+
+    ASSERT(dns_native.initialized);
+
+    query = (dns_native_query*)mem_alloc(sizeof(dns_native_query));
+    if (!query)
+        return NULL;
+    memset(query, 0, sizeof(dns_native_query));
+
+    query->loop = loop;
+    query->callback = callback;
+    query->arg = arg;
+    query->port = port;
+
+    query->timer = nanoev_event_new(nanoev_event_timer, loop, query);
+    if (!query->timer)
+        goto ERROR_EXIT;
+
+    if (dns_native_numeric(host, family, &query->immediate_addrs, &query->immediate_count)
+        || dns_native_lookup_hosts(host, family, &query->immediate_addrs, &query->immediate_count)) {
+        /* deliver from the loop, never from inside nanoev_dns_resolve() */
+        query->immediate = 1;
+        query->immediate_status = query->immediate_addrs ? 0 : EAI_MEMORY;
+        if (dns_native_arm_timer(query, 0) != NANOEV_SUCCESS)
+            goto ERROR_EXIT;
+        return query;
+    }
+
+    mutex_lock(&dns_native.lock);
+    memcpy(query->servers, dns_native.servers, sizeof(query->servers));
+    query->server_count = dns_native.server_count;
+    query->timeout_ms = dns_native.timeout_ms;
+    query->max_attempts = dns_native.attempts * dns_native.server_count;
+    if (family != AF_INET6) {
+        query->questions[query->question_count++].qtype = DNS_TYPE_A;
+    }
+    if (family != AF_INET) {
+        query->questions[query->question_count++].qtype = DNS_TYPE_AAAA;
+    }
+    mutex_unlock(&dns_native.lock);
+
+    if (!query->server_count)
+        goto ERROR_EXIT;
+    for (i = 0; i < query->question_count; i++) {
+        /* each ID comes fresh from the OS CSPRNG, so seeing some predicts none */
+        if (random_bytes(&query->questions[i].id, sizeof(query->questions[i].id)))
+            goto ERROR_EXIT;
+        if (dns_native_encode(&query->questions[i], host) != NANOEV_SUCCESS)
+            goto ERROR_EXIT;
+    }
+
+    query->udp = nanoev_event_new(nanoev_event_udp, loop, query);
+    if (!query->udp)
+        goto ERROR_EXIT;
+    if (dns_native_arm_timer(query, query->timeout_ms) != NANOEV_SUCCESS)
+        goto ERROR_EXIT;
+
+    dns_native_send(query);
+    if (!query->udp_writing)
+        goto ERROR_EXIT;
+
+    return query;
+
+ERROR_EXIT:
+    dns_native_release(query);
+    return NULL;
+}
+
+void dns_native_cancel(dns_native_query *query)
+{
+    ASSERT(query);
+    dns_native_release(query);
+}
+
+/*----------------------------------------------------------------------------*/
+
+static void dns_native_send(dns_native_query *query)
+{
+    dns_native_question *question;
+    const struct nanoev_addr *server;
+    unsigned int i;
+
+    if (query->udp_writing)
+        return;
+
+    /* only one write may be pending, the write callback sends the next one */
+    for (i = 0; i < query->question_count; i++) {
+        question = &query->questions[i];
+        if (question->done || question->truncated || question->sent == query->attempt + 1)
+            continue;
+
+        /* on failure the timer retries with the next server */
+        question->sent = query->attempt + 1;
+        server = &query->servers[query->server_index];
+        if (nanoev_udp_write(query->udp, question->packet, question->packet_len, server,
+                dns_native_on_udp_write) != NANOEV_SUCCESS)
+            return;
+        query->udp_writing = 1;
+
+        /* the socket exists once the first write has started */
+        if (!query->udp_reading
+            && nanoev_udp_read(query->udp, query->udp_buf, sizeof(query->udp_buf),
+                dns_native_on_udp_read) == NANOEV_SUCCESS) {
+            query->udp_reading = 1;
+        }
+        return;
+    }
+}
+
+static void dns_native_on_udp_write(nanoev_event *udp, int status, void *buf, unsigned int bytes)
+{
+    dns_native_query *query = (dns_native_query*)nanoev_event_userdata(udp);
+
+    (void)status;
+    (void)buf;
+    (void)bytes;
+
+    query->udp_writing = 0;
+    dns_native_send(query);
+}
+
+static void dns_native_on_udp_read(
+    nanoev_event *udp,
+    int status,
+    void *buf,
+    unsigned int bytes,
+    const struct nanoev_addr *from_addr
+    )
+{
+    dns_native_query *query = (dns_native_query*)nanoev_event_userdata(udp);
+    dns_native_question *question = NULL;
+    unsigned short id;
+    unsigned int i;
+    int rcode, truncated;
+
+    (void)buf;
+
+    query->udp_reading = 0;
+
+    if (status == 0 && bytes >= 12
+        && dns_native_same_addr(from_addr, &query->servers[query->server_index])) {
+        id = (unsigned short)((query->udp_buf[0] << 8) | query->udp_buf[1]);
+        for (i = 0; i < query->question_count; i++) {
+            if (query->questions[i].id == id && !query->questions[i].done && !query->questions[i].truncated) {
+                question = &query->questions[i];
+                break;
+            }
+        }
+    }
+
+    if (question && dns_native_parse(query->udp_buf, bytes, question, &rcode, &truncated) == NANOEV_SUCCESS) {
+        if (truncated) {
+            question->truncated = 1;
+            dns_native_start_tcp(query);
+        } else if (rcode == DNS_RCODE_SERVFAIL) {
+            /* move on to the next server right away */
+            dns_native_arm_timer(query, 0);
+        } else {
+            question->done = 1;
+        }
+    }
+
+    dns_native_check_done(query);
+}
+
+static void dns_native_check_done(dns_native_query *query)
+{
+    unsigned int i;
+
+    for (i = 0; i < query->question_count; i++) {
+        if (!query->questions[i].done)
+            break;
+    }
+    if (i == query->question_count) {
+        dns_native_finish(query);
+        return;
+    }
+
+    if (!query->udp_reading && query->udp
+        && nanoev_udp_read(query->udp, query->udp_buf, sizeof(query->udp_buf),
+            dns_native_on_udp_read) == NANOEV_SUCCESS) {
+        query->udp_reading = 1;
+    }
+}
+
+static void dns_native_start_tcp(dns_native_query *query)
+{
+    dns_native_question *question = NULL;
+    unsigned int i;
+
+    if (query->tcp)
+        return;
+
+    for (i = 0; i < query->question_count; i++) {
+        if (query->questions[i].truncated && !query->questions[i].done) {
+            question = &query->questions[i];
+            break;
+        }
+    }
+    if (!question)
+        return;
+
+    if (!query->tcp_buf) {
+        query->tcp_buf = (unsigned char*)mem_alloc(DNS_NATIVE_TCP_SIZE);
+        if (!query->tcp_buf)
+            goto ERROR_EXIT;
+    }
+
+    query->tcp = nanoev_event_new(nanoev_event_tcp, query->loop, query);
+    if (!query->tcp)
+        goto ERROR_EXIT;
+    query->tcp_question = question;
+    query->tcp_len = 0;
+    if (nanoev_tcp_connect(query->tcp, &query->servers[query->server_index], NULL,
+            dns_native_on_tcp_connect) != NANOEV_SUCCESS)
+        goto ERROR_EXIT;
+    return;
+
+ERROR_EXIT:
+    dns_native_stop_tcp(query);
+    question->status = EAI_AGAIN;
+    question->done = 1;
+}
+
+static void dns_native_stop_tcp(dns_native_query *query)
+{
+    if (query->tcp) {
+        nanoev_event_free(query->tcp);
+        query->tcp = NULL;
+    }
+    query->tcp_question = NULL;
+    query->tcp_len = 0;
+}
+
+static void dns_native_tcp_failed(dns_native_query *query)
+{
+    query->tcp_question->status = EAI_AGAIN;
+    query->tcp_question->done = 1;
+    dns_native_stop_tcp(query);
+    dns_native_start_tcp(query);
+    dns_native_check_done(query);
+}
+
+static void dns_native_on_tcp_connect(nanoev_event *tcp, int status)
+{
+    dns_native_query *query = (dns_native_query*)nanoev_event_userdata(tcp);
+    dns_native_question *question = query->tcp_question;
+
+    if (status != 0) {
+        dns_native_tcp_failed(query);
+        return;
+    }
+
+    query->tcp_buf[0] = (unsigned char)(question->packet_len >> 8);
+    query->tcp_buf[1] = (unsigned char)(question->packet_len & 0xFF);
+    memcpy(query->tcp_buf + 2, question->packet, question->packet_len);
+    query->tcp_len = 0;
+    if (nanoev_tcp_write(tcp, query->tcp_buf, 2 + question->packet_len, NULL,
+            dns_native_on_tcp_write) != NANOEV_SUCCESS) {
+        dns_native_tcp_failed(query);
+    }
+}
+
+static void dns_native_on_tcp_write(nanoev_event *tcp, int status, void *buf, unsigned int bytes)
+{
+    dns_native_query *query = (dns_native_query*)nanoev_event_userdata(tcp);
+    unsigned int total = 2 + query->tcp_question->packet_len;
+
+    (void)buf;
+
+    if (status != 0) {
+        dns_native_tcp_failed(query);
+        return;
+    }
+
+    query->tcp_len += bytes;
+    if (query->tcp_len < total) {
+        if (nanoev_tcp_write(tcp, query->tcp_buf + query->tcp_len, total - query->tcp_len, NULL,
+                dns_native_on_tcp_write) != NANOEV_SUCCESS) {
+            dns_native_tcp_failed(query);
+        }
+        return;
+    }
+
+    query->tcp_len = 0;
+    if (nanoev_tcp_read(tcp, query->tcp_buf, DNS_NATIVE_TCP_SIZE, NULL,
+            dns_native_on_tcp_read) != NANOEV_SUCCESS) {
+        dns_native_tcp_failed(query);
+    }
+}
+
+static void dns_native_on_tcp_read(nanoev_event *tcp, int status, void *buf, unsigned int bytes)
+{
+    dns_native_query *query = (dns_native_query*)nanoev_event_userdata(tcp);
+    dns_native_question *question = query->tcp_question;
+    unsigned int length;
+    int rcode, truncated;
+
+    (void)buf;
+
+    if (status != 0 || bytes == 0) {
+        dns_native_tcp_failed(query);
+        return;
+    }
+
+    query->tcp_len += bytes;
+    length = query->tcp_len >= 2 ? ((unsigned int)query->tcp_buf[0] << 8) | query->tcp_buf[1] : 0;
+    if (query->tcp_len < 2 || query->tcp_len < 2 + length) {
+        if (nanoev_tcp_read(tcp, query->tcp_buf + query->tcp_len, DNS_NATIVE_TCP_SIZE - query->tcp_len, NULL,
+                dns_native_on_tcp_read) != NANOEV_SUCCESS) {
+            dns_native_tcp_failed(query);
+        }
+        return;
+    }
+
+    if (dns_native_parse(query->tcp_buf + 2, length, question, &rcode, &truncated) != NANOEV_SUCCESS
+        || ((query->tcp_buf[2] << 8) | query->tcp_buf[3]) != question->id) {
+        dns_native_tcp_failed(query);
+        return;
+    }
+
+    question->done = 1;
+    dns_native_stop_tcp(query);
+    dns_native_start_tcp(query);
+    dns_native_check_done(query);
+}
+
+static void dns_native_on_timer(nanoev_event *timer)
+{
+    dns_native_query *query = (dns_native_query*)nanoev_event_userdata(timer);
+    unsigned int i;
+
+    if (query->immediate) {
+        dns_native_finish(query);
+        return;
+    }
+
+    query->attempt++;
+    if (query->attempt >= query->max_attempts) {
+        for (i = 0; i < query->question_count; i++) {
+            if (!query->questions[i].done) {
+                query->questions[i].status = EAI_AGAIN;
+                query->questions[i].done = 1;
+            }
+        }
+        dns_native_finish(query);
+        return;
+    }
+
+    /* retransmit everything unanswered to the next server */
+    dns_native_stop_tcp(query);
+    for (i = 0; i < query->question_count; i++) {
+        query->questions[i].truncated = 0;
+    }
+    query->server_index = (query->server_index + 1) % query->server_count;
+    dns_native_send(query);
+    dns_native_arm_timer(query, query->timeout_ms);
+}
+
+static void dns_native_finish(dns_native_query *query)
+{
+    dns_native_callback callback = query->callback;
+    void *arg = query->arg;
+    struct nanoev_addr *addrs = NULL;
+    unsigned int addr_count = 0, ttl = 0, i, j;
+    int status = EAI_NONAME;
+
+    if (query->immediate) {
+        status = query->immediate_status;
+        addrs = query->immediate_addrs;
+        addr_count = query->immediate_count;
+        query->immediate_addrs = NULL;
+    } else {
+        for (i = 0; i < query->question_count; i++) {
+            addr_count += query->questions[i].addr_count;
+        }
+        if (addr_count) {
+            addrs = (struct nanoev_addr*)mem_alloc(sizeof(struct nanoev_addr) * addr_count);
+            if (!addrs) {
+                status = EAI_MEMORY;
+                addr_count = 0;
+            }
+        }
+        if (addrs) {
+            status = 0;
+            addr_count = 0;
+            for (i = 0; i < query->question_count; i++) {
+                dns_native_question *question = &query->questions[i];
+                for (j = 0; j < question->addr_count; j++) {
+                    addrs[addr_count++] = question->addrs[j];
+                }
+                if (question->addr_count && (!ttl || question->ttl < ttl)) {
+                    ttl = question->ttl;
+                }
+            }
+        } else if (status != EAI_MEMORY) {
+            /* a transient failure of either question beats "no such name" */
+            for (i = 0; i < query->question_count; i++) {
+                if (query->questions[i].status != 0 && query->questions[i].status != EAI_NONAME) {
+                    status = query->questions[i].status;
+                }
+            }
+        }
+    }
+
+    for (i = 0; i < addr_count; i++) {
+        if (addrs[i].ss_family == AF_INET) {
+            ((struct sockaddr_in*)&addrs[i])->sin_port = htons(query->port);
+        } else {
+            ((struct sockaddr_in6*)&addrs[i])->sin6_port = htons(query->port);
+        }
+    }
+
+    dns_native_release(query);
+    callback(arg, status, addrs, addr_count, ttl);
+}
+
+static void dns_native_release(dns_native_query *query)
+{
+    unsigned int i;
+
+    dns_native_stop_tcp(query);
+    if (query->udp) {
+        nanoev_event_free(query->udp);
+    }
+    if (query->timer) {
+        nanoev_event_free(query->timer);
+    }
+    for (i = 0; i < query->question_count; i++) {
+        mem_free(query->questions[i].addrs);
+    }
+    mem_free(query->immediate_addrs);
+    mem_free(query->tcp_buf);
+    mem_free(query);
+}
+
+static int dns_native_arm_timer(dns_native_query *query, unsigned int msec)
+{
+    nanoev_timeval after;
+
+    nanoev_timer_del(query->timer);
+    after.tv_sec = msec / 1000;
+    after.tv_usec = (msec % 1000) * 1000;
+    return nanoev_timer_add(query->timer, after, 0, dns_native_on_timer);
+}
+
+/*----------------------------------------------------------------------------*/
+
+static int dns_native_encode(dns_native_question *question, const char *host)
+{
+    unsigned char *p = question->packet;
+    unsigned char *end = question->packet + sizeof(question->packet) - 5;
+    const char *label = host;
+    size_t len;
+
+    /* header: id, RD, one question */
+    p[0] = (unsigned char)(question->id >> 8);
+    p[1] = (unsigned char)(question->id & 0xFF);
+    p[2] = 0x01;
+    p[3] = 0x00;
+    p[4] = 0x00; p[5] = 0x01;
+    memset(p + 6, 0, 6);
+    p += 12;
+
+    while (*label) {
+        const char *dot = strchr(label, '.');
+        len = dot ? (size_t)(dot - label) : strlen(label);
+        if (len == 0 || len > 63 || p + 1 + len > end)
+            return NANOEV_ERROR_INVALID_ARG;
+        *p++ = (unsigned char)len;
+        memcpy(p, label, len);
+        p += len;
+        if (!dot)
+            break;
+        label = dot + 1;
+    }
+    if (p == question->packet + 12)
+        return NANOEV_ERROR_INVALID_ARG;
+    *p++ = 0;
+
+    *p++ = (unsigned char)(question->qtype >> 8);
+    *p++ = (unsigned char)(question->qtype & 0xFF);
+    *p++ = 0;
+    *p++ = DNS_CLASS_IN;
+
+    question->packet_len = (unsigned int)(p - question->packet);
+    return NANOEV_SUCCESS;
+}
+
+static int dns_native_skip_name(const unsigned char *buf, unsigned int len, unsigned int *offset)
+{
+    unsigned int pos = *offset;
+
+    while (pos < len) {
+        unsigned char c = buf[pos];
+        if (c == 0) {
+            *offset = pos + 1;
+            return NANOEV_SUCCESS;
+        }
+        if ((c & 0xC0) == 0xC0) {
+            /* a compression pointer ends the name */
+            if (pos + 2 > len)
+                return NANOEV_ERROR_FAIL;
+            *offset = pos + 2;
+            return NANOEV_SUCCESS;
+        }
+        if (c & 0xC0)
+            return NANOEV_ERROR_FAIL;
+        pos += 1 + c;
+    }
+    return NANOEV_ERROR_FAIL;
+}
+
+/* The echoed QNAME must be ours, compared case-insensitively (RFC 5452). */
+static int dns_native_match_name(const unsigned char *buf, unsigned int len, unsigned int *offset,
+    const dns_native_question *question)
+{
+    const unsigned char *name = question->packet + 12;
+    unsigned int name_len = question->packet_len - 12 - 4;
+    unsigned int i;
+
+    if (*offset + name_len > len)
+        return NANOEV_ERROR_FAIL;
+    /* our length bytes are below 64, where tolower() changes nothing */
+    for (i = 0; i < name_len; i++) {
+        if (tolower(buf[*offset + i]) != tolower(name[i]))
+            return NANOEV_ERROR_FAIL;
+    }
+    *offset += name_len;
+    return NANOEV_SUCCESS;
+}
+
+static int dns_native_parse(
+    const unsigned char *buf,
+    unsigned int len,
+    dns_native_question *question,
+    int *rcode,
+    int *truncated
+    )
+{
+    unsigned int qdcount, ancount, offset, i, ttl, min_ttl = 0, count = 0;
+    unsigned short type, klass, rdlength;
+    struct nanoev_addr *addrs = NULL;
+
+    if (len < 12)
+        return NANOEV_ERROR_FAIL;
+    if (!(buf[2] & 0x80))
+        return NANOEV_ERROR_FAIL;   /* not a response */
+
+    *truncated = (buf[2] & 0x02) != 0;
+    *rcode = buf[3] & 0x0F;
+    qdcount = ((unsigned int)buf[4] << 8) | buf[5];
+    ancount = ((unsigned int)buf[6] << 8) | buf[7];
+
+    /* the question must echo ours */
+    if (qdcount != 1)
+        return NANOEV_ERROR_FAIL;
+    offset = 12;
+    if (dns_native_match_name(buf, len, &offset, question) != NANOEV_SUCCESS || offset + 4 > len)
+        return NANOEV_ERROR_FAIL;
+    if ((((unsigned int)buf[offset] << 8) | buf[offset + 1]) != question->qtype
+        || buf[offset + 2] != 0 || buf[offset + 3] != DNS_CLASS_IN)
+        return NANOEV_ERROR_FAIL;
+    offset += 4;
+
+    if (*truncated)
+        return NANOEV_SUCCESS;
+
+    if (*rcode != DNS_RCODE_NOERROR) {
+        question->status = *rcode == DNS_RCODE_NXDOMAIN ? EAI_NONAME
+            : *rcode == DNS_RCODE_SERVFAIL ? EAI_AGAIN : EAI_FAIL;
+        return NANOEV_SUCCESS;
+    }
+
+    if (ancount) {
+        addrs = (struct nanoev_addr*)mem_alloc(sizeof(struct nanoev_addr) * ancount);
+        if (!addrs)
+            return NANOEV_ERROR_OUT_OF_MEMORY;
+    }
+
+    for (i = 0; i < ancount; i++) {
+        if (dns_native_skip_name(buf, len, &offset) != NANOEV_SUCCESS || offset + 10 > len)
+            goto ERROR_EXIT;
+        type = (unsigned short)((buf[offset] << 8) | buf[offset + 1]);
+        klass = (unsigned short)((buf[offset + 2] << 8) | buf[offset + 3]);
+        ttl = ((unsigned int)buf[offset + 4] << 24) | ((unsigned int)buf[offset + 5] << 16)
+            | ((unsigned int)buf[offset + 6] << 8) | buf[offset + 7];
+        rdlength = (unsigned short)((buf[offset + 8] << 8) | buf[offset + 9]);
+        offset += 10;
+        if (offset + rdlength > len)
+            goto ERROR_EXIT;
+
+        /* CNAMEs are followed by the server, only keep the final records */
+        if (klass == DNS_CLASS_IN && type == question->qtype) {
+            memset(&addrs[count], 0, sizeof(struct nanoev_addr));
+            if (type == DNS_TYPE_A && rdlength == 4) {
+                struct sockaddr_in *sin = (struct sockaddr_in*)&addrs[count];
+                sin->sin_family = AF_INET;
+                memcpy(&sin->sin_addr, buf + offset, 4);
+                count++;
+            } else if (type == DNS_TYPE_AAAA && rdlength == 16) {
+                struct sockaddr_in6 *sin6 = (struct sockaddr_in6*)&addrs[count];
+                sin6->sin6_family = AF_INET6;
+                memcpy(&sin6->sin6_addr, buf + offset, 16);
+                count++;
+            }
+            if (count && (count == 1 || ttl < min_ttl)) {
+                min_ttl = ttl;
+            }
+        }
+        offset += rdlength;
+    }
+
+    if (!count) {
+        mem_free(addrs);
+        addrs = NULL;
+    }
+    question->status = count ? 0 : EAI_NONAME;
+    question->addrs = addrs;
+    question->addr_count = count;
+    question->ttl = min_ttl;
+    return NANOEV_SUCCESS;
+
+ERROR_EXIT:
+    mem_free(addrs);
+    return NANOEV_ERROR_FAIL;
+}
+
+/*----------------------------------------------------------------------------*/
+
+static int dns_native_numeric(const char *host, int family, struct nanoev_addr **addrs, unsigned int *addr_count)
+{
+    struct nanoev_addr addr;
+
+    if ((family == AF_UNSPEC || family == AF_INET)
+        && nanoev_addr_init(&addr, AF_INET, host, 0) == NANOEV_SUCCESS) {
+    } else if ((family == AF_UNSPEC || family == AF_INET6)
+        && nanoev_addr_init(&addr, AF_INET6, host, 0) == NANOEV_SUCCESS) {
+    } else {
+        return 0;
+    }
+
+    *addrs = (struct nanoev_addr*)mem_alloc(sizeof(struct nanoev_addr));
+    if (*addrs) {
+        **addrs = addr;
+        *addr_count = 1;
+    }
+    return 1;
+}
+
+static int dns_native_lookup_hosts(
+    const char *host,
+    int family,
+    struct nanoev_addr **addrs,
+    unsigned int *addr_count
+    )
+{
+    unsigned int i, count = 0;
+    const unsigned char *a, *b;
+    int found = 0;
+
+    *addrs = NULL;
+    *addr_count = 0;
+
+    mutex_lock(&dns_native.lock);
+    for (i = 0; i < dns_native.host_count; i++) {
+        dns_hosts_entry *entry = &dns_native.hosts[i];
+
+        if (family != AF_UNSPEC && entry->addr.ss_family != family)
+            continue;
+        a = (const unsigned char*)entry->name;
+        b = (const unsigned char*)host;
+        while (*a && *a == (unsigned char)tolower(*b)) {
+            a++;
+            b++;
+        }
+        if (*a || *b)
+            continue;
+
+        found = 1;
+        if (!*addrs) {
+            *addrs = (struct nanoev_addr*)mem_alloc(sizeof(struct nanoev_addr) * dns_native.host_count);
+            if (!*addrs)
+                break;
+        }
+        (*addrs)[count++] = entry->addr;
+    }
+    mutex_unlock(&dns_native.lock);
+
+    /* an allocation failure still counts as found, reported as EAI_MEMORY */
+    *addr_count = count;
+    return found;
+}
+
+static char* dns_native_next_token(char **cursor)
+{
+    char *p = *cursor, *token;
+
+    while (*p == ' ' || *p == '\t')
+        p++;
+    if (!*p || *p == '#' || *p == ';' || *p == '\r' || *p == '\n')
+        return NULL;
+    token = p;
+    while (*p && *p != ' ' && *p != '\t' && *p != '#' && *p != '\r' && *p != '\n')
+        p++;
+    if (*p == '#') {
+        *p = '\0';
+        *cursor = p;
+    } else if (*p) {
+        *p = '\0';
+        *cursor = p + 1;
+    } else {
+        *cursor = p;
+    }
+    return token;
+}
+
+static int dns_native_load_resolv_conf(
+    struct nanoev_addr *servers,
+    unsigned int *count,
+    unsigned int *timeout_ms,
+    unsigned int *attempts
+    )
+{
+    *count = 0;
+
+#ifndef _WIN32
+    {
+        FILE *fp;
+        char line[512], *cursor, *token;
+        unsigned int value;
+
+        fp = fopen("/etc/resolv.conf", "r");
+        if (fp) {
+            while (fgets(line, sizeof(line), fp)) {
+                cursor = line;
+                token = dns_native_next_token(&cursor);
+                if (!token)
+                    continue;
+                if (strcmp(token, "nameserver") == 0) {
+                    token = dns_native_next_token(&cursor);
+                    if (token && *count < DNS_NATIVE_MAX_SERVERS
+                        && (nanoev_addr_init(&servers[*count], AF_INET, token, DNS_NATIVE_PORT) == NANOEV_SUCCESS
+                            || nanoev_addr_init(&servers[*count], AF_INET6, token, DNS_NATIVE_PORT) == NANOEV_SUCCESS)) {
+                        (*count)++;
+                    }
+                } else if (strcmp(token, "options") == 0) {
+                    while ((token = dns_native_next_token(&cursor)) != NULL) {
+                        if (sscanf(token, "timeout:%u", &value) == 1 && value > 0 && value <= 30) {
+                            *timeout_ms = value * 1000;
+                        } else if (sscanf(token, "attempts:%u", &value) == 1 && value > 0 && value <= 5) {
+                            *attempts = value;
+                        }
+                    }
+                }
+            }
+            fclose(fp);
+        }
+    }
+#else
+    /* Windows keeps its servers in the registry; they must be passed explicitly */
+    (void)timeout_ms;
+    (void)attempts;
+    return NANOEV_ERROR_FAIL;
+#endif
+
+    /* resolv.conf(5): without nameserver lines use the local host */
+    if (!*count) {
+        nanoev_addr_init(&servers[0], AF_INET, "127.0.0.1", DNS_NATIVE_PORT);
+        *count = 1;
+    }
+    return NANOEV_SUCCESS;
+}
+
+static int dns_native_load_hosts(dns_hosts_entry **hosts, unsigned int *count)
+{
+    FILE *fp;
+    char line[1024], *cursor, *token;
+    struct nanoev_addr addr;
+    dns_hosts_entry *list = NULL, *grown;
+    unsigned int capacity = 0, size = 0;
+    size_t i, len;
+#ifdef _WIN32
+    char path[MAX_PATH];
+    const char *root = getenv("SystemRoot");
+
+    snprintf(path, sizeof(path), "%s\\System32\\drivers\\etc\\hosts", root ? root : "C:\\Windows");
+#else
+    const char *path = "/etc/hosts";
+#endif
+
+    *hosts = NULL;
+    *count = 0;
+
+    fp = fopen(path, "r");
+    if (!fp)
+        return NANOEV_ERROR_FAIL;
+
+    while (fgets(line, sizeof(line), fp)) {
+        cursor = line;
+        token = dns_native_next_token(&cursor);
+        if (!token)
+            continue;
+        if (nanoev_addr_init(&addr, AF_INET, token, 0) != NANOEV_SUCCESS
+            && nanoev_addr_init(&addr, AF_INET6, token, 0) != NANOEV_SUCCESS)
+            continue;
+
+        while ((token = dns_native_next_token(&cursor)) != NULL) {
+            if (size == capacity) {
+                capacity = capacity ? capacity * 2 : 16;
+                grown = (dns_hosts_entry*)mem_realloc(list, sizeof(dns_hosts_entry) * capacity);
+                if (!grown)
+                    goto DONE;
+                list = grown;
+            }
+            len = strlen(token);
+            list[size].name = (char*)mem_alloc(len + 1);
+            if (!list[size].name)
+                goto DONE;
+            for (i = 0; i <= len; i++) {
+                list[size].name[i] = (char)tolower((unsigned char)token[i]);
+            }
+            list[size].addr = addr;
+            size++;
+        }
+    }
+
+DONE:
+    fclose(fp);
+    *hosts = list;
+    *count = size;
+    return NANOEV_SUCCESS;
+}
+
+static void dns_native_free_hosts(dns_hosts_entry *hosts, unsigned int count)
+{
+    unsigned int i;
+
+    for (i = 0; i < count; i++) {
+        mem_free(hosts[i].name);
+    }
+    mem_free(hosts);
+}
+
+static int dns_native_same_addr(const struct nanoev_addr *a, const struct nanoev_addr *b)
+{
+    if (!a || a->ss_family != b->ss_family)
+        return 0;
+
+    if (a->ss_family == AF_INET) {
+        const struct sockaddr_in *x = (const struct sockaddr_in*)a;
+        const struct sockaddr_in *y = (const struct sockaddr_in*)b;
+        return x->sin_port == y->sin_port
+            && memcmp(&x->sin_addr, &y->sin_addr, sizeof(x->sin_addr)) == 0;
+    } else {
+        const struct sockaddr_in6 *x = (const struct sockaddr_in6*)a;
+        const struct sockaddr_in6 *y = (const struct sockaddr_in6*)b;
+        return x->sin6_port == y->sin6_port
+            && memcmp(&x->sin6_addr, &y->sin6_addr, sizeof(x->sin6_addr)) == 0;
+    }
+}
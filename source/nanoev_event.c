@@ -39,6 +39,10 @@ nanoev_event* nanoev_event_new(
         event = NULL;
     }
 
+    if (event) {
+        loop_count_event(loop, type, 1);
+    }
+
     return event;
 }
 
@@ -49,6 +53,8 @@ void nanoev_event_free(
     ASSERT(event && event->loop);
     ASSERT(in_loop_thread(event->loop));
 
+    loop_count_event(event->loop, event->type, -1);
+
     switch (event->type) {
     case nanoev_event_tcp:
         tcp_free(event);
@@ -44,6 +44,7 @@ void mutex_unlock(mutex *m);
 int  cond_init(cond *c);
 void cond_uninit(cond *c);
 void cond_wait(cond *c, mutex *m);
+void cond_timedwait(cond *c, mutex *m, unsigned int msec);
 void cond_signal(cond *c);
 void cond_broadcast(cond *c);
 
@@ -63,6 +64,12 @@ int  thread_create(thread_handle *thread, thread_callback callback, void *arg);
 void thread_join(thread_handle thread);
 void thread_detach(thread_handle thread);
 
+/* returns the new value */
+long atomic_add(volatile long *value, long delta);
+
+/* fills buf from the OS CSPRNG, returns 0 on success */
+int  random_bytes(void *buf, size_t len);
+
 /*----------------------------------------------------------------------------*/
 
 struct nanoev_timer_node;
@@ -74,13 +81,16 @@ struct nanoev_timer_node {
     unsigned int min_heap_idx;
     nanoev_timeval timeout;
     nanoev_timer_node_callback callback;
-    void *userdata;
+    void *userdata;                        /* the owning nanoev_event */
 };
 
 typedef struct timer_min_heap {
     nanoev_timer_node **events;
     unsigned int capacity;
     unsigned int size;
+    unsigned long long fired;              /* nodes whose callback was invoked */
+    unsigned long long lateness_usec;      /* sum of (now - deadline) at firing */
+    unsigned long long lateness_max_usec;
 } timer_min_heap;
 
 void timer_node_init(nanoev_timer_node *node, nanoev_timer_node_callback callback, void *userdata);
@@ -91,10 +101,13 @@ void timer_node_del(timer_min_heap *heap, nanoev_timer_node *node);
 void timers_init(timer_min_heap *heap);
 void timers_term(timer_min_heap *heap);
 void timers_timeout(timer_min_heap *heap, const nanoev_timeval *now, nanoev_timeval *timeout);
-void timers_process(timer_min_heap *heap, const nanoev_timeval *now);
+void timers_process(nanoev_loop *loop, timer_min_heap *heap, const nanoev_timeval *now);
 void timers_adjust_backward(timer_min_heap *heap, const nanoev_timeval *off);
 
 timer_min_heap* get_loop_timers(nanoev_loop *loop);
+void loop_count_event(nanoev_loop *loop, nanoev_event_type type, int delta);
+int  loop_watch_slow(nanoev_loop *loop);
+void loop_check_slow(nanoev_loop *loop, nanoev_event_type type, void *userdata, const nanoev_timeval *start);
 
 void time_now(nanoev_timeval *tv);
 void time_add(nanoev_timeval *tv, const nanoev_timeval *add);
@@ -116,6 +129,30 @@ struct nanoev_event {
 nanoev_event* tcp_new(nanoev_loop *loop, void *userdata);
 void tcp_free(nanoev_event *event);
 
+typedef struct tcp_connector tcp_connector;
+tcp_connector* tcp_get_connector(nanoev_event *event);
+void tcp_set_connector(nanoev_event *event, tcp_connector *connector);
+void tcp_connector_free(tcp_connector *connector);
+typedef struct tcp_fanout_sub tcp_fanout_sub;
+tcp_fanout_sub* tcp_get_fanout_sub(nanoev_event *event);
+void tcp_set_fanout_sub(nanoev_event *event, tcp_fanout_sub *sub);
+void tcp_fanout_sub_free(tcp_fanout_sub *sub);
+typedef struct tcp_framer tcp_framer;
+tcp_framer* tcp_get_framer(nanoev_event *event);
+void tcp_set_framer(nanoev_event *event, tcp_framer *framer);
+void tcp_framer_stop(tcp_framer *framer);
+void tcp_framer_free(tcp_framer *framer);
+typedef struct tcp_pool_entry tcp_pool_entry;
+tcp_pool_entry* tcp_get_pool_entry(nanoev_event *event);
+void tcp_set_pool_entry(nanoev_event *event, tcp_pool_entry *entry);
+void tcp_pool_entry_free(tcp_pool_entry *entry);
+int  tcp_has_socket(nanoev_event *event);
+void tcp_reset(nanoev_event *event);
+int  tcp_check_idle(nanoev_event *event);
+#ifndef _WIN32
+int  tcp_adopt(nanoev_event *dst, nanoev_event *src);
+#endif
+
 nanoev_event* udp_new(nanoev_loop *loop, void *userdata);
 void udp_free(nanoev_event *event);
 
@@ -130,6 +167,20 @@ void dns_free(nanoev_event *event);
 int  dns_init(void);
 void dns_term(void);
 
+int  buf_init(void);
+void buf_term(void);
+unsigned int buf_fill_iov(const nanoev_buf *buf, unsigned int offset, io_buf *vec, unsigned int max);
+
+typedef struct dns_native_query dns_native_query;
+typedef void (*dns_native_callback)(void *arg, int status,
+    struct nanoev_addr *addrs, unsigned int addr_count, unsigned int ttl);
+int  dns_native_init(void);
+void dns_native_term(void);
+int  dns_native_configure(const struct nanoev_addr *servers, unsigned int server_count);
+dns_native_query* dns_native_start(nanoev_loop *loop, const char *host, int family,
+    unsigned short port, dns_native_callback callback, void *arg);
+void dns_native_cancel(dns_native_query *query);
+
 /*----------------------------------------------------------------------------*/
 
 struct nanoev_proactor;
@@ -165,6 +216,7 @@ void add_endgame_proactor(nanoev_loop *loop, nanoev_proactor *proactor);
 int  submit_fake_io(nanoev_loop *loop, nanoev_proactor *proactor, io_context *ctx);
 
 int  set_non_blocking(SOCKET sock, int set);
+int  set_busy_poll(SOCKET sock, unsigned int usec);
 void close_socket(SOCKET sock);
 int  socket_last_error(void);
 int  socket_timeout_error(void);
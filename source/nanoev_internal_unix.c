@@ -1,5 +1,9 @@
 #include "nanoev_internal.h"
 
+#ifdef __linux__
+# include <sys/random.h>
+#endif
+
 /*----------------------------------------------------------------------------*/
 
 int global_init(void)
@@ -50,6 +54,22 @@ void cond_wait(cond *c, mutex *m)
     pthread_cond_wait(c, m);
 }
 
+void cond_timedwait(cond *c, mutex *m, unsigned int msec)
+{
+    struct timeval now;
+    struct timespec abstime;
+
+    gettimeofday(&now, NULL);
+    abstime.tv_sec = now.tv_sec + msec / 1000;
+    abstime.tv_nsec = (now.tv_usec + (msec % 1000) * 1000) * 1000;
+    if (abstime.tv_nsec >= 1000000000) {
+        abstime.tv_sec += 1;
+        abstime.tv_nsec -= 1000000000;
+    }
+
+    pthread_cond_timedwait(c, m, &abstime);
+}
+
 void cond_signal(cond *c)
 {
     pthread_cond_signal(c);
@@ -118,6 +138,11 @@ void thread_detach(thread_handle thread)
     pthread_detach(thread);
 }
 
+long atomic_add(volatile long *value, long delta)
+{
+    return __atomic_add_fetch(value, delta, __ATOMIC_ACQ_REL);
+}
+
 /*----------------------------------------------------------------------------*/
 
 void time_now(nanoev_timeval *tv)
@@ -145,6 +170,49 @@ int set_close_on_exec(SOCKET sock, int set)
     return (fcntl(sock, F_SETFD, flags) == 0) ? 1 : 0;
 }
 
+int random_bytes(void *buf, size_t len)
+{
+#if defined(__APPLE__) || defined(__FreeBSD__) || defined(__OpenBSD__) \
+    || defined(__NetBSD__) || defined(__DragonFly__)
+    arc4random_buf(buf, len);
+    return 0;
+#else
+    char *p = (char*)buf;
+    ssize_t ret;
+
+    while (len) {
+        ret = getrandom(p, len, 0);
+        if (ret < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        p += ret;
+        len -= (size_t)ret;
+    }
+    return 0;
+#endif
+}
+
+int set_busy_poll(SOCKET sock, unsigned int usec)
+{
+#ifdef SO_BUSY_POLL
+    int value = (int)usec;
+    if (setsockopt(sock, SOL_SOCKET, SO_BUSY_POLL, &value, sizeof(value)) != 0)
+        return 0;
+# ifdef SO_PREFER_BUSY_POLL
+    /* best effort: older kernels only know SO_BUSY_POLL */
+    value = usec ? 1 : 0;
+    setsockopt(sock, SOL_SOCKET, SO_PREFER_BUSY_POLL, &value, sizeof(value));
+# endif
+    return 1;
+#else
+    (void)sock;
+    (void)usec;
+    return 0;
+#endif
+}
+
 void close_socket(SOCKET sock)
 {
     close(sock);
@@ -3,6 +3,7 @@
 #include "nanoev_internal.h"
 #include <process.h>
 #include <stdio.h>
+#include <bcrypt.h>
 
 /*----------------------------------------------------------------------------*/
 
@@ -122,6 +123,11 @@ void cond_wait(cond *c, mutex *m)
     SleepConditionVariableCS(c, m, INFINITE);
 }
 
+void cond_timedwait(cond *c, mutex *m, unsigned int msec)
+{
+    SleepConditionVariableCS(c, m, msec);
+}
+
 void cond_signal(cond *c)
 {
     WakeConditionVariable(c);
@@ -192,6 +198,11 @@ void thread_detach(thread_handle thread)
     CloseHandle(thread);
 }
 
+long atomic_add(volatile long *value, long delta)
+{
+    return InterlockedExchangeAdd(value, delta) + delta;
+}
+
 /*----------------------------------------------------------------------------*/
 
 #define DELTA_EPOCH_IN_MICROSECS  11644473600000000Ui64
@@ -241,6 +252,24 @@ int set_non_blocking(SOCKET sock, int set)
     return (ioctlsocket(sock, FIONBIO, &mode) == 0) ? 1 : 0;
 }
 
+int random_bytes(void *buf, size_t len)
+{
+    if (len > (ULONG)-1)
+        return -1;
+    if (!BCRYPT_SUCCESS(BCryptGenRandom(NULL, (PUCHAR)buf, (ULONG)len,
+        BCRYPT_USE_SYSTEM_PREFERRED_RNG)))
+        return -1;
+    return 0;
+}
+
+int set_busy_poll(SOCKET sock, unsigned int usec)
+{
+    /* Winsock has no socket-level busy polling */
+    (void)sock;
+    (void)usec;
+    return 0;
+}
+
 void close_socket(SOCKET sock)
 {
     closesocket(sock);
@@ -1,4 +1,5 @@
 #include "nanoev_internal.h"
+#include "nanoev_trace.h"
 
 /*----------------------------------------------------------------------------*/
 
@@ -24,14 +25,36 @@ const char* nanoev_strerror(
 
 /*----------------------------------------------------------------------------*/
 
+nanoev_trace_hooks trace_hooks;
+
+void nanoev_set_trace_hooks(
+    const nanoev_trace_hooks *hooks
+    )
+{
+    if (hooks) {
+        trace_hooks = *hooks;
+    } else {
+        memset(&trace_hooks, 0, sizeof(trace_hooks));
+    }
+}
+
+/*----------------------------------------------------------------------------*/
+
 int nanoev_init(void)
 {
     int ret = global_init();
     if (ret != NANOEV_SUCCESS)
         return ret;
 
+    ret = buf_init();
+    if (ret != NANOEV_SUCCESS) {
+        global_term();
+        return ret;
+    }
+
     ret = dns_init();
     if (ret != NANOEV_SUCCESS) {
+        buf_term();
         global_term();
         return ret;
     }
@@ -42,5 +65,6 @@ int nanoev_init(void)
 void nanoev_term(void)
 {
     dns_term();
+    buf_term();
     global_term();
 }
@@ -1,8 +1,22 @@
 #include "nanoev_internal.h"
 #include "nanoev_poller.h"
+#include "nanoev_trace.h"
 
 /*----------------------------------------------------------------------------*/
 
+typedef struct loop_watchdog {
+    thread_handle thread;
+    cond wakeup;
+    int stop;
+    unsigned int timeout_ms;
+    nanoev_watchdog_callback callback;
+
+    int busy;                                     /* loop is away from the poller */
+    nanoev_timeval busy_since;
+    unsigned long long busy_seq;                  /* bumped when the loop leaves the poller */
+    unsigned long long reported_seq;              /* busy_seq of the last reported stall */
+} loop_watchdog;
+
 struct nanoev_loop {
     void *userdata;
     poller_impl *poller_impl_;
@@ -15,10 +29,35 @@ struct nanoev_loop {
 
     mutex lock;
     int is_break;
+
+    /* spin-then-block polling */
+    unsigned int busy_poll_usec;                  /* configured spin budget, 0 means disabled */
+    unsigned int busy_poll_budget;                /* current adaptive spin budget */
+    nanoev_timeval busy_poll_started;             /* start of the current spin */
+    int busy_polling;                             /* spinning with a zero time-out */
+
+    /* runtime statistics, loop thread only */
+    nanoev_loop_stats stats;
+
+    /* slow callback detection */
+    nanoev_timeval slow_threshold;
+    nanoev_slow_callback on_slow;
+
+    /* stall watchdog, its shared fields are protected by lock */
+    loop_watchdog *watchdog;
 };
 
 static void __process_endgame_proactor(nanoev_loop *loop, int enforcing);
 static void __update_time(nanoev_loop *loop);
+static void __busy_poll_timeout(nanoev_loop *loop, nanoev_timeval *timeout);
+static void __busy_poll_update(nanoev_loop *loop, int count);
+static unsigned long long __elapsed_usec(const nanoev_timeval *from, const nanoev_timeval *to);
+static void __record_poll(nanoev_loop *loop, int count);
+static void __watchdog_heartbeat(nanoev_loop *loop, int busy, const nanoev_timeval *now);
+static void __watchdog_stop(nanoev_loop *loop);
+static void __watchdog_proc(void *arg);
+
+#define BUSY_POLL_MAX_USEC  (1000000)   /* spinning longer than this is never useful */
 
 /*----------------------------------------------------------------------------*/
 
@@ -54,6 +93,8 @@ void nanoev_loop_free(nanoev_loop *loop)
 {
     ASSERT(loop);
 
+    __watchdog_stop(loop);
+
     ASSERT(loop->poller_);
     loop->poller_impl_->poller_destroy(loop->poller_);
 
@@ -70,7 +111,7 @@ int nanoev_loop_run(nanoev_loop *loop)
 {
     poller_event events[256];
     int count, i;
-    nanoev_timeval timeout;
+    nanoev_timeval timeout, poll_start, poll_end;
     int ret_code = NANOEV_SUCCESS;
 
     ASSERT(loop);
@@ -86,34 +127,72 @@ int nanoev_loop_run(nanoev_loop *loop)
 
     /* make sure we have a valid time before enter into the while loop */
     nanoev_now(&loop->now);
+    poll_end = loop->now;
+    if (loop->watchdog) {
+        __watchdog_heartbeat(loop, 1, &poll_end);
+    }
 
     while (1) {
         /* update time */
         __update_time(loop);
         
         /* process timer */
-        timers_process(&loop->timers, &loop->now);
+        timers_process(loop, &loop->timers, &loop->now);
 
         /* process lazy-delete proactor */
         __process_endgame_proactor(loop, 0);
 
         /* get a appropriate time-out */
         timers_timeout(&loop->timers, &loop->now, &timeout);
+        if (loop->busy_poll_usec) {
+            __busy_poll_timeout(loop, &timeout);
+        }
 
         /* waiting I/O events */
+        nanoev_now(&poll_start);
+        if (loop->watchdog) {
+            __watchdog_heartbeat(loop, 0, NULL);
+        }
+        TRACE_POLL_ENTER(loop, &timeout);
         count = loop->poller_impl_->poller_poll(
             loop->poller_, 
             events, 
             sizeof(events)/sizeof(events[0]), 
             &timeout);
+        TRACE_POLL_EXIT(loop, count);
         if (count < 0) {
             ret_code = NANOEV_ERROR_FAIL;
             break;
         }
+        loop->stats.callback_usec += __elapsed_usec(&poll_end, &poll_start);
+        nanoev_now(&poll_end);
+        loop->stats.poll_usec += __elapsed_usec(&poll_start, &poll_end);
+        __record_poll(loop, count);
+        if (loop->watchdog) {
+            __watchdog_heartbeat(loop, 1, &poll_end);
+        }
+        if (loop->busy_poll_usec) {
+            __busy_poll_update(loop, count);
+        }
 
         /* process events */
-        for (i = 0; i < count; ++i) {
-            events[i].proactor->cb(events[i].proactor, events[i].ctx);
+        if (loop->on_slow) {
+            for (i = 0; i < count; ++i) {
+                /* the event may be freed by its callback */
+                nanoev_event_type type = events[i].proactor->type;
+                void *userdata = events[i].proactor->userdata;
+                nanoev_timeval start;
+
+                TRACE_DISPATCH(loop, (nanoev_event*)events[i].proactor);
+                nanoev_now(&start);
+                events[i].proactor->cb(events[i].proactor, events[i].ctx);
+                loop_check_slow(loop, type, userdata, &start);
+            }
+        } else {
+            for (i = 0; i < count; ++i) {
+                TRACE_DISPATCH(loop, (nanoev_event*)events[i].proactor);
+                events[i].proactor->cb(events[i].proactor, events[i].ctx);
+            }
         }
 
         /* check is_break */
@@ -125,6 +204,11 @@ int nanoev_loop_run(nanoev_loop *loop)
         mutex_unlock(&loop->lock);
     }
 
+    /* an idle loop is not stalled */
+    if (loop->watchdog) {
+        __watchdog_heartbeat(loop, 0, NULL);
+    }
+
     /* clear the running thread ID */
     loop->thread_id = (thread_t)NULL;
 
@@ -159,6 +243,130 @@ void nanoev_loop_now(nanoev_loop *loop, nanoev_timeval *now)
         nanoev_now(now);
 }
 
+int nanoev_loop_set_busy_poll(nanoev_loop *loop, const nanoev_timeval *budget)
+{
+    unsigned int usec = 0;
+
+    ASSERT(loop);
+    ASSERT(in_loop_thread(loop));
+
+    if (budget) {
+        if (budget->tv_sec < 0 || budget->tv_usec < 0 || budget->tv_usec >= 1000000)
+            return NANOEV_ERROR_INVALID_ARG;
+        if (budget->tv_sec >= BUSY_POLL_MAX_USEC / 1000000)
+            return NANOEV_ERROR_INVALID_ARG;
+        usec = (unsigned int)(budget->tv_sec * 1000000 + budget->tv_usec);
+    }
+
+    loop->busy_poll_usec = usec;
+    loop->busy_poll_budget = usec;
+    loop->busy_polling = 0;
+
+    return NANOEV_SUCCESS;
+}
+
+void nanoev_loop_get_stats(nanoev_loop *loop, nanoev_loop_stats *stats)
+{
+    nanoev_proactor *proactor;
+
+    ASSERT(loop);
+    ASSERT(in_loop_thread(loop));
+    ASSERT(stats);
+
+    *stats = loop->stats;
+
+    stats->timers_fired = loop->timers.fired;
+    stats->timer_lateness_usec = loop->timers.lateness_usec;
+    stats->timer_lateness_max_usec = loop->timers.lateness_max_usec;
+    stats->timer_count = loop->timers.size;
+    stats->fake_io_depth = loop->poller_impl_->poller_pending(loop->poller_);
+
+    stats->endgame_count = 0;
+    for (proactor = loop->endgame_proactor_listhead; proactor; proactor = proactor->next) {
+        stats->endgame_count++;
+    }
+}
+
+int nanoev_loop_set_slow_callback(
+    nanoev_loop *loop,
+    const nanoev_timeval *threshold,
+    nanoev_slow_callback callback
+    )
+{
+    ASSERT(loop);
+    ASSERT(in_loop_thread(loop));
+
+    if (!threshold || !callback) {
+        loop->on_slow = NULL;
+        return NANOEV_SUCCESS;
+    }
+
+    if (threshold->tv_sec < 0 || threshold->tv_usec < 0 || threshold->tv_usec >= 1000000)
+        return NANOEV_ERROR_INVALID_ARG;
+
+    loop->slow_threshold = *threshold;
+    loop->on_slow = callback;
+
+    return NANOEV_SUCCESS;
+}
+
+int nanoev_loop_set_watchdog(
+    nanoev_loop *loop,
+    const nanoev_timeval *timeout,
+    nanoev_watchdog_callback callback
+    )
+{
+    loop_watchdog *watchdog;
+    unsigned int timeout_ms;
+
+    ASSERT(loop);
+    ASSERT(in_loop_thread(loop));
+
+    if (timeout && callback) {
+        if (timeout->tv_sec < 0 || timeout->tv_usec < 0 || timeout->tv_usec >= 1000000)
+            return NANOEV_ERROR_INVALID_ARG;
+        if (timeout->tv_sec > 86400)
+            return NANOEV_ERROR_INVALID_ARG;
+        timeout_ms = (unsigned int)(timeout->tv_sec * 1000 + timeout->tv_usec / 1000);
+        if (!timeout_ms)
+            return NANOEV_ERROR_INVALID_ARG;
+    }
+
+    __watchdog_stop(loop);
+
+    if (!timeout || !callback)
+        return NANOEV_SUCCESS;
+
+    watchdog = (loop_watchdog*)mem_alloc(sizeof(loop_watchdog));
+    if (!watchdog)
+        return NANOEV_ERROR_OUT_OF_MEMORY;
+    memset(watchdog, 0, sizeof(loop_watchdog));
+
+    watchdog->timeout_ms = timeout_ms;
+    watchdog->callback = callback;
+    if (loop->thread_id != (thread_t)NULL) {
+        /* enabled from a callback, the loop is busy right now */
+        watchdog->busy = 1;
+        nanoev_now(&watchdog->busy_since);
+        watchdog->busy_seq = 1;
+    }
+
+    if (cond_init(&watchdog->wakeup)) {
+        mem_free(watchdog);
+        return NANOEV_ERROR_FAIL;
+    }
+
+    loop->watchdog = watchdog;
+    if (thread_create(&watchdog->thread, __watchdog_proc, loop)) {
+        loop->watchdog = NULL;
+        cond_uninit(&watchdog->wakeup);
+        mem_free(watchdog);
+        return NANOEV_ERROR_FAIL;
+    }
+
+    return NANOEV_SUCCESS;
+}
+
 timer_min_heap* get_loop_timers(nanoev_loop *loop)
 {
     ASSERT(loop);
@@ -176,6 +384,51 @@ int in_loop_thread(nanoev_loop *loop)
     return 1;
 }
 
+void loop_count_event(nanoev_loop *loop, nanoev_event_type type, int delta)
+{
+    switch (type) {
+    case nanoev_event_tcp:
+        loop->stats.tcp_count += delta;
+        break;
+
+    case nanoev_event_udp:
+        loop->stats.udp_count += delta;
+        break;
+
+    case nanoev_event_async:
+        loop->stats.async_count += delta;
+        break;
+
+    default:
+        break;
+    }
+}
+
+int loop_watch_slow(nanoev_loop *loop)
+{
+    return loop->on_slow != NULL;
+}
+
+void loop_check_slow(nanoev_loop *loop, nanoev_event_type type, void *userdata, const nanoev_timeval *start)
+{
+    nanoev_timeval elapsed;
+
+    /* the callback may have disabled the detector */
+    if (!loop->on_slow) {
+        return;
+    }
+
+    nanoev_now(&elapsed);
+    if (time_cmp(&elapsed, start) <= 0) {
+        return;
+    }
+    time_sub(&elapsed, start);
+
+    if (time_cmp(&elapsed, &loop->slow_threshold) >= 0) {
+        loop->on_slow(loop, type, userdata, &elapsed);
+    }
+}
+
 int register_proactor(nanoev_loop *loop, nanoev_proactor *proactor, SOCKET sock, int events)
 {
     return loop->poller_impl_->poller_modify(loop->poller_, sock, proactor, events);
@@ -185,6 +438,7 @@ void add_endgame_proactor(nanoev_loop *loop, nanoev_proactor *proactor)
 {
     ASSERT(!(proactor->flags & NANOEV_PROACTOR_FLAG_DELETED));
     proactor->flags |= NANOEV_PROACTOR_FLAG_DELETED;
+    TRACE_LAZY_DELETE(loop, (nanoev_event*)proactor);
     proactor->next = loop->endgame_proactor_listhead;
     loop->endgame_proactor_listhead = proactor;
 }
@@ -250,6 +504,154 @@ static void __process_endgame_proactor(nanoev_loop *loop, int enforcing)
     }
 }
 
+static void __busy_poll_timeout(nanoev_loop *loop, nanoev_timeval *timeout)
+{
+    nanoev_timeval elapsed;
+
+    if (timeout->tv_sec == 0 && timeout->tv_usec == 0) {
+        return;
+    }
+
+    if (!loop->busy_polling) {
+        if (!loop->busy_poll_budget) {
+            /* backed off completely, an idle loop blocks */
+            return;
+        }
+        loop->busy_polling = 1;
+        loop->busy_poll_started = loop->now;
+    }
+
+    elapsed = loop->now;
+    time_sub(&elapsed, &loop->busy_poll_started);
+    if (elapsed.tv_sec == 0 && (unsigned int)elapsed.tv_usec < loop->busy_poll_budget) {
+        /* keep spinning */
+        timeout->tv_sec = 0;
+        timeout->tv_usec = 0;
+        return;
+    }
+
+    /* the spin found nothing, halve the budget and block */
+    loop->busy_polling = 0;
+    loop->busy_poll_budget /= 2;
+}
+
+static void __busy_poll_update(nanoev_loop *loop, int count)
+{
+    unsigned int budget;
+
+    if (count <= 0) {
+        return;
+    }
+
+    if (loop->busy_polling) {
+        /* the spin paid off, grow the budget back */
+        budget = loop->busy_poll_budget * 2;
+        loop->busy_poll_budget = budget < loop->busy_poll_usec ? budget : loop->busy_poll_usec;
+        loop->busy_polling = 0;
+    } else if (!loop->busy_poll_budget) {
+        /* traffic after blocking, probe again with a small budget */
+        budget = loop->busy_poll_usec / 16;
+        loop->busy_poll_budget = budget ? budget : 1;
+    }
+}
+
+static unsigned long long __elapsed_usec(const nanoev_timeval *from, const nanoev_timeval *to)
+{
+    nanoev_timeval tv;
+
+    /* the wall clock may step backward */
+    if (time_cmp(to, from) <= 0) {
+        return 0;
+    }
+
+    tv = *to;
+    time_sub(&tv, from);
+    return (unsigned long long)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+static void __record_poll(nanoev_loop *loop, int count)
+{
+    unsigned int bucket = 0;
+
+    loop->stats.iterations++;
+    loop->stats.events += count;
+
+    while (count && bucket < NANOEV_LOOP_STATS_BUCKETS - 1) {
+        bucket++;
+        count >>= 1;
+    }
+    loop->stats.events_per_poll[bucket]++;
+}
+
+static void __watchdog_heartbeat(nanoev_loop *loop, int busy, const nanoev_timeval *now)
+{
+    loop_watchdog *watchdog = loop->watchdog;
+
+    mutex_lock(&loop->lock);
+    watchdog->busy = busy;
+    if (busy) {
+        watchdog->busy_since = *now;
+        watchdog->busy_seq++;
+    }
+    mutex_unlock(&loop->lock);
+}
+
+static void __watchdog_stop(nanoev_loop *loop)
+{
+    loop_watchdog *watchdog = loop->watchdog;
+
+    if (!watchdog) {
+        return;
+    }
+
+    mutex_lock(&loop->lock);
+    watchdog->stop = 1;
+    cond_signal(&watchdog->wakeup);
+    mutex_unlock(&loop->lock);
+
+    thread_join(watchdog->thread);
+
+    loop->watchdog = NULL;
+    cond_uninit(&watchdog->wakeup);
+    mem_free(watchdog);
+}
+
+static void __watchdog_proc(void *arg)
+{
+    nanoev_loop *loop = (nanoev_loop*)arg;
+    loop_watchdog *watchdog = loop->watchdog;
+    nanoev_timeval now, stalled;
+    unsigned int interval;
+
+    /* sample often enough to report a stall within 1.25 x timeout */
+    interval = watchdog->timeout_ms / 4;
+    if (!interval)
+        interval = 1;
+
+    mutex_lock(&loop->lock);
+    while (!watchdog->stop) {
+        cond_timedwait(&watchdog->wakeup, &loop->lock, interval);
+        if (watchdog->stop)
+            break;
+        if (!watchdog->busy || watchdog->reported_seq == watchdog->busy_seq)
+            continue;
+
+        nanoev_now(&now);
+        if (time_cmp(&now, &watchdog->busy_since) <= 0)
+            continue;
+        stalled = now;
+        time_sub(&stalled, &watchdog->busy_since);
+        if ((unsigned long long)stalled.tv_sec * 1000 + stalled.tv_usec / 1000 < watchdog->timeout_ms)
+            continue;
+
+        watchdog->reported_seq = watchdog->busy_seq;
+        mutex_unlock(&loop->lock);
+        watchdog->callback(loop, &stalled);
+        mutex_lock(&loop->lock);
+    }
+    mutex_unlock(&loop->lock);
+}
+
 static void __update_time(nanoev_loop *loop)
 {
     nanoev_timeval tv, off;
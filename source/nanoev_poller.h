@@ -25,6 +25,8 @@ typedef struct poller_impl {
     int (*poller_submit)(poller p, const poller_event *event);
 
     int (*poller_notify)(poller p);
+
+    unsigned int (*poller_pending)(poller p);
 } poller_impl;
 
 poller_impl* get_poller_impl(void);
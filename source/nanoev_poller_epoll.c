@@ -164,7 +164,8 @@ int epoll_poller_poll(poller p, poller_event *events, int max_events, const nano
 
     int timeout_in_ms;
     if (timeout->tv_sec != -1) {
-        timeout_in_ms = timeout->tv_sec * 1000 + timeout->tv_usec / 1000;
+        /* round up: a truncated sub-millisecond wait polls with 0 and spins until the timer is due */
+        timeout_in_ms = timeout->tv_sec * 1000 + (timeout->tv_usec + 999) / 1000;
     } else {
         timeout_in_ms = -1;
     }
@@ -192,6 +193,11 @@ int epoll_poller_poll(poller p, poller_event *events, int max_events, const nano
         ASSERT(proactor);
         ASSERT(proactor->reactor_cb);
 
+        if ((_events[i].events & EPOLLERR) && (proactor->reactor_events & _EV_ERROR)) {
+            /* the proactor consumes its error queue (e.g. MSG_ZEROCOPY notifications) */
+            count = epoll_append_reactor_event(events, count, max_events, proactor, _EV_ERROR);
+        }
+
         if (_events[i].events & EPOLLIN) {
             count = epoll_append_reactor_event(events, count, max_events, proactor, _EV_READ);
         } else if (_events[i].events & EPOLLOUT) {
@@ -253,6 +259,14 @@ int epoll_poller_notify(poller p)
     return 0;
 }
 
+unsigned int epoll_poller_pending(poller p)
+{
+    _epoll_poller *_p = (_epoll_poller*)p;
+    ASSERT(_p->epd >= 0);
+
+    return (unsigned int)_p->events_count;
+}
+
 /*----------------------------------------------------------------------------*/
 
 poller_impl _nanoev_poller_impl = {
@@ -262,6 +276,7 @@ poller_impl _nanoev_poller_impl = {
     .poller_poll    = epoll_poller_poll,
     .poller_submit  = epoll_poller_submit,
     .poller_notify  = epoll_poller_notify,
+    .poller_pending = epoll_poller_pending,
 };
 
 /*----------------------------------------------------------------------------*/
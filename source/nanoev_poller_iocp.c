@@ -70,7 +70,8 @@ int iocp_poller_poll(poller p, poller_event *events, int max_events, const nanoe
         count = max_events;
 
     if (timeout->tv_sec != -1) {
-        timeout_in_ms = timeout->tv_sec * 1000 + timeout->tv_usec / 1000;
+        /* round up: a truncated sub-millisecond wait polls with 0 and spins until the timer is due */
+        timeout_in_ms = timeout->tv_sec * 1000 + (timeout->tv_usec + 999) / 1000;
     } else {
         timeout_in_ms = INFINITE;
     }
@@ -139,6 +140,12 @@ int iocp_poller_notify(poller p)
     }
 }
 
+unsigned int iocp_poller_pending(poller p)
+{
+    /* fake I/O is not used with IOCP */
+    return 0;
+}
+
 /*----------------------------------------------------------------------------*/
 
 poller_impl _nanoev_poller_impl;
@@ -151,6 +158,7 @@ void init_iocp_poller_impl(void)
     _nanoev_poller_impl.poller_poll    = iocp_poller_poll;
     _nanoev_poller_impl.poller_submit  = iocp_poller_submit;
     _nanoev_poller_impl.poller_notify  = iocp_poller_notify;
+    _nanoev_poller_impl.poller_pending = iocp_poller_pending;
 }
 
 /*----------------------------------------------------------------------------*/
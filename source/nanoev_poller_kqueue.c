@@ -217,6 +217,14 @@ int kqueue_poller_notify(poller p)
     return 0;
 }
 
+unsigned int kqueue_poller_pending(poller p)
+{
+    _kqueue_poller *_p = (_kqueue_poller*)p;
+    ASSERT(_p->kq >= 0);
+
+    return (unsigned int)_p->events_count;
+}
+
 /*----------------------------------------------------------------------------*/
 
 poller_impl _nanoev_poller_impl = {
@@ -226,6 +234,7 @@ poller_impl _nanoev_poller_impl = {
     .poller_poll    = kqueue_poller_poll,
     .poller_submit  = kqueue_poller_submit,
     .poller_notify  = kqueue_poller_notify,
+    .poller_pending = kqueue_poller_pending,
 };
 
 /*----------------------------------------------------------------------------*/
@@ -1,4 +1,23 @@
 #include "nanoev_internal.h"
+#include "nanoev_trace.h"
+#include <limits.h>
+
+#ifndef _WIN32
+# include <poll.h>
+# include <sys/uio.h>
+#endif
+
+#if defined(__linux__) && defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY)
+# define NANOEV_TCP_ZEROCOPY
+# include <linux/errqueue.h>
+#endif
+
+/* FreeBSD only balances connections across SO_REUSEPORT_LB listeners */
+#if defined(SO_REUSEPORT_LB)
+# define TCP_REUSEPORT  SO_REUSEPORT_LB
+#elif defined(SO_REUSEPORT)
+# define TCP_REUSEPORT  SO_REUSEPORT
+#endif
 
 /*----------------------------------------------------------------------------*/
 
@@ -18,6 +37,31 @@ typedef struct nanoev_tcp_timeout {
     nanoev_tcp_timeout_op op;
 } nanoev_tcp_timeout;
 
+/* pieces gathered into one send */
+#define TCP_MAX_IOV  NANOEV_TCP_MAX_IOV
+
+/* nanoev_tcp_read_buf() and nanoev_tcp_write_buf() state, allocated on first use */
+typedef struct tcp_buf_io {
+    io_buf vec[TCP_MAX_IOV];              /* pieces of the pending nanoev_buf write */
+    nanoev_buf *read_buf;                 /* nanoev_tcp_read_buf() target */
+    nanoev_buf *write_buf;                /* nanoev_tcp_write_buf() source, referenced */
+    unsigned int write_done;
+    int write_has_timeout;
+    nanoev_timeval write_timeout;
+    nanoev_tcp_on_read_buf  on_read_buf;
+    nanoev_tcp_on_write_buf on_write_buf;
+} tcp_buf_io;
+
+/* nanoev_tcp_read_exact() and nanoev_tcp_read_until() state, allocated on first use */
+typedef struct tcp_read_ext {
+    unsigned int min;                     /* nanoev_tcp_read_exact(): complete at this count */
+    unsigned int scan;                    /* nanoev_tcp_read_until(): first offset not yet searched */
+    unsigned int found;                   /* end of the delimiter, 0 until it is found */
+    unsigned int delim_len;               /* 0 unless a nanoev_tcp_read_until() is pending */
+    char delim[NANOEV_TCP_MAX_DELIMITER];
+    nanoev_tcp_on_read_until on_read_until;
+} tcp_read_ext;
+
 struct nanoev_tcp {
     NANOEV_PROACTOR_FILEDS
     int family;
@@ -38,6 +82,23 @@ struct nanoev_tcp {
     nanoev_tcp_timeout timeout_read;
     nanoev_tcp_timeout timeout_write;
     unsigned char *accept_addr_buf;
+    tcp_connector *connector;             /* racing connection attempts, see nanoev_connect.c */
+    tcp_fanout_sub *fanout_sub;           /* broadcast subscription, see nanoev_tcp_fanout.c */
+    tcp_framer *framer;                   /* nanoev_tcp_read_frames() state, see nanoev_tcp_frame.c */
+    tcp_pool_entry *pool_entry;           /* pooled connection, see nanoev_tcp_pool.c */
+    unsigned int write_vec_count;         /* 1: buf_write alone, else buf_io->vec */
+    tcp_buf_io *buf_io;                   /* NULL until nanoev_tcp_read_buf()/write_buf() */
+    io_buf *read_vec;                     /* nanoev_tcp_readv() buffers, TCP_MAX_IOV entries */
+    unsigned int read_vec_count;          /* 0 when reading into buf_read alone */
+    unsigned int read_done;               /* bytes of the pending read received so far */
+    tcp_read_ext *read_ext;               /* NULL until nanoev_tcp_read_exact()/read_until() */
+#ifdef NANOEV_TCP_ZEROCOPY
+    unsigned int zerocopy_threshold;      /* 0 means MSG_ZEROCOPY is disabled */
+    unsigned int zerocopy_next_id;        /* notification id of the next MSG_ZEROCOPY send */
+    unsigned int zerocopy_pending_id;     /* notification id the pending write waits for */
+    unsigned int zerocopy_completions;
+    unsigned int zerocopy_copied;
+#endif
     /* callback functions */
     nanoev_tcp_on_write   on_write;
     nanoev_tcp_on_read    on_read;
@@ -61,9 +122,34 @@ static void tcp_timeout_del(nanoev_tcp *tcp, nanoev_tcp_timeout *timeout);
 static int sockaddr_len(nanoev_tcp *tcp);
 static int tcp_set_option(nanoev_tcp *tcp, int level, int optname, const char *optval, int optlen);
 static int tcp_set_int_option(nanoev_tcp *tcp, int level, int optname, int value);
+static int tcp_start_write(nanoev_tcp *tcp, const nanoev_timeval *timeout, nanoev_tcp_on_write callback);
+static int tcp_buf_io_alloc(nanoev_tcp *tcp);
+static int tcp_write_buf_next(nanoev_tcp *tcp);
+static void tcp_on_write_buf(nanoev_event *event, int status, void *buf, unsigned int bytes);
+static void tcp_on_read_buf(nanoev_event *event, int status, void *buf, unsigned int bytes);
+static int tcp_start_read(nanoev_tcp *tcp, void *buf, unsigned int len, unsigned int done,
+    unsigned int vec_count, const nanoev_timeval *timeout, nanoev_tcp_on_read callback);
+static int tcp_read_ext_alloc(nanoev_tcp *tcp);
+static void tcp_read_ext_clear(nanoev_tcp *tcp);
+static int tcp_read_satisfied(nanoev_tcp *tcp);
+static const char* tcp_find_delim(const char *buf, unsigned int len, const char *delim,
+    unsigned int delim_len);
+static void tcp_on_read_until(nanoev_event *event, int status, void *buf, unsigned int bytes);
+#ifdef _WIN32
+static int tcp_recv(nanoev_tcp *tcp);
+#endif
+#ifndef _WIN32
+static int tcp_write_some(nanoev_tcp *tcp);
+static int tcp_read_vec(nanoev_tcp *tcp);
+#endif
+#ifdef NANOEV_TCP_ZEROCOPY
+static int tcp_zerocopy_reap(nanoev_tcp *tcp);
+#endif
 
 #define NANOEV_TCP_FLAG_CONNECTED    (0x00000001)      /* connection established */
 #define NANOEV_TCP_FLAG_LISTENING    (0x00000002)      /* listening */
+#define NANOEV_TCP_FLAG_ZEROCOPY     (0x00000004)      /* written, waiting for the zerocopy notification */
+#define NANOEV_TCP_FLAG_BOUND        (0x00000008)      /* bound by nanoev_tcp_bind(), not yet connecting */
 #define NANOEV_TCP_FLAG_WRITING      NANOEV_PROACTOR_FLAG_WRITING
 #define NANOEV_TCP_FLAG_READING      NANOEV_PROACTOR_FLAG_READING
 #define NANOEV_TCP_FLAG_ERROR        NANOEV_PROACTOR_FLAG_ERROR
@@ -100,6 +186,19 @@ void tcp_free(nanoev_event *event)
 
     ASSERT(tcp->type == nanoev_event_tcp);
 
+    if (tcp->connector) {
+        tcp_connector_free(tcp->connector);
+        tcp->connector = NULL;
+    }
+    if (tcp->fanout_sub) {
+        tcp_fanout_sub_free(tcp->fanout_sub);
+        tcp->fanout_sub = NULL;
+    }
+    if (tcp->pool_entry) {
+        tcp_pool_entry_free(tcp->pool_entry);
+        tcp->pool_entry = NULL;
+    }
+
     tcp_timeout_del(tcp, &tcp->timeout_read);
     tcp_timeout_del(tcp, &tcp->timeout_write);
 
@@ -109,12 +208,25 @@ void tcp_free(nanoev_event *event)
 
     if ((tcp->flags & NANOEV_TCP_FLAG_READING) || (tcp->flags & NANOEV_TCP_FLAG_WRITING)) {
         /* lazy delete */
+        if (tcp->framer)
+            tcp_framer_stop(tcp->framer);
         add_endgame_proactor(tcp->loop, (nanoev_proactor*)tcp);
     } else {
         if (tcp->accept_addr_buf) {
             mem_free(tcp->accept_addr_buf);
             tcp->accept_addr_buf = NULL;
         }
+        if (tcp->buf_io) {
+            nanoev_buf_unref(tcp->buf_io->write_buf);
+            mem_free(tcp->buf_io);
+        }
+        if (tcp->read_vec)
+            mem_free(tcp->read_vec);
+        if (tcp->read_ext)
+            mem_free(tcp->read_ext);
+        /* only now, a pending read may still target its buffer */
+        if (tcp->framer)
+            tcp_framer_free(tcp->framer);
         mem_free(tcp);
     }
 }
@@ -143,26 +255,34 @@ int nanoev_tcp_connect(
         return NANOEV_ERROR_INVALID_ARG;
     if (timeout && (timeout->tv_sec < 0 || timeout->tv_usec < 0 || timeout->tv_usec >= 1000000))
         return NANOEV_ERROR_INVALID_ARG;
-    if (tcp->sock != INVALID_SOCKET)
-        return NANOEV_ERROR_ACCESS_DENIED;
-
-    error_code = create_tcp_socket(tcp, server_addr->ss_family);
-    if (0 != error_code)
-        goto ERROR_EXIT;
+    if (tcp->flags & NANOEV_TCP_FLAG_BOUND) {
+        if (tcp->flags & NANOEV_TCP_FLAG_ERROR)
+            return NANOEV_ERROR_ACCESS_DENIED;
+        if (server_addr->ss_family != tcp->family)
+            return NANOEV_ERROR_INVALID_ARG;
+        tcp->flags &= ~NANOEV_TCP_FLAG_BOUND;
+    } else {
+        if (tcp->sock != INVALID_SOCKET)
+            return NANOEV_ERROR_ACCESS_DENIED;
+        error_code = create_tcp_socket(tcp, server_addr->ss_family);
+        if (0 != error_code)
+            goto ERROR_EXIT;
+#ifdef _WIN32
+        /* We have to call bind(...), or ConnectEx will failed with WSAEINVAL... */
+        memset(&local_addr, 0, sizeof(local_addr));
+        local_addr.ss_family = tcp->family;
+        if (0 != bind(tcp->sock, (const struct sockaddr*)&local_addr, sockaddr_len(tcp))) {
+            error_code = WSAGetLastError();
+            goto ERROR_EXIT;
+        }
+#endif
+    }
 
 #ifdef _WIN32
     error_code = register_proactor(tcp->loop, (nanoev_proactor*)tcp, tcp->sock, _EV_READ);
     if (0 != error_code)
         goto ERROR_EXIT;
 
-    /* We have to call bind(...), or ConnectEx will failed with WSAEINVAL... */
-    memset(&local_addr, 0, sizeof(local_addr));
-    local_addr.ss_family = tcp->family;
-    if (0 != bind(tcp->sock, (const struct sockaddr*)&local_addr, sockaddr_len(tcp))) {
-        error_code = WSAGetLastError();
-        goto ERROR_EXIT;
-    }
-
     /* Call ConnectEx */
     connect_result = get_winsock_ext()->ConnectEx(tcp->sock, (const struct sockaddr*)server_addr,
         sockaddr_len(tcp), NULL, 0, NULL, &tcp->ctx_write);
@@ -217,11 +337,69 @@ ERROR_EXIT:
     return NANOEV_ERROR_FAIL;
 }
 
+int nanoev_tcp_bind(
+    nanoev_event *event,
+    const struct nanoev_addr *local_addr
+    )
+{
+    nanoev_tcp *tcp = (nanoev_tcp*)event;
+    int error_code = 0;
+    unsigned short port = 0;
+
+    ASSERT(tcp);
+    ASSERT(tcp->type == nanoev_event_tcp);
+    ASSERT(in_loop_thread(tcp->loop));
+
+    if (!local_addr || nanoev_addr_get_port(local_addr, &port) != NANOEV_SUCCESS)
+        return NANOEV_ERROR_INVALID_ARG;
+    if (tcp->sock != INVALID_SOCKET)
+        return NANOEV_ERROR_ACCESS_DENIED;
+
+    error_code = create_tcp_socket(tcp, local_addr->ss_family);
+    if (0 != error_code)
+        goto ERROR_EXIT;
+
+#ifdef IP_BIND_ADDRESS_NO_PORT
+    if (port == 0) {
+        /* pick the port at connect time, so it only has to be unique per destination */
+        int on = 1;
+        if (0 != setsockopt(tcp->sock, IPPROTO_IP, IP_BIND_ADDRESS_NO_PORT, (const char*)&on, sizeof(on))) {
+            error_code = socket_last_error();
+            goto ERROR_EXIT;
+        }
+    }
+#endif
+
+    if (0 != bind(tcp->sock, (const struct sockaddr*)local_addr, sockaddr_len(tcp))) {
+        error_code = socket_last_error();
+        goto ERROR_EXIT;
+    }
+
+    tcp->flags |= NANOEV_TCP_FLAG_BOUND;
+
+    return NANOEV_SUCCESS;
+
+ERROR_EXIT:
+    tcp->error_code = error_code;
+    tcp->flags |= NANOEV_TCP_FLAG_ERROR;
+    return NANOEV_ERROR_FAIL;
+}
+
 int nanoev_tcp_listen(
     nanoev_event *event, 
     const struct nanoev_addr *local_addr,
     int backlog
     )
+{
+    return nanoev_tcp_listen_ex(event, local_addr, backlog, 0);
+}
+
+int nanoev_tcp_listen_ex(
+    nanoev_event *event,
+    const struct nanoev_addr *local_addr,
+    int backlog,
+    unsigned int flags
+    )
 {
     nanoev_tcp *tcp = (nanoev_tcp*)event;
     int error_code = 0;
@@ -230,10 +408,14 @@ int nanoev_tcp_listen(
     ASSERT(tcp->type == nanoev_event_tcp);
     ASSERT(in_loop_thread(tcp->loop));
 
-    if (!local_addr)
+    if (!local_addr || flags & ~NANOEV_TCP_LISTEN_REUSEPORT)
         return NANOEV_ERROR_INVALID_ARG;
     if (tcp->sock != INVALID_SOCKET)
         return NANOEV_ERROR_ACCESS_DENIED;
+#ifndef TCP_REUSEPORT
+    if (flags & NANOEV_TCP_LISTEN_REUSEPORT)
+        return NANOEV_ERROR_FAIL;
+#endif
 
     error_code = create_tcp_socket(tcp, local_addr->ss_family);
     if (0 != error_code)
@@ -243,6 +425,16 @@ int nanoev_tcp_listen(
     if (0 != error_code)
         goto ERROR_EXIT;
 
+#ifdef TCP_REUSEPORT
+    if (flags & NANOEV_TCP_LISTEN_REUSEPORT) {
+        int on = 1;
+        if (0 != setsockopt(tcp->sock, SOL_SOCKET, TCP_REUSEPORT, (const char*)&on, sizeof(on))) {
+            error_code = socket_last_error();
+            goto ERROR_EXIT;
+        }
+    }
+#endif
+
     /* bind */
     if (0 != bind(tcp->sock, (const struct sockaddr*)local_addr, sockaddr_len(tcp))) {
         error_code = socket_last_error();
@@ -392,10 +584,6 @@ int nanoev_tcp_write(
     )
 {
     nanoev_tcp *tcp = (nanoev_tcp*)event;
-    int write_pending = 0;
-#ifdef _WIN32
-    DWORD cb;
-#endif
 
     ASSERT(tcp);
     ASSERT(tcp->type == nanoev_event_tcp);
@@ -415,10 +603,73 @@ int nanoev_tcp_write(
 
     tcp->buf_write.buf = (char*)buf;
     tcp->buf_write.len = len;
+    tcp->write_vec_count = 1;
+
+    return tcp_start_write(tcp, timeout, callback);
+}
+
+int nanoev_tcp_write_buf(
+    nanoev_event *event,
+    nanoev_buf *buf,
+    const nanoev_timeval *timeout,
+    nanoev_tcp_on_write_buf callback
+    )
+{
+    nanoev_tcp *tcp = (nanoev_tcp*)event;
+    int ret_code;
+
+    ASSERT(tcp);
+    ASSERT(tcp->type == nanoev_event_tcp);
+    ASSERT(in_loop_thread(tcp->loop));
+
+    if (!buf || !nanoev_buf_len(buf) || !callback)
+        return NANOEV_ERROR_INVALID_ARG;
+    if (timeout && (timeout->tv_sec < 0 || timeout->tv_usec < 0 || timeout->tv_usec >= 1000000))
+        return NANOEV_ERROR_INVALID_ARG;
+    if (tcp->sock == INVALID_SOCKET
+        || tcp->flags & NANOEV_TCP_FLAG_ERROR
+        || tcp->flags & NANOEV_TCP_FLAG_DELETED
+        || !(tcp->flags & NANOEV_TCP_FLAG_CONNECTED)
+        || tcp->flags & NANOEV_TCP_FLAG_WRITING
+        )
+        return NANOEV_ERROR_ACCESS_DENIED;
+
+    if (tcp_buf_io_alloc(tcp))
+        return NANOEV_ERROR_OUT_OF_MEMORY;
+
+    ASSERT(!tcp->buf_io->write_buf);
+    tcp->buf_io->write_buf = nanoev_buf_ref(buf);
+    tcp->buf_io->write_done = 0;
+    tcp->buf_io->write_has_timeout = timeout != NULL;
+    if (timeout)
+        tcp->buf_io->write_timeout = *timeout;
+    tcp->buf_io->on_write_buf = callback;
+
+    ret_code = tcp_write_buf_next(tcp);
+    if (ret_code != NANOEV_SUCCESS) {
+        nanoev_buf_unref(tcp->buf_io->write_buf);
+        tcp->buf_io->write_buf = NULL;
+        tcp->buf_io->on_write_buf = NULL;
+    }
+    return ret_code;
+}
+
+static int tcp_start_write(
+    nanoev_tcp *tcp,
+    const nanoev_timeval *timeout,
+    nanoev_tcp_on_write callback
+    )
+{
+    int write_pending = 0;
+#ifdef _WIN32
+    DWORD cb;
+#endif
+
     memset(&tcp->ctx_write, 0, sizeof(io_context));
     
 #ifdef _WIN32
-    if (0 != WSASend(tcp->sock, &tcp->buf_write, 1, &cb, 0, &tcp->ctx_write, NULL)) {
+    if (0 != WSASend(tcp->sock, tcp->write_vec_count == 1 ? &tcp->buf_write : tcp->buf_io->vec,
+        tcp->write_vec_count, &cb, 0, &tcp->ctx_write, NULL)) {
         if (WSA_IO_PENDING != WSAGetLastError()) {
             tcp->flags |= NANOEV_TCP_FLAG_ERROR;
             tcp->error_code = WSAGetLastError();
@@ -427,8 +678,13 @@ int nanoev_tcp_write(
         write_pending = 1;
     }
 #else
-    int ret = write(tcp->sock, buf, len);
-    if (ret > 0) {
+    int ret = tcp_write_some(tcp);
+    if (ret > 0 && (tcp->flags & NANOEV_TCP_FLAG_ZEROCOPY)) {
+        /* the kernel still references buf, complete on the error-queue notification */
+        tcp->ctx_write.status = 0;
+        tcp->ctx_write.bytes = ret;
+        write_pending = 1;
+    } else if (ret > 0) {
         tcp->ctx_write.status = 0;
         tcp->ctx_write.bytes = ret;
         if (submit_fake_io(tcp->loop, (nanoev_proactor*)tcp, &tcp->ctx_write)) {
@@ -477,9 +733,7 @@ int nanoev_tcp_read(
     )
 {
     nanoev_tcp *tcp = (nanoev_tcp*)event;
-#ifdef _WIN32
-    DWORD cb, flags = 0;
-#endif
+    int ret_code;
 
     ASSERT(tcp);
     ASSERT(tcp->type == nanoev_event_tcp);
@@ -487,42 +741,159 @@ int nanoev_tcp_read(
 
     if (!buf || !len || !callback)
         return NANOEV_ERROR_INVALID_ARG;
-    if (timeout && (timeout->tv_sec < 0 || timeout->tv_usec < 0 || timeout->tv_usec >= 1000000))
+
+    ret_code = tcp_start_read(tcp, buf, len, 0, 0, timeout, callback);
+    if (ret_code == NANOEV_SUCCESS)
+        tcp_read_ext_clear(tcp);
+    return ret_code;
+}
+
+int nanoev_tcp_read_exact(
+    nanoev_event *event,
+    void *buf,
+    unsigned int len,
+    const nanoev_timeval *timeout,
+    nanoev_tcp_on_read callback
+    )
+{
+    nanoev_tcp *tcp = (nanoev_tcp*)event;
+    int ret_code;
+
+    ASSERT(tcp);
+    ASSERT(tcp->type == nanoev_event_tcp);
+    ASSERT(in_loop_thread(tcp->loop));
+
+    if (!buf || !len || !callback)
         return NANOEV_ERROR_INVALID_ARG;
-    if (tcp->sock == INVALID_SOCKET
-        || tcp->flags & NANOEV_TCP_FLAG_ERROR
-        || tcp->flags & NANOEV_TCP_FLAG_DELETED
-        || !(tcp->flags & NANOEV_TCP_FLAG_CONNECTED)
-        || tcp->flags & NANOEV_TCP_FLAG_READING
-        )
-        return NANOEV_ERROR_ACCESS_DENIED;
+    if (tcp_read_ext_alloc(tcp))
+        return NANOEV_ERROR_OUT_OF_MEMORY;
 
-    tcp->buf_read.buf = (char*)buf;
-    tcp->buf_read.len = len;
-    memset(&tcp->ctx_read, 0, sizeof(io_context));
-    
-#ifdef _WIN32
-    if (0 != WSARecv(tcp->sock, &tcp->buf_read, 1, &cb, &flags, &tcp->ctx_read, NULL)
-        && WSA_IO_PENDING != WSAGetLastError()
-        ) {
-        tcp->flags |= NANOEV_TCP_FLAG_ERROR;
-        tcp->error_code = WSAGetLastError();
-        return NANOEV_ERROR_FAIL;
+    ret_code = tcp_start_read(tcp, buf, len, 0, 0, timeout, callback);
+    if (ret_code == NANOEV_SUCCESS) {
+        tcp->read_ext->min = len;
+        tcp->read_ext->delim_len = 0;
     }
-#endif
+    return ret_code;
+}
 
-    if (timeout) {
-        int ret_code = tcp_timeout_add(tcp, &tcp->timeout_read, NANOEV_TCP_TIMEOUT_READ, timeout);
-        if (ret_code != NANOEV_SUCCESS) {
-            tcp->flags |= NANOEV_TCP_FLAG_ERROR;
-            tcp->error_code = ENOMEM;
-            return NANOEV_ERROR_FAIL;
-        }
+int nanoev_tcp_read_until(
+    nanoev_event *event,
+    void *buf,
+    unsigned int len,
+    unsigned int filled,
+    const void *delim,
+    unsigned int delim_len,
+    const nanoev_timeval *timeout,
+    nanoev_tcp_on_read_until callback
+    )
+{
+    nanoev_tcp *tcp = (nanoev_tcp*)event;
+    int ret_code;
+
+    ASSERT(tcp);
+    ASSERT(tcp->type == nanoev_event_tcp);
+    ASSERT(in_loop_thread(tcp->loop));
+
+    if (!buf || !callback || !delim || !delim_len || delim_len > NANOEV_TCP_MAX_DELIMITER)
+        return NANOEV_ERROR_INVALID_ARG;
+    if (filled >= len)
+        return NANOEV_ERROR_INVALID_ARG;
+    if (tcp_find_delim((const char*)buf, filled, (const char*)delim, delim_len))
+        return NANOEV_ERROR_INVALID_ARG;
+    if (tcp_read_ext_alloc(tcp))
+        return NANOEV_ERROR_OUT_OF_MEMORY;
+
+    ret_code = tcp_start_read(tcp, buf, len, filled, 0, timeout, tcp_on_read_until);
+    if (ret_code == NANOEV_SUCCESS) {
+        tcp->read_ext->min = 0;
+        tcp->read_ext->scan = filled >= delim_len ? filled - (delim_len - 1) : 0;
+        tcp->read_ext->found = 0;
+        tcp->read_ext->delim_len = delim_len;
+        memcpy(tcp->read_ext->delim, delim, delim_len);
+        tcp->read_ext->on_read_until = callback;
     }
+    return ret_code;
+}
 
-    tcp->flags |= NANOEV_TCP_FLAG_READING;
-    tcp->on_read = callback;
+int nanoev_tcp_readv(
+    nanoev_event *event,
+    const nanoev_iovec *bufs,
+    unsigned int count,
+    const nanoev_timeval *timeout,
+    nanoev_tcp_on_read callback
+    )
+{
+    nanoev_tcp *tcp = (nanoev_tcp*)event;
+    unsigned int i, total = 0;
+    int ret_code;
+
+    ASSERT(tcp);
+    ASSERT(tcp->type == nanoev_event_tcp);
+    ASSERT(in_loop_thread(tcp->loop));
+
+    if (!bufs || !count || count > NANOEV_TCP_MAX_IOV || !callback)
+        return NANOEV_ERROR_INVALID_ARG;
+    for (i = 0; i < count; i++) {
+        if (!bufs[i].buf || !bufs[i].len || bufs[i].len > UINT_MAX - total)
+            return NANOEV_ERROR_INVALID_ARG;
+        total += bufs[i].len;
+    }
+    /* read_vec belongs to the pending read, if any */
+    if (tcp->flags & NANOEV_TCP_FLAG_READING)
+        return NANOEV_ERROR_ACCESS_DENIED;
+
+    if (count == 1)
+        return nanoev_tcp_read(event, bufs[0].buf, bufs[0].len, timeout, callback);
+
+    if (!tcp->read_vec) {
+        tcp->read_vec = (io_buf*)mem_alloc(TCP_MAX_IOV * sizeof(io_buf));
+        if (!tcp->read_vec)
+            return NANOEV_ERROR_OUT_OF_MEMORY;
+    }
+    for (i = 0; i < count; i++) {
+        tcp->read_vec[i].buf = (char*)bufs[i].buf;
+        tcp->read_vec[i].len = bufs[i].len;
+    }
+
+    ret_code = tcp_start_read(tcp, bufs[0].buf, bufs[0].len, 0, count, timeout, callback);
+    if (ret_code == NANOEV_SUCCESS)
+        tcp_read_ext_clear(tcp);
+    return ret_code;
+}
+
+int nanoev_tcp_read_buf(
+    nanoev_event *event,
+    nanoev_buf *buf,
+    unsigned int len,
+    const nanoev_timeval *timeout,
+    nanoev_tcp_on_read_buf callback
+    )
+{
+    nanoev_tcp *tcp = (nanoev_tcp*)event;
+    void *space;
+    int ret_code;
+
+    ASSERT(tcp);
+    ASSERT(tcp->type == nanoev_event_tcp);
+    ASSERT(in_loop_thread(tcp->loop));
+
+    if (!buf || !len || !callback)
+        return NANOEV_ERROR_INVALID_ARG;
+    if (tcp->flags & NANOEV_TCP_FLAG_READING)
+        return NANOEV_ERROR_ACCESS_DENIED;
+    if (tcp_buf_io_alloc(tcp))
+        return NANOEV_ERROR_OUT_OF_MEMORY;
+
+    space = nanoev_buf_reserve(buf, len);
+    if (!space)
+        return NANOEV_ERROR_OUT_OF_MEMORY;
 
+    ret_code = nanoev_tcp_read(event, space, len, timeout, tcp_on_read_buf);
+    if (ret_code != NANOEV_SUCCESS)
+        return ret_code;
+
+    tcp->buf_io->read_buf = buf;
+    tcp->buf_io->on_read_buf = callback;
     return NANOEV_SUCCESS;
 }
 
@@ -682,9 +1053,96 @@ int nanoev_tcp_set_keepalive(
     return tcp_set_int_option(tcp, SOL_SOCKET, SO_KEEPALIVE, enabled ? 1 : 0);
 }
 
-/*----------------------------------------------------------------------------*/
+int nanoev_tcp_set_busy_poll(
+    nanoev_event *event,
+    unsigned int usec
+    )
+{
+    nanoev_tcp *tcp = (nanoev_tcp*)event;
 
-void tcp_proactor_callback(nanoev_proactor *proactor, io_context *ctx)
+    ASSERT(tcp);
+    ASSERT(tcp->type == nanoev_event_tcp);
+    ASSERT(in_loop_thread(tcp->loop));
+
+    if (tcp->sock == INVALID_SOCKET || tcp->flags & NANOEV_TCP_FLAG_DELETED)
+        return NANOEV_ERROR_ACCESS_DENIED;
+
+    /* an unsupported or unprivileged busy-poll request leaves the socket usable */
+    return set_busy_poll(tcp->sock, usec) ? NANOEV_SUCCESS : NANOEV_ERROR_FAIL;
+}
+
+int nanoev_tcp_set_zerocopy(
+    nanoev_event *event,
+    unsigned int threshold
+    )
+{
+    nanoev_tcp *tcp = (nanoev_tcp*)event;
+#ifdef NANOEV_TCP_ZEROCOPY
+    int enabled = threshold ? 1 : 0;
+    int events;
+#endif
+
+    ASSERT(tcp);
+    ASSERT(tcp->type == nanoev_event_tcp);
+    ASSERT(in_loop_thread(tcp->loop));
+
+    if (tcp->sock == INVALID_SOCKET
+        || tcp->flags & NANOEV_TCP_FLAG_ERROR
+        || tcp->flags & NANOEV_TCP_FLAG_DELETED
+        || !(tcp->flags & NANOEV_TCP_FLAG_CONNECTED)
+        || tcp->flags & NANOEV_TCP_FLAG_ZEROCOPY
+        )
+        return NANOEV_ERROR_ACCESS_DENIED;
+
+#ifdef NANOEV_TCP_ZEROCOPY
+    /* A kernel without SO_ZEROCOPY rejects the option; the connection stays usable. */
+    if (0 != setsockopt(tcp->sock, SOL_SOCKET, SO_ZEROCOPY, &enabled, sizeof(enabled)))
+        return NANOEV_ERROR_FAIL;
+
+    /* Completion notifications arrive on the error queue and are reported as EPOLLERR. */
+    events = enabled ? (tcp->reactor_events | _EV_ERROR) : (tcp->reactor_events & ~_EV_ERROR);
+    if (0 != register_proactor(tcp->loop, (nanoev_proactor*)tcp, tcp->sock, events)) {
+        tcp->flags |= NANOEV_TCP_FLAG_ERROR;
+        tcp->error_code = errno;
+        return NANOEV_ERROR_FAIL;
+    }
+
+    tcp->zerocopy_threshold = threshold;
+    return NANOEV_SUCCESS;
+#else
+    (void)threshold;
+    return NANOEV_ERROR_FAIL;
+#endif
+}
+
+int nanoev_tcp_zerocopy_stats(
+    nanoev_event *event,
+    unsigned int *completions,
+    unsigned int *copied
+    )
+{
+    nanoev_tcp *tcp = (nanoev_tcp*)event;
+
+    ASSERT(tcp);
+    ASSERT(tcp->type == nanoev_event_tcp);
+    ASSERT(in_loop_thread(tcp->loop));
+
+    if (!completions || !copied)
+        return NANOEV_ERROR_INVALID_ARG;
+
+#ifdef NANOEV_TCP_ZEROCOPY
+    *completions = tcp->zerocopy_completions;
+    *copied = tcp->zerocopy_copied;
+#else
+    *completions = 0;
+    *copied = 0;
+#endif
+    return NANOEV_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+
+void tcp_proactor_callback(nanoev_proactor *proactor, io_context *ctx)
 {
     nanoev_tcp *tcp = (nanoev_tcp*)proactor;
     nanoev_tcp_on_write on_write;
@@ -738,6 +1196,18 @@ void tcp_proactor_callback(nanoev_proactor *proactor, io_context *ctx)
                 tcp->error_code = socket_timeout_error();
                 return;
             }
+#ifdef _WIN32
+            if (tcp->on_read && !(tcp->flags & NANOEV_TCP_FLAG_DELETED)) {
+                /* continue a partial read_exact / read_until with another receive */
+                tcp->read_done += bytes;
+                if (status == 0 && bytes && !tcp_read_satisfied(tcp)) {
+                    if (!tcp_recv(tcp))
+                        return;
+                    status = tcp->error_code;
+                }
+                bytes = tcp->read_done;
+            }
+#endif
             tcp->flags &= ~NANOEV_TCP_FLAG_READING;
             on_read = tcp->on_read;
             tcp->on_read = NULL;
@@ -753,6 +1223,7 @@ void tcp_proactor_callback(nanoev_proactor *proactor, io_context *ctx)
                 return;
             }
             if (!(tcp->flags & NANOEV_TCP_FLAG_DELETED)) {
+                TRACE_TCP_READ((nanoev_event*)tcp, status, bytes);
                 on_read((nanoev_event*)tcp, status, tcp->buf_read.buf, bytes);
             }
 
@@ -783,6 +1254,7 @@ void tcp_proactor_callback(nanoev_proactor *proactor, io_context *ctx)
                 return;
             }
             if (!(tcp->flags & NANOEV_TCP_FLAG_DELETED)) {
+                TRACE_TCP_WRITE((nanoev_event*)tcp, status, bytes);
                 on_write((nanoev_event*)tcp, status, tcp->buf_write.buf, bytes);
             }
         }
@@ -871,6 +1343,7 @@ void tcp_proactor_callback(nanoev_proactor *proactor, io_context *ctx)
                     }
                 }
 
+                TRACE_TCP_ACCEPT((nanoev_event*)tcp, status, (nanoev_event*)tcp_new);
                 on_accept((nanoev_event*)tcp, status, (nanoev_event*)tcp_new);
 
             } else {
@@ -926,6 +1399,7 @@ void tcp_proactor_callback(nanoev_proactor *proactor, io_context *ctx)
                 #endif
                 }
 
+                TRACE_TCP_CONNECT((nanoev_event*)tcp, status);
                 on_connect((nanoev_event*)tcp, status);
             }
         }
@@ -990,9 +1464,11 @@ static void tcp_timeout_read_callback(nanoev_timer_node *node)
 
     if (!(tcp->flags & NANOEV_TCP_FLAG_DELETED)) {
         if (on_accept) {
+            TRACE_TCP_ACCEPT((nanoev_event*)tcp, status, NULL);
             on_accept((nanoev_event*)tcp, status, NULL);
         } else if (on_read) {
-            on_read((nanoev_event*)tcp, status, tcp->buf_read.buf, 0);
+            TRACE_TCP_READ((nanoev_event*)tcp, status, tcp->read_done);
+            on_read((nanoev_event*)tcp, status, tcp->buf_read.buf, tcp->read_done);
         }
     }
 }
@@ -1049,7 +1525,7 @@ static void tcp_timeout_write_callback(nanoev_timer_node *node)
     if (tcp->reactor_events & _EV_WRITE) {
         register_proactor(tcp->loop, (nanoev_proactor*)tcp, tcp->sock, tcp->reactor_events & ~_EV_WRITE);
     }
-    tcp->flags &= ~NANOEV_TCP_FLAG_WRITING;
+    tcp->flags &= ~(NANOEV_TCP_FLAG_WRITING | NANOEV_TCP_FLAG_ZEROCOPY);
 #endif
 
     if (tcp->sock != INVALID_SOCKET) {
@@ -1058,13 +1534,167 @@ static void tcp_timeout_write_callback(nanoev_timer_node *node)
 
     if (!(tcp->flags & NANOEV_TCP_FLAG_DELETED)) {
         if (on_connect) {
+            TRACE_TCP_CONNECT((nanoev_event*)tcp, status);
             on_connect((nanoev_event*)tcp, status);
         } else if (on_write) {
+            TRACE_TCP_WRITE((nanoev_event*)tcp, status, 0);
             on_write((nanoev_event*)tcp, status, tcp->buf_write.buf, 0);
         }
     }
 }
 
+tcp_connector* tcp_get_connector(nanoev_event *event)
+{
+    nanoev_tcp *tcp = (nanoev_tcp*)event;
+
+    ASSERT(tcp->type == nanoev_event_tcp);
+    return tcp->connector;
+}
+
+void tcp_set_connector(nanoev_event *event, tcp_connector *connector)
+{
+    nanoev_tcp *tcp = (nanoev_tcp*)event;
+
+    ASSERT(tcp->type == nanoev_event_tcp);
+    tcp->connector = connector;
+}
+
+tcp_fanout_sub* tcp_get_fanout_sub(nanoev_event *event)
+{
+    nanoev_tcp *tcp = (nanoev_tcp*)event;
+
+    ASSERT(tcp->type == nanoev_event_tcp);
+    return tcp->fanout_sub;
+}
+
+void tcp_set_fanout_sub(nanoev_event *event, tcp_fanout_sub *sub)
+{
+    nanoev_tcp *tcp = (nanoev_tcp*)event;
+
+    ASSERT(tcp->type == nanoev_event_tcp);
+    tcp->fanout_sub = sub;
+}
+
+tcp_framer* tcp_get_framer(nanoev_event *event)
+{
+    nanoev_tcp *tcp = (nanoev_tcp*)event;
+
+    ASSERT(tcp->type == nanoev_event_tcp);
+    return tcp->framer;
+}
+
+void tcp_set_framer(nanoev_event *event, tcp_framer *framer)
+{
+    nanoev_tcp *tcp = (nanoev_tcp*)event;
+
+    ASSERT(tcp->type == nanoev_event_tcp);
+    tcp->framer = framer;
+}
+
+tcp_pool_entry* tcp_get_pool_entry(nanoev_event *event)
+{
+    nanoev_tcp *tcp = (nanoev_tcp*)event;
+
+    ASSERT(tcp->type == nanoev_event_tcp);
+    return tcp->pool_entry;
+}
+
+void tcp_set_pool_entry(nanoev_event *event, tcp_pool_entry *entry)
+{
+    nanoev_tcp *tcp = (nanoev_tcp*)event;
+
+    ASSERT(tcp->type == nanoev_event_tcp);
+    tcp->pool_entry = entry;
+}
+
+int tcp_has_socket(nanoev_event *event)
+{
+    nanoev_tcp *tcp = (nanoev_tcp*)event;
+
+    ASSERT(tcp->type == nanoev_event_tcp);
+    return tcp->sock != INVALID_SOCKET;
+}
+
+void tcp_reset(nanoev_event *event)
+{
+    nanoev_tcp *tcp = (nanoev_tcp*)event;
+
+    ASSERT(tcp->type == nanoev_event_tcp);
+    ASSERT(!(tcp->flags & (NANOEV_TCP_FLAG_READING | NANOEV_TCP_FLAG_WRITING)));
+
+    /* closing the socket also drops it from the poller */
+    if (tcp->sock != INVALID_SOCKET) {
+        close_tcp_socket(tcp);
+    }
+    tcp->reactor_events = 0;
+    tcp->flags &= ~(NANOEV_TCP_FLAG_CONNECTED | NANOEV_TCP_FLAG_ERROR);
+    tcp->error_code = 0;
+}
+
+#ifndef _WIN32
+int tcp_adopt(nanoev_event *dst_event, nanoev_event *src_event)
+{
+    nanoev_tcp *dst = (nanoev_tcp*)dst_event;
+    nanoev_tcp *src = (nanoev_tcp*)src_event;
+
+    ASSERT(dst->type == nanoev_event_tcp && src->type == nanoev_event_tcp);
+    ASSERT(dst->loop == src->loop);
+    ASSERT(dst->sock == INVALID_SOCKET);
+    ASSERT(src->flags & NANOEV_TCP_FLAG_CONNECTED);
+    ASSERT(!(src->flags & (NANOEV_TCP_FLAG_READING | NANOEV_TCP_FLAG_WRITING)));
+
+    if (register_proactor(src->loop, (nanoev_proactor*)src, src->sock, 0))
+        return NANOEV_ERROR_FAIL;
+
+    dst->family = src->family;
+    dst->sock = src->sock;
+    src->sock = INVALID_SOCKET;
+    src->flags &= ~NANOEV_TCP_FLAG_CONNECTED;
+
+    dst->reactor_events = 0;
+    dst->flags &= ~NANOEV_TCP_FLAG_ERROR;
+    dst->error_code = 0;
+    if (register_proactor(dst->loop, (nanoev_proactor*)dst, dst->sock, _EV_READ)) {
+        close_tcp_socket(dst);
+        return NANOEV_ERROR_FAIL;
+    }
+    dst->flags |= NANOEV_TCP_FLAG_CONNECTED;
+
+    return NANOEV_SUCCESS;
+}
+#endif
+
+int tcp_check_idle(nanoev_event *event)
+{
+    nanoev_tcp *tcp = (nanoev_tcp*)event;
+#ifdef _WIN32
+    fd_set rfds;
+    struct timeval tv = { 0, 0 };
+#else
+    struct pollfd pfd;
+#endif
+
+    ASSERT(tcp->type == nanoev_event_tcp);
+
+    if (tcp->sock == INVALID_SOCKET
+        || !(tcp->flags & NANOEV_TCP_FLAG_CONNECTED)
+        || tcp->flags & (NANOEV_TCP_FLAG_READING | NANOEV_TCP_FLAG_WRITING)
+        || tcp->flags & (NANOEV_TCP_FLAG_ERROR | NANOEV_TCP_FLAG_DELETED))
+        return 0;
+
+    /* an idle connection has nothing to read; EOF, RST or stray data all make it readable */
+#ifdef _WIN32
+    FD_ZERO(&rfds);
+    FD_SET(tcp->sock, &rfds);
+    return select(0, &rfds, NULL, NULL, &tv) == 0;
+#else
+    pfd.fd = tcp->sock;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    return poll(&pfd, 1, 0) == 0;
+#endif
+}
+
 nanoev_tcp* tcp_alloc_client(nanoev_loop *loop, void *userdata, int family, SOCKET socket)
 {
     nanoev_tcp *tcp = (nanoev_tcp*)tcp_new(loop, userdata);
@@ -1091,7 +1721,9 @@ nanoev_tcp* tcp_alloc_client(nanoev_loop *loop, void *userdata, int family, SOCK
     }
 
     tcp->flags |= NANOEV_TCP_FLAG_CONNECTED;
-    
+    /* the caller frees it with nanoev_event_free(), which uncounts it */
+    loop_count_event(loop, nanoev_event_tcp, 1);
+
     return tcp;
 }
 
@@ -1101,25 +1733,42 @@ static io_context* reactor_cb(nanoev_proactor *proactor, int events)
 {
     nanoev_tcp *tcp = (nanoev_tcp*)proactor;
 
-    if (events == _EV_READ) {
+    if (events == _EV_ERROR) {
+#ifdef NANOEV_TCP_ZEROCOPY
+        /* the pending MSG_ZEROCOPY write has been released by the kernel */
+        if (tcp_zerocopy_reap(tcp)) {
+            tcp->flags &= ~NANOEV_TCP_FLAG_ZEROCOPY;
+            return &(tcp->ctx_write);
+        }
+#endif
+        return NULL;
+
+    } else if (events == _EV_READ) {
         if (!(tcp->flags & NANOEV_TCP_FLAG_READING)) {
             return NULL;
         }
 
         if (tcp->flags & NANOEV_TCP_FLAG_CONNECTED) {
-            /* read */
-            int ret = read(tcp->sock, tcp->buf_read.buf, tcp->buf_read.len);
-            if (ret >= 0) {
+            /* read, completing only once the pending read is satisfied */
+            int ret = tcp->read_vec_count ? tcp_read_vec(tcp)
+                : read(tcp->sock, tcp->buf_read.buf + tcp->read_done, tcp->buf_read.len - tcp->read_done);
+            if (ret > 0) {
+                tcp->read_done += ret;
+                if (!tcp_read_satisfied(tcp)) {
+                    /* short read: the socket is drained, the poller reports the rest */
+                    return NULL;
+                }
+                tcp->ctx_read.status = 0;
+            } else if (ret == 0) {
                 tcp->ctx_read.status = 0;
-                tcp->ctx_read.bytes = ret;
             } else {
                 ASSERT(ret == -1);
                 if (socket_would_block(errno)) {
                     return NULL;
                 }
                 tcp->ctx_read.status = errno;
-                tcp->ctx_read.bytes = 0;
             }
+            tcp->ctx_read.bytes = tcp->read_done;
             return &(tcp->ctx_read);
 
         } else {
@@ -1156,10 +1805,19 @@ static io_context* reactor_cb(nanoev_proactor *proactor, int events)
 
         if (tcp->flags & NANOEV_TCP_FLAG_CONNECTED) {
             /* write */
-            int ret = write(tcp->sock, tcp->buf_write.buf, tcp->buf_write.len);
+            int ret;
+            if (tcp->flags & NANOEV_TCP_FLAG_ZEROCOPY) {
+                return NULL;
+            }
+            ret = tcp_write_some(tcp);
             if (ret > 0) {
                 tcp->ctx_write.status = 0;
                 tcp->ctx_write.bytes = ret;
+                if (tcp->flags & NANOEV_TCP_FLAG_ZEROCOPY) {
+                    /* stop polling for writability until the notification arrives */
+                    register_proactor(tcp->loop, proactor, tcp->sock, tcp->reactor_events & ~_EV_WRITE);
+                    return NULL;
+                }
             } else {
                 ASSERT(ret == -1);
                 if (socket_would_block(errno)) {
@@ -1187,6 +1845,307 @@ static io_context* reactor_cb(nanoev_proactor *proactor, int events)
 }
 #endif
 
+static int tcp_buf_io_alloc(nanoev_tcp *tcp)
+{
+    if (!tcp->buf_io) {
+        tcp->buf_io = (tcp_buf_io*)mem_alloc(sizeof(tcp_buf_io));
+        if (!tcp->buf_io)
+            return -1;
+        memset(tcp->buf_io, 0, sizeof(tcp_buf_io));
+    }
+    return 0;
+}
+
+static int tcp_write_buf_next(nanoev_tcp *tcp)
+{
+    tcp_buf_io *io = tcp->buf_io;
+
+    tcp->write_vec_count = buf_fill_iov(io->write_buf, io->write_done, io->vec, TCP_MAX_IOV);
+    ASSERT(tcp->write_vec_count);
+    tcp->buf_write = io->vec[0];
+
+    return tcp_start_write(tcp, io->write_has_timeout ? &io->write_timeout : NULL,
+        tcp_on_write_buf);
+}
+
+static void tcp_on_write_buf(nanoev_event *event, int status, void *data, unsigned int bytes)
+{
+    nanoev_tcp *tcp = (nanoev_tcp*)event;
+    tcp_buf_io *io = tcp->buf_io;
+    nanoev_tcp_on_write_buf callback;
+    nanoev_buf *buf = io->write_buf;
+
+    (void)data;
+
+    /* keep going until the whole chain is written; the timeout covers each send */
+    io->write_done += bytes;
+    if (status == 0 && io->write_done < nanoev_buf_len(buf)) {
+        if (tcp_write_buf_next(tcp) == NANOEV_SUCCESS)
+            return;
+        status = tcp->error_code;
+    }
+
+    callback = io->on_write_buf;
+    io->on_write_buf = NULL;
+    io->write_buf = NULL;
+    callback(event, status, buf, io->write_done);
+    nanoev_buf_unref(buf);
+}
+
+static void tcp_on_read_buf(nanoev_event *event, int status, void *data, unsigned int bytes)
+{
+    nanoev_tcp *tcp = (nanoev_tcp*)event;
+    nanoev_tcp_on_read_buf callback = tcp->buf_io->on_read_buf;
+    nanoev_buf *buf = tcp->buf_io->read_buf;
+
+    (void)data;
+
+    tcp->buf_io->on_read_buf = NULL;
+    tcp->buf_io->read_buf = NULL;
+    nanoev_buf_commit(buf, bytes);
+    callback(event, status, buf, bytes);
+}
+
+static int tcp_start_read(
+    nanoev_tcp *tcp,
+    void *buf,
+    unsigned int len,
+    unsigned int done,
+    unsigned int vec_count,
+    const nanoev_timeval *timeout,
+    nanoev_tcp_on_read callback
+    )
+{
+    if (timeout && (timeout->tv_sec < 0 || timeout->tv_usec < 0 || timeout->tv_usec >= 1000000))
+        return NANOEV_ERROR_INVALID_ARG;
+    if (tcp->sock == INVALID_SOCKET
+        || tcp->flags & NANOEV_TCP_FLAG_ERROR
+        || tcp->flags & NANOEV_TCP_FLAG_DELETED
+        || !(tcp->flags & NANOEV_TCP_FLAG_CONNECTED)
+        || tcp->flags & NANOEV_TCP_FLAG_READING
+        )
+        return NANOEV_ERROR_ACCESS_DENIED;
+
+    tcp->buf_read.buf = (char*)buf;
+    tcp->buf_read.len = len;
+    tcp->read_done = done;
+    tcp->read_vec_count = vec_count;
+
+#ifdef _WIN32
+    if (tcp_recv(tcp))
+        return NANOEV_ERROR_FAIL;
+#endif
+
+    if (timeout) {
+        int ret_code = tcp_timeout_add(tcp, &tcp->timeout_read, NANOEV_TCP_TIMEOUT_READ, timeout);
+        if (ret_code != NANOEV_SUCCESS) {
+            tcp->flags |= NANOEV_TCP_FLAG_ERROR;
+            tcp->error_code = ENOMEM;
+            return NANOEV_ERROR_FAIL;
+        }
+    }
+
+    tcp->flags |= NANOEV_TCP_FLAG_READING;
+    tcp->on_read = callback;
+
+    return NANOEV_SUCCESS;
+}
+
+#ifdef _WIN32
+/* Post a receive for the rest of buf_read, or for all of read_vec. */
+static int tcp_recv(nanoev_tcp *tcp)
+{
+    io_buf rest, *vec = &rest;
+    DWORD cb, count = 1, flags = 0;
+
+    if (tcp->read_vec_count) {
+        vec = tcp->read_vec;
+        count = tcp->read_vec_count;
+    } else {
+        rest.buf = tcp->buf_read.buf + tcp->read_done;
+        rest.len = tcp->buf_read.len - tcp->read_done;
+    }
+    memset(&tcp->ctx_read, 0, sizeof(io_context));
+
+    if (0 != WSARecv(tcp->sock, vec, count, &cb, &flags, &tcp->ctx_read, NULL)
+        && WSA_IO_PENDING != WSAGetLastError()
+        ) {
+        tcp->flags |= NANOEV_TCP_FLAG_ERROR;
+        tcp->error_code = WSAGetLastError();
+        return -1;
+    }
+    return 0;
+}
+#endif
+
+static int tcp_read_ext_alloc(nanoev_tcp *tcp)
+{
+    if (!tcp->read_ext) {
+        tcp->read_ext = (tcp_read_ext*)mem_alloc(sizeof(tcp_read_ext));
+        if (!tcp->read_ext)
+            return -1;
+        memset(tcp->read_ext, 0, sizeof(tcp_read_ext));
+    }
+    return 0;
+}
+
+/* A plain read completes on any bytes. */
+static void tcp_read_ext_clear(nanoev_tcp *tcp)
+{
+    if (tcp->read_ext) {
+        tcp->read_ext->min = 0;
+        tcp->read_ext->delim_len = 0;
+    }
+}
+
+/* Called with new bytes in buf_read: may the pending read complete now? */
+static int tcp_read_satisfied(nanoev_tcp *tcp)
+{
+    tcp_read_ext *ext = tcp->read_ext;
+    const char *found;
+
+    if (!ext)
+        return 1;
+    if (ext->delim_len) {
+        found = tcp_find_delim(tcp->buf_read.buf + ext->scan, tcp->read_done - ext->scan,
+            ext->delim, ext->delim_len);
+        if (found) {
+            ext->found = (unsigned int)(found - tcp->buf_read.buf) + ext->delim_len;
+            return 1;
+        }
+        /* the last delim_len - 1 bytes may start a delimiter */
+        if (tcp->read_done - ext->scan >= ext->delim_len)
+            ext->scan = tcp->read_done - (ext->delim_len - 1);
+    } else if (tcp->read_done >= ext->min) {
+        return 1;
+    }
+    return tcp->read_done == tcp->buf_read.len;
+}
+
+/* memchr() for the first byte does the scanning; libc vectorizes it. */
+static const char* tcp_find_delim(
+    const char *buf,
+    unsigned int len,
+    const char *delim,
+    unsigned int delim_len
+    )
+{
+    const char *p = buf, *end = buf + len;
+
+    while ((unsigned int)(end - p) >= delim_len) {
+        p = (const char*)memchr(p, delim[0], (end - p) - (delim_len - 1));
+        if (!p)
+            return NULL;
+        if (delim_len == 1 || 0 == memcmp(p + 1, delim + 1, delim_len - 1))
+            return p;
+        p++;
+    }
+    return NULL;
+}
+
+static void tcp_on_read_until(nanoev_event *event, int status, void *buf, unsigned int bytes)
+{
+    nanoev_tcp *tcp = (nanoev_tcp*)event;
+    tcp_read_ext *ext = tcp->read_ext;
+    nanoev_tcp_on_read_until callback = ext->on_read_until;
+
+    ext->on_read_until = NULL;
+    ext->delim_len = 0;
+    callback(event, status, buf, bytes, ext->found);
+}
+
+#ifndef _WIN32
+static int tcp_write_some(nanoev_tcp *tcp)
+{
+    struct iovec iov[TCP_MAX_IOV];
+    unsigned int i;
+
+#ifdef NANOEV_TCP_ZEROCOPY
+    if (tcp->zerocopy_threshold && tcp->write_vec_count == 1
+        && tcp->buf_write.len >= tcp->zerocopy_threshold) {
+        int ret = send(tcp->sock, tcp->buf_write.buf, tcp->buf_write.len, MSG_ZEROCOPY);
+        if (ret > 0) {
+            /* every successful MSG_ZEROCOPY send consumes one notification id */
+            tcp->zerocopy_pending_id = tcp->zerocopy_next_id++;
+            tcp->flags |= NANOEV_TCP_FLAG_ZEROCOPY;
+            return ret;
+        }
+        if (errno != ENOBUFS) {
+            return ret;
+        }
+        /* out of optmem for notifications, fall back to a copying write */
+    }
+#endif
+    if (tcp->write_vec_count == 1)
+        return write(tcp->sock, tcp->buf_write.buf, tcp->buf_write.len);
+
+    ASSERT(tcp->write_vec_count <= TCP_MAX_IOV);
+    for (i = 0; i < tcp->write_vec_count; i++) {
+        iov[i].iov_base = tcp->buf_io->vec[i].buf;
+        iov[i].iov_len = tcp->buf_io->vec[i].len;
+    }
+    return writev(tcp->sock, iov, (int)tcp->write_vec_count);
+}
+
+static int tcp_read_vec(nanoev_tcp *tcp)
+{
+    struct iovec iov[TCP_MAX_IOV];
+    unsigned int i;
+
+    ASSERT(tcp->read_vec_count <= TCP_MAX_IOV);
+    for (i = 0; i < tcp->read_vec_count; i++) {
+        iov[i].iov_base = tcp->read_vec[i].buf;
+        iov[i].iov_len = tcp->read_vec[i].len;
+    }
+    return readv(tcp->sock, iov, (int)tcp->read_vec_count);
+}
+
+#ifdef NANOEV_TCP_ZEROCOPY
+static int tcp_zerocopy_reap(nanoev_tcp *tcp)
+{
+    char control[128];
+    struct msghdr msg;
+    struct cmsghdr *cm;
+    struct sock_extended_err *serr;
+    unsigned int count;
+    int done = 0;
+
+    while (1) {
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        if (recvmsg(tcp->sock, &msg, MSG_ERRQUEUE) < 0) {
+            break;
+        }
+
+        for (cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+            if (!(cm->cmsg_level == IPPROTO_IP && cm->cmsg_type == IP_RECVERR)
+                && !(cm->cmsg_level == IPPROTO_IPV6 && cm->cmsg_type == IPV6_RECVERR)) {
+                continue;
+            }
+            serr = (struct sock_extended_err*)CMSG_DATA(cm);
+            if (serr->ee_errno != 0 || serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+                continue;
+            }
+
+            /* [ee_info, ee_data] is an inclusive range of notification ids */
+            count = serr->ee_data - serr->ee_info + 1;
+            tcp->zerocopy_completions += count;
+            if (serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+                tcp->zerocopy_copied += count;
+            }
+            if ((tcp->flags & NANOEV_TCP_FLAG_ZEROCOPY)
+                && tcp->zerocopy_pending_id - serr->ee_info < count) {
+                done = 1;
+            }
+        }
+    }
+
+    return done;
+}
+#endif
+#endif
+
 static int create_tcp_socket(nanoev_tcp *tcp, int family)
 {
     int error_code = 0;
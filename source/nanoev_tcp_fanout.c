@@ -0,0 +1,453 @@
+#include "nanoev_internal.h"
+
+/*----------------------------------------------------------------------------*/
+
+/*
+ * Broadcast to many TCP connections.
+ *
+ * Every subscriber has a queue, a nanoev_buf that takes zero-copy slices of
+ * the published payloads. publish() only appends to the queues and puts idle
+ * subscribers on a dirty list; a zero-delay timer then hands each dirty queue
+ * to nanoev_tcp_write_buf() as one gathered write. While that write is
+ * pending new messages collect in a fresh queue, which fanout_on_write()
+ * sends as the next batch.
+ *
+ * The subscription hangs off the tcp event (tcp_get_fanout_sub()), which is
+ * how the write callback finds it and how nanoev_event_free() unsubscribes.
+ * A removed subscriber with a write pending is parked on the removed list
+ * until the write completes, so that the callback still finds it.
+ */
+
+struct tcp_fanout_sub {
+    tcp_fanout_sub *prev;               /* fanout->subs or fanout->removed */
+    tcp_fanout_sub *next;
+    tcp_fanout_sub *dirty_prev;         /* fanout->dirty, when dirty is set */
+    tcp_fanout_sub *dirty_next;
+    nanoev_tcp_fanout *fanout;
+    nanoev_event *tcp;
+    nanoev_buf *queue;                  /* published, not yet written */
+    unsigned int queued;                /* queue length */
+    unsigned int inflight;              /* bytes in the pending write */
+    int dirty;
+    int dropping;                       /* on_drop is due */
+    int drop_status;
+    int removed;
+};
+
+struct nanoev_tcp_fanout {
+    nanoev_loop *loop;
+    unsigned int max_queued_bytes;
+    int policy;
+    nanoev_tcp_fanout_on_drop on_drop;
+    void *userdata;
+    nanoev_event *flusher;              /* drains the dirty list */
+    int flush_armed;
+    int flushing;
+    int freed;
+    tcp_fanout_sub *subs;
+    tcp_fanout_sub *removed;            /* unsubscribed, write still pending */
+    tcp_fanout_sub *dirty_head;
+    tcp_fanout_sub *dirty_tail;
+    nanoev_tcp_fanout_stats stats;
+};
+
+static void fanout_destroy(nanoev_tcp_fanout *fanout);
+static void fanout_link(tcp_fanout_sub **list, tcp_fanout_sub *sub);
+static void fanout_unlink(tcp_fanout_sub **list, tcp_fanout_sub *sub);
+static void fanout_mark_dirty(nanoev_tcp_fanout *fanout, tcp_fanout_sub *sub);
+static void fanout_clear_dirty(nanoev_tcp_fanout *fanout, tcp_fanout_sub *sub);
+static void fanout_detach(nanoev_tcp_fanout *fanout, tcp_fanout_sub *sub);
+static void fanout_drop(nanoev_tcp_fanout *fanout, tcp_fanout_sub *sub, int status);
+static int  fanout_flush(nanoev_tcp_fanout *fanout, tcp_fanout_sub *sub);
+static void fanout_on_write(nanoev_event *tcp, int status, nanoev_buf *buf, unsigned int bytes);
+static void fanout_on_flush(nanoev_event *timer);
+
+/*----------------------------------------------------------------------------*/
+
+nanoev_tcp_fanout* nanoev_tcp_fanout_new(
+    nanoev_loop *loop,
+    unsigned int max_queued_bytes,
+    int policy,
+    nanoev_tcp_fanout_on_drop on_drop,
+    void *userdata
+    )
+{
+    nanoev_tcp_fanout *fanout;
+
+    ASSERT(loop);
+    ASSERT(in_loop_thread(loop));
+
+    if (policy != NANOEV_FANOUT_DROP_SUBSCRIBER && policy != NANOEV_FANOUT_DROP_MESSAGE)
+        return NULL;
+
+    fanout = (nanoev_tcp_fanout*)mem_alloc(sizeof(nanoev_tcp_fanout));
+    if (!fanout)
+        return NULL;
+    memset(fanout, 0, sizeof(nanoev_tcp_fanout));
+
+    fanout->loop = loop;
+    fanout->max_queued_bytes = max_queued_bytes;
+    fanout->policy = policy;
+    fanout->on_drop = on_drop;
+    fanout->userdata = userdata;
+
+    fanout->flusher = nanoev_event_new(nanoev_event_timer, loop, fanout);
+    if (!fanout->flusher) {
+        mem_free(fanout);
+        return NULL;
+    }
+
+    return fanout;
+}
+
+void nanoev_tcp_fanout_free(
+    nanoev_tcp_fanout *fanout
+    )
+{
+    ASSERT(fanout);
+    ASSERT(in_loop_thread(fanout->loop));
+    ASSERT(!fanout->freed);
+
+    if (fanout->flushing) {
+        /* fanout_on_flush() finishes the job */
+        fanout->freed = 1;
+        return;
+    }
+    fanout_destroy(fanout);
+}
+
+int nanoev_tcp_fanout_add(
+    nanoev_tcp_fanout *fanout,
+    nanoev_event *tcp
+    )
+{
+    tcp_fanout_sub *sub;
+
+    ASSERT(fanout);
+    ASSERT(in_loop_thread(fanout->loop));
+
+    if (!tcp || tcp->type != nanoev_event_tcp || tcp->loop != fanout->loop)
+        return NANOEV_ERROR_INVALID_ARG;
+    if (fanout->freed)
+        return NANOEV_ERROR_ACCESS_DENIED;
+
+    sub = tcp_get_fanout_sub(tcp);
+    if (sub) {
+        if (sub->fanout != fanout || !sub->removed)
+            return NANOEV_ERROR_ACCESS_DENIED;
+        /* back before its last write completed */
+        fanout_unlink(&fanout->removed, sub);
+        sub->removed = 0;
+    } else {
+        sub = (tcp_fanout_sub*)mem_alloc(sizeof(tcp_fanout_sub));
+        if (!sub)
+            return NANOEV_ERROR_OUT_OF_MEMORY;
+        memset(sub, 0, sizeof(tcp_fanout_sub));
+        sub->fanout = fanout;
+        sub->tcp = tcp;
+        tcp_set_fanout_sub(tcp, sub);
+    }
+
+    fanout_link(&fanout->subs, sub);
+    fanout->stats.subscribers++;
+    return NANOEV_SUCCESS;
+}
+
+int nanoev_tcp_fanout_remove(
+    nanoev_tcp_fanout *fanout,
+    nanoev_event *tcp
+    )
+{
+    tcp_fanout_sub *sub;
+
+    ASSERT(fanout);
+    ASSERT(in_loop_thread(fanout->loop));
+
+    if (!tcp || tcp->type != nanoev_event_tcp)
+        return NANOEV_ERROR_INVALID_ARG;
+    sub = tcp_get_fanout_sub(tcp);
+    if (!sub || sub->fanout != fanout || sub->removed)
+        return NANOEV_ERROR_INVALID_ARG;
+
+    fanout_detach(fanout, sub);
+    return NANOEV_SUCCESS;
+}
+
+int nanoev_tcp_fanout_publish(
+    nanoev_tcp_fanout *fanout,
+    const nanoev_buf *payload
+    )
+{
+    tcp_fanout_sub *sub;
+    unsigned int len;
+    nanoev_timeval zero = { 0, 0 };
+
+    ASSERT(fanout);
+    ASSERT(in_loop_thread(fanout->loop));
+
+    if (fanout->freed)
+        return NANOEV_ERROR_ACCESS_DENIED;
+    if (!payload || !(len = nanoev_buf_len(payload)))
+        return NANOEV_ERROR_INVALID_ARG;
+
+    fanout->stats.published++;
+
+    for (sub = fanout->subs; sub; sub = sub->next) {
+        if (sub->dropping)
+            continue;
+
+        if (fanout->max_queued_bytes && (sub->queued || sub->inflight)
+            && (unsigned long long)sub->queued + sub->inflight + len > fanout->max_queued_bytes) {
+            if (fanout->policy == NANOEV_FANOUT_DROP_MESSAGE) {
+                fanout->stats.skipped++;
+            } else {
+                sub->dropping = 1;
+                sub->drop_status = 0;
+                fanout_mark_dirty(fanout, sub);
+            }
+            continue;
+        }
+
+        if (!sub->queue)
+            sub->queue = nanoev_buf_new();
+        if (!sub->queue
+            || nanoev_buf_append_buf(sub->queue, payload, 0, len) != NANOEV_SUCCESS) {
+            sub->dropping = 1;
+            sub->drop_status = NANOEV_ERROR_OUT_OF_MEMORY;
+            fanout_mark_dirty(fanout, sub);
+            continue;
+        }
+        sub->queued += len;
+        fanout->stats.deliveries++;
+        fanout->stats.queued_bytes += len;
+        if (!sub->inflight)
+            fanout_mark_dirty(fanout, sub);
+    }
+
+    if (fanout->dirty_head && !fanout->flush_armed && !fanout->flushing) {
+        if (nanoev_timer_add(fanout->flusher, zero, 0, fanout_on_flush) != NANOEV_SUCCESS)
+            return NANOEV_ERROR_OUT_OF_MEMORY;
+        fanout->flush_armed = 1;
+    }
+    return NANOEV_SUCCESS;
+}
+
+void nanoev_tcp_fanout_get_stats(
+    nanoev_tcp_fanout *fanout,
+    nanoev_tcp_fanout_stats *stats
+    )
+{
+    tcp_fanout_sub *sub;
+
+    ASSERT(fanout && stats);
+    ASSERT(in_loop_thread(fanout->loop));
+
+    *stats = fanout->stats;
+    stats->writing = 0;
+    for (sub = fanout->subs; sub; sub = sub->next) {
+        if (sub->inflight)
+            stats->writing++;
+    }
+}
+
+/*----------------------------------------------------------------------------*/
+
+void tcp_fanout_sub_free(tcp_fanout_sub *sub)
+{
+    nanoev_tcp_fanout *fanout = sub->fanout;
+
+    /* the event is being freed; its pending write will not call back */
+    fanout->stats.queued_bytes -= sub->inflight;
+    sub->inflight = 0;
+    if (sub->removed) {
+        fanout_unlink(&fanout->removed, sub);
+        tcp_set_fanout_sub(sub->tcp, NULL);
+        mem_free(sub);
+    } else {
+        fanout_detach(fanout, sub);
+    }
+}
+
+static void fanout_destroy(nanoev_tcp_fanout *fanout)
+{
+    tcp_fanout_sub *sub;
+
+    while ((sub = fanout->subs) != NULL) {
+        fanout->subs = sub->next;
+        tcp_set_fanout_sub(sub->tcp, NULL);
+        nanoev_buf_unref(sub->queue);
+        mem_free(sub);
+    }
+    while ((sub = fanout->removed) != NULL) {
+        fanout->removed = sub->next;
+        tcp_set_fanout_sub(sub->tcp, NULL);
+        mem_free(sub);
+    }
+
+    nanoev_event_free(fanout->flusher);
+    mem_free(fanout);
+}
+
+static void fanout_link(tcp_fanout_sub **list, tcp_fanout_sub *sub)
+{
+    sub->prev = NULL;
+    sub->next = *list;
+    if (*list)
+        (*list)->prev = sub;
+    *list = sub;
+}
+
+static void fanout_unlink(tcp_fanout_sub **list, tcp_fanout_sub *sub)
+{
+    if (sub->prev)
+        sub->prev->next = sub->next;
+    else
+        *list = sub->next;
+    if (sub->next)
+        sub->next->prev = sub->prev;
+    sub->prev = sub->next = NULL;
+}
+
+static void fanout_mark_dirty(nanoev_tcp_fanout *fanout, tcp_fanout_sub *sub)
+{
+    if (sub->dirty)
+        return;
+    sub->dirty = 1;
+    sub->dirty_next = NULL;
+    sub->dirty_prev = fanout->dirty_tail;
+    if (fanout->dirty_tail)
+        fanout->dirty_tail->dirty_next = sub;
+    else
+        fanout->dirty_head = sub;
+    fanout->dirty_tail = sub;
+}
+
+static void fanout_clear_dirty(nanoev_tcp_fanout *fanout, tcp_fanout_sub *sub)
+{
+    if (!sub->dirty)
+        return;
+    if (sub->dirty_prev)
+        sub->dirty_prev->dirty_next = sub->dirty_next;
+    else
+        fanout->dirty_head = sub->dirty_next;
+    if (sub->dirty_next)
+        sub->dirty_next->dirty_prev = sub->dirty_prev;
+    else
+        fanout->dirty_tail = sub->dirty_prev;
+    sub->dirty = 0;
+    sub->dirty_prev = sub->dirty_next = NULL;
+}
+
+static void fanout_detach(nanoev_tcp_fanout *fanout, tcp_fanout_sub *sub)
+{
+    fanout_unlink(&fanout->subs, sub);
+    fanout_clear_dirty(fanout, sub);
+    fanout->stats.subscribers--;
+    fanout->stats.queued_bytes -= sub->queued;
+    nanoev_buf_unref(sub->queue);
+    sub->queue = NULL;
+    sub->queued = 0;
+    sub->dropping = 0;
+
+    if (sub->inflight) {
+        sub->removed = 1;
+        fanout_link(&fanout->removed, sub);
+    } else {
+        tcp_set_fanout_sub(sub->tcp, NULL);
+        mem_free(sub);
+    }
+}
+
+static void fanout_drop(nanoev_tcp_fanout *fanout, tcp_fanout_sub *sub, int status)
+{
+    nanoev_event *tcp = sub->tcp;
+
+    fanout->stats.dropped++;
+    fanout_detach(fanout, sub);
+    if (fanout->on_drop)
+        fanout->on_drop(fanout, tcp, status, fanout->userdata);
+}
+
+static int fanout_flush(nanoev_tcp_fanout *fanout, tcp_fanout_sub *sub)
+{
+    nanoev_buf *batch = sub->queue;
+    int ret_code;
+
+    ASSERT(!sub->inflight && sub->queued);
+
+    /* the socket keeps its own reference until the write completes */
+    ret_code = nanoev_tcp_write_buf(sub->tcp, batch, NULL, fanout_on_write);
+    if (ret_code != NANOEV_SUCCESS)
+        return ret_code;
+
+    sub->queue = NULL;
+    sub->inflight = sub->queued;
+    sub->queued = 0;
+    nanoev_buf_unref(batch);
+    fanout->stats.flushes++;
+    return NANOEV_SUCCESS;
+}
+
+static void fanout_on_write(nanoev_event *tcp, int status, nanoev_buf *buf, unsigned int bytes)
+{
+    tcp_fanout_sub *sub = tcp_get_fanout_sub(tcp);
+    nanoev_tcp_fanout *fanout;
+    int ret_code;
+
+    (void)buf;
+    (void)bytes;
+
+    if (!sub)
+        return;     /* the fanout was freed */
+
+    fanout = sub->fanout;
+    fanout->stats.queued_bytes -= sub->inflight;
+    sub->inflight = 0;
+
+    if (sub->removed) {
+        fanout_unlink(&fanout->removed, sub);
+        tcp_set_fanout_sub(tcp, NULL);
+        mem_free(sub);
+        return;
+    }
+
+    if (status != 0) {
+        fanout_drop(fanout, sub, status);
+        return;
+    }
+
+    /* whatever was published meanwhile goes out as the next batch */
+    if (sub->queued && !sub->dropping) {
+        fanout_clear_dirty(fanout, sub);
+        ret_code = fanout_flush(fanout, sub);
+        if (ret_code != NANOEV_SUCCESS)
+            fanout_drop(fanout, sub, ret_code);
+    }
+}
+
+static void fanout_on_flush(nanoev_event *timer)
+{
+    nanoev_tcp_fanout *fanout = (nanoev_tcp_fanout*)nanoev_event_userdata(timer);
+    tcp_fanout_sub *sub;
+    int ret_code;
+
+    fanout->flush_armed = 0;
+    fanout->flushing = 1;
+
+    /* subscribers dirtied by on_drop callbacks are flushed in this pass too */
+    while (!fanout->freed && (sub = fanout->dirty_head) != NULL) {
+        fanout_clear_dirty(fanout, sub);
+
+        if (sub->dropping) {
+            fanout_drop(fanout, sub, sub->drop_status);
+        } else if (!sub->inflight && sub->queued) {
+            ret_code = fanout_flush(fanout, sub);
+            if (ret_code != NANOEV_SUCCESS)
+                fanout_drop(fanout, sub, ret_code);
+        }
+    }
+
+    fanout->flushing = 0;
+    if (fanout->freed)
+        fanout_destroy(fanout);
+}
@@ -0,0 +1,261 @@
+#include "nanoev_internal.h"
+#include <limits.h>
+
+/*----------------------------------------------------------------------------*/
+
+/*
+ * Length-prefixed framing on top of nanoev_tcp_read().
+ *
+ * Each read asks for all the free space after the buffered bytes, and
+ * framer_dispatch() then hands every complete frame in [start, end) to the
+ * callback as a pointer into the buffer. A trailing partial frame is moved to
+ * the front only when it would not fit behind start, or when the free tail
+ * gets too small to keep reads large; an empty buffer simply rewinds.
+ */
+
+#define FRAMER_DEFAULT_BUFFER  (64 * 1024)
+
+struct tcp_framer {
+    nanoev_event *tcp;
+    nanoev_tcp_framing framing;
+    nanoev_tcp_on_frame callback;
+    char *buf;
+    unsigned int size;
+    unsigned int start;                 /* first unparsed byte */
+    unsigned int end;                   /* one past the last buffered byte */
+    int dispatching;
+    int stopped;
+    int freed;
+};
+
+static void framer_release(tcp_framer *framer);
+static int  framer_frame_size(const tcp_framer *framer, const char *header, unsigned int *size);
+static int  framer_dispatch(tcp_framer *framer);
+static int  framer_read_next(tcp_framer *framer);
+static void framer_fail(tcp_framer *framer, int status);
+static void framer_on_read(nanoev_event *tcp, int status, void *buf, unsigned int bytes);
+
+/*----------------------------------------------------------------------------*/
+
+int nanoev_tcp_read_frames(
+    nanoev_event *event,
+    const nanoev_tcp_framing *framing,
+    nanoev_tcp_on_frame callback
+    )
+{
+    tcp_framer *framer;
+    unsigned int size;
+    int ret_code;
+
+    ASSERT(event);
+    ASSERT(event->type == nanoev_event_tcp);
+    ASSERT(in_loop_thread(event->loop));
+
+    if (!framing || !callback)
+        return NANOEV_ERROR_INVALID_ARG;
+    if (framing->prefix_size != 1 && framing->prefix_size != 2 && framing->prefix_size != 4)
+        return NANOEV_ERROR_INVALID_ARG;
+    if (framing->header_size < framing->prefix_size
+        || framing->max_payload > UINT_MAX - framing->header_size)
+        return NANOEV_ERROR_INVALID_ARG;
+    if (tcp_get_framer(event))
+        return NANOEV_ERROR_ACCESS_DENIED;
+
+    size = framing->buffer_size ? framing->buffer_size : FRAMER_DEFAULT_BUFFER;
+    if (size < framing->header_size)
+        size = framing->header_size;
+
+    framer = (tcp_framer*)mem_alloc(sizeof(tcp_framer));
+    if (!framer)
+        return NANOEV_ERROR_OUT_OF_MEMORY;
+    memset(framer, 0, sizeof(tcp_framer));
+    framer->tcp = event;
+    framer->framing = *framing;
+    framer->callback = callback;
+    framer->size = size;
+    framer->buf = (char*)mem_alloc(size);
+    if (!framer->buf) {
+        mem_free(framer);
+        return NANOEV_ERROR_OUT_OF_MEMORY;
+    }
+
+    tcp_set_framer(event, framer);
+    ret_code = framer_read_next(framer);
+    if (ret_code != NANOEV_SUCCESS) {
+        tcp_set_framer(event, NULL);
+        framer_release(framer);
+    }
+    return ret_code;
+}
+
+int nanoev_tcp_stop_frames(
+    nanoev_event *event
+    )
+{
+    tcp_framer *framer;
+
+    ASSERT(event);
+    ASSERT(event->type == nanoev_event_tcp);
+    ASSERT(in_loop_thread(event->loop));
+
+    framer = tcp_get_framer(event);
+    if (!framer || !framer->dispatching || framer->stopped)
+        return NANOEV_ERROR_ACCESS_DENIED;
+
+    framer->stopped = 1;
+    return NANOEV_SUCCESS;
+}
+
+void tcp_framer_stop(tcp_framer *framer)
+{
+    /*
+     * The event is being freed lazily. A dispatch in progress detaches and
+     * releases the framer once the callback returns; otherwise the buffer
+     * stays until tcp_framer_free(), a pending read may still target it.
+     */
+    framer->stopped = 1;
+}
+
+void tcp_framer_free(tcp_framer *framer)
+{
+    /* freed from the frame callback: framer_dispatch() finishes the job */
+    if (framer->dispatching) {
+        framer->freed = 1;
+        return;
+    }
+    framer_release(framer);
+}
+
+/*----------------------------------------------------------------------------*/
+
+static void framer_release(tcp_framer *framer)
+{
+    mem_free(framer->buf);
+    mem_free(framer);
+}
+
+static int framer_frame_size(const tcp_framer *framer, const char *header, unsigned int *size)
+{
+    const unsigned char *p = (const unsigned char*)header;
+    const nanoev_tcp_framing *framing = &framer->framing;
+    unsigned int value = 0, i;
+
+    for (i = 0; i < framing->prefix_size; i++) {
+        if (framing->little_endian)
+            value |= (unsigned int)p[i] << (8 * i);
+        else
+            value = (value << 8) | p[i];
+    }
+
+    if (framing->length_includes_header) {
+        if (value < framing->header_size)
+            return -1;
+        value -= framing->header_size;
+    }
+    if (value > framing->max_payload)
+        return -1;
+
+    *size = framing->header_size + value;
+    return 0;
+}
+
+/* Returns 0 to keep reading, -1 once the framer has been released. */
+static int framer_dispatch(tcp_framer *framer)
+{
+    unsigned int frame_size = 0, need;
+    char *buf;
+
+    framer->dispatching = 1;
+    while (framer->end - framer->start >= framer->framing.header_size) {
+        if (framer_frame_size(framer, framer->buf + framer->start, &frame_size)) {
+            framer->dispatching = 0;
+            framer_fail(framer, NANOEV_ERROR_FAIL);
+            return -1;
+        }
+        if (framer->end - framer->start < frame_size)
+            break;
+
+        framer->callback(framer->tcp, 0, framer->buf + framer->start, frame_size);
+        framer->start += frame_size;
+        if (framer->freed || framer->stopped)
+            break;
+    }
+    framer->dispatching = 0;
+
+    if (framer->freed) {
+        framer_release(framer);
+        return -1;
+    }
+    if (framer->stopped) {
+        tcp_set_framer(framer->tcp, NULL);
+        framer_release(framer);
+        return -1;
+    }
+
+    if (framer->start == framer->end) {
+        framer->start = framer->end = 0;
+        return 0;
+    }
+
+    /* room for the partial frame, or at least its header */
+    need = framer->end - framer->start >= framer->framing.header_size
+        ? frame_size : framer->framing.header_size;
+    if (need > framer->size) {
+        buf = (char*)mem_realloc(framer->buf, need);
+        if (!buf) {
+            framer_fail(framer, NANOEV_ERROR_OUT_OF_MEMORY);
+            return -1;
+        }
+        framer->buf = buf;
+        framer->size = need;
+    }
+    if (framer->start
+        && (need > framer->size - framer->start || framer->size - framer->end < framer->size / 4)) {
+        memmove(framer->buf, framer->buf + framer->start, framer->end - framer->start);
+        framer->end -= framer->start;
+        framer->start = 0;
+    }
+    return 0;
+}
+
+static int framer_read_next(tcp_framer *framer)
+{
+    return nanoev_tcp_read(framer->tcp, framer->buf + framer->end,
+        framer->size - framer->end, NULL, framer_on_read);
+}
+
+static void framer_fail(tcp_framer *framer, int status)
+{
+    nanoev_event *tcp = framer->tcp;
+    nanoev_tcp_on_frame callback = framer->callback;
+
+    tcp_set_framer(tcp, NULL);
+    framer_release(framer);
+    callback(tcp, status, NULL, 0);
+}
+
+static void framer_on_read(nanoev_event *tcp, int status, void *buf, unsigned int bytes)
+{
+    tcp_framer *framer = tcp_get_framer(tcp);
+    int ret_code;
+
+    (void)buf;
+    ASSERT(framer);
+
+    if (status != 0) {
+        framer_fail(framer, status);
+        return;
+    }
+    if (bytes == 0) {
+        framer_fail(framer, framer->start == framer->end ? 0 : NANOEV_ERROR_FAIL);
+        return;
+    }
+
+    framer->end += bytes;
+    if (framer_dispatch(framer))
+        return;
+
+    ret_code = framer_read_next(framer);
+    if (ret_code != NANOEV_SUCCESS)
+        framer_fail(framer, ret_code);
+}
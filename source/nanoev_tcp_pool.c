@@ -0,0 +1,671 @@
+#include "nanoev_internal.h"
+
+/*----------------------------------------------------------------------------*/
+
+/*
+ * Outbound connection pool.
+ *
+ * Connections are grouped by server address into targets. Each target keeps
+ * its idle connections on a LIFO list and its waiting acquires on a FIFO
+ * queue; target_dispatch() matches the two and opens new connections while
+ * the target is below max_per_target. Granted requests are moved to a ready
+ * list that a zero-delay timer drains, so acquire never calls back inline.
+ */
+
+#define POOL_HASH_SIZE  256
+
+typedef enum {
+    POOL_ENTRY_CONNECTING,
+    POOL_ENTRY_IDLE,
+    POOL_ENTRY_ACTIVE,
+} pool_entry_state;
+
+typedef struct pool_target pool_target;
+
+/* hangs off its tcp event (tcp_get_pool_entry()) so nanoev_event_free() can release it */
+struct tcp_pool_entry {
+    tcp_pool_entry *hash_next;          /* pool->entries bucket */
+    tcp_pool_entry *idle_prev;          /* target->idle list */
+    tcp_pool_entry *idle_next;
+    pool_target *target;
+    nanoev_event *tcp;
+    pool_entry_state state;
+    nanoev_timer_node expire;           /* idle timeout, userdata is tcp */
+};
+
+typedef struct pool_request {
+    struct pool_request *prev;          /* target->waiting queue */
+    struct pool_request *next;          /* target->waiting queue or ready list */
+    pool_target *target;
+    nanoev_tcp_pool_callback callback;
+    void *userdata;
+    int has_timeout;
+    nanoev_timeval timeout;
+    nanoev_timer_node deadline;         /* userdata is pool->dispatcher */
+    int status;
+    tcp_pool_entry *entry;              /* granted connection */
+} pool_request;
+
+struct pool_target {
+    pool_target *next;
+    nanoev_tcp_pool *pool;
+    struct nanoev_addr addr;
+    unsigned int active;
+    unsigned int connecting;
+    unsigned int idle_count;
+    tcp_pool_entry *idle;               /* most recently released first */
+    pool_request *wait_head;
+    pool_request *wait_tail;
+    unsigned int waiting;
+};
+
+struct nanoev_tcp_pool {
+    nanoev_loop *loop;
+    unsigned int max_per_target;
+    unsigned int max_idle_per_target;
+    int has_idle_timeout;
+    nanoev_timeval idle_timeout;
+    nanoev_event *dispatcher;           /* drains the ready list */
+    int dispatch_armed;
+    int dispatching;
+    int freed;
+    pool_request *ready_head;
+    pool_request *ready_tail;
+    pool_target *targets;
+    tcp_pool_entry *entries[POOL_HASH_SIZE];
+    nanoev_tcp_pool_stats stats;        /* cumulative counters only */
+};
+
+#define POOL_CONTAINER(ptr, type, member) \
+    ((type*)((char*)(ptr) - offsetof(type, member)))
+
+static void pool_destroy(nanoev_tcp_pool *pool);
+static pool_target* pool_find_target(nanoev_tcp_pool *pool, const struct nanoev_addr *addr);
+static int  pool_same_addr(const struct nanoev_addr *a, const struct nanoev_addr *b);
+static unsigned int pool_hash(const nanoev_event *tcp);
+static tcp_pool_entry* pool_find_entry(nanoev_tcp_pool *pool, const nanoev_event *tcp);
+static void pool_unhash_entry(nanoev_tcp_pool *pool, tcp_pool_entry *entry);
+static void pool_close_entry(nanoev_tcp_pool *pool, tcp_pool_entry *entry);
+static void pool_idle_push(nanoev_tcp_pool *pool, tcp_pool_entry *entry);
+static void pool_idle_unlink(nanoev_tcp_pool *pool, tcp_pool_entry *entry);
+static tcp_pool_entry* pool_idle_take(nanoev_tcp_pool *pool, pool_target *target);
+static pool_request* pool_wait_pop(nanoev_tcp_pool *pool, pool_target *target);
+static void pool_wait_unlink(pool_target *target, pool_request *request);
+static void pool_grant(nanoev_tcp_pool *pool, tcp_pool_entry *entry);
+static void pool_ready(nanoev_tcp_pool *pool, pool_request *request, int status, tcp_pool_entry *entry);
+static int  pool_connect(nanoev_tcp_pool *pool, pool_target *target, const pool_request *request);
+static void target_dispatch(nanoev_tcp_pool *pool, pool_target *target);
+static void pool_on_connect(nanoev_event *tcp, int status);
+static void pool_on_expire(nanoev_timer_node *node);
+static void pool_on_deadline(nanoev_timer_node *node);
+static void pool_on_dispatch(nanoev_event *timer);
+
+/*----------------------------------------------------------------------------*/
+
+nanoev_tcp_pool* nanoev_tcp_pool_new(
+    nanoev_loop *loop,
+    unsigned int max_per_target,
+    unsigned int max_idle_per_target,
+    const nanoev_timeval *idle_timeout
+    )
+{
+    nanoev_tcp_pool *pool;
+
+    ASSERT(loop);
+    ASSERT(in_loop_thread(loop));
+
+    if (idle_timeout && (idle_timeout->tv_sec < 0 || idle_timeout->tv_usec < 0
+        || idle_timeout->tv_usec >= 1000000))
+        return NULL;
+
+    pool = (nanoev_tcp_pool*)mem_alloc(sizeof(nanoev_tcp_pool));
+    if (!pool)
+        return NULL;
+    memset(pool, 0, sizeof(nanoev_tcp_pool));
+
+    pool->loop = loop;
+    pool->max_per_target = max_per_target;
+    pool->max_idle_per_target = max_idle_per_target;
+    if (idle_timeout) {
+        pool->has_idle_timeout = 1;
+        pool->idle_timeout = *idle_timeout;
+    }
+
+    pool->dispatcher = nanoev_event_new(nanoev_event_timer, loop, pool);
+    if (!pool->dispatcher) {
+        mem_free(pool);
+        return NULL;
+    }
+
+    return pool;
+}
+
+void nanoev_tcp_pool_free(
+    nanoev_tcp_pool *pool
+    )
+{
+    ASSERT(pool);
+    ASSERT(in_loop_thread(pool->loop));
+    ASSERT(!pool->freed);
+
+    if (pool->dispatching) {
+        /* pool_on_dispatch() finishes the job */
+        pool->freed = 1;
+        return;
+    }
+    pool_destroy(pool);
+}
+
+int nanoev_tcp_pool_acquire(
+    nanoev_tcp_pool *pool,
+    const struct nanoev_addr *addr,
+    const nanoev_timeval *timeout,
+    nanoev_tcp_pool_callback callback,
+    void *userdata
+    )
+{
+    pool_target *target;
+    pool_request *request;
+    nanoev_timeval deadline;
+
+    ASSERT(pool);
+    ASSERT(in_loop_thread(pool->loop));
+
+    if (pool->freed)
+        return NANOEV_ERROR_ACCESS_DENIED;
+    if (!addr || !callback)
+        return NANOEV_ERROR_INVALID_ARG;
+    if (addr->ss_family != AF_INET && addr->ss_family != AF_INET6)
+        return NANOEV_ERROR_INVALID_ARG;
+    if (timeout && (timeout->tv_sec < 0 || timeout->tv_usec < 0 || timeout->tv_usec >= 1000000))
+        return NANOEV_ERROR_INVALID_ARG;
+
+    target = pool_find_target(pool, addr);
+    if (!target) {
+        target = (pool_target*)mem_alloc(sizeof(pool_target));
+        if (!target)
+            return NANOEV_ERROR_OUT_OF_MEMORY;
+        memset(target, 0, sizeof(pool_target));
+        target->pool = pool;
+        memcpy(&target->addr, addr, sizeof(struct nanoev_addr));
+        target->next = pool->targets;
+        pool->targets = target;
+    }
+
+    request = (pool_request*)mem_alloc(sizeof(pool_request));
+    if (!request)
+        return NANOEV_ERROR_OUT_OF_MEMORY;
+    memset(request, 0, sizeof(pool_request));
+    request->target = target;
+    request->callback = callback;
+    request->userdata = userdata;
+    timer_node_init(&request->deadline, pool_on_deadline, pool->dispatcher);
+
+    if (timeout) {
+        request->has_timeout = 1;
+        request->timeout = *timeout;
+        nanoev_loop_now(pool->loop, &deadline);
+        time_add(&deadline, timeout);
+        if (timer_node_add(get_loop_timers(pool->loop), &request->deadline, &deadline)) {
+            mem_free(request);
+            return NANOEV_ERROR_OUT_OF_MEMORY;
+        }
+    }
+
+    request->prev = target->wait_tail;
+    if (target->wait_tail)
+        target->wait_tail->next = request;
+    else
+        target->wait_head = request;
+    target->wait_tail = request;
+    target->waiting++;
+
+    target_dispatch(pool, target);
+    return NANOEV_SUCCESS;
+}
+
+int nanoev_tcp_pool_release(
+    nanoev_tcp_pool *pool,
+    nanoev_event *tcp,
+    int reusable
+    )
+{
+    tcp_pool_entry *entry;
+    pool_target *target;
+
+    ASSERT(pool);
+    ASSERT(in_loop_thread(pool->loop));
+
+    entry = tcp ? pool_find_entry(pool, tcp) : NULL;
+    if (!entry || entry->state != POOL_ENTRY_ACTIVE)
+        return NANOEV_ERROR_INVALID_ARG;
+
+    target = entry->target;
+    target->active--;
+    if (reusable && tcp_check_idle(tcp)) {
+        nanoev_event_set_userdata(tcp, entry);
+        if (target->wait_head)
+            pool->stats.reuses++;
+        pool_grant(pool, entry);
+    } else {
+        pool_close_entry(pool, entry);
+    }
+
+    if (!pool->freed)
+        target_dispatch(pool, target);
+    return NANOEV_SUCCESS;
+}
+
+void nanoev_tcp_pool_get_stats(
+    nanoev_tcp_pool *pool,
+    nanoev_tcp_pool_stats *stats
+    )
+{
+    pool_target *target;
+
+    ASSERT(pool && stats);
+    ASSERT(in_loop_thread(pool->loop));
+
+    *stats = pool->stats;
+    stats->idle = stats->active = stats->connecting = stats->waiting = 0;
+    for (target = pool->targets; target; target = target->next) {
+        stats->idle += target->idle_count;
+        stats->active += target->active;
+        stats->connecting += target->connecting;
+        stats->waiting += target->waiting;
+    }
+}
+
+void tcp_pool_entry_free(tcp_pool_entry *entry)
+{
+    pool_target *target = entry->target;
+    nanoev_tcp_pool *pool = target->pool;
+
+    /* the caller freed a connection it was handed instead of releasing it */
+    ASSERT(entry->state == POOL_ENTRY_ACTIVE);
+    target->active--;
+    pool_unhash_entry(pool, entry);
+    mem_free(entry);
+
+    if (!pool->freed)
+        target_dispatch(pool, target);
+}
+
+/*----------------------------------------------------------------------------*/
+
+static void pool_destroy(nanoev_tcp_pool *pool)
+{
+    pool_target *target;
+    pool_request *request;
+    tcp_pool_entry *entry;
+    unsigned int i;
+
+    /* granted but not yet delivered */
+    while ((request = pool->ready_head) != NULL) {
+        pool->ready_head = request->next;
+        if (request->entry)
+            pool_close_entry(pool, request->entry);
+        mem_free(request);
+    }
+
+    while ((target = pool->targets) != NULL) {
+        pool->targets = target->next;
+        while ((request = target->wait_head) != NULL) {
+            target->wait_head = request->next;
+            timer_node_del(get_loop_timers(pool->loop), &request->deadline);
+            mem_free(request);
+        }
+        mem_free(target);
+    }
+
+    /* what remains is idle, connecting, or handed out */
+    for (i = 0; i < POOL_HASH_SIZE; i++) {
+        while ((entry = pool->entries[i]) != NULL) {
+            pool->entries[i] = entry->hash_next;
+            timer_node_del(get_loop_timers(pool->loop), &entry->expire);
+            tcp_set_pool_entry(entry->tcp, NULL);
+            if (entry->state != POOL_ENTRY_ACTIVE)
+                nanoev_event_free(entry->tcp);
+            mem_free(entry);
+        }
+    }
+
+    nanoev_event_free(pool->dispatcher);
+    mem_free(pool);
+}
+
+static pool_target* pool_find_target(nanoev_tcp_pool *pool, const struct nanoev_addr *addr)
+{
+    pool_target *target;
+
+    for (target = pool->targets; target; target = target->next) {
+        if (pool_same_addr(&target->addr, addr))
+            return target;
+    }
+    return NULL;
+}
+
+static int pool_same_addr(const struct nanoev_addr *a, const struct nanoev_addr *b)
+{
+    if (a->ss_family != b->ss_family)
+        return 0;
+
+    if (a->ss_family == AF_INET) {
+        const struct sockaddr_in *x = (const struct sockaddr_in*)a;
+        const struct sockaddr_in *y = (const struct sockaddr_in*)b;
+        return x->sin_port == y->sin_port
+            && memcmp(&x->sin_addr, &y->sin_addr, sizeof(x->sin_addr)) == 0;
+    } else {
+        const struct sockaddr_in6 *x = (const struct sockaddr_in6*)a;
+        const struct sockaddr_in6 *y = (const struct sockaddr_in6*)b;
+        return x->sin6_port == y->sin6_port
+            && x->sin6_scope_id == y->sin6_scope_id
+            && memcmp(&x->sin6_addr, &y->sin6_addr, sizeof(x->sin6_addr)) == 0;
+    }
+}
+
+static unsigned int pool_hash(const nanoev_event *tcp)
+{
+    size_t h = (size_t)tcp;
+
+    h ^= h >> 12;
+    return (unsigned int)(h >> 4) % POOL_HASH_SIZE;
+}
+
+static tcp_pool_entry* pool_find_entry(nanoev_tcp_pool *pool, const nanoev_event *tcp)
+{
+    tcp_pool_entry *entry;
+
+    for (entry = pool->entries[pool_hash(tcp)]; entry; entry = entry->hash_next) {
+        if (entry->tcp == tcp)
+            return entry;
+    }
+    return NULL;
+}
+
+static void pool_unhash_entry(nanoev_tcp_pool *pool, tcp_pool_entry *entry)
+{
+    tcp_pool_entry **link = &pool->entries[pool_hash(entry->tcp)];
+
+    while (*link != entry) {
+        ASSERT(*link);
+        link = &(*link)->hash_next;
+    }
+    *link = entry->hash_next;
+}
+
+static void pool_close_entry(nanoev_tcp_pool *pool, tcp_pool_entry *entry)
+{
+    if (entry->state == POOL_ENTRY_IDLE)
+        pool_idle_unlink(pool, entry);
+    pool_unhash_entry(pool, entry);
+    tcp_set_pool_entry(entry->tcp, NULL);
+    nanoev_event_free(entry->tcp);
+    mem_free(entry);
+}
+
+static void pool_idle_push(nanoev_tcp_pool *pool, tcp_pool_entry *entry)
+{
+    pool_target *target = entry->target;
+    nanoev_timeval expiry;
+
+    if (pool->has_idle_timeout) {
+        nanoev_loop_now(pool->loop, &expiry);
+        time_add(&expiry, &pool->idle_timeout);
+        if (timer_node_add(get_loop_timers(pool->loop), &entry->expire, &expiry)) {
+            pool_close_entry(pool, entry);
+            return;
+        }
+    }
+
+    entry->state = POOL_ENTRY_IDLE;
+    entry->idle_prev = NULL;
+    entry->idle_next = target->idle;
+    if (target->idle)
+        target->idle->idle_prev = entry;
+    target->idle = entry;
+    target->idle_count++;
+}
+
+static void pool_idle_unlink(nanoev_tcp_pool *pool, tcp_pool_entry *entry)
+{
+    pool_target *target = entry->target;
+
+    ASSERT(entry->state == POOL_ENTRY_IDLE);
+
+    timer_node_del(get_loop_timers(pool->loop), &entry->expire);
+    if (entry->idle_prev)
+        entry->idle_prev->idle_next = entry->idle_next;
+    else
+        target->idle = entry->idle_next;
+    if (entry->idle_next)
+        entry->idle_next->idle_prev = entry->idle_prev;
+    entry->idle_prev = entry->idle_next = NULL;
+    target->idle_count--;
+}
+
+static tcp_pool_entry* pool_idle_take(nanoev_tcp_pool *pool, pool_target *target)
+{
+    tcp_pool_entry *entry;
+
+    while ((entry = target->idle) != NULL) {
+        pool_idle_unlink(pool, entry);
+        if (tcp_check_idle(entry->tcp))
+            return entry;
+        pool->stats.unhealthy++;
+        entry->state = POOL_ENTRY_ACTIVE;
+        pool_close_entry(pool, entry);
+    }
+    return NULL;
+}
+
+static pool_request* pool_wait_pop(nanoev_tcp_pool *pool, pool_target *target)
+{
+    pool_request *request = target->wait_head;
+
+    if (request) {
+        pool_wait_unlink(target, request);
+        timer_node_del(get_loop_timers(pool->loop), &request->deadline);
+    }
+    return request;
+}
+
+static void pool_wait_unlink(pool_target *target, pool_request *request)
+{
+    if (request->prev)
+        request->prev->next = request->next;
+    else
+        target->wait_head = request->next;
+    if (request->next)
+        request->next->prev = request->prev;
+    else
+        target->wait_tail = request->prev;
+    request->prev = request->next = NULL;
+    target->waiting--;
+}
+
+/* hand a connected entry to the oldest waiter, or park it */
+static void pool_grant(nanoev_tcp_pool *pool, tcp_pool_entry *entry)
+{
+    pool_target *target = entry->target;
+    pool_request *request;
+
+    request = pool_wait_pop(pool, target);
+    if (request) {
+        entry->state = POOL_ENTRY_ACTIVE;
+        target->active++;
+        pool_ready(pool, request, 0, entry);
+    } else if (target->idle_count < pool->max_idle_per_target) {
+        pool_idle_push(pool, entry);
+    } else {
+        entry->state = POOL_ENTRY_ACTIVE;
+        pool_close_entry(pool, entry);
+    }
+}
+
+static void pool_ready(nanoev_tcp_pool *pool, pool_request *request, int status, tcp_pool_entry *entry)
+{
+    nanoev_timeval zero = { 0, 0 };
+
+    request->status = status;
+    request->entry = entry;
+    request->next = NULL;
+    if (pool->ready_tail)
+        pool->ready_tail->next = request;
+    else
+        pool->ready_head = request;
+    pool->ready_tail = request;
+
+    if (!pool->dispatch_armed && !pool->dispatching) {
+        if (nanoev_timer_add(pool->dispatcher, zero, 0, pool_on_dispatch) == NANOEV_SUCCESS)
+            pool->dispatch_armed = 1;
+    }
+}
+
+static int pool_connect(nanoev_tcp_pool *pool, pool_target *target, const pool_request *request)
+{
+    tcp_pool_entry *entry;
+    unsigned int bucket;
+    int status;
+
+    entry = (tcp_pool_entry*)mem_alloc(sizeof(tcp_pool_entry));
+    if (!entry)
+        return NANOEV_ERROR_OUT_OF_MEMORY;
+    memset(entry, 0, sizeof(tcp_pool_entry));
+    entry->target = target;
+    entry->state = POOL_ENTRY_CONNECTING;
+
+    entry->tcp = nanoev_event_new(nanoev_event_tcp, pool->loop, entry);
+    if (!entry->tcp) {
+        mem_free(entry);
+        return NANOEV_ERROR_OUT_OF_MEMORY;
+    }
+    timer_node_init(&entry->expire, pool_on_expire, entry->tcp);
+
+    /* the request this connection is opened for bounds the connect as well */
+    if (nanoev_tcp_connect(entry->tcp, &target->addr,
+        request->has_timeout ? &request->timeout : NULL, pool_on_connect) != NANOEV_SUCCESS) {
+        status = nanoev_tcp_error(entry->tcp);
+        nanoev_event_free(entry->tcp);
+        mem_free(entry);
+        return status ? status : NANOEV_ERROR_FAIL;
+    }
+
+    bucket = pool_hash(entry->tcp);
+    entry->hash_next = pool->entries[bucket];
+    pool->entries[bucket] = entry;
+    tcp_set_pool_entry(entry->tcp, entry);
+    target->connecting++;
+    return 0;
+}
+
+static void target_dispatch(nanoev_tcp_pool *pool, pool_target *target)
+{
+    tcp_pool_entry *entry;
+    pool_request *request;
+    unsigned int i;
+    int status;
+
+    while (target->wait_head) {
+        entry = pool_idle_take(pool, target);
+        if (entry) {
+            pool->stats.reuses++;
+            pool_grant(pool, entry);
+            continue;
+        }
+
+        /* connections already on their way will serve the head of the queue */
+        if (target->connecting >= target->waiting)
+            break;
+        if (pool->max_per_target
+            && target->active + target->connecting >= pool->max_per_target)
+            break;
+
+        request = target->wait_head;
+        for (i = 0; i < target->connecting; i++)
+            request = request->next;
+
+        status = pool_connect(pool, target, request);
+        if (status) {
+            pool->stats.connect_failures++;
+            pool_ready(pool, pool_wait_pop(pool, target), status, NULL);
+        }
+    }
+}
+
+static void pool_on_connect(nanoev_event *tcp, int status)
+{
+    tcp_pool_entry *entry = (tcp_pool_entry*)nanoev_event_userdata(tcp);
+    pool_target *target = entry->target;
+    nanoev_tcp_pool *pool = target->pool;
+    pool_request *request;
+
+    ASSERT(entry->state == POOL_ENTRY_CONNECTING);
+    target->connecting--;
+
+    if (status) {
+        pool->stats.connect_failures++;
+        entry->state = POOL_ENTRY_ACTIVE;
+        pool_close_entry(pool, entry);
+        request = pool_wait_pop(pool, target);
+        if (request)
+            pool_ready(pool, request, status, NULL);
+    } else {
+        pool->stats.connects++;
+        pool_grant(pool, entry);
+    }
+
+    target_dispatch(pool, target);
+}
+
+static void pool_on_expire(nanoev_timer_node *node)
+{
+    tcp_pool_entry *entry = POOL_CONTAINER(node, tcp_pool_entry, expire);
+    nanoev_tcp_pool *pool = entry->target->pool;
+
+    pool->stats.expired++;
+    pool_close_entry(pool, entry);
+}
+
+static void pool_on_deadline(nanoev_timer_node *node)
+{
+    pool_request *request = POOL_CONTAINER(node, pool_request, deadline);
+    pool_target *target = request->target;
+
+    pool_wait_unlink(target, request);
+    pool_ready(target->pool, request, socket_timeout_error(), NULL);
+}
+
+static void pool_on_dispatch(nanoev_event *timer)
+{
+    nanoev_tcp_pool *pool = (nanoev_tcp_pool*)nanoev_event_userdata(timer);
+    pool_request *request;
+    nanoev_tcp_pool_callback callback;
+    nanoev_event *tcp;
+    void *userdata;
+    int status;
+
+    pool->dispatch_armed = 0;
+    pool->dispatching = 1;
+
+    /* requests made ready by the callbacks are delivered in this pass too */
+    while (!pool->freed && (request = pool->ready_head) != NULL) {
+        pool->ready_head = request->next;
+        if (!pool->ready_head)
+            pool->ready_tail = NULL;
+
+        tcp = request->entry ? request->entry->tcp : NULL;
+        if (tcp)
+            nanoev_event_set_userdata(tcp, NULL);
+        callback = request->callback;
+        userdata = request->userdata;
+        status = request->status;
+        mem_free(request);
+
+        callback(pool, status, tcp, userdata);
+    }
+
+    pool->dispatching = 0;
+    if (pool->freed)
+        pool_destroy(pool);
+}
@@ -1,4 +1,5 @@
 #include "nanoev_internal.h"
+#include "nanoev_trace.h"
 
 /*----------------------------------------------------------------------------*/
 
@@ -175,6 +176,9 @@ void timers_init(timer_min_heap *heap)
     heap->events = NULL;
     heap->capacity = 0;
     heap->size = 0;
+    heap->fired = 0;
+    heap->lateness_usec = 0;
+    heap->lateness_max_usec = 0;
 }
 
 void timers_term(timer_min_heap *heap)
@@ -204,11 +208,16 @@ void timers_timeout(timer_min_heap *heap, const nanoev_timeval *now, nanoev_time
     }
 }
 
-void timers_process(timer_min_heap *heap, const nanoev_timeval *now)
+void timers_process(nanoev_loop *loop, timer_min_heap *heap, const nanoev_timeval *now)
 {
     nanoev_timer_node *top;
+    nanoev_timeval late, start;
+    unsigned long long late_usec;
+    nanoev_event *owner;
+    nanoev_event_type type;
+    void *userdata;
 
-    ASSERT(heap && now);
+    ASSERT(loop && heap && now);
 
     while (heap->size) {
         top = heap->events[0];
@@ -218,8 +227,28 @@ void timers_process(timer_min_heap *heap, const nanoev_timeval *now)
         /* Erase from the heap */
         min_heap_erase(heap, top);
 
+        /* Statistics */
+        late = *now;
+        time_sub(&late, &top->timeout);
+        late_usec = (unsigned long long)late.tv_sec * 1000000 + late.tv_usec;
+        heap->fired++;
+        heap->lateness_usec += late_usec;
+        if (late_usec > heap->lateness_max_usec)
+            heap->lateness_max_usec = late_usec;
+        TRACE_TIMER_FIRE(loop, (nanoev_event*)top->userdata, late_usec);
+
         /* Invoke callback */
-        top->callback(top);
+        if (loop_watch_slow(loop)) {
+            /* the owner may be freed by its callback */
+            owner = (nanoev_event*)top->userdata;
+            type = owner->type;
+            userdata = owner->userdata;
+            nanoev_now(&start);
+            top->callback(top);
+            loop_check_slow(loop, type, userdata, &start);
+        } else {
+            top->callback(top);
+        }
     }
 }
 
@@ -0,0 +1,92 @@
+#ifndef __NANOEV_TRACE_H__
+#define __NANOEV_TRACE_H__
+
+#include "nanoev_internal.h"
+
+/*----------------------------------------------------------------------------*/
+
+/*
+ * Trace points on the dispatch path.
+ *
+ * Each point fires a USDT probe (provider "nanoev") when the library is built
+ * with NANOEV_HAVE_USDT, and calls the matching hook installed by
+ * nanoev_set_trace_hooks(). A disabled USDT probe is a single NOP; a missing
+ * hook costs one load and branch.
+ */
+
+#ifdef NANOEV_HAVE_USDT
+# include <sys/sdt.h>
+# define NANOEV_USDT1(name, a)              DTRACE_PROBE1(nanoev, name, a)
+# define NANOEV_USDT2(name, a, b)           DTRACE_PROBE2(nanoev, name, a, b)
+# define NANOEV_USDT3(name, a, b, c)        DTRACE_PROBE3(nanoev, name, a, b, c)
+#else
+# define NANOEV_USDT1(name, a)
+# define NANOEV_USDT2(name, a, b)
+# define NANOEV_USDT3(name, a, b, c)
+#endif
+
+extern nanoev_trace_hooks trace_hooks;
+
+#define TRACE_HOOK(name, args)                                    \
+    do {                                                          \
+        if (trace_hooks.name)                                     \
+            trace_hooks.name args;                                \
+    } while (0)
+
+#define TRACE_POLL_ENTER(loop, timeout)                           \
+    do {                                                          \
+        NANOEV_USDT2(poll__enter, loop, timeout);                 \
+        TRACE_HOOK(poll_enter, (loop, timeout));                  \
+    } while (0)
+
+#define TRACE_POLL_EXIT(loop, count)                              \
+    do {                                                          \
+        NANOEV_USDT2(poll__exit, loop, count);                    \
+        TRACE_HOOK(poll_exit, (loop, count));                     \
+    } while (0)
+
+#define TRACE_DISPATCH(loop, event)                               \
+    do {                                                          \
+        NANOEV_USDT3(dispatch, loop, event, (event)->type);       \
+        TRACE_HOOK(dispatch, (loop, event));                      \
+    } while (0)
+
+#define TRACE_TIMER_FIRE(loop, event, late_usec)                  \
+    do {                                                          \
+        NANOEV_USDT3(timer__fire, loop, event, late_usec);        \
+        TRACE_HOOK(timer_fire, (loop, event, late_usec));         \
+    } while (0)
+
+#define TRACE_TCP_ACCEPT(listener, status, tcp)                   \
+    do {                                                          \
+        NANOEV_USDT3(tcp__accept, listener, status, tcp);         \
+        TRACE_HOOK(tcp_accept, (listener, status, tcp));          \
+    } while (0)
+
+#define TRACE_TCP_CONNECT(tcp, status)                            \
+    do {                                                          \
+        NANOEV_USDT2(tcp__connect, tcp, status);                  \
+        TRACE_HOOK(tcp_connect, (tcp, status));                   \
+    } while (0)
+
+#define TRACE_TCP_READ(tcp, status, bytes)                        \
+    do {                                                          \
+        NANOEV_USDT3(tcp__read, tcp, status, bytes);              \
+        TRACE_HOOK(tcp_read, (tcp, status, bytes));               \
+    } while (0)
+
+#define TRACE_TCP_WRITE(tcp, status, bytes)                       \
+    do {                                                          \
+        NANOEV_USDT3(tcp__write, tcp, status, bytes);             \
+        TRACE_HOOK(tcp_write, (tcp, status, bytes));              \
+    } while (0)
+
+#define TRACE_LAZY_DELETE(loop, event)                            \
+    do {                                                          \
+        NANOEV_USDT2(lazy__delete, loop, event);                  \
+        TRACE_HOOK(lazy_delete, (loop, event));                   \
+    } while (0)
+
+/*----------------------------------------------------------------------------*/
+
+#endif  /* __NANOEV_TRACE_H__ */
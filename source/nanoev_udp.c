@@ -1,7 +1,23 @@
 #include "nanoev_internal.h"
 
+#ifndef _WIN32
+# include <sys/uio.h>
+#endif
+
 /*----------------------------------------------------------------------------*/
 
+/* pieces gathered into one datagram */
+#define UDP_MAX_IOV  16
+
+/* nanoev_udp_read_buf() and nanoev_udp_write_buf() state, allocated on first use */
+typedef struct udp_buf_io {
+    io_buf vec[UDP_MAX_IOV];              /* pieces of a pending nanoev_buf datagram */
+    nanoev_buf *read_buf;                 /* nanoev_udp_read_buf() target */
+    nanoev_buf *write_buf;                /* nanoev_udp_write_buf() source, referenced */
+    nanoev_udp_on_read_buf  on_read_buf;
+    nanoev_udp_on_write_buf on_write_buf;
+} udp_buf_io;
+
 struct nanoev_udp {
     NANOEV_PROACTOR_FILEDS
     int family;
@@ -13,6 +29,8 @@ struct nanoev_udp {
     io_buf buf_write;
     socklen_t from_addr_len;
     struct sockaddr_storage from_addr;
+    unsigned int write_vec_count;         /* 1: buf_write alone, else buf_io->vec */
+    udp_buf_io *buf_io;                   /* NULL until nanoev_udp_read_buf()/write_buf() */
 #ifndef _WIN32
     struct sockaddr_storage to_addr;
     int write_connected;
@@ -29,6 +47,16 @@ static int create_udp_socket(nanoev_udp *udp, int family);
 static int sockaddr_len(nanoev_udp *udp);
 static int udp_set_option(nanoev_udp *udp, int level, int optname, const char *optval, int optlen);
 static int udp_set_int_option(nanoev_udp *udp, int level, int optname, int value);
+static int udp_check_write(nanoev_udp *udp, const struct nanoev_addr *to_addr);
+static int udp_buf_io_alloc(nanoev_udp *udp);
+static int udp_start_write(nanoev_udp *udp, const struct nanoev_addr *to_addr,
+    nanoev_udp_on_write callback);
+static void udp_on_write_buf(nanoev_event *event, int status, void *buf, unsigned int bytes);
+static void udp_on_read_buf(nanoev_event *event, int status, void *buf, unsigned int bytes,
+    const struct nanoev_addr *from_addr);
+#ifndef _WIN32
+static int udp_send_some(nanoev_udp *udp);
+#endif
 
 #define NANOEV_UDP_FLAG_WRITING      NANOEV_PROACTOR_FLAG_WRITING
 #define NANOEV_UDP_FLAG_READING      NANOEV_PROACTOR_FLAG_READING
@@ -74,6 +102,10 @@ void udp_free(nanoev_event *event)
         /* lazy delete */
         add_endgame_proactor(udp->loop, (nanoev_proactor*)udp);
     } else {
+        if (udp->buf_io) {
+            nanoev_buf_unref(udp->buf_io->write_buf);
+            mem_free(udp->buf_io);
+        }
         mem_free(udp);
     }
 }
@@ -142,6 +174,7 @@ int nanoev_udp_write(
     )
 {
     nanoev_udp *udp = (nanoev_udp*)event;
+    int ret_code;
 
     ASSERT(udp);
     ASSERT(udp->type == nanoev_event_udp);
@@ -149,6 +182,69 @@ int nanoev_udp_write(
 
     if (!buf || !len || !callback)
         return NANOEV_ERROR_INVALID_ARG;
+    ret_code = udp_check_write(udp, to_addr);
+    if (ret_code != NANOEV_SUCCESS)
+        return ret_code;
+
+    udp->buf_write.buf = (char*)buf;
+    udp->buf_write.len = len;
+    udp->write_vec_count = 1;
+
+    return udp_start_write(udp, to_addr, callback);
+}
+
+int nanoev_udp_write_buf(
+    nanoev_event *event,
+    nanoev_buf *buf,
+    const struct nanoev_addr *to_addr,
+    nanoev_udp_on_write_buf callback
+    )
+{
+    nanoev_udp *udp = (nanoev_udp*)event;
+    int ret_code;
+
+    ASSERT(udp);
+    ASSERT(udp->type == nanoev_event_udp);
+    ASSERT(in_loop_thread(udp->loop));
+
+    if (!buf || !nanoev_buf_len(buf) || !callback)
+        return NANOEV_ERROR_INVALID_ARG;
+    if (nanoev_buf_segments(buf, NULL, 0) > UDP_MAX_IOV)
+        return NANOEV_ERROR_INVALID_ARG;
+    ret_code = udp_check_write(udp, to_addr);
+    if (ret_code != NANOEV_SUCCESS)
+        return ret_code;
+
+    if (udp_buf_io_alloc(udp))
+        return NANOEV_ERROR_OUT_OF_MEMORY;
+    udp->write_vec_count = buf_fill_iov(buf, 0, udp->buf_io->vec, UDP_MAX_IOV);
+    udp->buf_write = udp->buf_io->vec[0];
+
+    ret_code = udp_start_write(udp, to_addr, udp_on_write_buf);
+    if (ret_code != NANOEV_SUCCESS)
+        return ret_code;
+
+    ASSERT(!udp->buf_io->write_buf);
+    udp->buf_io->write_buf = nanoev_buf_ref(buf);
+    udp->buf_io->on_write_buf = callback;
+    return NANOEV_SUCCESS;
+}
+
+static int udp_buf_io_alloc(nanoev_udp *udp)
+{
+    if (!udp->buf_io) {
+        udp->buf_io = (udp_buf_io*)mem_alloc(sizeof(udp_buf_io));
+        if (!udp->buf_io)
+            return -1;
+        memset(udp->buf_io, 0, sizeof(udp_buf_io));
+    }
+    return 0;
+}
+
+static int udp_check_write(nanoev_udp *udp, const struct nanoev_addr *to_addr)
+{
+    int ret_code;
+
     if (!to_addr && !(udp->flags & NANOEV_UDP_FLAG_CONNECTED))
         return NANOEV_ERROR_INVALID_ARG;
     if (udp->flags & NANOEV_UDP_FLAG_ERROR
@@ -158,7 +254,7 @@ int nanoev_udp_write(
         return NANOEV_ERROR_ACCESS_DENIED;
 
     if (udp->sock == INVALID_SOCKET) {
-        int ret_code = create_udp_socket(udp, to_addr->ss_family);
+        ret_code = create_udp_socket(udp, to_addr->ss_family);
         if (ret_code != 0) {
             udp->flags |= NANOEV_UDP_FLAG_ERROR;
             udp->error_code = ret_code;
@@ -168,13 +264,22 @@ int nanoev_udp_write(
     if (to_addr && to_addr->ss_family != udp->family)
         return NANOEV_ERROR_INVALID_ARG;
 
-    udp->buf_write.buf = (char*)buf;
-    udp->buf_write.len = len;
+    return NANOEV_SUCCESS;
+}
+
+static int udp_start_write(
+    nanoev_udp *udp,
+    const struct nanoev_addr *to_addr,
+    nanoev_udp_on_write callback
+    )
+{
     memset(&udp->ctx_write, 0, sizeof(io_context));
 
 #ifdef _WIN32
+    io_buf *vec = udp->write_vec_count == 1 ? &udp->buf_write : udp->buf_io->vec;
+
     if (to_addr) {
-        if (0 != WSASendTo(udp->sock, &udp->buf_write, 1, NULL, 0,
+        if (0 != WSASendTo(udp->sock, vec, udp->write_vec_count, NULL, 0,
             (struct sockaddr*)to_addr, sockaddr_len(udp), &udp->ctx_write, NULL)
             && WSA_IO_PENDING != WSAGetLastError()
             ) {
@@ -182,7 +287,8 @@ int nanoev_udp_write(
             udp->error_code = WSAGetLastError();
             return NANOEV_ERROR_FAIL;
         }
-    } else if (0 != WSASend(udp->sock, &udp->buf_write, 1, NULL, 0, &udp->ctx_write, NULL)
+    } else if (0 != WSASend(udp->sock, vec, udp->write_vec_count, NULL, 0,
+        &udp->ctx_write, NULL)
         && WSA_IO_PENDING != WSAGetLastError()) {
         udp->flags |= NANOEV_UDP_FLAG_ERROR;
         udp->error_code = WSAGetLastError();
@@ -193,12 +299,10 @@ int nanoev_udp_write(
     if (to_addr) {
         udp->write_connected = 0;
         memcpy(&(udp->to_addr), to_addr, sizeof(udp->to_addr));
-        ret = sendto(udp->sock, udp->buf_write.buf, udp->buf_write.len, 0,
-            (struct sockaddr*)&udp->to_addr, sockaddr_len(udp));
     } else {
         udp->write_connected = 1;
-        ret = send(udp->sock, udp->buf_write.buf, udp->buf_write.len, 0);
     }
+    ret = udp_send_some(udp);
     if (ret > 0) {
         udp->ctx_write.status = 0;
         udp->ctx_write.bytes = ret;
@@ -228,6 +332,42 @@ int nanoev_udp_write(
     return NANOEV_SUCCESS;
 }
 
+int nanoev_udp_read_buf(
+    nanoev_event *event,
+    nanoev_buf *buf,
+    unsigned int len,
+    nanoev_udp_on_read_buf callback
+    )
+{
+    nanoev_udp *udp = (nanoev_udp*)event;
+    void *space;
+    int ret_code;
+
+    ASSERT(udp);
+    ASSERT(udp->type == nanoev_event_udp);
+    ASSERT(in_loop_thread(udp->loop));
+
+    if (!buf || !len || !callback)
+        return NANOEV_ERROR_INVALID_ARG;
+    if (udp->flags & NANOEV_UDP_FLAG_READING)
+        return NANOEV_ERROR_ACCESS_DENIED;
+    if (udp_buf_io_alloc(udp))
+        return NANOEV_ERROR_OUT_OF_MEMORY;
+
+    /* a datagram has to land in one piece */
+    space = nanoev_buf_reserve(buf, len);
+    if (!space)
+        return NANOEV_ERROR_OUT_OF_MEMORY;
+
+    ret_code = nanoev_udp_read(event, space, len, udp_on_read_buf);
+    if (ret_code != NANOEV_SUCCESS)
+        return ret_code;
+
+    udp->buf_io->read_buf = buf;
+    udp->buf_io->on_read_buf = callback;
+    return NANOEV_SUCCESS;
+}
+
 int nanoev_udp_connect(
     nanoev_event *event,
     const struct nanoev_addr *addr
@@ -409,6 +549,24 @@ int nanoev_udp_set_broadcast(
     return udp_set_int_option(udp, SOL_SOCKET, SO_BROADCAST, enabled ? 1 : 0);
 }
 
+int nanoev_udp_set_busy_poll(
+    nanoev_event *event,
+    unsigned int usec
+    )
+{
+    nanoev_udp *udp = (nanoev_udp*)event;
+
+    ASSERT(udp);
+    ASSERT(udp->type == nanoev_event_udp);
+    ASSERT(in_loop_thread(udp->loop));
+
+    if (udp->sock == INVALID_SOCKET || udp->flags & NANOEV_UDP_FLAG_DELETED)
+        return NANOEV_ERROR_ACCESS_DENIED;
+
+    /* an unsupported or unprivileged busy-poll request leaves the socket usable */
+    return set_busy_poll(udp->sock, usec) ? NANOEV_SUCCESS : NANOEV_ERROR_FAIL;
+}
+
 /*----------------------------------------------------------------------------*/
 
 void udp_proactor_callback(nanoev_proactor *proactor, io_context *ctx)
@@ -467,6 +625,35 @@ void udp_proactor_callback(nanoev_proactor *proactor, io_context *ctx)
     }
 }
 
+static void udp_on_write_buf(nanoev_event *event, int status, void *data, unsigned int bytes)
+{
+    nanoev_udp *udp = (nanoev_udp*)event;
+    nanoev_udp_on_write_buf callback = udp->buf_io->on_write_buf;
+    nanoev_buf *buf = udp->buf_io->write_buf;
+
+    (void)data;
+
+    udp->buf_io->on_write_buf = NULL;
+    udp->buf_io->write_buf = NULL;
+    callback(event, status, buf, bytes);
+    nanoev_buf_unref(buf);
+}
+
+static void udp_on_read_buf(nanoev_event *event, int status, void *data, unsigned int bytes,
+    const struct nanoev_addr *from_addr)
+{
+    nanoev_udp *udp = (nanoev_udp*)event;
+    nanoev_udp_on_read_buf callback = udp->buf_io->on_read_buf;
+    nanoev_buf *buf = udp->buf_io->read_buf;
+
+    (void)data;
+
+    udp->buf_io->on_read_buf = NULL;
+    udp->buf_io->read_buf = NULL;
+    nanoev_buf_commit(buf, bytes);
+    callback(event, status, buf, bytes, from_addr);
+}
+
 #ifndef _WIN32
 static io_context* reactor_cb(nanoev_proactor *proactor, int events)
 {
@@ -491,13 +678,7 @@ static io_context* reactor_cb(nanoev_proactor *proactor, int events)
 
     } else {
         ASSERT(events == _EV_WRITE);
-        int ret;
-        if (udp->write_connected) {
-            ret = send(udp->sock, udp->buf_write.buf, udp->buf_write.len, 0);
-        } else {
-            ret = sendto(udp->sock, udp->buf_write.buf, udp->buf_write.len, 0,
-                (struct sockaddr*)&udp->to_addr, sockaddr_len(udp));
-        }
+        int ret = udp_send_some(udp);
         if (ret > 0) {
             udp->ctx_write.status = 0;
             udp->ctx_write.bytes = ret;
@@ -512,6 +693,34 @@ static io_context* reactor_cb(nanoev_proactor *proactor, int events)
         return &(udp->ctx_write);
     }
 }
+
+static int udp_send_some(nanoev_udp *udp)
+{
+    struct iovec iov[UDP_MAX_IOV];
+    struct msghdr msg;
+    unsigned int i;
+
+    if (udp->write_vec_count == 1) {
+        if (udp->write_connected)
+            return send(udp->sock, udp->buf_write.buf, udp->buf_write.len, 0);
+        return sendto(udp->sock, udp->buf_write.buf, udp->buf_write.len, 0,
+            (struct sockaddr*)&udp->to_addr, sockaddr_len(udp));
+    }
+
+    ASSERT(udp->write_vec_count <= UDP_MAX_IOV);
+    for (i = 0; i < udp->write_vec_count; i++) {
+        iov[i].iov_base = udp->buf_io->vec[i].buf;
+        iov[i].iov_len = udp->buf_io->vec[i].len;
+    }
+    memset(&msg, 0, sizeof(msg));
+    if (!udp->write_connected) {
+        msg.msg_name = &udp->to_addr;
+        msg.msg_namelen = sockaddr_len(udp);
+    }
+    msg.msg_iov = iov;
+    msg.msg_iovlen = udp->write_vec_count;
+    return sendmsg(udp->sock, &msg, 0);
+}
 #endif
 
 static int create_udp_socket(nanoev_udp *udp, int family)
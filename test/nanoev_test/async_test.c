@@ -41,6 +41,53 @@ static void test_async_coalesces_sends(nanoev_test *test)
     nanoev_term();
 }
 
+static void on_async_stop(nanoev_event *timer)
+{
+    async_case *tc = (async_case*)nanoev_event_userdata(timer);
+    nanoev_loop_break(tc->loop);
+}
+
+static void test_async_free_with_pending_send(nanoev_test *test)
+{
+    async_case tc;
+    nanoev_event *async;
+    nanoev_event *timer;
+    nanoev_loop_stats stats;
+    nanoev_timeval after = { 0, 20000 };
+
+    TEST_REQUIRE(test, nanoev_init() == NANOEV_SUCCESS);
+    tc.loop = nanoev_loop_new(NULL);
+    TEST_REQUIRE(test, tc.loop);
+    tc.fired = 0;
+    async = nanoev_event_new(nanoev_event_async, tc.loop, &tc);
+    timer = nanoev_event_new(nanoev_event_timer, tc.loop, &tc);
+    TEST_REQUIRE(test, async && timer);
+
+    /* the wakeup is still queued when the event is freed, so it must wait for it */
+    TEST_EXPECT(test, nanoev_async_start(async, on_async) == NANOEV_SUCCESS);
+    TEST_EXPECT(test, nanoev_async_send(async) == NANOEV_SUCCESS);
+    nanoev_event_free(async);
+    nanoev_loop_get_stats(tc.loop, &stats);
+    TEST_EXPECT(test, stats.endgame_count == 1);
+
+    TEST_EXPECT(test, nanoev_timer_add(timer, after, 0, on_async_stop) == NANOEV_SUCCESS);
+    TEST_EXPECT(test, nanoev_loop_run(tc.loop) == NANOEV_SUCCESS);
+    TEST_EXPECT(test, tc.fired == 0);
+    nanoev_loop_get_stats(tc.loop, &stats);
+    TEST_EXPECT(test, stats.endgame_count == 0);
+
+    /* freed again with a wakeup pending, but the loop goes away before it is read */
+    async = nanoev_event_new(nanoev_event_async, tc.loop, &tc);
+    TEST_REQUIRE(test, async);
+    TEST_EXPECT(test, nanoev_async_start(async, on_async) == NANOEV_SUCCESS);
+    TEST_EXPECT(test, nanoev_async_send(async) == NANOEV_SUCCESS);
+    nanoev_event_free(async);
+
+    nanoev_event_free(timer);
+    nanoev_loop_free(tc.loop);
+    nanoev_term();
+}
+
 #ifndef _WIN32
 static void test_async_closes_pipe_fd_zero(nanoev_test *test)
 {
@@ -97,6 +144,7 @@ cleanup:
 void test_async(nanoev_test *test)
 {
     test_async_coalesces_sends(test);
+    test_async_free_with_pending_send(test);
 #ifndef _WIN32
     test_async_closes_pipe_fd_zero(test);
 #endif
@@ -0,0 +1,391 @@
+#include "nanoev.h"
+#include "test.h"
+#include <string.h>
+
+#define BUF_TEST_PAYLOAD  (NANOEV_BUF_CHUNK_SIZE * 3 + 100)
+
+typedef struct buf_case {
+    nanoev_loop *loop;
+    nanoev_event *listener;
+    nanoev_event *client;
+    nanoev_event *accepted;
+    nanoev_event *timer;
+    nanoev_buf *payload;
+    nanoev_buf *received;
+    unsigned int expect;
+    unsigned int written;
+    int write_called;
+    int read_eof;
+    int timed_out;
+    int callback_failures;
+} buf_case;
+
+static nanoev_timeval seconds(long sec)
+{
+    nanoev_timeval tv;
+    tv.tv_sec = sec;
+    tv.tv_usec = 0;
+    return tv;
+}
+
+static void fill_pattern(char *data, unsigned int len, unsigned int seed)
+{
+    unsigned int i;
+    for (i = 0; i < len; i++)
+        data[i] = (char)((i + seed) * 31);
+}
+
+static int buf_matches(const nanoev_buf *buf, unsigned int offset, unsigned int len, unsigned int seed)
+{
+    char chunk[512], expect[512];
+    unsigned int n;
+
+    while (len) {
+        n = len < sizeof(chunk) ? len : (unsigned int)sizeof(chunk);
+        if (nanoev_buf_copy(buf, offset, chunk, n) != n)
+            return 0;
+        fill_pattern(expect, n, seed + offset);
+        if (memcmp(chunk, expect, n) != 0)
+            return 0;
+        offset += n;
+        len -= n;
+    }
+    return 1;
+}
+
+static int buf_append_pattern(nanoev_buf *buf, unsigned int len, unsigned int seed)
+{
+    char data[512];
+    unsigned int n, done = 0;
+
+    while (done < len) {
+        n = len - done < sizeof(data) ? len - done : (unsigned int)sizeof(data);
+        fill_pattern(data, n, seed + done);
+        if (nanoev_buf_append(buf, data, n) != NANOEV_SUCCESS)
+            return 0;
+        done += n;
+    }
+    return 1;
+}
+
+static void test_buf_chain(nanoev_test *test)
+{
+    nanoev_buf *a, *b;
+    nanoev_buf_seg segs[8];
+    char *space;
+    char out[8];
+
+    TEST_REQUIRE(test, nanoev_init() == NANOEV_SUCCESS);
+
+    a = nanoev_buf_new();
+    TEST_REQUIRE(test, a);
+    TEST_EXPECT(test, nanoev_buf_len(a) == 0);
+    TEST_EXPECT(test, nanoev_buf_segments(a, segs, 8) == 0);
+
+    /* appends fill the tail chunk before taking another */
+    TEST_EXPECT(test, buf_append_pattern(a, NANOEV_BUF_CHUNK_SIZE + 10, 0));
+    TEST_EXPECT(test, nanoev_buf_len(a) == NANOEV_BUF_CHUNK_SIZE + 10);
+    TEST_EXPECT(test, nanoev_buf_segments(a, segs, 8) == 2);
+    TEST_EXPECT(test, segs[0].len == NANOEV_BUF_CHUNK_SIZE && segs[1].len == 10);
+    TEST_EXPECT(test, buf_matches(a, 0, NANOEV_BUF_CHUNK_SIZE + 10, 0));
+
+    space = (char*)nanoev_buf_reserve(a, 4);
+    TEST_REQUIRE(test, space);
+    memcpy(space, "tail", 4);
+    nanoev_buf_commit(a, 4);
+    TEST_EXPECT(test, nanoev_buf_segments(a, segs, 8) == 2);
+    TEST_EXPECT(test, nanoev_buf_copy(a, NANOEV_BUF_CHUNK_SIZE + 10, out, sizeof(out)) == 4);
+    TEST_EXPECT(test, memcmp(out, "tail", 4) == 0);
+
+    /* a slice shares the chunks: same bytes, no copy */
+    b = nanoev_buf_new();
+    TEST_REQUIRE(test, b);
+    TEST_EXPECT(test, nanoev_buf_append_buf(b, a, NANOEV_BUF_CHUNK_SIZE - 6, 20) == NANOEV_SUCCESS);
+    TEST_EXPECT(test, nanoev_buf_append_buf(b, a, 0, nanoev_buf_len(a) + 1) == NANOEV_ERROR_INVALID_ARG);
+    TEST_EXPECT(test, nanoev_buf_len(b) == 20);
+    TEST_EXPECT(test, nanoev_buf_segments(b, segs, 8) == 2);
+    TEST_EXPECT(test, segs[0].len == 6 && segs[1].len == 14);
+    TEST_EXPECT(test, buf_matches(b, 0, 16, NANOEV_BUF_CHUNK_SIZE - 6));
+
+    /* b cannot grow into a's chunk, and a's later appends do not show in b */
+    TEST_EXPECT(test, nanoev_buf_append(b, "!", 1) == NANOEV_SUCCESS);
+    TEST_EXPECT(test, nanoev_buf_segments(b, segs, 8) == 3);
+    TEST_EXPECT(test, nanoev_buf_append(a, "more", 4) == NANOEV_SUCCESS);
+    TEST_EXPECT(test, nanoev_buf_len(b) == 21);
+    TEST_EXPECT(test, nanoev_buf_copy(b, 16, out, sizeof(out)) == 5);
+    TEST_EXPECT(test, memcmp(out, "tail!", 5) == 0);
+
+    /* a shared buf is read-only */
+    nanoev_buf_ref(a);
+    TEST_EXPECT(test, nanoev_buf_append(a, "x", 1) == NANOEV_ERROR_ACCESS_DENIED);
+    TEST_EXPECT(test, nanoev_buf_reserve(a, 1) == NULL);
+    nanoev_buf_unref(a);
+
+    /* consuming a drops its first chunk while b still reads from it */
+    nanoev_buf_consume(a, NANOEV_BUF_CHUNK_SIZE + 2);
+    TEST_EXPECT(test, nanoev_buf_len(a) == 16);
+    TEST_EXPECT(test, nanoev_buf_segments(a, segs, 8) == 1);
+    TEST_EXPECT(test, buf_matches(a, 0, 8, NANOEV_BUF_CHUNK_SIZE + 2));
+    nanoev_buf_unref(a);
+    TEST_EXPECT(test, buf_matches(b, 0, 16, NANOEV_BUF_CHUNK_SIZE - 6));
+
+    nanoev_buf_consume(b, nanoev_buf_len(b));
+    TEST_EXPECT(test, nanoev_buf_len(b) == 0);
+    TEST_EXPECT(test, nanoev_buf_append(b, "ok", 2) == NANOEV_SUCCESS);
+    TEST_EXPECT(test, nanoev_buf_copy(b, 0, out, sizeof(out)) == 2);
+
+    /* reservations beyond a chunk get a chunk of their own */
+    space = (char*)nanoev_buf_reserve(b, NANOEV_BUF_CHUNK_SIZE * 2);
+    TEST_REQUIRE(test, space);
+    memset(space, 'z', NANOEV_BUF_CHUNK_SIZE * 2);
+    nanoev_buf_commit(b, NANOEV_BUF_CHUNK_SIZE * 2);
+    TEST_EXPECT(test, nanoev_buf_len(b) == NANOEV_BUF_CHUNK_SIZE * 2 + 2);
+    TEST_EXPECT(test, nanoev_buf_segments(b, NULL, 0) == 2);
+    nanoev_buf_unref(b);
+
+    nanoev_term();
+}
+
+static void buf_note_failure(buf_case *bc)
+{
+    bc->callback_failures++;
+    nanoev_loop_break(bc->loop);
+}
+
+static void on_buf_timeout(nanoev_event *timer)
+{
+    buf_case *bc = (buf_case*)nanoev_event_userdata(timer);
+    bc->timed_out = 1;
+    nanoev_loop_break(bc->loop);
+}
+
+static void on_buf_server_read(
+    nanoev_event *tcp,
+    int status,
+    nanoev_buf *buf,
+    unsigned int bytes
+    )
+{
+    buf_case *bc = (buf_case*)nanoev_event_userdata(tcp);
+
+    if (status != 0 || buf != bc->received) {
+        buf_note_failure(bc);
+        return;
+    }
+    if (bytes == 0) {
+        bc->read_eof = 1;
+        nanoev_loop_break(bc->loop);
+        return;
+    }
+    if (nanoev_tcp_read_buf(tcp, buf, NANOEV_BUF_CHUNK_SIZE, NULL, on_buf_server_read) != NANOEV_SUCCESS)
+        buf_note_failure(bc);
+}
+
+static void on_buf_accept(
+    nanoev_event *tcp,
+    int status,
+    nanoev_event *tcp_new
+    )
+{
+    buf_case *bc = (buf_case*)nanoev_event_userdata(tcp);
+
+    if (status != 0 || !tcp_new) {
+        buf_note_failure(bc);
+        return;
+    }
+    bc->accepted = tcp_new;
+    nanoev_event_set_userdata(tcp_new, bc);
+    if (nanoev_tcp_read_buf(tcp_new, bc->received, 1000, NULL, on_buf_server_read) != NANOEV_SUCCESS)
+        buf_note_failure(bc);
+}
+
+static void on_buf_client_write(
+    nanoev_event *tcp,
+    int status,
+    nanoev_buf *buf,
+    unsigned int bytes
+    )
+{
+    buf_case *bc = (buf_case*)nanoev_event_userdata(tcp);
+
+    bc->write_called++;
+    if (status != 0 || buf != bc->payload || bytes != nanoev_buf_len(buf)) {
+        buf_note_failure(bc);
+        return;
+    }
+    bc->written += bytes;
+
+    /* the same chain again, then close */
+    if (bc->write_called == 1) {
+        if (nanoev_tcp_write_buf(tcp, buf, NULL, on_buf_client_write) != NANOEV_SUCCESS)
+            buf_note_failure(bc);
+    } else if (nanoev_tcp_shutdown(tcp, NANOEV_TCP_SHUT_WRITE) != NANOEV_SUCCESS) {
+        buf_note_failure(bc);
+    }
+}
+
+static void on_buf_connect(
+    nanoev_event *tcp,
+    int status
+    )
+{
+    buf_case *bc = (buf_case*)nanoev_event_userdata(tcp);
+
+    if (status != 0
+        || nanoev_tcp_write_buf(tcp, bc->payload, NULL, on_buf_client_write) != NANOEV_SUCCESS)
+        buf_note_failure(bc);
+}
+
+static void test_buf_tcp(nanoev_test *test)
+{
+    buf_case bc;
+    struct nanoev_addr addr;
+    nanoev_buf *head;
+
+    memset(&bc, 0, sizeof(bc));
+
+    TEST_REQUIRE(test, nanoev_init() == NANOEV_SUCCESS);
+    bc.loop = nanoev_loop_new(NULL);
+    TEST_REQUIRE(test, bc.loop);
+    bc.timer = nanoev_event_new(nanoev_event_timer, bc.loop, &bc);
+    TEST_REQUIRE(test, bc.timer);
+
+    /* a header of its own followed by a multi-chunk body taken by reference */
+    head = nanoev_buf_new();
+    TEST_REQUIRE(test, head);
+    TEST_EXPECT(test, buf_append_pattern(head, BUF_TEST_PAYLOAD, 0));
+    bc.payload = nanoev_buf_new();
+    TEST_REQUIRE(test, bc.payload);
+    TEST_EXPECT(test, buf_append_pattern(bc.payload, 7, 0));
+    TEST_EXPECT(test, nanoev_buf_append_buf(bc.payload, head, 7, BUF_TEST_PAYLOAD - 7) == NANOEV_SUCCESS);
+    nanoev_buf_unref(head);
+    TEST_EXPECT(test, nanoev_buf_segments(bc.payload, NULL, 0) == 5);
+    bc.received = nanoev_buf_new();
+    TEST_REQUIRE(test, bc.received);
+
+    bc.listener = nanoev_event_new(nanoev_event_tcp, bc.loop, &bc);
+    TEST_REQUIRE(test, bc.listener);
+    TEST_EXPECT(test, nanoev_addr_init(&addr, NANOEV_AF_INET, "127.0.0.1", 0) == NANOEV_SUCCESS);
+    TEST_REQUIRE(test, nanoev_tcp_listen(bc.listener, &addr, 4) == NANOEV_SUCCESS);
+    TEST_REQUIRE(test, nanoev_tcp_addr(bc.listener, 1, &addr) == NANOEV_SUCCESS);
+    TEST_EXPECT(test, nanoev_tcp_accept(bc.listener, NULL, on_buf_accept, NULL) == NANOEV_SUCCESS);
+
+    bc.client = nanoev_event_new(nanoev_event_tcp, bc.loop, &bc);
+    TEST_REQUIRE(test, bc.client);
+    TEST_EXPECT(test, nanoev_tcp_write_buf(bc.client, bc.payload, NULL, on_buf_client_write) == NANOEV_ERROR_ACCESS_DENIED);
+    TEST_EXPECT(test, nanoev_tcp_connect(bc.client, &addr, NULL, on_buf_connect) == NANOEV_SUCCESS);
+    TEST_EXPECT(test, nanoev_timer_add(bc.timer, seconds(2), 0, on_buf_timeout) == NANOEV_SUCCESS);
+    TEST_EXPECT(test, nanoev_loop_run(bc.loop) == NANOEV_SUCCESS);
+
+    TEST_EXPECT(test, bc.timed_out == 0);
+    TEST_EXPECT(test, bc.callback_failures == 0);
+    TEST_EXPECT(test, bc.write_called == 2);
+    TEST_EXPECT(test, bc.read_eof == 1);
+    TEST_EXPECT(test, bc.written == 2 * BUF_TEST_PAYLOAD);
+    TEST_EXPECT(test, nanoev_buf_len(bc.received) == 2 * BUF_TEST_PAYLOAD);
+    TEST_EXPECT(test, buf_matches(bc.received, 0, BUF_TEST_PAYLOAD, 0));
+    TEST_EXPECT(test, buf_matches(bc.received, BUF_TEST_PAYLOAD, BUF_TEST_PAYLOAD, 0 - BUF_TEST_PAYLOAD));
+
+    nanoev_event_free(bc.client);
+    if (bc.accepted)
+        nanoev_event_free(bc.accepted);
+    nanoev_event_free(bc.listener);
+    nanoev_event_free(bc.timer);
+    nanoev_loop_free(bc.loop);
+    nanoev_buf_unref(bc.payload);
+    nanoev_buf_unref(bc.received);
+    nanoev_term();
+}
+
+static void on_buf_udp_read(
+    nanoev_event *udp,
+    int status,
+    nanoev_buf *buf,
+    unsigned int bytes,
+    const struct nanoev_addr *from_addr
+    )
+{
+    buf_case *bc = (buf_case*)nanoev_event_userdata(udp);
+
+    if (status != 0 || buf != bc->received || bytes != bc->expect || !from_addr) {
+        buf_note_failure(bc);
+        return;
+    }
+    nanoev_loop_break(bc->loop);
+}
+
+static void on_buf_udp_write(
+    nanoev_event *udp,
+    int status,
+    nanoev_buf *buf,
+    unsigned int bytes
+    )
+{
+    buf_case *bc = (buf_case*)nanoev_event_userdata(udp);
+
+    bc->write_called++;
+    if (status != 0 || buf != bc->payload || bytes != bc->expect)
+        buf_note_failure(bc);
+}
+
+static void test_buf_udp(nanoev_test *test)
+{
+    buf_case bc;
+    struct nanoev_addr addr;
+    nanoev_buf *part;
+    char out[16];
+
+    memset(&bc, 0, sizeof(bc));
+
+    TEST_REQUIRE(test, nanoev_init() == NANOEV_SUCCESS);
+    bc.loop = nanoev_loop_new(NULL);
+    TEST_REQUIRE(test, bc.loop);
+    bc.timer = nanoev_event_new(nanoev_event_timer, bc.loop, &bc);
+    TEST_REQUIRE(test, bc.timer);
+    bc.client = nanoev_event_new(nanoev_event_udp, bc.loop, &bc);
+    TEST_REQUIRE(test, bc.client);
+
+    TEST_EXPECT(test, nanoev_addr_init(&addr, NANOEV_AF_INET, "127.0.0.1", 0) == NANOEV_SUCCESS);
+    TEST_REQUIRE(test, nanoev_udp_bind(bc.client, &addr) == NANOEV_SUCCESS);
+    TEST_REQUIRE(test, nanoev_udp_addr(bc.client, &addr) == NANOEV_SUCCESS);
+
+    /* two segments from two bufs leave as one datagram */
+    part = nanoev_buf_new();
+    TEST_REQUIRE(test, part);
+    TEST_EXPECT(test, nanoev_buf_append(part, "world", 5) == NANOEV_SUCCESS);
+    bc.payload = nanoev_buf_new();
+    TEST_REQUIRE(test, bc.payload);
+    TEST_EXPECT(test, nanoev_buf_append(bc.payload, "hello ", 6) == NANOEV_SUCCESS);
+    TEST_EXPECT(test, nanoev_buf_append_buf(bc.payload, part, 0, 5) == NANOEV_SUCCESS);
+    nanoev_buf_unref(part);
+    TEST_EXPECT(test, nanoev_buf_segments(bc.payload, NULL, 0) == 2);
+    bc.expect = 11;
+
+    bc.received = nanoev_buf_new();
+    TEST_REQUIRE(test, bc.received);
+    TEST_EXPECT(test, nanoev_udp_read_buf(bc.client, bc.received, 2048, on_buf_udp_read) == NANOEV_SUCCESS);
+    TEST_EXPECT(test, nanoev_udp_write_buf(bc.client, bc.payload, &addr, on_buf_udp_write) == NANOEV_SUCCESS);
+    TEST_EXPECT(test, nanoev_timer_add(bc.timer, seconds(2), 0, on_buf_timeout) == NANOEV_SUCCESS);
+    TEST_EXPECT(test, nanoev_loop_run(bc.loop) == NANOEV_SUCCESS);
+
+    TEST_EXPECT(test, bc.timed_out == 0);
+    TEST_EXPECT(test, bc.callback_failures == 0);
+    TEST_EXPECT(test, bc.write_called == 1);
+    TEST_EXPECT(test, nanoev_buf_len(bc.received) == 11);
+    TEST_EXPECT(test, nanoev_buf_copy(bc.received, 0, out, sizeof(out)) == 11);
+    TEST_EXPECT(test, memcmp(out, "hello world", 11) == 0);
+
+    nanoev_event_free(bc.client);
+    nanoev_event_free(bc.timer);
+    nanoev_loop_free(bc.loop);
+    nanoev_buf_unref(bc.payload);
+    nanoev_buf_unref(bc.received);
+    nanoev_term();
+}
+
+void test_buf(nanoev_test *test)
+{
+    test_buf_chain(test);
+    test_buf_tcp(test);
+    test_buf_udp(test);
+}
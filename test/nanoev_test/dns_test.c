@@ -1,18 +1,23 @@
 #include "nanoev.h"
 #include "test.h"
 
+#include <stdlib.h>
+#include <string.h>
+
 typedef struct dns_case {
     nanoev_loop *loop;
     int called;
     int status;
     unsigned int addr_count;
     unsigned short port;
+    char ip[64];
 } dns_case;
 
 typedef struct dns_pool_case {
     nanoev_loop *loop;
     int called;
     int failures;
+    unsigned int port_sum;
 } dns_pool_case;
 
 static nanoev_timeval seconds(long sec)
@@ -43,6 +48,7 @@ static void on_dns_resolve(
     tc->addr_count = addr_count;
     if (status == 0 && addr_count > 0) {
         nanoev_addr_get_port(&addrs[0], &tc->port);
+        nanoev_addr_get_ip(&addrs[0], tc->ip, sizeof(tc->ip));
     }
     nanoev_loop_break(tc->loop);
 }
@@ -90,9 +96,13 @@ static void on_dns_pool_resolve(
     )
 {
     dns_pool_case *tc = (dns_pool_case*)nanoev_event_userdata(dns);
+    unsigned short port = 0;
 
     if (status != 0 || !addrs || addr_count == 0) {
         tc->failures++;
+    } else {
+        nanoev_addr_get_port(&addrs[0], &port);
+        tc->port_sum += port;
     }
     tc->called++;
     if (tc->called == 6) {
@@ -113,6 +123,7 @@ static void test_dns_pool_handles_multiple_requests(nanoev_test *test)
     TEST_REQUIRE(test, tc.loop);
     tc.called = 0;
     tc.failures = 0;
+    tc.port_sum = 0;
 
     timer = nanoev_event_new(nanoev_event_timer, tc.loop, &tc);
     TEST_REQUIRE(test, timer);
@@ -136,8 +147,420 @@ static void test_dns_pool_handles_multiple_requests(nanoev_test *test)
     nanoev_term();
 }
 
+static void test_dns_pool_coalesces_lookups(nanoev_test *test)
+{
+    dns_pool_case tc;
+    nanoev_event *dns[6];
+    nanoev_event *timer;
+    int i;
+
+    TEST_REQUIRE(test, nanoev_init() == NANOEV_SUCCESS);
+    TEST_EXPECT(test, nanoev_dns_set_pool(0, 0) == NANOEV_ERROR_INVALID_ARG);
+    TEST_EXPECT(test, nanoev_dns_set_pool(65, 0) == NANOEV_ERROR_INVALID_ARG);
+    TEST_EXPECT(test, nanoev_dns_set_pool(1, 1) == NANOEV_SUCCESS);
+
+    tc.loop = nanoev_loop_new(NULL);
+    TEST_REQUIRE(test, tc.loop);
+    tc.called = 0;
+    tc.failures = 0;
+    tc.port_sum = 0;
+
+    timer = nanoev_event_new(nanoev_event_timer, tc.loop, &tc);
+    TEST_REQUIRE(test, timer);
+    TEST_EXPECT(test, nanoev_timer_add(timer, seconds(2), 0, on_dns_timeout) == NANOEV_SUCCESS);
+
+    /* one queue slot is enough: every request joins the pending lookup */
+    for (i = 0; i < 6; i++) {
+        dns[i] = nanoev_event_new(nanoev_event_dns, tc.loop, &tc);
+        TEST_REQUIRE(test, dns[i]);
+        TEST_EXPECT(test, nanoev_dns_resolve(dns[i], i % 2 ? "LOCALHOST" : "localhost", NANOEV_AF_UNSPEC,
+            (unsigned short)(1000 + i), on_dns_pool_resolve) == NANOEV_SUCCESS);
+    }
+
+    TEST_EXPECT(test, nanoev_loop_run(tc.loop) == NANOEV_SUCCESS);
+    TEST_EXPECT(test, tc.called == 6);
+    TEST_EXPECT(test, tc.failures == 0);
+    TEST_EXPECT(test, tc.port_sum == 6015);
+
+    nanoev_event_free(timer);
+    for (i = 0; i < 6; i++) {
+        nanoev_event_free(dns[i]);
+    }
+    nanoev_loop_free(tc.loop);
+    nanoev_term();
+}
+
+static void test_dns_cache(nanoev_test *test)
+{
+    dns_case tc;
+    nanoev_event *dns;
+    nanoev_event *timer;
+    unsigned int hits, misses;
+
+    TEST_REQUIRE(test, nanoev_init() == NANOEV_SUCCESS);
+    TEST_EXPECT(test, nanoev_dns_set_cache(16, 0, 0) == NANOEV_ERROR_INVALID_ARG);
+    TEST_EXPECT(test, nanoev_dns_set_cache(16, 60, 5) == NANOEV_SUCCESS);
+
+    tc.loop = nanoev_loop_new(NULL);
+    TEST_REQUIRE(test, tc.loop);
+    dns = nanoev_event_new(nanoev_event_dns, tc.loop, &tc);
+    TEST_REQUIRE(test, dns);
+    timer = nanoev_event_new(nanoev_event_timer, tc.loop, &tc);
+    TEST_REQUIRE(test, timer);
+    TEST_EXPECT(test, nanoev_timer_add(timer, seconds(2), 0, on_dns_timeout) == NANOEV_SUCCESS);
+
+    /* the first lookup goes to the resolver and fills the cache */
+    tc.called = 0;
+    tc.status = -1;
+    TEST_EXPECT(test, nanoev_dns_resolve(dns, "localhost", NANOEV_AF_UNSPEC, 80, on_dns_resolve) == NANOEV_SUCCESS);
+    TEST_EXPECT(test, nanoev_loop_run(tc.loop) == NANOEV_SUCCESS);
+    TEST_EXPECT(test, tc.called == 1);
+    TEST_EXPECT(test, tc.status == 0);
+
+    /* the second is a hit: asynchronous, case insensitive, with its own port */
+    tc.called = 0;
+    tc.status = -1;
+    tc.port = 0;
+    TEST_EXPECT(test, nanoev_dns_resolve(dns, "LocalHost", NANOEV_AF_UNSPEC, 8080, on_dns_resolve) == NANOEV_SUCCESS);
+    TEST_EXPECT(test, tc.called == 0);
+    TEST_EXPECT(test, nanoev_dns_resolve(dns, "localhost", NANOEV_AF_UNSPEC, 8080, on_dns_resolve) == NANOEV_ERROR_ACCESS_DENIED);
+    TEST_EXPECT(test, nanoev_loop_run(tc.loop) == NANOEV_SUCCESS);
+    TEST_EXPECT(test, tc.called == 1);
+    TEST_EXPECT(test, tc.status == 0);
+    TEST_EXPECT(test, tc.addr_count > 0);
+    TEST_EXPECT(test, tc.port == 8080);
+
+    nanoev_dns_cache_stats(&hits, &misses);
+    TEST_EXPECT(test, hits == 1);
+    TEST_EXPECT(test, misses == 1);
+
+    /* freeing the event with an undelivered hit cancels it */
+    TEST_EXPECT(test, nanoev_dns_resolve(dns, "localhost", NANOEV_AF_UNSPEC, 80, on_dns_resolve) == NANOEV_SUCCESS);
+    nanoev_event_free(dns);
+
+    TEST_EXPECT(test, nanoev_dns_set_cache(0, 0, 0) == NANOEV_SUCCESS);
+    nanoev_dns_cache_stats(&hits, &misses);
+    TEST_EXPECT(test, hits == 0 && misses == 0);
+
+    nanoev_event_free(timer);
+    nanoev_loop_free(tc.loop);
+    nanoev_term();
+}
+
+/*
+ * A fake name server for the native backend, on UDP and TCP at the same port:
+ *   a.test       - A 10.0.0.1, no AAAA
+ *   big.test     - truncated over UDP, A 10.0.0.2 over TCP
+ *   case.test    - A 10.0.0.4, the question echoed in upper case
+ *   spoof.test   - A 10.0.0.3 over UDP, after an answer for spooe.test
+ *   anything else - NXDOMAIN
+ */
+typedef struct dns_server_conn {
+    struct dns_fake_server *server;
+    unsigned char buf[512];
+    unsigned int len;
+} dns_server_conn;
+
+typedef struct dns_fake_server {
+    nanoev_event *udp;
+    nanoev_event *listener;
+    unsigned char in[512];
+    unsigned char out[512];
+    unsigned char genuine[512];      /* spoof.test: the real answer, sent second */
+    unsigned int genuine_len;
+    struct nanoev_addr genuine_to;
+    int udp_queries;
+    int tcp_queries;
+} dns_fake_server;
+
+static unsigned int dns_fake_answer(
+    const unsigned char *query,
+    unsigned int len,
+    int over_tcp,
+    unsigned char *out
+    )
+{
+    unsigned int offset = 12, name_end;
+    unsigned short qtype;
+    char name[64];
+    unsigned int name_len = 0;
+    unsigned char ip = 0;
+
+    if (len < 12)
+        return 0;
+    while (offset < len && query[offset] && name_len + query[offset] + 1 < sizeof(name)) {
+        if (name_len)
+            name[name_len++] = '.';
+        memcpy(name + name_len, query + offset + 1, query[offset]);
+        name_len += query[offset];
+        offset += 1 + query[offset];
+    }
+    name[name_len] = '\0';
+    name_end = offset + 1;
+    if (name_end + 4 > len)
+        return 0;
+    qtype = (unsigned short)((query[name_end] << 8) | query[name_end + 1]);
+
+    /* echo the header and question, then patch flags and counts */
+    memcpy(out, query, name_end + 4);
+    out[2] = 0x81;
+    out[3] = 0x80;
+    out[6] = out[7] = 0;
+    offset = name_end + 4;
+
+    if (strcmp(name, "a.test") == 0) {
+        ip = qtype == 1 ? 1 : 0;
+    } else if (strcmp(name, "case.test") == 0) {
+        for (offset = 13; offset < name_end; offset++) {
+            if (out[offset] >= 'a' && out[offset] <= 'z')
+                out[offset] = (unsigned char)(out[offset] - 'a' + 'A');
+        }
+        offset = name_end + 4;
+        ip = qtype == 1 ? 4 : 0;
+    } else if (strcmp(name, "spoof.test") == 0) {
+        ip = qtype == 1 ? 3 : 0;
+    } else if (strcmp(name, "big.test") == 0) {
+        if (!over_tcp) {
+            out[2] |= 0x02;
+            return offset;
+        }
+        ip = qtype == 1 ? 2 : 0;
+    } else {
+        out[3] |= 3;
+        return offset;
+    }
+
+    if (ip) {
+        static const unsigned char rr[] = { 0xC0, 0x0C, 0, 1, 0, 1, 0, 0, 0, 30, 0, 4, 10, 0, 0 };
+        memcpy(out + offset, rr, sizeof(rr));
+        out[offset + sizeof(rr)] = ip;
+        offset += sizeof(rr) + 1;
+        out[7] = 1;
+    }
+    return offset;
+}
+
+static void on_fake_udp_read(nanoev_event *udp, int status, void *buf, unsigned int bytes,
+    const struct nanoev_addr *from_addr);
+
+static void on_fake_udp_write(nanoev_event *udp, int status, void *buf, unsigned int bytes)
+{
+    dns_fake_server *server = (dns_fake_server*)nanoev_event_userdata(udp);
+
+    (void)status;
+    (void)buf;
+    (void)bytes;
+    if (server->genuine_len) {
+        unsigned int len = server->genuine_len;
+
+        server->genuine_len = 0;
+        if (nanoev_udp_write(udp, server->genuine, len, &server->genuine_to, on_fake_udp_write) == NANOEV_SUCCESS)
+            return;
+    }
+    nanoev_udp_read(udp, server->in, sizeof(server->in), on_fake_udp_read);
+}
+
+static void on_fake_udp_read(
+    nanoev_event *udp,
+    int status,
+    void *buf,
+    unsigned int bytes,
+    const struct nanoev_addr *from_addr
+    )
+{
+    dns_fake_server *server = (dns_fake_server*)nanoev_event_userdata(udp);
+    unsigned int len;
+
+    (void)buf;
+    len = status == 0 ? dns_fake_answer(server->in, bytes, 0, server->out) : 0;
+    if (len && bytes > 18 && memcmp(server->in + 12, "\5spoof\4test", 11) == 0) {
+        /* same id and source, but for another name: the resolver must wait for the real one */
+        memcpy(server->genuine, server->out, len);
+        server->genuine_len = len;
+        server->genuine_to = *from_addr;
+        server->out[17] = 'e';
+        if (server->out[7])
+            server->out[len - 1] = 66;
+    }
+    if (len) {
+        server->udp_queries++;
+        if (nanoev_udp_write(udp, server->out, len, from_addr, on_fake_udp_write) == NANOEV_SUCCESS)
+            return;
+    }
+    nanoev_udp_read(udp, server->in, sizeof(server->in), on_fake_udp_read);
+}
+
+static void on_fake_tcp_write(nanoev_event *tcp, int status, void *buf, unsigned int bytes)
+{
+    dns_server_conn *conn = (dns_server_conn*)nanoev_event_userdata(tcp);
+
+    (void)status;
+    (void)buf;
+    (void)bytes;
+    nanoev_event_free(tcp);
+    free(conn);
+}
+
+static void on_fake_tcp_read(nanoev_event *tcp, int status, void *buf, unsigned int bytes)
+{
+    dns_server_conn *conn = (dns_server_conn*)nanoev_event_userdata(tcp);
+    dns_fake_server *server = conn->server;
+    unsigned int need, len;
+
+    (void)buf;
+    if (status != 0 || bytes == 0) {
+        nanoev_event_free(tcp);
+        free(conn);
+        return;
+    }
+
+    conn->len += bytes;
+    need = conn->len >= 2 ? 2 + ((conn->buf[0] << 8) | conn->buf[1]) : 2;
+    if (conn->len < need) {
+        nanoev_tcp_read(tcp, conn->buf + conn->len, sizeof(conn->buf) - conn->len, NULL, on_fake_tcp_read);
+        return;
+    }
+
+    server->tcp_queries++;
+    len = dns_fake_answer(conn->buf + 2, need - 2, 1, server->out + 2);
+    server->out[0] = (unsigned char)(len >> 8);
+    server->out[1] = (unsigned char)(len & 0xFF);
+    memcpy(conn->buf, server->out, 2 + len);
+    nanoev_tcp_write(tcp, conn->buf, 2 + len, NULL, on_fake_tcp_write);
+}
+
+static void on_fake_tcp_accept(nanoev_event *listener, int status, nanoev_event *tcp)
+{
+    dns_fake_server *server = (dns_fake_server*)nanoev_event_userdata(listener);
+    dns_server_conn *conn;
+
+    if (status == 0 && tcp) {
+        conn = (dns_server_conn*)malloc(sizeof(dns_server_conn));
+        conn->server = server;
+        conn->len = 0;
+        nanoev_event_set_userdata(tcp, conn);
+        nanoev_tcp_read(tcp, conn->buf, sizeof(conn->buf), NULL, on_fake_tcp_read);
+    }
+    nanoev_tcp_accept(listener, NULL, on_fake_tcp_accept, NULL);
+}
+
+static int resolve_native(dns_case *tc, nanoev_event *dns, const char *host)
+{
+    tc->called = 0;
+    tc->status = -1;
+    tc->addr_count = 0;
+    tc->port = 0;
+    tc->ip[0] = '\0';
+    if (nanoev_dns_resolve(dns, host, NANOEV_AF_UNSPEC, 80, on_dns_resolve) != NANOEV_SUCCESS)
+        return 0;
+    return nanoev_loop_run(tc->loop) == NANOEV_SUCCESS && tc->called;
+}
+
+static void test_dns_native_backend(nanoev_test *test)
+{
+    dns_case tc;
+    dns_fake_server server;
+    struct nanoev_addr addr;
+    nanoev_event *dns;
+    nanoev_event *timer;
+    unsigned short port = 0;
+    int i;
+
+    TEST_REQUIRE(test, nanoev_init() == NANOEV_SUCCESS);
+    TEST_EXPECT(test, nanoev_dns_set_backend(2, NULL, 0) == NANOEV_ERROR_INVALID_ARG);
+
+    tc.loop = nanoev_loop_new(NULL);
+    TEST_REQUIRE(test, tc.loop);
+    memset(&server, 0, sizeof(server));
+
+    /* the TCP listener shares the UDP port, which another socket may already hold */
+    for (i = 0; i < 16; i++) {
+        server.udp = nanoev_event_new(nanoev_event_udp, tc.loop, &server);
+        TEST_REQUIRE(test, server.udp);
+        TEST_EXPECT(test, nanoev_addr_init(&addr, NANOEV_AF_INET, "127.0.0.1", 0) == NANOEV_SUCCESS);
+        TEST_REQUIRE(test, nanoev_udp_bind(server.udp, &addr) == NANOEV_SUCCESS);
+        TEST_REQUIRE(test, nanoev_udp_addr(server.udp, &addr) == NANOEV_SUCCESS);
+
+        server.listener = nanoev_event_new(nanoev_event_tcp, tc.loop, &server);
+        TEST_REQUIRE(test, server.listener);
+        if (nanoev_tcp_listen(server.listener, &addr, 8) == NANOEV_SUCCESS)
+            break;
+        nanoev_event_free(server.listener);
+        nanoev_event_free(server.udp);
+        server.listener = NULL;
+        server.udp = NULL;
+    }
+    TEST_REQUIRE(test, server.listener);
+    nanoev_addr_get_port(&addr, &port);
+    TEST_EXPECT(test, nanoev_udp_read(server.udp, server.in, sizeof(server.in), on_fake_udp_read) == NANOEV_SUCCESS);
+    TEST_EXPECT(test, nanoev_tcp_accept(server.listener, NULL, on_fake_tcp_accept, NULL) == NANOEV_SUCCESS);
+
+    TEST_EXPECT(test, nanoev_dns_set_backend(NANOEV_DNS_BACKEND_NATIVE, &addr, 1) == NANOEV_SUCCESS);
+
+    dns = nanoev_event_new(nanoev_event_dns, tc.loop, &tc);
+    TEST_REQUIRE(test, dns);
+    timer = nanoev_event_new(nanoev_event_timer, tc.loop, &tc);
+    TEST_REQUIRE(test, timer);
+    TEST_EXPECT(test, nanoev_timer_add(timer, seconds(2), 0, on_dns_timeout) == NANOEV_SUCCESS);
+
+    /* A and AAAA go out together, only A has an answer */
+    TEST_EXPECT(test, resolve_native(&tc, dns, "a.test"));
+    TEST_EXPECT(test, tc.status == 0);
+    TEST_EXPECT(test, tc.addr_count == 1);
+    TEST_EXPECT(test, strcmp(tc.ip, "10.0.0.1") == 0);
+    TEST_EXPECT(test, tc.port == 80);
+    TEST_EXPECT(test, server.udp_queries == 2);
+
+    /* a truncated answer is asked again over TCP */
+    TEST_EXPECT(test, resolve_native(&tc, dns, "big.test"));
+    TEST_EXPECT(test, tc.status == 0);
+    TEST_EXPECT(test, tc.addr_count == 1);
+    TEST_EXPECT(test, strcmp(tc.ip, "10.0.0.2") == 0);
+    TEST_EXPECT(test, server.tcp_queries == 2);
+
+    /* an answer for another name is ignored, the question's case is not */
+    TEST_EXPECT(test, resolve_native(&tc, dns, "spoof.test"));
+    TEST_EXPECT(test, tc.status == 0);
+    TEST_EXPECT(test, tc.addr_count == 1);
+    TEST_EXPECT(test, strcmp(tc.ip, "10.0.0.3") == 0);
+    TEST_EXPECT(test, resolve_native(&tc, dns, "case.test"));
+    TEST_EXPECT(test, tc.status == 0);
+    TEST_EXPECT(test, tc.addr_count == 1);
+    TEST_EXPECT(test, strcmp(tc.ip, "10.0.0.4") == 0);
+
+    TEST_EXPECT(test, resolve_native(&tc, dns, "missing.test"));
+    TEST_EXPECT(test, tc.status != 0);
+    TEST_EXPECT(test, tc.addr_count == 0);
+
+    /* numeric addresses and hosts file names never reach the server */
+    server.udp_queries = 0;
+    TEST_EXPECT(test, resolve_native(&tc, dns, "192.0.2.7"));
+    TEST_EXPECT(test, tc.status == 0);
+    TEST_EXPECT(test, strcmp(tc.ip, "192.0.2.7") == 0);
+    TEST_EXPECT(test, resolve_native(&tc, dns, "localhost"));
+    TEST_EXPECT(test, tc.status == 0);
+    TEST_EXPECT(test, tc.addr_count > 0);
+    TEST_EXPECT(test, tc.port == 80);
+    TEST_EXPECT(test, server.udp_queries == 0);
+
+    /* freeing the event cancels a query in flight */
+    TEST_EXPECT(test, nanoev_dns_resolve(dns, "a.test", NANOEV_AF_INET, 80, on_dns_resolve) == NANOEV_SUCCESS);
+    nanoev_event_free(dns);
+
+    TEST_EXPECT(test, nanoev_dns_set_backend(NANOEV_DNS_BACKEND_SYSTEM, NULL, 0) == NANOEV_SUCCESS);
+
+    nanoev_event_free(timer);
+    nanoev_event_free(server.listener);
+    nanoev_event_free(server.udp);
+    nanoev_loop_free(tc.loop);
+    nanoev_term();
+}
+
 void test_dns(nanoev_test *test)
 {
     test_dns_resolves_localhost(test);
     test_dns_pool_handles_multiple_requests(test);
+    test_dns_pool_coalesces_lookups(test);
+    test_dns_cache(test);
+    test_dns_native_backend(test);
 }
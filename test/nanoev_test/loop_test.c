@@ -1,5 +1,6 @@
 #include "nanoev.h"
 #include "test.h"
+#include <string.h>
 #ifndef _WIN32
 # include <fcntl.h>
 # include <unistd.h>
@@ -52,9 +53,428 @@ cleanup:
 }
 #endif
 
+typedef struct busy_poll_case {
+    nanoev_loop *loop;
+    int ticks;
+    int timed_out;
+} busy_poll_case;
+
+static void on_busy_poll_tick(nanoev_event *timer)
+{
+    busy_poll_case *bc = (busy_poll_case*)nanoev_event_userdata(timer);
+
+    if (++bc->ticks == 20) {
+        nanoev_loop_break(bc->loop);
+    }
+}
+
+static void on_busy_poll_timeout(nanoev_event *timer)
+{
+    busy_poll_case *bc = (busy_poll_case*)nanoev_event_userdata(timer);
+
+    bc->timed_out = 1;
+    nanoev_loop_break(bc->loop);
+}
+
+static void test_loop_busy_poll(nanoev_test *test)
+{
+    busy_poll_case bc;
+    nanoev_event *tick = NULL;
+    nanoev_event *guard = NULL;
+    nanoev_timeval budget, interval;
+
+    bc.ticks = 0;
+    bc.timed_out = 0;
+
+    TEST_REQUIRE(test, nanoev_init() == NANOEV_SUCCESS);
+    bc.loop = nanoev_loop_new(NULL);
+    TEST_REQUIRE(test, bc.loop);
+
+    budget.tv_sec = 0;
+    budget.tv_usec = 1000000;
+    TEST_EXPECT(test, nanoev_loop_set_busy_poll(bc.loop, &budget) == NANOEV_ERROR_INVALID_ARG);
+    budget.tv_sec = 1;
+    budget.tv_usec = 0;
+    TEST_EXPECT(test, nanoev_loop_set_busy_poll(bc.loop, &budget) == NANOEV_ERROR_INVALID_ARG);
+    budget.tv_sec = 0;
+    budget.tv_usec = 2000;
+    TEST_EXPECT(test, nanoev_loop_set_busy_poll(bc.loop, &budget) == NANOEV_SUCCESS);
+
+    tick = nanoev_event_new(nanoev_event_timer, bc.loop, &bc);
+    guard = nanoev_event_new(nanoev_event_timer, bc.loop, &bc);
+    TEST_EXPECT(test, tick && guard);
+    if (!tick || !guard) {
+        goto cleanup;
+    }
+
+    /* timers keep firing while the loop spins with a zero time-out */
+    interval.tv_sec = 0;
+    interval.tv_usec = 1000;
+    TEST_EXPECT(test, nanoev_timer_add(tick, interval, 1, on_busy_poll_tick) == NANOEV_SUCCESS);
+    interval.tv_sec = 2;
+    interval.tv_usec = 0;
+    TEST_EXPECT(test, nanoev_timer_add(guard, interval, 0, on_busy_poll_timeout) == NANOEV_SUCCESS);
+    TEST_EXPECT(test, nanoev_loop_run(bc.loop) == NANOEV_SUCCESS);
+
+    TEST_EXPECT(test, bc.timed_out == 0);
+    TEST_EXPECT(test, bc.ticks == 20);
+    TEST_EXPECT(test, nanoev_loop_set_busy_poll(bc.loop, NULL) == NANOEV_SUCCESS);
+
+cleanup:
+    if (tick) {
+        nanoev_event_free(tick);
+    }
+    if (guard) {
+        nanoev_event_free(guard);
+    }
+    nanoev_loop_free(bc.loop);
+    nanoev_term();
+}
+
+typedef struct stats_case {
+    nanoev_loop *loop;
+    int ticks;
+    nanoev_loop_stats stats;
+} stats_case;
+
+static void on_stats_tick(nanoev_event *timer)
+{
+    stats_case *sc = (stats_case*)nanoev_event_userdata(timer);
+
+    if (++sc->ticks == 3) {
+        nanoev_loop_get_stats(sc->loop, &sc->stats);
+        nanoev_loop_break(sc->loop);
+    }
+}
+
+static void test_loop_stats(nanoev_test *test)
+{
+    stats_case sc;
+    nanoev_event *tick = NULL;
+    nanoev_event *udp = NULL;
+    nanoev_event *async = NULL;
+    nanoev_loop_stats stats;
+    nanoev_timeval interval;
+    unsigned long long polls;
+    int i;
+
+    memset(&sc, 0, sizeof(sc));
+
+    TEST_REQUIRE(test, nanoev_init() == NANOEV_SUCCESS);
+    sc.loop = nanoev_loop_new(NULL);
+    TEST_REQUIRE(test, sc.loop);
+
+    nanoev_loop_get_stats(sc.loop, &stats);
+    TEST_EXPECT(test, stats.iterations == 0);
+    TEST_EXPECT(test, stats.timer_count == 0);
+
+    tick = nanoev_event_new(nanoev_event_timer, sc.loop, &sc);
+    udp = nanoev_event_new(nanoev_event_udp, sc.loop, NULL);
+    async = nanoev_event_new(nanoev_event_async, sc.loop, NULL);
+    TEST_EXPECT(test, tick && udp && async);
+    if (!tick || !udp || !async) {
+        goto cleanup;
+    }
+
+    interval.tv_sec = 0;
+    interval.tv_usec = 2000;
+    TEST_EXPECT(test, nanoev_timer_add(tick, interval, 1, on_stats_tick) == NANOEV_SUCCESS);
+    TEST_EXPECT(test, nanoev_loop_run(sc.loop) == NANOEV_SUCCESS);
+
+    TEST_EXPECT(test, sc.ticks == 3);
+    TEST_EXPECT(test, sc.stats.iterations >= 3);
+    TEST_EXPECT(test, sc.stats.timers_fired == 3);
+    TEST_EXPECT(test, sc.stats.timer_lateness_max_usec * 3 >= sc.stats.timer_lateness_usec);
+    TEST_EXPECT(test, sc.stats.timer_count == 0);   /* a firing timer is out of the heap */
+    TEST_EXPECT(test, sc.stats.poll_usec > 0);
+    TEST_EXPECT(test, sc.stats.fake_io_depth == 0);
+    TEST_EXPECT(test, sc.stats.endgame_count == 0);
+    TEST_EXPECT(test, sc.stats.tcp_count == 0);
+    TEST_EXPECT(test, sc.stats.udp_count == 1);
+    TEST_EXPECT(test, sc.stats.async_count == 1);
+
+    polls = 0;
+    for (i = 0; i < NANOEV_LOOP_STATS_BUCKETS; i++) {
+        polls += sc.stats.events_per_poll[i];
+    }
+    TEST_EXPECT(test, polls == sc.stats.iterations);
+
+    nanoev_event_free(udp);
+    udp = NULL;
+    nanoev_loop_get_stats(sc.loop, &stats);
+    TEST_EXPECT(test, stats.timer_count == 1);
+    TEST_EXPECT(test, stats.udp_count == 0);
+    TEST_EXPECT(test, stats.async_count == 1);
+
+cleanup:
+    if (tick) {
+        nanoev_event_free(tick);
+    }
+    if (udp) {
+        nanoev_event_free(udp);
+    }
+    if (async) {
+        nanoev_event_free(async);
+    }
+    nanoev_loop_free(sc.loop);
+    nanoev_term();
+}
+
+typedef struct stats_tcp_case {
+    nanoev_loop *loop;
+    nanoev_event *accepted;
+    int connected;
+    int failures;
+    nanoev_loop_stats stats;
+} stats_tcp_case;
+
+static void stats_tcp_check_done(stats_tcp_case *sc)
+{
+    if (sc->accepted && sc->connected) {
+        nanoev_loop_get_stats(sc->loop, &sc->stats);
+        nanoev_loop_break(sc->loop);
+    }
+}
+
+static void on_stats_accept(nanoev_event *listener, int status, nanoev_event *tcp_new)
+{
+    stats_tcp_case *sc = (stats_tcp_case*)nanoev_event_userdata(listener);
+
+    if (status != 0 || !tcp_new) {
+        sc->failures++;
+        nanoev_loop_break(sc->loop);
+        return;
+    }
+    sc->accepted = tcp_new;
+    stats_tcp_check_done(sc);
+}
+
+static void on_stats_connect(nanoev_event *tcp, int status)
+{
+    stats_tcp_case *sc = (stats_tcp_case*)nanoev_event_userdata(tcp);
+
+    if (status != 0) {
+        sc->failures++;
+        nanoev_loop_break(sc->loop);
+        return;
+    }
+    sc->connected = 1;
+    stats_tcp_check_done(sc);
+}
+
+static void on_stats_tcp_timeout(nanoev_event *timer)
+{
+    stats_tcp_case *sc = (stats_tcp_case*)nanoev_event_userdata(timer);
+
+    sc->failures++;
+    nanoev_loop_break(sc->loop);
+}
+
+static void test_loop_stats_accept(nanoev_test *test)
+{
+    stats_tcp_case sc;
+    nanoev_event *listener = NULL;
+    nanoev_event *client = NULL;
+    nanoev_event *guard = NULL;
+    struct nanoev_addr addr;
+    nanoev_loop_stats stats;
+    nanoev_timeval after;
+
+    memset(&sc, 0, sizeof(sc));
+
+    TEST_REQUIRE(test, nanoev_init() == NANOEV_SUCCESS);
+    sc.loop = nanoev_loop_new(NULL);
+    TEST_REQUIRE(test, sc.loop);
+
+    listener = nanoev_event_new(nanoev_event_tcp, sc.loop, &sc);
+    client = nanoev_event_new(nanoev_event_tcp, sc.loop, &sc);
+    guard = nanoev_event_new(nanoev_event_timer, sc.loop, &sc);
+    TEST_EXPECT(test, listener && client && guard);
+    if (!listener || !client || !guard) {
+        goto cleanup;
+    }
+
+    TEST_EXPECT(test, nanoev_addr_init(&addr, NANOEV_AF_INET, "127.0.0.1", 0) == NANOEV_SUCCESS);
+    TEST_EXPECT(test, nanoev_tcp_listen(listener, &addr, 4) == NANOEV_SUCCESS);
+    TEST_EXPECT(test, nanoev_tcp_addr(listener, 1, &addr) == NANOEV_SUCCESS);
+    TEST_EXPECT(test, nanoev_tcp_accept(listener, NULL, on_stats_accept, NULL) == NANOEV_SUCCESS);
+    TEST_EXPECT(test, nanoev_tcp_connect(client, &addr, NULL, on_stats_connect) == NANOEV_SUCCESS);
+    after.tv_sec = 2;
+    after.tv_usec = 0;
+    TEST_EXPECT(test, nanoev_timer_add(guard, after, 0, on_stats_tcp_timeout) == NANOEV_SUCCESS);
+    TEST_EXPECT(test, nanoev_loop_run(sc.loop) == NANOEV_SUCCESS);
+    TEST_EXPECT(test, sc.failures == 0);
+
+    /* an accepted connection counts like one created with nanoev_event_new() */
+    TEST_EXPECT(test, sc.accepted != NULL);
+    TEST_EXPECT(test, sc.stats.tcp_count == 3);
+
+    if (sc.accepted) {
+        nanoev_event_free(sc.accepted);
+        sc.accepted = NULL;
+    }
+    nanoev_loop_get_stats(sc.loop, &stats);
+    TEST_EXPECT(test, stats.tcp_count == 2);
+
+    nanoev_event_free(client);
+    client = NULL;
+    nanoev_event_free(listener);
+    listener = NULL;
+    nanoev_loop_get_stats(sc.loop, &stats);
+    TEST_EXPECT(test, stats.tcp_count == 0);
+
+cleanup:
+    if (sc.accepted) {
+        nanoev_event_free(sc.accepted);
+    }
+    if (client) {
+        nanoev_event_free(client);
+    }
+    if (listener) {
+        nanoev_event_free(listener);
+    }
+    if (guard) {
+        nanoev_event_free(guard);
+    }
+    nanoev_loop_free(sc.loop);
+    nanoev_term();
+}
+
+typedef struct slow_case {
+    nanoev_loop *loop;
+    nanoev_event *fast;
+    nanoev_event *slow;
+    int fast_ticks;
+    int slow_reports;
+    int other_reports;
+    int last_type;
+    void *last_userdata;
+    nanoev_timeval last_elapsed;
+    int stalls;
+    nanoev_timeval last_stalled;
+} slow_case;
+
+static slow_case *g_slow_case;
+
+static void spin_for_msec(int msec)
+{
+    nanoev_timeval start, now;
+
+    nanoev_now(&start);
+    do {
+        nanoev_now(&now);
+    } while ((now.tv_sec - start.tv_sec) * 1000000L + (now.tv_usec - start.tv_usec) < msec * 1000L);
+}
+
+static void on_slow_report(nanoev_loop *loop, int type, void *userdata, const nanoev_timeval *elapsed)
+{
+    slow_case *sc = (slow_case*)nanoev_loop_userdata(loop);
+
+    if (userdata == sc) {
+        sc->slow_reports++;
+    } else {
+        sc->other_reports++;
+    }
+    sc->last_type = type;
+    sc->last_userdata = userdata;
+    sc->last_elapsed = *elapsed;
+}
+
+static void on_stall_report(nanoev_loop *loop, const nanoev_timeval *stalled)
+{
+    /* watchdog thread: only touch fields the loop thread does not write */
+    g_slow_case->stalls++;
+    g_slow_case->last_stalled = *stalled;
+    (void)loop;
+}
+
+static void on_fast_tick(nanoev_event *timer)
+{
+    slow_case *sc = (slow_case*)nanoev_loop_userdata(nanoev_event_loop(timer));
+
+    sc->fast_ticks++;
+}
+
+static void on_slow_tick(nanoev_event *timer)
+{
+    slow_case *sc = (slow_case*)nanoev_event_userdata(timer);
+
+    spin_for_msec(60);
+    nanoev_event_free(timer);
+    sc->slow = NULL;
+    nanoev_loop_break(sc->loop);
+}
+
+static void test_loop_slow_callback(nanoev_test *test)
+{
+    slow_case sc;
+    nanoev_timeval threshold, interval;
+
+    memset(&sc, 0, sizeof(sc));
+    g_slow_case = &sc;
+
+    TEST_REQUIRE(test, nanoev_init() == NANOEV_SUCCESS);
+    sc.loop = nanoev_loop_new(&sc);
+    TEST_REQUIRE(test, sc.loop);
+
+    threshold.tv_sec = 0;
+    threshold.tv_usec = 1000000;
+    TEST_EXPECT(test, nanoev_loop_set_slow_callback(sc.loop, &threshold, on_slow_report) == NANOEV_ERROR_INVALID_ARG);
+    TEST_EXPECT(test, nanoev_loop_set_watchdog(sc.loop, &threshold, on_stall_report) == NANOEV_ERROR_INVALID_ARG);
+    threshold.tv_usec = 0;
+    TEST_EXPECT(test, nanoev_loop_set_watchdog(sc.loop, &threshold, on_stall_report) == NANOEV_ERROR_INVALID_ARG);
+
+    threshold.tv_usec = 20000;
+    TEST_EXPECT(test, nanoev_loop_set_slow_callback(sc.loop, &threshold, on_slow_report) == NANOEV_SUCCESS);
+    TEST_EXPECT(test, nanoev_loop_set_watchdog(sc.loop, &threshold, on_stall_report) == NANOEV_SUCCESS);
+
+    sc.fast = nanoev_event_new(nanoev_event_timer, sc.loop, NULL);
+    sc.slow = nanoev_event_new(nanoev_event_timer, sc.loop, &sc);
+    TEST_EXPECT(test, sc.fast && sc.slow);
+    if (!sc.fast || !sc.slow) {
+        goto cleanup;
+    }
+
+    interval.tv_sec = 0;
+    interval.tv_usec = 1000;
+    TEST_EXPECT(test, nanoev_timer_add(sc.fast, interval, 1, on_fast_tick) == NANOEV_SUCCESS);
+    interval.tv_usec = 30000;
+    TEST_EXPECT(test, nanoev_timer_add(sc.slow, interval, 0, on_slow_tick) == NANOEV_SUCCESS);
+    TEST_EXPECT(test, nanoev_loop_run(sc.loop) == NANOEV_SUCCESS);
+
+    /* the slow timer freed itself, the report still carries its identity */
+    TEST_EXPECT(test, sc.fast_ticks > 0);
+    TEST_EXPECT(test, sc.slow_reports == 1);
+    TEST_EXPECT(test, sc.other_reports == 0);
+    TEST_EXPECT(test, sc.last_type == nanoev_event_timer);
+    TEST_EXPECT(test, sc.last_userdata == &sc);
+    TEST_EXPECT(test, sc.last_elapsed.tv_sec > 0 || sc.last_elapsed.tv_usec >= 60000);
+
+    /* joins the watchdog thread */
+    TEST_EXPECT(test, nanoev_loop_set_watchdog(sc.loop, NULL, NULL) == NANOEV_SUCCESS);
+    TEST_EXPECT(test, sc.stalls == 1);
+    TEST_EXPECT(test, sc.last_stalled.tv_sec > 0 || sc.last_stalled.tv_usec >= 20000);
+    TEST_EXPECT(test, nanoev_loop_set_slow_callback(sc.loop, NULL, NULL) == NANOEV_SUCCESS);
+
+cleanup:
+    if (sc.fast) {
+        nanoev_event_free(sc.fast);
+    }
+    if (sc.slow) {
+        nanoev_event_free(sc.slow);
+    }
+    nanoev_loop_free(sc.loop);
+    nanoev_term();
+    g_slow_case = NULL;
+}
+
 void test_loop(nanoev_test *test)
 {
 #ifndef _WIN32
     test_loop_allows_poller_fd_zero(test);
 #endif
+    test_loop_busy_poll(test);
+    test_loop_stats(test);
+    test_loop_stats_accept(test);
+    test_loop_slow_callback(test);
 }
@@ -3,10 +3,15 @@
 
 void test_addr(nanoev_test *test);
 void test_async(nanoev_test *test);
+void test_buf(nanoev_test *test);
 void test_dns(nanoev_test *test);
 void test_event(nanoev_test *test);
 void test_loop(nanoev_test *test);
 void test_tcp(nanoev_test *test);
+void test_tcp_fanout(nanoev_test *test);
+void test_tcp_frame(nanoev_test *test);
+void test_tcp_read(nanoev_test *test);
+void test_tcp_pool(nanoev_test *test);
 void test_udp(nanoev_test *test);
 void test_thread(nanoev_test *test);
 void test_timer(nanoev_test *test);
@@ -28,10 +33,15 @@ int main(void)
 
     test_addr(&test);
     test_async(&test);
+    test_buf(&test);
     test_dns(&test);
     test_event(&test);
     test_loop(&test);
     test_tcp(&test);
+    test_tcp_fanout(&test);
+    test_tcp_frame(&test);
+    test_tcp_read(&test);
+    test_tcp_pool(&test);
     test_udp(&test);
     test_thread(&test);
     test_timer(&test);
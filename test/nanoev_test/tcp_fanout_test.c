@@ -0,0 +1,349 @@
+#include "nanoev.h"
+#include "test.h"
+#include <string.h>
+
+#define FANOUT_CLIENTS  3
+#define FANOUT_BIG      (32 * 1024 * 1024)
+
+typedef struct fanout_client {
+    struct fanout_case *fc;
+    nanoev_event *tcp;
+    char data[256];
+    unsigned int received;
+    unsigned int expect;
+} fanout_client;
+
+typedef struct fanout_case {
+    nanoev_loop *loop;
+    nanoev_tcp_fanout *fanout;
+    nanoev_event *listener;
+    nanoev_event *timer;
+    fanout_client clients[FANOUT_CLIENTS];
+    nanoev_event *accepted[FANOUT_CLIENTS];
+    unsigned int accepted_count;
+    unsigned int client_count;
+    unsigned int connected;
+    nanoev_event *dropped;
+    int drop_status;
+    int drops;
+    int timed_out;
+    int callback_failures;
+} fanout_case;
+
+static nanoev_timeval msecs(long ms)
+{
+    nanoev_timeval tv;
+    tv.tv_sec = ms / 1000;
+    tv.tv_usec = (ms % 1000) * 1000;
+    return tv;
+}
+
+static void on_fanout_timeout(nanoev_event *timer)
+{
+    fanout_case *fc = (fanout_case*)nanoev_event_userdata(timer);
+    fc->timed_out = 1;
+    nanoev_loop_break(fc->loop);
+}
+
+static void fanout_run(fanout_case *fc, long limit_ms)
+{
+    fc->timed_out = 0;
+    nanoev_timer_add(fc->timer, msecs(limit_ms), 0, on_fanout_timeout);
+    nanoev_loop_run(fc->loop);
+    nanoev_timer_del(fc->timer);
+}
+
+static int fanout_clients_done(fanout_case *fc)
+{
+    unsigned int i;
+    for (i = 0; i < fc->client_count; i++) {
+        if (fc->clients[i].tcp && fc->clients[i].received < fc->clients[i].expect)
+            return 0;
+    }
+    return 1;
+}
+
+static void fanout_check_setup(fanout_case *fc)
+{
+    if (fc->connected == fc->client_count && fc->accepted_count == fc->client_count)
+        nanoev_loop_break(fc->loop);
+}
+
+static void on_fanout_client_read(
+    nanoev_event *tcp,
+    int status,
+    void *buf,
+    unsigned int bytes
+    )
+{
+    fanout_client *client = (fanout_client*)nanoev_event_userdata(tcp);
+    fanout_case *fc = client->fc;
+
+    (void)buf;
+    if (status != 0 || bytes == 0) {
+        fc->callback_failures++;
+        nanoev_loop_break(fc->loop);
+        return;
+    }
+    client->received += bytes;
+    if (fanout_clients_done(fc))
+        nanoev_loop_break(fc->loop);
+    if (nanoev_tcp_read(tcp, client->data + client->received,
+        sizeof(client->data) - client->received, NULL, on_fanout_client_read) != NANOEV_SUCCESS)
+        fc->callback_failures++;
+}
+
+static void on_fanout_connect(
+    nanoev_event *tcp,
+    int status
+    )
+{
+    fanout_client *client = (fanout_client*)nanoev_event_userdata(tcp);
+
+    if (status != 0) {
+        client->fc->callback_failures++;
+        return;
+    }
+    client->fc->connected++;
+    fanout_check_setup(client->fc);
+}
+
+static void on_fanout_accept(
+    nanoev_event *tcp,
+    int status,
+    nanoev_event *tcp_new
+    )
+{
+    fanout_case *fc = (fanout_case*)nanoev_event_userdata(tcp);
+
+    if (status != 0 || !tcp_new || fc->accepted_count == fc->client_count) {
+        fc->callback_failures++;
+        if (tcp_new)
+            nanoev_event_free(tcp_new);
+        return;
+    }
+    fc->accepted[fc->accepted_count++] = tcp_new;
+    if (nanoev_tcp_fanout_add(fc->fanout, tcp_new) != NANOEV_SUCCESS)
+        fc->callback_failures++;
+    fanout_check_setup(fc);
+    if (fc->accepted_count < fc->client_count
+        && nanoev_tcp_accept(tcp, NULL, on_fanout_accept, NULL) != NANOEV_SUCCESS)
+        fc->callback_failures++;
+}
+
+static void on_fanout_drop(
+    nanoev_tcp_fanout *fanout,
+    nanoev_event *tcp,
+    int status,
+    void *userdata
+    )
+{
+    fanout_case *fc = (fanout_case*)userdata;
+
+    if (fanout != fc->fanout)
+        fc->callback_failures++;
+    fc->drops++;
+    fc->dropped = tcp;
+    fc->drop_status = status;
+    nanoev_loop_break(fc->loop);
+}
+
+static int fanout_setup(fanout_case *fc, unsigned int clients, unsigned int max_queued_bytes, int policy)
+{
+    struct nanoev_addr addr;
+    unsigned int i;
+
+    memset(fc, 0, sizeof(fanout_case));
+    fc->client_count = clients;
+    fc->loop = nanoev_loop_new(NULL);
+    if (!fc->loop)
+        return 0;
+    fc->timer = nanoev_event_new(nanoev_event_timer, fc->loop, fc);
+    fc->fanout = nanoev_tcp_fanout_new(fc->loop, max_queued_bytes, policy, on_fanout_drop, fc);
+    fc->listener = nanoev_event_new(nanoev_event_tcp, fc->loop, fc);
+    if (!fc->timer || !fc->fanout || !fc->listener)
+        return 0;
+
+    nanoev_addr_init(&addr, NANOEV_AF_INET, "127.0.0.1", 0);
+    if (nanoev_tcp_listen(fc->listener, &addr, FANOUT_CLIENTS) != NANOEV_SUCCESS
+        || nanoev_tcp_addr(fc->listener, 1, &addr) != NANOEV_SUCCESS
+        || nanoev_tcp_accept(fc->listener, NULL, on_fanout_accept, NULL) != NANOEV_SUCCESS)
+        return 0;
+
+    for (i = 0; i < clients; i++) {
+        fc->clients[i].fc = fc;
+        fc->clients[i].tcp = nanoev_event_new(nanoev_event_tcp, fc->loop, &fc->clients[i]);
+        if (!fc->clients[i].tcp
+            || nanoev_tcp_connect(fc->clients[i].tcp, &addr, NULL, on_fanout_connect) != NANOEV_SUCCESS)
+            return 0;
+    }
+    fanout_run(fc, 2000);
+    return !fc->timed_out && fc->callback_failures == 0;
+}
+
+static void fanout_teardown(fanout_case *fc)
+{
+    unsigned int i;
+
+    if (fc->fanout)
+        nanoev_tcp_fanout_free(fc->fanout);
+    for (i = 0; i < FANOUT_CLIENTS; i++) {
+        if (fc->clients[i].tcp)
+            nanoev_event_free(fc->clients[i].tcp);
+        if (fc->accepted[i])
+            nanoev_event_free(fc->accepted[i]);
+    }
+    if (fc->listener)
+        nanoev_event_free(fc->listener);
+    if (fc->timer)
+        nanoev_event_free(fc->timer);
+    if (fc->loop)
+        nanoev_loop_free(fc->loop);
+}
+
+static nanoev_buf* fanout_message(const char *text)
+{
+    nanoev_buf *buf = nanoev_buf_new();
+    if (buf && nanoev_buf_append(buf, text, (unsigned int)strlen(text)) != NANOEV_SUCCESS) {
+        nanoev_buf_unref(buf);
+        buf = NULL;
+    }
+    return buf;
+}
+
+static void test_tcp_fanout_broadcast(nanoev_test *test)
+{
+    fanout_case fc;
+    nanoev_tcp_fanout_stats stats;
+    nanoev_buf *msg;
+    const char *parts[] = { "alpha;", "bravo;", "charlie;" };
+    unsigned int i;
+
+    TEST_REQUIRE(test, nanoev_init() == NANOEV_SUCCESS);
+    TEST_REQUIRE(test, fanout_setup(&fc, FANOUT_CLIENTS, 0, NANOEV_FANOUT_DROP_SUBSCRIBER));
+    TEST_EXPECT(test, nanoev_tcp_fanout_add(fc.fanout, fc.accepted[0]) == NANOEV_ERROR_ACCESS_DENIED);
+    TEST_EXPECT(test, nanoev_tcp_fanout_add(fc.fanout, fc.timer) == NANOEV_ERROR_INVALID_ARG);
+
+    for (i = 0; i < FANOUT_CLIENTS; i++) {
+        fc.clients[i].expect = 20;
+        TEST_EXPECT(test, nanoev_tcp_read(fc.clients[i].tcp, fc.clients[i].data,
+            sizeof(fc.clients[i].data), NULL, on_fanout_client_read) == NANOEV_SUCCESS);
+    }
+
+    /* three messages published back to back go out as one write per subscriber */
+    for (i = 0; i < 3; i++) {
+        msg = fanout_message(parts[i]);
+        TEST_REQUIRE(test, msg);
+        TEST_EXPECT(test, nanoev_tcp_fanout_publish(fc.fanout, msg) == NANOEV_SUCCESS);
+        nanoev_buf_unref(msg);
+    }
+    nanoev_tcp_fanout_get_stats(fc.fanout, &stats);
+    TEST_EXPECT(test, stats.flushes == 0);
+    TEST_EXPECT(test, stats.queued_bytes == 3 * 20);
+
+    fanout_run(&fc, 2000);
+    TEST_EXPECT(test, fc.timed_out == 0);
+    for (i = 0; i < FANOUT_CLIENTS; i++) {
+        TEST_EXPECT(test, fc.clients[i].received == 20);
+        TEST_EXPECT(test, memcmp(fc.clients[i].data, "alpha;bravo;charlie;", 20) == 0);
+    }
+    nanoev_tcp_fanout_get_stats(fc.fanout, &stats);
+    TEST_EXPECT(test, stats.published == 3);
+    TEST_EXPECT(test, stats.deliveries == 9);
+    TEST_EXPECT(test, stats.flushes == FANOUT_CLIENTS);
+    TEST_EXPECT(test, stats.subscribers == FANOUT_CLIENTS);
+
+    /* removed and freed subscribers get nothing more */
+    TEST_EXPECT(test, nanoev_tcp_fanout_remove(fc.fanout, fc.accepted[0]) == NANOEV_SUCCESS);
+    TEST_EXPECT(test, nanoev_tcp_fanout_remove(fc.fanout, fc.accepted[0]) == NANOEV_ERROR_INVALID_ARG);
+    nanoev_event_free(fc.accepted[1]);
+    fc.accepted[1] = NULL;
+    nanoev_event_free(fc.clients[1].tcp);
+    fc.clients[1].tcp = NULL;
+    fc.clients[2].expect = 25;
+
+    msg = fanout_message("delta");
+    TEST_REQUIRE(test, msg);
+    TEST_EXPECT(test, nanoev_tcp_fanout_publish(fc.fanout, msg) == NANOEV_SUCCESS);
+    nanoev_buf_unref(msg);
+    fanout_run(&fc, 2000);
+    TEST_EXPECT(test, fc.timed_out == 0);
+    fanout_run(&fc, 50);
+    TEST_EXPECT(test, fc.clients[0].received == 20);
+    TEST_EXPECT(test, fc.clients[2].received == 25);
+    TEST_EXPECT(test, memcmp(fc.clients[2].data + 20, "delta", 5) == 0);
+    nanoev_tcp_fanout_get_stats(fc.fanout, &stats);
+    TEST_EXPECT(test, stats.subscribers == 1);
+    TEST_EXPECT(test, stats.deliveries == 10);
+    TEST_EXPECT(test, stats.queued_bytes == 0);
+
+    TEST_EXPECT(test, fc.drops == 0);
+    TEST_EXPECT(test, fc.callback_failures == 0);
+    fanout_teardown(&fc);
+    nanoev_term();
+}
+
+static void test_tcp_fanout_slow_consumer(nanoev_test *test, int policy)
+{
+    fanout_case fc;
+    nanoev_tcp_fanout_stats stats;
+    nanoev_buf *big, *small;
+    char *space;
+
+    TEST_REQUIRE(test, nanoev_init() == NANOEV_SUCCESS);
+    TEST_REQUIRE(test, fanout_setup(&fc, 1, 1024 * 1024, policy));
+
+    /* the client never reads, so this write stays pending */
+    big = nanoev_buf_new();
+    TEST_REQUIRE(test, big);
+    while (nanoev_buf_len(big) < FANOUT_BIG) {
+        space = (char*)nanoev_buf_reserve(big, NANOEV_BUF_CHUNK_SIZE);
+        if (!space)
+            break;
+        memset(space, 'x', NANOEV_BUF_CHUNK_SIZE);
+        nanoev_buf_commit(big, NANOEV_BUF_CHUNK_SIZE);
+    }
+    TEST_REQUIRE(test, nanoev_buf_len(big) == FANOUT_BIG);
+    TEST_EXPECT(test, nanoev_tcp_fanout_publish(fc.fanout, big) == NANOEV_SUCCESS);
+    nanoev_buf_unref(big);
+    fanout_run(&fc, 100);
+    nanoev_tcp_fanout_get_stats(fc.fanout, &stats);
+    TEST_EXPECT(test, stats.writing == 1);
+
+    small = fanout_message("late");
+    TEST_REQUIRE(test, small);
+    TEST_EXPECT(test, nanoev_tcp_fanout_publish(fc.fanout, small) == NANOEV_SUCCESS);
+    nanoev_buf_unref(small);
+    fanout_run(&fc, 100);
+    nanoev_tcp_fanout_get_stats(fc.fanout, &stats);
+
+    if (policy == NANOEV_FANOUT_DROP_SUBSCRIBER) {
+        TEST_EXPECT(test, fc.drops == 1);
+        TEST_EXPECT(test, fc.dropped == fc.accepted[0]);
+        TEST_EXPECT(test, fc.drop_status == 0);
+        TEST_EXPECT(test, stats.dropped == 1);
+        TEST_EXPECT(test, stats.subscribers == 0);
+        /* still writing in the background; freeing it releases the payload */
+        TEST_EXPECT(test, stats.queued_bytes == FANOUT_BIG);
+        nanoev_event_free(fc.accepted[0]);
+        fc.accepted[0] = NULL;
+        nanoev_tcp_fanout_get_stats(fc.fanout, &stats);
+        TEST_EXPECT(test, stats.queued_bytes == 0);
+    } else {
+        TEST_EXPECT(test, fc.drops == 0);
+        TEST_EXPECT(test, stats.skipped == 1);
+        TEST_EXPECT(test, stats.subscribers == 1);
+        TEST_EXPECT(test, stats.writing == 1);
+    }
+
+    TEST_EXPECT(test, fc.callback_failures == 0);
+    fanout_teardown(&fc);
+    nanoev_term();
+}
+
+void test_tcp_fanout(nanoev_test *test)
+{
+    test_tcp_fanout_broadcast(test);
+    test_tcp_fanout_slow_consumer(test, NANOEV_FANOUT_DROP_SUBSCRIBER);
+    test_tcp_fanout_slow_consumer(test, NANOEV_FANOUT_DROP_MESSAGE);
+}
@@ -0,0 +1,312 @@
+#include "nanoev.h"
+#include "test.h"
+#include <string.h>
+
+#define FRAME_CASE_MAX  64
+
+typedef struct frame_case {
+    nanoev_loop *loop;
+    nanoev_event *listener;
+    nanoev_event *client;
+    nanoev_event *server;
+    nanoev_event *timer;
+    nanoev_tcp_framing framing;
+    unsigned char out[8192];
+    unsigned int out_len;
+    unsigned int frames;
+    unsigned int sizes[FRAME_CASE_MAX];
+    unsigned int bad_content;
+    int final_status;
+    int finished;
+    unsigned int stop_after;
+    int stop_ret;
+    unsigned int free_after;
+    int free_write_ret;
+    int timed_out;
+    int callback_failures;
+} frame_case;
+
+static nanoev_timeval seconds(long sec)
+{
+    nanoev_timeval tv;
+    tv.tv_sec = sec;
+    tv.tv_usec = 0;
+    return tv;
+}
+
+static void on_frame_timeout(nanoev_event *timer)
+{
+    frame_case *fc = (frame_case*)nanoev_event_userdata(timer);
+    fc->timed_out = 1;
+    nanoev_loop_break(fc->loop);
+}
+
+/* big endian, 4 byte length of the payload, then a 4 byte sequence number */
+static void frame_append(frame_case *fc, unsigned int payload, unsigned int sequence)
+{
+    unsigned char *p = fc->out + fc->out_len;
+    unsigned int i;
+
+    p[0] = (unsigned char)(payload >> 24);
+    p[1] = (unsigned char)(payload >> 16);
+    p[2] = (unsigned char)(payload >> 8);
+    p[3] = (unsigned char)payload;
+    p[4] = p[5] = p[6] = 0;
+    p[7] = (unsigned char)sequence;
+    for (i = 0; i < payload; i++)
+        p[8 + i] = (unsigned char)(sequence + i);
+    fc->out_len += 8 + payload;
+}
+
+static void on_frame_reply(
+    nanoev_event *tcp,
+    int status,
+    void *buf,
+    unsigned int bytes
+    )
+{
+    frame_case *fc = (frame_case*)nanoev_event_userdata(tcp);
+
+    /* never called, the event was freed with this write pending */
+    (void)status;
+    (void)buf;
+    (void)bytes;
+    fc->callback_failures++;
+}
+
+static void on_frame(
+    nanoev_event *tcp,
+    int status,
+    void *frame,
+    unsigned int len
+    )
+{
+    frame_case *fc = (frame_case*)nanoev_event_userdata(tcp);
+    const unsigned char *p = (const unsigned char*)frame;
+    unsigned int i;
+
+    if (!frame) {
+        fc->final_status = status;
+        fc->finished = 1;
+        nanoev_loop_break(fc->loop);
+        return;
+    }
+    if (status != 0 || fc->frames == FRAME_CASE_MAX) {
+        fc->callback_failures++;
+        return;
+    }
+
+    for (i = 8; i < len; i++) {
+        if (p[i] != (unsigned char)(p[7] + i - 8))
+            fc->bad_content++;
+    }
+    if (p[7] != (unsigned char)fc->frames)
+        fc->bad_content++;
+    fc->sizes[fc->frames++] = len;
+
+    if (fc->frames == fc->stop_after) {
+        fc->stop_ret = nanoev_tcp_stop_frames(tcp);
+        nanoev_loop_break(fc->loop);
+    }
+    if (fc->frames == fc->free_after) {
+        /* the pending write defers the free while frames are still buffered */
+        fc->free_write_ret = nanoev_tcp_write(tcp, fc->out, 8, NULL, on_frame_reply);
+        nanoev_event_free(tcp);
+        fc->server = NULL;
+        nanoev_loop_break(fc->loop);
+    }
+}
+
+static void on_frame_accept(
+    nanoev_event *tcp,
+    int status,
+    nanoev_event *tcp_new
+    )
+{
+    frame_case *fc = (frame_case*)nanoev_event_userdata(tcp);
+
+    if (status != 0 || !tcp_new) {
+        fc->callback_failures++;
+        nanoev_loop_break(fc->loop);
+        return;
+    }
+    fc->server = tcp_new;
+    nanoev_event_set_userdata(tcp_new, fc);
+    if (nanoev_tcp_read_frames(tcp_new, &fc->framing, on_frame) != NANOEV_SUCCESS)
+        fc->callback_failures++;
+}
+
+static void on_frame_write(
+    nanoev_event *tcp,
+    int status,
+    void *buf,
+    unsigned int bytes
+    )
+{
+    frame_case *fc = (frame_case*)nanoev_event_userdata(tcp);
+
+    (void)buf;
+    if (status != 0 || bytes != fc->out_len) {
+        fc->callback_failures++;
+        return;
+    }
+    if (nanoev_tcp_shutdown(tcp, NANOEV_TCP_SHUT_WRITE) != NANOEV_SUCCESS)
+        fc->callback_failures++;
+}
+
+static void on_frame_connect(
+    nanoev_event *tcp,
+    int status
+    )
+{
+    frame_case *fc = (frame_case*)nanoev_event_userdata(tcp);
+
+    /* everything in one write, so reads carry many frames */
+    if (status != 0
+        || nanoev_tcp_write(tcp, fc->out, fc->out_len, NULL, on_frame_write) != NANOEV_SUCCESS)
+        fc->callback_failures++;
+}
+
+static void frame_case_init(frame_case *fc)
+{
+    memset(fc, 0, sizeof(frame_case));
+    fc->framing.prefix_size = 4;
+    fc->framing.header_size = 8;
+    fc->framing.max_payload = 4096;
+    fc->framing.buffer_size = 256;
+}
+
+static void frame_case_run(nanoev_test *test, frame_case *fc)
+{
+    struct nanoev_addr addr;
+
+    fc->loop = nanoev_loop_new(NULL);
+    TEST_REQUIRE(test, fc->loop);
+    fc->timer = nanoev_event_new(nanoev_event_timer, fc->loop, fc);
+    fc->listener = nanoev_event_new(nanoev_event_tcp, fc->loop, fc);
+    fc->client = nanoev_event_new(nanoev_event_tcp, fc->loop, fc);
+    TEST_REQUIRE(test, fc->timer && fc->listener && fc->client);
+
+    TEST_EXPECT(test, nanoev_addr_init(&addr, NANOEV_AF_INET, "127.0.0.1", 0) == NANOEV_SUCCESS);
+    TEST_REQUIRE(test, nanoev_tcp_listen(fc->listener, &addr, 4) == NANOEV_SUCCESS);
+    TEST_REQUIRE(test, nanoev_tcp_addr(fc->listener, 1, &addr) == NANOEV_SUCCESS);
+    TEST_EXPECT(test, nanoev_tcp_accept(fc->listener, NULL, on_frame_accept, NULL) == NANOEV_SUCCESS);
+    TEST_EXPECT(test, nanoev_tcp_connect(fc->client, &addr, NULL, on_frame_connect) == NANOEV_SUCCESS);
+    TEST_EXPECT(test, nanoev_timer_add(fc->timer, seconds(2), 0, on_frame_timeout) == NANOEV_SUCCESS);
+    TEST_EXPECT(test, nanoev_loop_run(fc->loop) == NANOEV_SUCCESS);
+    TEST_EXPECT(test, fc->timed_out == 0);
+}
+
+static void frame_case_free(frame_case *fc)
+{
+    if (fc->server)
+        nanoev_event_free(fc->server);
+    if (fc->client)
+        nanoev_event_free(fc->client);
+    if (fc->listener)
+        nanoev_event_free(fc->listener);
+    if (fc->timer)
+        nanoev_event_free(fc->timer);
+    if (fc->loop)
+        nanoev_loop_free(fc->loop);
+}
+
+static void test_tcp_frame_stream(nanoev_test *test)
+{
+    frame_case fc;
+    nanoev_tcp_framing bad;
+    unsigned int i;
+
+    TEST_REQUIRE(test, nanoev_init() == NANOEV_SUCCESS);
+    frame_case_init(&fc);
+
+    /* small frames, an empty one, and one bigger than the initial buffer */
+    for (i = 0; i < 40; i++)
+        frame_append(&fc, i == 7 ? 0 : (i == 20 ? 3000 : i * 3), i);
+
+    frame_case_run(test, &fc);
+    TEST_EXPECT(test, fc.callback_failures == 0);
+    TEST_EXPECT(test, fc.finished == 1);
+    TEST_EXPECT(test, fc.final_status == 0);
+    TEST_EXPECT(test, fc.frames == 40);
+    TEST_EXPECT(test, fc.bad_content == 0);
+    TEST_EXPECT(test, fc.sizes[7] == 8);
+    TEST_EXPECT(test, fc.sizes[20] == 3008);
+    TEST_EXPECT(test, fc.sizes[39] == 8 + 39 * 3);
+
+    /* the framer has finished and let go of the read side */
+    bad = fc.framing;
+    bad.prefix_size = 3;
+    TEST_EXPECT(test, nanoev_tcp_read_frames(fc.server, &bad, on_frame) == NANOEV_ERROR_INVALID_ARG);
+    bad.prefix_size = 4;
+    bad.header_size = 2;
+    TEST_EXPECT(test, nanoev_tcp_read_frames(fc.server, &bad, on_frame) == NANOEV_ERROR_INVALID_ARG);
+    TEST_EXPECT(test, nanoev_tcp_stop_frames(fc.server) == NANOEV_ERROR_ACCESS_DENIED);
+
+    frame_case_free(&fc);
+    nanoev_term();
+}
+
+static void test_tcp_frame_errors(nanoev_test *test)
+{
+    frame_case fc;
+
+    TEST_REQUIRE(test, nanoev_init() == NANOEV_SUCCESS);
+
+    /* a frame over max_payload fails the stream after the good ones */
+    frame_case_init(&fc);
+    fc.framing.max_payload = 100;
+    frame_append(&fc, 10, 0);
+    frame_append(&fc, 101, 1);
+    frame_case_run(test, &fc);
+    TEST_EXPECT(test, fc.frames == 1);
+    TEST_EXPECT(test, fc.finished == 1);
+    TEST_EXPECT(test, fc.final_status == NANOEV_ERROR_FAIL);
+    frame_case_free(&fc);
+
+    /* so does a connection closed in the middle of a frame */
+    frame_case_init(&fc);
+    frame_append(&fc, 10, 0);
+    frame_append(&fc, 10, 1);
+    fc.out_len -= 4;
+    frame_case_run(test, &fc);
+    TEST_EXPECT(test, fc.frames == 1);
+    TEST_EXPECT(test, fc.finished == 1);
+    TEST_EXPECT(test, fc.final_status == NANOEV_ERROR_FAIL);
+    frame_case_free(&fc);
+
+    /* stopping from the callback ends delivery without a final callback */
+    frame_case_init(&fc);
+    fc.stop_after = 2;
+    frame_append(&fc, 5, 0);
+    frame_append(&fc, 5, 1);
+    frame_append(&fc, 5, 2);
+    frame_case_run(test, &fc);
+    TEST_EXPECT(test, fc.stop_ret == NANOEV_SUCCESS);
+    TEST_EXPECT(test, fc.frames == 2);
+    TEST_EXPECT(test, fc.finished == 0);
+    TEST_EXPECT(test, nanoev_tcp_read_frames(fc.server, &fc.framing, on_frame) == NANOEV_SUCCESS);
+    TEST_EXPECT(test, fc.callback_failures == 0);
+    frame_case_free(&fc);
+
+    /* freeing the event from the callback ends delivery, even with a write in flight */
+    frame_case_init(&fc);
+    fc.free_after = 1;
+    frame_append(&fc, 5, 0);
+    frame_append(&fc, 5, 1);
+    frame_append(&fc, 5, 2);
+    frame_case_run(test, &fc);
+    TEST_EXPECT(test, fc.free_write_ret == NANOEV_SUCCESS);
+    TEST_EXPECT(test, fc.frames == 1);
+    TEST_EXPECT(test, fc.finished == 0);
+    TEST_EXPECT(test, fc.callback_failures == 0);
+    frame_case_free(&fc);
+
+    nanoev_term();
+}
+
+void test_tcp_frame(nanoev_test *test)
+{
+    test_tcp_frame_stream(test);
+    test_tcp_frame_errors(test);
+}
@@ -0,0 +1,248 @@
+#include "nanoev.h"
+#include "test.h"
+#include <string.h>
+
+#define POOL_CASE_MAX  8
+
+typedef struct pool_case {
+    nanoev_loop *loop;
+    nanoev_tcp_pool *pool;
+    nanoev_event *listener;
+    nanoev_event *timer;
+    nanoev_event *accepted[POOL_CASE_MAX];
+    unsigned int accepted_count;
+    nanoev_event *granted[POOL_CASE_MAX];
+    int status[POOL_CASE_MAX];
+    unsigned int calls;
+    unsigned int expect;
+    int timed_out;
+    int callback_failures;
+} pool_case;
+
+static nanoev_timeval msecs(long ms)
+{
+    nanoev_timeval tv;
+    tv.tv_sec = ms / 1000;
+    tv.tv_usec = (ms % 1000) * 1000;
+    return tv;
+}
+
+static void on_pool_timeout(nanoev_event *timer)
+{
+    pool_case *pc = (pool_case*)nanoev_event_userdata(timer);
+    pc->timed_out = 1;
+    nanoev_loop_break(pc->loop);
+}
+
+static void on_pool_accept(
+    nanoev_event *tcp,
+    int status,
+    nanoev_event *tcp_new
+    )
+{
+    pool_case *pc = (pool_case*)nanoev_event_userdata(tcp);
+
+    if (status != 0 || !tcp_new || pc->accepted_count == POOL_CASE_MAX) {
+        pc->callback_failures++;
+        if (tcp_new)
+            nanoev_event_free(tcp_new);
+        return;
+    }
+    pc->accepted[pc->accepted_count++] = tcp_new;
+    if (nanoev_tcp_accept(tcp, NULL, on_pool_accept, NULL) != NANOEV_SUCCESS)
+        pc->callback_failures++;
+}
+
+static void on_pool_acquire(
+    nanoev_tcp_pool *pool,
+    int status,
+    nanoev_event *tcp,
+    void *userdata
+    )
+{
+    pool_case *pc = (pool_case*)userdata;
+
+    if (pool != pc->pool || pc->calls == POOL_CASE_MAX || (status == 0) != (tcp != NULL)
+        || (tcp && nanoev_event_userdata(tcp) != NULL)) {
+        pc->callback_failures++;
+        nanoev_loop_break(pc->loop);
+        return;
+    }
+    pc->granted[pc->calls] = tcp;
+    pc->status[pc->calls] = status;
+    if (++pc->calls == pc->expect)
+        nanoev_loop_break(pc->loop);
+}
+
+static void pool_run(pool_case *pc, unsigned int expect, long limit_ms)
+{
+    pc->expect = expect;
+    pc->timed_out = 0;
+    nanoev_timer_add(pc->timer, msecs(limit_ms), 0, on_pool_timeout);
+    nanoev_loop_run(pc->loop);
+    nanoev_timer_del(pc->timer);
+}
+
+static void test_tcp_pool_reuse(nanoev_test *test)
+{
+    pool_case pc;
+    struct nanoev_addr addr;
+    nanoev_tcp_pool_stats stats;
+    nanoev_timeval idle_timeout, timeout;
+    unsigned int i;
+
+    memset(&pc, 0, sizeof(pc));
+    idle_timeout = msecs(300);
+    timeout = msecs(2000);
+
+    TEST_REQUIRE(test, nanoev_init() == NANOEV_SUCCESS);
+    pc.loop = nanoev_loop_new(NULL);
+    TEST_REQUIRE(test, pc.loop);
+    pc.timer = nanoev_event_new(nanoev_event_timer, pc.loop, &pc);
+    TEST_REQUIRE(test, pc.timer);
+
+    pc.listener = nanoev_event_new(nanoev_event_tcp, pc.loop, &pc);
+    TEST_REQUIRE(test, pc.listener);
+    TEST_EXPECT(test, nanoev_addr_init(&addr, NANOEV_AF_INET, "127.0.0.1", 0) == NANOEV_SUCCESS);
+    TEST_REQUIRE(test, nanoev_tcp_listen(pc.listener, &addr, 8) == NANOEV_SUCCESS);
+    TEST_REQUIRE(test, nanoev_tcp_addr(pc.listener, 1, &addr) == NANOEV_SUCCESS);
+    TEST_EXPECT(test, nanoev_tcp_accept(pc.listener, NULL, on_pool_accept, NULL) == NANOEV_SUCCESS);
+
+    pc.pool = nanoev_tcp_pool_new(pc.loop, 2, 2, &idle_timeout);
+    TEST_REQUIRE(test, pc.pool);
+    TEST_EXPECT(test, nanoev_tcp_pool_acquire(pc.pool, NULL, NULL, on_pool_acquire, &pc) == NANOEV_ERROR_INVALID_ARG);
+
+    /* two connect right away, the third waits for one of them */
+    for (i = 0; i < 3; i++)
+        TEST_EXPECT(test, nanoev_tcp_pool_acquire(pc.pool, &addr, &timeout, on_pool_acquire, &pc) == NANOEV_SUCCESS);
+    TEST_EXPECT(test, pc.calls == 0);
+    pool_run(&pc, 2, 2000);
+    TEST_EXPECT(test, pc.timed_out == 0);
+    TEST_EXPECT(test, pc.calls == 2);
+    TEST_REQUIRE(test, pc.granted[0] && pc.granted[1]);
+    nanoev_tcp_pool_get_stats(pc.pool, &stats);
+    TEST_EXPECT(test, stats.connects == 2);
+    TEST_EXPECT(test, stats.active == 2);
+    TEST_EXPECT(test, stats.waiting == 1);
+
+    TEST_EXPECT(test, nanoev_tcp_pool_release(pc.pool, pc.granted[0], 1) == NANOEV_SUCCESS);
+    pool_run(&pc, 3, 2000);
+    TEST_EXPECT(test, pc.calls == 3);
+    TEST_EXPECT(test, pc.granted[2] == pc.granted[0]);
+    nanoev_tcp_pool_get_stats(pc.pool, &stats);
+    TEST_EXPECT(test, stats.connects == 2);
+    TEST_EXPECT(test, stats.reuses == 1);
+    TEST_EXPECT(test, stats.waiting == 0);
+
+    TEST_EXPECT(test, nanoev_tcp_pool_release(pc.pool, pc.granted[1], 1) == NANOEV_SUCCESS);
+    TEST_EXPECT(test, nanoev_tcp_pool_release(pc.pool, pc.granted[2], 1) == NANOEV_SUCCESS);
+    TEST_EXPECT(test, nanoev_tcp_pool_release(pc.pool, pc.granted[2], 1) == NANOEV_ERROR_INVALID_ARG);
+    nanoev_tcp_pool_get_stats(pc.pool, &stats);
+    TEST_EXPECT(test, stats.idle == 2);
+    TEST_EXPECT(test, stats.active == 0);
+
+    /* the peer closes both idle connections: the next acquire dials anew */
+    TEST_EXPECT(test, pc.accepted_count == 2);
+    for (i = 0; i < pc.accepted_count; i++) {
+        nanoev_event_free(pc.accepted[i]);
+        pc.accepted[i] = NULL;
+    }
+    pool_run(&pc, POOL_CASE_MAX, 50);
+    TEST_EXPECT(test, nanoev_tcp_pool_acquire(pc.pool, &addr, &timeout, on_pool_acquire, &pc) == NANOEV_SUCCESS);
+    pool_run(&pc, 4, 2000);
+    TEST_EXPECT(test, pc.calls == 4);
+    TEST_EXPECT(test, pc.status[3] == 0);
+    nanoev_tcp_pool_get_stats(pc.pool, &stats);
+    TEST_EXPECT(test, stats.unhealthy == 2);
+    TEST_EXPECT(test, stats.connects == 3);
+    TEST_EXPECT(test, stats.idle == 0);
+
+    /* an idle connection is closed after idle_timeout */
+    TEST_EXPECT(test, nanoev_tcp_pool_release(pc.pool, pc.granted[3], 1) == NANOEV_SUCCESS);
+    pool_run(&pc, POOL_CASE_MAX, 500);
+    TEST_EXPECT(test, pc.timed_out == 1);
+    nanoev_tcp_pool_get_stats(pc.pool, &stats);
+    TEST_EXPECT(test, stats.expired == 1);
+    TEST_EXPECT(test, stats.idle == 0);
+
+    TEST_EXPECT(test, pc.callback_failures == 0);
+    nanoev_tcp_pool_free(pc.pool);
+    for (i = 0; i < pc.accepted_count; i++) {
+        if (pc.accepted[i])
+            nanoev_event_free(pc.accepted[i]);
+    }
+    nanoev_event_free(pc.timer);
+    nanoev_event_free(pc.listener);
+    nanoev_loop_free(pc.loop);
+    nanoev_term();
+}
+
+static void test_tcp_pool_wait_timeout(nanoev_test *test)
+{
+    pool_case pc;
+    struct nanoev_addr addr;
+    nanoev_tcp_pool_stats stats;
+    nanoev_timeval timeout;
+    unsigned int i;
+
+    memset(&pc, 0, sizeof(pc));
+    timeout = msecs(50);
+
+    TEST_REQUIRE(test, nanoev_init() == NANOEV_SUCCESS);
+    pc.loop = nanoev_loop_new(NULL);
+    TEST_REQUIRE(test, pc.loop);
+    pc.timer = nanoev_event_new(nanoev_event_timer, pc.loop, &pc);
+    TEST_REQUIRE(test, pc.timer);
+
+    pc.listener = nanoev_event_new(nanoev_event_tcp, pc.loop, &pc);
+    TEST_REQUIRE(test, pc.listener);
+    TEST_EXPECT(test, nanoev_addr_init(&addr, NANOEV_AF_INET, "127.0.0.1", 0) == NANOEV_SUCCESS);
+    TEST_REQUIRE(test, nanoev_tcp_listen(pc.listener, &addr, 8) == NANOEV_SUCCESS);
+    TEST_REQUIRE(test, nanoev_tcp_addr(pc.listener, 1, &addr) == NANOEV_SUCCESS);
+    TEST_EXPECT(test, nanoev_tcp_accept(pc.listener, NULL, on_pool_accept, NULL) == NANOEV_SUCCESS);
+
+    pc.pool = nanoev_tcp_pool_new(pc.loop, 1, 1, NULL);
+    TEST_REQUIRE(test, pc.pool);
+
+    /* the only connection is held, so the second request times out */
+    TEST_EXPECT(test, nanoev_tcp_pool_acquire(pc.pool, &addr, NULL, on_pool_acquire, &pc) == NANOEV_SUCCESS);
+    TEST_EXPECT(test, nanoev_tcp_pool_acquire(pc.pool, &addr, &timeout, on_pool_acquire, &pc) == NANOEV_SUCCESS);
+    pool_run(&pc, 2, 2000);
+    TEST_EXPECT(test, pc.timed_out == 0);
+    TEST_EXPECT(test, pc.calls == 2);
+    TEST_EXPECT(test, pc.status[0] == 0 && pc.granted[0]);
+    TEST_EXPECT(test, pc.status[1] != 0 && !pc.granted[1]);
+    nanoev_tcp_pool_get_stats(pc.pool, &stats);
+    TEST_EXPECT(test, stats.connects == 1);
+    TEST_EXPECT(test, stats.active == 1);
+    TEST_EXPECT(test, stats.waiting == 0);
+
+    /* freeing the held connection instead of releasing it frees its slot */
+    TEST_EXPECT(test, nanoev_tcp_pool_acquire(pc.pool, &addr, NULL, on_pool_acquire, &pc) == NANOEV_SUCCESS);
+    nanoev_event_free(pc.granted[0]);
+    pool_run(&pc, 3, 2000);
+    TEST_EXPECT(test, pc.timed_out == 0);
+    TEST_EXPECT(test, pc.calls == 3);
+    TEST_EXPECT(test, pc.status[2] == 0 && pc.granted[2]);
+    nanoev_tcp_pool_get_stats(pc.pool, &stats);
+    TEST_EXPECT(test, stats.connects == 2);
+    TEST_EXPECT(test, stats.active == 1);
+
+    /* a connection handed out outlives the pool */
+    TEST_EXPECT(test, nanoev_tcp_pool_acquire(pc.pool, &addr, NULL, on_pool_acquire, &pc) == NANOEV_SUCCESS);
+    nanoev_tcp_pool_free(pc.pool);
+    TEST_EXPECT(test, pc.callback_failures == 0);
+    nanoev_event_free(pc.granted[2]);
+    for (i = 0; i < pc.accepted_count; i++)
+        nanoev_event_free(pc.accepted[i]);
+    nanoev_event_free(pc.timer);
+    nanoev_event_free(pc.listener);
+    nanoev_loop_free(pc.loop);
+    nanoev_term();
+}
+
+void test_tcp_pool(nanoev_test *test)
+{
+    test_tcp_pool_reuse(test);
+    test_tcp_pool_wait_timeout(test);
+}
@@ -0,0 +1,356 @@
+#include "nanoev.h"
+#include "test.h"
+#include <string.h>
+
+#define READ_CASE_PIECES  8
+
+typedef struct read_case {
+    nanoev_loop *loop;
+    nanoev_event *listener;
+    nanoev_event *client;
+    nanoev_event *server;
+    nanoev_event *timer;
+    nanoev_event *pacer;
+    /* the client sends pieces[] one at a time, a few milliseconds apart */
+    const char *pieces[READ_CASE_PIECES];
+    unsigned int piece_count;
+    unsigned int piece_next;
+    char data[4096];
+    unsigned int data_len;
+    /* server side */
+    char buf[4096];
+    char head[8];
+    int vectored;
+    int busy_ret;
+    unsigned int exact;
+    unsigned int calls;
+    unsigned int bytes[4];
+    unsigned int found[4];
+    int statuses[4];
+    int invalid_ret;
+    int finished;
+    int timed_out;
+    int callback_failures;
+} read_case;
+
+static nanoev_timeval millis(long ms)
+{
+    nanoev_timeval tv;
+    tv.tv_sec = ms / 1000;
+    tv.tv_usec = (ms % 1000) * 1000;
+    return tv;
+}
+
+static void on_read_timeout(nanoev_event *timer)
+{
+    read_case *rc = (read_case*)nanoev_event_userdata(timer);
+    rc->timed_out = 1;
+    nanoev_loop_break(rc->loop);
+}
+
+static void read_case_send_next(read_case *rc);
+static void on_pacer(nanoev_event *timer);
+
+static void on_piece_write(nanoev_event *tcp, int status, void *buf, unsigned int bytes)
+{
+    read_case *rc = (read_case*)nanoev_event_userdata(tcp);
+
+    (void)buf;
+    (void)bytes;
+    if (status != 0) {
+        rc->callback_failures++;
+        return;
+    }
+    if (rc->piece_next == rc->piece_count) {
+        if (nanoev_tcp_shutdown(tcp, NANOEV_TCP_SHUT_WRITE) != NANOEV_SUCCESS)
+            rc->callback_failures++;
+        return;
+    }
+    if (nanoev_timer_add(rc->pacer, millis(5), 0, on_pacer) != NANOEV_SUCCESS)
+        rc->callback_failures++;
+}
+
+static void read_case_send_next(read_case *rc)
+{
+    const char *piece = rc->pieces[rc->piece_next++];
+
+    if (nanoev_tcp_write(rc->client, piece, (unsigned int)strlen(piece), NULL, on_piece_write) != NANOEV_SUCCESS)
+        rc->callback_failures++;
+}
+
+static void on_pacer(nanoev_event *timer)
+{
+    read_case_send_next((read_case*)nanoev_event_userdata(timer));
+}
+
+static void on_client_connect(nanoev_event *tcp, int status)
+{
+    read_case *rc = (read_case*)nanoev_event_userdata(tcp);
+
+    if (status != 0) {
+        rc->callback_failures++;
+        return;
+    }
+    read_case_send_next(rc);
+}
+
+static void read_case_finish(read_case *rc)
+{
+    rc->finished = 1;
+    nanoev_loop_break(rc->loop);
+}
+
+static void on_exact(nanoev_event *tcp, int status, void *buf, unsigned int bytes)
+{
+    read_case *rc = (read_case*)nanoev_event_userdata(tcp);
+    unsigned int n = rc->calls++;
+
+    if (n == 4 || buf != rc->buf) {
+        rc->callback_failures++;
+        return;
+    }
+    rc->statuses[n] = status;
+    rc->bytes[n] = bytes;
+    if (status != 0 || bytes < rc->exact) {
+        read_case_finish(rc);
+        return;
+    }
+    if (memcmp(rc->buf, rc->data + n * rc->exact, bytes) != 0)
+        rc->callback_failures++;
+    if (nanoev_tcp_read_exact(tcp, rc->buf, rc->exact, NULL, on_exact) != NANOEV_SUCCESS)
+        rc->callback_failures++;
+}
+
+static void on_until(nanoev_event *tcp, int status, void *buf, unsigned int bytes, unsigned int found)
+{
+    read_case *rc = (read_case*)nanoev_event_userdata(tcp);
+    unsigned int n = rc->calls++, left;
+    char *line_end;
+
+    if (n == 4 || buf != rc->buf) {
+        rc->callback_failures++;
+        return;
+    }
+    rc->statuses[n] = status;
+    rc->bytes[n] = bytes;
+    rc->found[n] = found;
+    if (status != 0 || !found) {
+        read_case_finish(rc);
+        return;
+    }
+
+    /* keep what followed the line, as a line protocol would */
+    left = bytes - found;
+    memmove(rc->buf, rc->buf + found, left);
+    line_end = left ? (char*)memchr(rc->buf, '\n', left) : NULL;
+    if (line_end) {
+        /* a whole line is already buffered: the caller handles it */
+        rc->invalid_ret = nanoev_tcp_read_until(tcp, rc->buf, sizeof(rc->buf), left, "\r\n", 2, NULL, on_until);
+        left -= (unsigned int)(line_end + 1 - rc->buf);
+        memmove(rc->buf, line_end + 1, left);
+    }
+    if (nanoev_tcp_read_until(tcp, rc->buf, sizeof(rc->buf), left, "\r\n", 2, NULL, on_until) != NANOEV_SUCCESS)
+        rc->callback_failures++;
+}
+
+static int read_case_readv(read_case *rc, nanoev_event *tcp);
+
+static void on_readv(nanoev_event *tcp, int status, void *buf, unsigned int bytes)
+{
+    read_case *rc = (read_case*)nanoev_event_userdata(tcp);
+    unsigned int n = rc->calls++;
+
+    if (n == 4 || buf != rc->head) {
+        rc->callback_failures++;
+        return;
+    }
+    rc->statuses[n] = status;
+    rc->bytes[n] = bytes;
+    if (status != 0 || bytes == 0) {
+        read_case_finish(rc);
+        return;
+    }
+    if (read_case_readv(rc, tcp) != NANOEV_SUCCESS)
+        rc->callback_failures++;
+}
+
+static int read_case_readv(read_case *rc, nanoev_event *tcp)
+{
+    nanoev_iovec bufs[2];
+
+    bufs[0].buf = rc->head;
+    bufs[0].len = sizeof(rc->head);
+    bufs[1].buf = rc->buf;
+    bufs[1].len = sizeof(rc->buf);
+    return nanoev_tcp_readv(tcp, bufs, 2, NULL, on_readv);
+}
+
+static void on_read_accept(nanoev_event *tcp, int status, nanoev_event *tcp_new)
+{
+    read_case *rc = (read_case*)nanoev_event_userdata(tcp);
+    int ret_code;
+
+    if (status != 0 || !tcp_new) {
+        rc->callback_failures++;
+        nanoev_loop_break(rc->loop);
+        return;
+    }
+    rc->server = tcp_new;
+    nanoev_event_set_userdata(tcp_new, rc);
+    if (rc->vectored) {
+        ret_code = read_case_readv(rc, tcp_new);
+        rc->busy_ret = read_case_readv(rc, tcp_new);
+    } else if (rc->exact)
+        ret_code = nanoev_tcp_read_exact(tcp_new, rc->buf, rc->exact, NULL, on_exact);
+    else
+        ret_code = nanoev_tcp_read_until(tcp_new, rc->buf, sizeof(rc->buf), 0, "\r\n", 2, NULL, on_until);
+    if (ret_code != NANOEV_SUCCESS)
+        rc->callback_failures++;
+}
+
+static void read_case_run(nanoev_test *test, read_case *rc)
+{
+    struct nanoev_addr addr;
+    unsigned int i;
+
+    for (i = 0; i < rc->piece_count; i++) {
+        memcpy(rc->data + rc->data_len, rc->pieces[i], strlen(rc->pieces[i]));
+        rc->data_len += (unsigned int)strlen(rc->pieces[i]);
+    }
+
+    rc->loop = nanoev_loop_new(NULL);
+    TEST_REQUIRE(test, rc->loop);
+    rc->timer = nanoev_event_new(nanoev_event_timer, rc->loop, rc);
+    rc->pacer = nanoev_event_new(nanoev_event_timer, rc->loop, rc);
+    rc->listener = nanoev_event_new(nanoev_event_tcp, rc->loop, rc);
+    rc->client = nanoev_event_new(nanoev_event_tcp, rc->loop, rc);
+    TEST_REQUIRE(test, rc->timer && rc->pacer && rc->listener && rc->client);
+
+    TEST_EXPECT(test, nanoev_addr_init(&addr, NANOEV_AF_INET, "127.0.0.1", 0) == NANOEV_SUCCESS);
+    TEST_REQUIRE(test, nanoev_tcp_listen(rc->listener, &addr, 4) == NANOEV_SUCCESS);
+    TEST_REQUIRE(test, nanoev_tcp_addr(rc->listener, 1, &addr) == NANOEV_SUCCESS);
+    TEST_EXPECT(test, nanoev_tcp_accept(rc->listener, NULL, on_read_accept, NULL) == NANOEV_SUCCESS);
+    TEST_EXPECT(test, nanoev_tcp_connect(rc->client, &addr, NULL, on_client_connect) == NANOEV_SUCCESS);
+    TEST_EXPECT(test, nanoev_timer_add(rc->timer, millis(2000), 0, on_read_timeout) == NANOEV_SUCCESS);
+    TEST_EXPECT(test, nanoev_loop_run(rc->loop) == NANOEV_SUCCESS);
+    TEST_EXPECT(test, rc->timed_out == 0);
+    TEST_EXPECT(test, rc->finished == 1);
+    TEST_EXPECT(test, rc->callback_failures == 0);
+}
+
+static void read_case_free(read_case *rc)
+{
+    if (rc->server)
+        nanoev_event_free(rc->server);
+    if (rc->client)
+        nanoev_event_free(rc->client);
+    if (rc->listener)
+        nanoev_event_free(rc->listener);
+    if (rc->pacer)
+        nanoev_event_free(rc->pacer);
+    if (rc->timer)
+        nanoev_event_free(rc->timer);
+    if (rc->loop)
+        nanoev_loop_free(rc->loop);
+}
+
+static void test_tcp_read_exact(nanoev_test *test)
+{
+    read_case rc;
+
+    TEST_REQUIRE(test, nanoev_init() == NANOEV_SUCCESS);
+
+    /* 12-byte records arriving in pieces that split them */
+    memset(&rc, 0, sizeof(rc));
+    rc.exact = 12;
+    rc.pieces[0] = "0123";
+    rc.pieces[1] = "456789ab";
+    rc.pieces[2] = "cdefghijklmnopqrstu";
+    rc.pieces[3] = "vwxyz";
+    rc.pieces[4] = "ABCDE";
+    rc.piece_count = 5;
+    read_case_run(test, &rc);
+    TEST_EXPECT(test, rc.calls == 4);
+    TEST_EXPECT(test, rc.bytes[0] == 12 && rc.bytes[1] == 12 && rc.bytes[2] == 12);
+    /* the peer closed after 5 bytes of the last record */
+    TEST_EXPECT(test, rc.statuses[3] == 0);
+    TEST_EXPECT(test, rc.bytes[3] == 5);
+    TEST_EXPECT(test, memcmp(rc.buf, "ABCDE", 5) == 0);
+    read_case_free(&rc);
+
+    nanoev_term();
+}
+
+static void test_tcp_read_until(nanoev_test *test)
+{
+    read_case rc;
+
+    TEST_REQUIRE(test, nanoev_init() == NANOEV_SUCCESS);
+
+    /* a delimiter split across reads, and lines that arrive together */
+    memset(&rc, 0, sizeof(rc));
+    rc.invalid_ret = -1;
+    rc.pieces[0] = "PI";
+    rc.pieces[1] = "NG\r\nSET k v\r";
+    rc.pieces[2] = "\nGET k\r\nDEL";
+    rc.pieces[3] = " k";
+    rc.piece_count = 4;
+    read_case_run(test, &rc);
+    TEST_EXPECT(test, rc.calls == 3);
+    TEST_EXPECT(test, rc.found[0] == 6);
+    TEST_EXPECT(test, rc.bytes[0] == 14);
+    TEST_EXPECT(test, rc.found[1] == 9);
+    TEST_EXPECT(test, rc.bytes[1] == 19);
+    TEST_EXPECT(test, rc.invalid_ret == NANOEV_ERROR_INVALID_ARG);
+    /* "DEL k" never ended: the peer closed and nothing was found */
+    TEST_EXPECT(test, rc.statuses[2] == 0);
+    TEST_EXPECT(test, rc.found[2] == 0);
+    TEST_EXPECT(test, rc.bytes[2] == 5);
+    TEST_EXPECT(test, memcmp(rc.buf, "DEL k", 5) == 0);
+    read_case_free(&rc);
+
+    nanoev_term();
+}
+
+static void test_tcp_readv(nanoev_test *test)
+{
+    read_case rc;
+    nanoev_iovec bufs[NANOEV_TCP_MAX_IOV + 1];
+    unsigned int i;
+
+    TEST_REQUIRE(test, nanoev_init() == NANOEV_SUCCESS);
+
+    /* one read splits a header from its payload */
+    memset(&rc, 0, sizeof(rc));
+    rc.vectored = 1;
+    rc.pieces[0] = "HEADER:8payload follows it";
+    rc.piece_count = 1;
+    read_case_run(test, &rc);
+    TEST_EXPECT(test, rc.busy_ret == NANOEV_ERROR_ACCESS_DENIED);
+    TEST_EXPECT(test, rc.calls == 2);
+    TEST_EXPECT(test, rc.statuses[0] == 0);
+    TEST_EXPECT(test, rc.bytes[0] == 26);
+    TEST_EXPECT(test, memcmp(rc.head, "HEADER:8", 8) == 0);
+    TEST_EXPECT(test, memcmp(rc.buf, "payload follows it", 18) == 0);
+    TEST_EXPECT(test, rc.statuses[1] == 0);
+    TEST_EXPECT(test, rc.bytes[1] == 0);
+
+    for (i = 0; i <= NANOEV_TCP_MAX_IOV; i++) {
+        bufs[i].buf = rc.buf;
+        bufs[i].len = 1;
+    }
+    TEST_EXPECT(test, nanoev_tcp_readv(rc.server, bufs, 0, NULL, on_readv) == NANOEV_ERROR_INVALID_ARG);
+    TEST_EXPECT(test, nanoev_tcp_readv(rc.server, bufs, NANOEV_TCP_MAX_IOV + 1, NULL, on_readv) == NANOEV_ERROR_INVALID_ARG);
+    bufs[1].len = 0;
+    TEST_EXPECT(test, nanoev_tcp_readv(rc.server, bufs, 2, NULL, on_readv) == NANOEV_ERROR_INVALID_ARG);
+    read_case_free(&rc);
+
+    nanoev_term();
+}
+
+void test_tcp_read(nanoev_test *test)
+{
+    test_tcp_read_exact(test);
+    test_tcp_read_until(test);
+    test_tcp_readv(test);
+}
@@ -457,18 +457,82 @@ cleanup:
     nanoev_term();
 }
 
+static struct {
+    int polls;
+    int dispatched;
+    int accepts;
+    int connects;
+    int reads;
+    int writes;
+} tcp_traces;
+
+static void trace_poll_exit(nanoev_loop *loop, int count)
+{
+    tcp_traces.polls++;
+    (void)loop;
+    (void)count;
+}
+
+static void trace_dispatch(nanoev_loop *loop, nanoev_event *event)
+{
+    tcp_traces.dispatched++;
+    (void)loop;
+    (void)event;
+}
+
+static void trace_tcp_accept(nanoev_event *listener, int status, nanoev_event *tcp)
+{
+    tcp_traces.accepts++;
+    (void)listener;
+    (void)status;
+    (void)tcp;
+}
+
+static void trace_tcp_connect(nanoev_event *tcp, int status)
+{
+    tcp_traces.connects++;
+    (void)tcp;
+    (void)status;
+}
+
+static void trace_tcp_read(nanoev_event *tcp, int status, unsigned int bytes)
+{
+    tcp_traces.reads++;
+    (void)tcp;
+    (void)status;
+    (void)bytes;
+}
+
+static void trace_tcp_write(nanoev_event *tcp, int status, unsigned int bytes)
+{
+    tcp_traces.writes++;
+    (void)tcp;
+    (void)status;
+    (void)bytes;
+}
+
 static void test_tcp_loopback_round_trip(nanoev_test *test)
 {
+    nanoev_trace_hooks hooks;
     tcp_case tc;
     struct nanoev_addr addr;
     unsigned short port;
     int ret;
 
     memset(&tc, 0, sizeof(tc));
+    memset(&tcp_traces, 0, sizeof(tcp_traces));
+    memset(&hooks, 0, sizeof(hooks));
+    hooks.poll_exit = trace_poll_exit;
+    hooks.dispatch = trace_dispatch;
+    hooks.tcp_accept = trace_tcp_accept;
+    hooks.tcp_connect = trace_tcp_connect;
+    hooks.tcp_read = trace_tcp_read;
+    hooks.tcp_write = trace_tcp_write;
 
     TEST_REQUIRE(test, nanoev_init() == NANOEV_SUCCESS);
     tc.loop = nanoev_loop_new(NULL);
     TEST_REQUIRE(test, tc.loop);
+    nanoev_set_trace_hooks(&hooks);
 
     tc.client = nanoev_event_new(nanoev_event_tcp, tc.loop, &tc);
     TEST_REQUIRE(test, tc.client);
@@ -479,6 +543,7 @@ static void test_tcp_loopback_round_trip(nanoev_test *test)
     tc.client_shutdown_result = NANOEV_ERROR_FAIL;
     TEST_EXPECT(test, nanoev_tcp_set_nodelay(tc.client, 1) == NANOEV_ERROR_ACCESS_DENIED);
     TEST_EXPECT(test, nanoev_tcp_set_keepalive(tc.client, 1) == NANOEV_ERROR_ACCESS_DENIED);
+    TEST_EXPECT(test, nanoev_tcp_set_busy_poll(tc.client, 50) == NANOEV_ERROR_ACCESS_DENIED);
     TEST_EXPECT(test, nanoev_tcp_shutdown(tc.client, NANOEV_TCP_SHUT_WRITE) == NANOEV_ERROR_ACCESS_DENIED);
     TEST_EXPECT(test, nanoev_tcp_shutdown(tc.client, -1) == NANOEV_ERROR_INVALID_ARG);
 
@@ -529,8 +594,15 @@ static void test_tcp_loopback_round_trip(nanoev_test *test)
     TEST_EXPECT(test, tc.client_nodelay_result == NANOEV_SUCCESS);
     TEST_EXPECT(test, tc.client_keepalive_result == NANOEV_SUCCESS);
     TEST_EXPECT(test, tc.client_shutdown_result == NANOEV_SUCCESS);
+    TEST_EXPECT(test, tcp_traces.polls > 0);
+    TEST_EXPECT(test, tcp_traces.dispatched >= 6);
+    TEST_EXPECT(test, tcp_traces.accepts == 1);
+    TEST_EXPECT(test, tcp_traces.connects == 1);
+    TEST_EXPECT(test, tcp_traces.reads == 2);
+    TEST_EXPECT(test, tcp_traces.writes == 2);
 
 cleanup:
+    nanoev_set_trace_hooks(NULL);
     if (tc.accepted) {
         nanoev_event_free(tc.accepted);
     }
@@ -547,10 +619,433 @@ cleanup:
     nanoev_term();
 }
 
+#define ZEROCOPY_PAYLOAD (64 * 1024)
+
+typedef struct tcp_zerocopy_case {
+    tcp_case base;
+    char payload[ZEROCOPY_PAYLOAD];
+    char sink[16 * 1024];
+    unsigned int written;
+    unsigned int received;
+    int set_result;
+    int pending_set_result;
+    int write_done;
+    unsigned int completions;
+    unsigned int copied;
+} tcp_zerocopy_case;
+
+static void zerocopy_maybe_done(tcp_zerocopy_case *zc)
+{
+    if (zc->write_done && zc->received == zc->written) {
+        nanoev_loop_break(zc->base.loop);
+    }
+}
+
+static void on_zerocopy_write(
+    nanoev_event *tcp,
+    int status,
+    void *buf,
+    unsigned int bytes
+    )
+{
+    tcp_zerocopy_case *zc = (tcp_zerocopy_case*)nanoev_event_userdata(tcp);
+
+    zc->base.client_write_called++;
+    if (status != 0 || bytes == 0 || buf != zc->payload) {
+        tcp_note_failure(&zc->base);
+        return;
+    }
+    zc->written = bytes;
+    zc->write_done = 1;
+    nanoev_tcp_zerocopy_stats(tcp, &zc->completions, &zc->copied);
+    zerocopy_maybe_done(zc);
+}
+
+static void on_zerocopy_server_read(
+    nanoev_event *tcp,
+    int status,
+    void *buf,
+    unsigned int bytes
+    )
+{
+    tcp_zerocopy_case *zc = (tcp_zerocopy_case*)nanoev_event_userdata(tcp);
+    (void)buf;
+
+    if (status != 0 || bytes == 0) {
+        tcp_note_failure(&zc->base);
+        return;
+    }
+    zc->received += bytes;
+    zerocopy_maybe_done(zc);
+    if (!zc->write_done || zc->received < zc->written) {
+        if (nanoev_tcp_read(tcp, zc->sink, sizeof(zc->sink), NULL, on_zerocopy_server_read) != NANOEV_SUCCESS) {
+            tcp_note_failure(&zc->base);
+        }
+    }
+}
+
+static void on_zerocopy_accept(
+    nanoev_event *tcp,
+    int status,
+    nanoev_event *tcp_new
+    )
+{
+    tcp_zerocopy_case *zc = (tcp_zerocopy_case*)nanoev_event_userdata(tcp);
+
+    zc->base.accepted_called++;
+    if (status != 0 || !tcp_new) {
+        tcp_note_failure(&zc->base);
+        return;
+    }
+    zc->base.accepted = tcp_new;
+    nanoev_event_set_userdata(tcp_new, zc);
+    if (nanoev_tcp_read(tcp_new, zc->sink, sizeof(zc->sink), NULL, on_zerocopy_server_read) != NANOEV_SUCCESS) {
+        tcp_note_failure(&zc->base);
+    }
+}
+
+static void on_zerocopy_connect(
+    nanoev_event *tcp,
+    int status
+    )
+{
+    tcp_zerocopy_case *zc = (tcp_zerocopy_case*)nanoev_event_userdata(tcp);
+
+    zc->base.connect_called++;
+    if (status != 0) {
+        tcp_note_failure(&zc->base);
+        return;
+    }
+    zc->set_result = nanoev_tcp_set_zerocopy(tcp, ZEROCOPY_PAYLOAD);
+    if (zc->set_result != NANOEV_SUCCESS && zc->set_result != NANOEV_ERROR_FAIL) {
+        tcp_note_failure(&zc->base);
+        return;
+    }
+    if (nanoev_tcp_write(tcp, zc->payload, sizeof(zc->payload), NULL, on_zerocopy_write) != NANOEV_SUCCESS) {
+        tcp_note_failure(&zc->base);
+        return;
+    }
+    /* refused only while a MSG_ZEROCOPY send waits for its notification */
+    zc->pending_set_result = nanoev_tcp_set_zerocopy(tcp, ZEROCOPY_PAYLOAD);
+}
+
+static void test_tcp_zerocopy(nanoev_test *test)
+{
+    static tcp_zerocopy_case zc;
+    struct nanoev_addr addr;
+    unsigned int completions, copied;
+    int ret;
+
+    memset(&zc, 0, sizeof(zc));
+    memset(zc.payload, 'z', sizeof(zc.payload));
+
+    TEST_REQUIRE(test, nanoev_init() == NANOEV_SUCCESS);
+    zc.base.loop = nanoev_loop_new(NULL);
+    TEST_REQUIRE(test, zc.base.loop);
+
+    zc.base.listener = nanoev_event_new(nanoev_event_tcp, zc.base.loop, &zc);
+    TEST_REQUIRE(test, zc.base.listener);
+    zc.base.client = nanoev_event_new(nanoev_event_tcp, zc.base.loop, &zc);
+    TEST_REQUIRE(test, zc.base.client);
+    zc.base.timer = nanoev_event_new(nanoev_event_timer, zc.base.loop, &zc.base);
+    TEST_REQUIRE(test, zc.base.timer);
+
+    TEST_EXPECT(test, nanoev_tcp_set_zerocopy(zc.base.client, 1) == NANOEV_ERROR_ACCESS_DENIED);
+    TEST_EXPECT(test, nanoev_tcp_zerocopy_stats(zc.base.client, NULL, &copied) == NANOEV_ERROR_INVALID_ARG);
+    TEST_EXPECT(test, nanoev_tcp_zerocopy_stats(zc.base.client, &completions, &copied) == NANOEV_SUCCESS);
+    TEST_EXPECT(test, completions == 0 && copied == 0);
+
+    TEST_EXPECT(test, nanoev_addr_init(&addr, NANOEV_AF_INET, "127.0.0.1", 0) == NANOEV_SUCCESS);
+    ret = nanoev_tcp_listen(zc.base.listener, &addr, 1);
+    TEST_EXPECT(test, ret == NANOEV_SUCCESS);
+    if (ret != NANOEV_SUCCESS) {
+        goto cleanup;
+    }
+    ret = nanoev_tcp_addr(zc.base.listener, 1, &addr);
+    TEST_EXPECT(test, ret == NANOEV_SUCCESS);
+    if (ret != NANOEV_SUCCESS) {
+        goto cleanup;
+    }
+    ret = nanoev_tcp_accept(zc.base.listener, NULL, on_zerocopy_accept, NULL);
+    TEST_EXPECT(test, ret == NANOEV_SUCCESS);
+    if (ret != NANOEV_SUCCESS) {
+        goto cleanup;
+    }
+    ret = nanoev_tcp_connect(zc.base.client, &addr, NULL, on_zerocopy_connect);
+    TEST_EXPECT(test, ret == NANOEV_SUCCESS);
+    if (ret != NANOEV_SUCCESS) {
+        goto cleanup;
+    }
+    ret = nanoev_timer_add(zc.base.timer, seconds(2), 0, on_tcp_timeout);
+    TEST_EXPECT(test, ret == NANOEV_SUCCESS);
+    if (ret != NANOEV_SUCCESS) {
+        goto cleanup;
+    }
+    TEST_EXPECT(test, nanoev_loop_run(zc.base.loop) == NANOEV_SUCCESS);
+
+    TEST_EXPECT(test, zc.base.timed_out == 0);
+    TEST_EXPECT(test, zc.base.callback_failures == 0);
+    TEST_EXPECT(test, zc.base.client_write_called == 1);
+    TEST_EXPECT(test, zc.received == zc.written);
+    if (zc.set_result == NANOEV_SUCCESS) {
+        /* the write took the MSG_ZEROCOPY path, not the copying fallback */
+        TEST_EXPECT(test, zc.pending_set_result == NANOEV_ERROR_ACCESS_DENIED);
+        /* and completed only once its notification was reaped */
+        TEST_EXPECT(test, zc.completions == 1);
+        /* loopback never transmits from user pages, every completion is a copy */
+        TEST_EXPECT(test, zc.copied == 1);
+        TEST_EXPECT(test, nanoev_tcp_zerocopy_stats(zc.base.client, &completions, &copied) == NANOEV_SUCCESS);
+        TEST_EXPECT(test, completions == 1 && copied == 1);
+    } else {
+        TEST_EXPECT(test, zc.completions == 0);
+    }
+
+cleanup:
+    if (zc.base.accepted) {
+        nanoev_event_free(zc.base.accepted);
+    }
+    if (zc.base.timer) {
+        nanoev_event_free(zc.base.timer);
+    }
+    if (zc.base.client) {
+        nanoev_event_free(zc.base.client);
+    }
+    if (zc.base.listener) {
+        nanoev_event_free(zc.base.listener);
+    }
+    nanoev_loop_free(zc.base.loop);
+    nanoev_term();
+}
+
+static void reset_round_trip(tcp_case *tc)
+{
+    tc->accepted_called = 0;
+    tc->connect_called = 0;
+    tc->server_read_called = 0;
+    tc->server_write_called = 0;
+    tc->client_write_called = 0;
+    tc->client_read_called = 0;
+    tc->callback_failures = 0;
+    tc->timed_out = 0;
+}
+
+static void test_tcp_connect_race(nanoev_test *test)
+{
+    tcp_case tc;
+    struct nanoev_addr addrs[3];
+    struct nanoev_addr addr;
+    nanoev_event *closed;
+    nanoev_timeval timeout;
+    unsigned short port, closed_port, peer_port;
+
+    memset(&tc, 0, sizeof(tc));
+    timeout = seconds(2);
+
+    TEST_REQUIRE(test, nanoev_init() == NANOEV_SUCCESS);
+    tc.loop = nanoev_loop_new(NULL);
+    TEST_REQUIRE(test, tc.loop);
+    tc.timer = nanoev_event_new(nanoev_event_timer, tc.loop, &tc);
+    TEST_REQUIRE(test, tc.timer);
+
+    tc.listener = nanoev_event_new(nanoev_event_tcp, tc.loop, &tc);
+    TEST_REQUIRE(test, tc.listener);
+    TEST_EXPECT(test, nanoev_addr_init(&addr, NANOEV_AF_INET, "127.0.0.1", 0) == NANOEV_SUCCESS);
+    TEST_REQUIRE(test, nanoev_tcp_listen(tc.listener, &addr, 4) == NANOEV_SUCCESS);
+    TEST_REQUIRE(test, nanoev_tcp_addr(tc.listener, 1, &addr) == NANOEV_SUCCESS);
+    nanoev_addr_get_port(&addr, &port);
+
+    /* a port that was just released is very likely closed */
+    closed = nanoev_event_new(nanoev_event_tcp, tc.loop, &tc);
+    TEST_REQUIRE(test, closed);
+    TEST_EXPECT(test, nanoev_addr_init(&addrs[1], NANOEV_AF_INET, "127.0.0.1", 0) == NANOEV_SUCCESS);
+    TEST_REQUIRE(test, nanoev_tcp_listen(closed, &addrs[1], 1) == NANOEV_SUCCESS);
+    TEST_REQUIRE(test, nanoev_tcp_addr(closed, 1, &addrs[1]) == NANOEV_SUCCESS);
+    nanoev_addr_get_port(&addrs[1], &closed_port);
+    nanoev_event_free(closed);
+
+    /* an unroutable address, a refused one, then the listener */
+    TEST_EXPECT(test, nanoev_addr_init(&addrs[0], NANOEV_AF_INET, "192.0.2.1", port) == NANOEV_SUCCESS);
+    addrs[2] = addr;
+
+    tc.client = nanoev_event_new(nanoev_event_tcp, tc.loop, &tc);
+    TEST_REQUIRE(test, tc.client);
+    TEST_EXPECT(test, nanoev_tcp_connect_addrs(tc.client, addrs, 0, NULL, on_connect) == NANOEV_ERROR_INVALID_ARG);
+    TEST_EXPECT(test, nanoev_tcp_accept(tc.listener, NULL, on_accept, NULL) == NANOEV_SUCCESS);
+    TEST_EXPECT(test, nanoev_tcp_connect_addrs(tc.client, addrs, 3, &timeout, on_connect) == NANOEV_SUCCESS);
+    TEST_EXPECT(test, nanoev_tcp_connect_addrs(tc.client, addrs, 3, &timeout, on_connect) == NANOEV_ERROR_ACCESS_DENIED);
+    TEST_EXPECT(test, nanoev_timer_add(tc.timer, seconds(2), 0, on_tcp_timeout) == NANOEV_SUCCESS);
+    TEST_EXPECT(test, nanoev_loop_run(tc.loop) == NANOEV_SUCCESS);
+    TEST_EXPECT(test, tc.timed_out == 0);
+    TEST_EXPECT(test, tc.callback_failures == 0);
+    TEST_EXPECT(test, tc.connect_called == 1);
+    TEST_EXPECT(test, tc.client_read_called == 1);
+    peer_port = 0;
+    TEST_EXPECT(test, nanoev_tcp_addr(tc.client, 0, &addr) == NANOEV_SUCCESS);
+    nanoev_addr_get_port(&addr, &peer_port);
+    TEST_EXPECT(test, peer_port == port);
+    nanoev_event_free(tc.client);
+    nanoev_event_free(tc.accepted);
+    tc.accepted = NULL;
+
+    /* by name: ::1 (if localhost has it) is refused, 127.0.0.1 answers */
+    reset_round_trip(&tc);
+    tc.client = nanoev_event_new(nanoev_event_tcp, tc.loop, &tc);
+    TEST_REQUIRE(test, tc.client);
+    TEST_EXPECT(test, nanoev_tcp_accept(tc.listener, NULL, on_accept, NULL) == NANOEV_SUCCESS);
+    TEST_EXPECT(test, nanoev_tcp_connect_host(tc.client, "localhost", port, &timeout, on_connect) == NANOEV_SUCCESS);
+    TEST_EXPECT(test, nanoev_loop_run(tc.loop) == NANOEV_SUCCESS);
+    TEST_EXPECT(test, tc.timed_out == 0);
+    TEST_EXPECT(test, tc.callback_failures == 0);
+    TEST_EXPECT(test, tc.client_read_called == 1);
+    nanoev_event_free(tc.client);
+    nanoev_event_free(tc.accepted);
+    tc.accepted = NULL;
+
+    /* every attempt refused: the last error is reported */
+    reset_round_trip(&tc);
+    tc.connect_status = 0;
+    tc.client = nanoev_event_new(nanoev_event_tcp, tc.loop, &tc);
+    TEST_REQUIRE(test, tc.client);
+    TEST_EXPECT(test, nanoev_tcp_connect_addrs(tc.client, &addrs[1], 1, NULL, on_connect_timeout) == NANOEV_SUCCESS);
+    TEST_EXPECT(test, nanoev_loop_run(tc.loop) == NANOEV_SUCCESS);
+    TEST_EXPECT(test, tc.connect_called == 1);
+    TEST_EXPECT(test, tc.connect_status != 0);
+    nanoev_event_free(tc.client);
+
+    /* freeing the event cancels the race */
+    tc.client = nanoev_event_new(nanoev_event_tcp, tc.loop, &tc);
+    TEST_REQUIRE(test, tc.client);
+    TEST_EXPECT(test, nanoev_tcp_connect_addrs(tc.client, addrs, 3, NULL, on_connect) == NANOEV_SUCCESS);
+    nanoev_event_free(tc.client);
+
+    nanoev_event_free(tc.timer);
+    nanoev_event_free(tc.listener);
+    nanoev_loop_free(tc.loop);
+    nanoev_term();
+}
+
+static void test_tcp_listen_reuseport(nanoev_test *test)
+{
+    nanoev_loop *loop;
+    nanoev_event *first;
+    nanoev_event *second;
+    nanoev_event *third;
+    struct nanoev_addr addr;
+    int ret;
+
+    TEST_REQUIRE(test, nanoev_init() == NANOEV_SUCCESS);
+    loop = nanoev_loop_new(NULL);
+    TEST_REQUIRE(test, loop);
+    first = nanoev_event_new(nanoev_event_tcp, loop, NULL);
+    second = nanoev_event_new(nanoev_event_tcp, loop, NULL);
+    third = nanoev_event_new(nanoev_event_tcp, loop, NULL);
+    TEST_REQUIRE(test, first && second && third);
+
+    TEST_EXPECT(test, nanoev_addr_init(&addr, NANOEV_AF_INET, "127.0.0.1", 0) == NANOEV_SUCCESS);
+    TEST_EXPECT(test, nanoev_tcp_listen_ex(first, &addr, 1, 0x8000) == NANOEV_ERROR_INVALID_ARG);
+    TEST_EXPECT(test, nanoev_tcp_listen_ex(first, NULL, 1, NANOEV_TCP_LISTEN_REUSEPORT)
+        == NANOEV_ERROR_INVALID_ARG);
+
+    ret = nanoev_tcp_listen_ex(first, &addr, 1, NANOEV_TCP_LISTEN_REUSEPORT);
+#ifdef SO_REUSEPORT
+    TEST_EXPECT(test, ret == NANOEV_SUCCESS);
+    if (ret == NANOEV_SUCCESS) {
+        TEST_EXPECT(test, nanoev_tcp_addr(first, 1, &addr) == NANOEV_SUCCESS);
+        /* a listener that did not opt in cannot join the port */
+        TEST_EXPECT(test, nanoev_tcp_listen(third, &addr, 1) == NANOEV_ERROR_FAIL);
+        TEST_EXPECT(test, nanoev_tcp_listen_ex(second, &addr, 1, NANOEV_TCP_LISTEN_REUSEPORT)
+            == NANOEV_SUCCESS);
+    }
+#else
+    TEST_EXPECT(test, ret == NANOEV_ERROR_FAIL);
+#endif
+
+    nanoev_event_free(third);
+    nanoev_event_free(second);
+    nanoev_event_free(first);
+    nanoev_loop_free(loop);
+    nanoev_term();
+}
+
+static void test_tcp_bind_source(nanoev_test *test)
+{
+    tcp_case tc;
+    struct nanoev_addr addr;
+    struct nanoev_addr local;
+    struct nanoev_addr peer;
+    struct nanoev_addr addr6;
+    nanoev_event *unused;
+    char ip[64];
+    unsigned short local_port = 0, peer_port = 1;
+#ifdef __linux__
+    /* all of 127/8 is local on Linux, so the source is really chosen */
+    const char *source_ip = "127.0.0.2";
+#else
+    const char *source_ip = "127.0.0.1";
+#endif
+
+    memset(&tc, 0, sizeof(tc));
+    TEST_REQUIRE(test, nanoev_init() == NANOEV_SUCCESS);
+    tc.loop = nanoev_loop_new(NULL);
+    TEST_REQUIRE(test, tc.loop);
+    tc.timer = nanoev_event_new(nanoev_event_timer, tc.loop, &tc);
+    tc.listener = nanoev_event_new(nanoev_event_tcp, tc.loop, &tc);
+    tc.client = nanoev_event_new(nanoev_event_tcp, tc.loop, &tc);
+    unused = nanoev_event_new(nanoev_event_tcp, tc.loop, &tc);
+    TEST_REQUIRE(test, tc.timer && tc.listener && tc.client && unused);
+
+    TEST_EXPECT(test, nanoev_addr_init(&addr, NANOEV_AF_INET, "127.0.0.1", 0) == NANOEV_SUCCESS);
+    TEST_REQUIRE(test, nanoev_tcp_listen(tc.listener, &addr, 4) == NANOEV_SUCCESS);
+    TEST_REQUIRE(test, nanoev_tcp_addr(tc.listener, 1, &addr) == NANOEV_SUCCESS);
+
+    TEST_EXPECT(test, nanoev_tcp_bind(tc.client, NULL) == NANOEV_ERROR_INVALID_ARG);
+    TEST_EXPECT(test, nanoev_addr_init(&local, NANOEV_AF_INET, source_ip, 0) == NANOEV_SUCCESS);
+    TEST_REQUIRE(test, nanoev_tcp_bind(tc.client, &local) == NANOEV_SUCCESS);
+    TEST_EXPECT(test, nanoev_tcp_bind(tc.client, &local) == NANOEV_ERROR_ACCESS_DENIED);
+    TEST_EXPECT(test, nanoev_tcp_listen(tc.client, &local, 1) == NANOEV_ERROR_ACCESS_DENIED);
+    TEST_EXPECT(test, nanoev_tcp_connect_addrs(tc.client, &addr, 1, NULL, on_connect) == NANOEV_ERROR_ACCESS_DENIED);
+    TEST_EXPECT(test, nanoev_addr_init(&addr6, NANOEV_AF_INET6, "::1", 1) == NANOEV_SUCCESS);
+    TEST_EXPECT(test, nanoev_tcp_connect(tc.client, &addr6, NULL, on_connect) == NANOEV_ERROR_INVALID_ARG);
+
+    /* a bound event that never connects is freed like any other */
+    TEST_EXPECT(test, nanoev_tcp_bind(unused, &local) == NANOEV_SUCCESS);
+    nanoev_event_free(unused);
+
+    TEST_EXPECT(test, nanoev_tcp_accept(tc.listener, NULL, on_accept, NULL) == NANOEV_SUCCESS);
+    TEST_EXPECT(test, nanoev_tcp_connect(tc.client, &addr, NULL, on_connect) == NANOEV_SUCCESS);
+    TEST_EXPECT(test, nanoev_timer_add(tc.timer, seconds(2), 0, on_tcp_timeout) == NANOEV_SUCCESS);
+    TEST_EXPECT(test, nanoev_loop_run(tc.loop) == NANOEV_SUCCESS);
+    TEST_EXPECT(test, tc.timed_out == 0);
+    TEST_EXPECT(test, tc.callback_failures == 0);
+    TEST_EXPECT(test, tc.client_read_called == 1);
+
+    TEST_EXPECT(test, nanoev_tcp_addr(tc.client, 1, &local) == NANOEV_SUCCESS);
+    TEST_EXPECT(test, nanoev_addr_get_ip(&local, ip, sizeof(ip)) == NANOEV_SUCCESS);
+    TEST_EXPECT(test, strcmp(ip, source_ip) == 0);
+    nanoev_addr_get_port(&local, &local_port);
+    TEST_EXPECT(test, local_port != 0);
+    if (tc.accepted) {
+        TEST_EXPECT(test, nanoev_tcp_addr(tc.accepted, 0, &peer) == NANOEV_SUCCESS);
+        nanoev_addr_get_port(&peer, &peer_port);
+        TEST_EXPECT(test, peer_port == local_port);
+        nanoev_event_free(tc.accepted);
+    }
+
+    nanoev_event_free(tc.client);
+    nanoev_event_free(tc.listener);
+    nanoev_event_free(tc.timer);
+    nanoev_loop_free(tc.loop);
+    nanoev_term();
+}
+
 void test_tcp(nanoev_test *test)
 {
     test_tcp_loopback_round_trip(test);
     test_tcp_connect_timeout(test);
     test_tcp_read_timeout(test);
     test_tcp_accept_timeout(test);
+    test_tcp_zerocopy(test);
+    test_tcp_connect_race(test);
+    test_tcp_listen_reuseport(test);
+    test_tcp_bind_source(test);
 }